@@ -0,0 +1,46 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "api/sb-api.h"
+#include "api/helpers.h"
+#include "sb-common.h"
+
+int api_cancel(char *targetpluginkey, uint64_t callid, uint32_t timeout,
+    struct api_error *api_error)
+{
+  string cancel;
+
+  sbassert(targetpluginkey);
+  sbassert(api_error);
+
+  array meta = ARRAY_DICT_INIT;
+  ADD(meta, UINTEGER_OBJ(callid));
+
+  array request = ARRAY_DICT_INIT;
+  ADD(request, ARRAY_OBJ(meta));
+
+  cancel = (string) {.str = "cancel", .length = sizeof("cancel") - 1};
+
+  /*
+   * the instance running the call is not known, every instance is asked to
+   * cancel it. Plugins may not know about cancel, answers are dropped.
+   */
+  return connection_send_request_all(targetpluginkey, cancel, request,
+      timeout, api_error);
+}
@@ -75,8 +75,13 @@ void api_free_object(object value)
 
 void api_free_array(array value)
 {
-  for (size_t i = 0; i < value.size; i++) {
-    api_free_object(value.items[i]);
+  /* nested in a decoded tree, it goes with the root */
+  sbassert(value.capacity != OBJECT_CAPACITY_PACKED);
+
+  if (value.capacity != OBJECT_CAPACITY_PACKED_ROOT) {
+    for (size_t i = 0; i < value.size; i++) {
+      api_free_object(value.items[i]);
+    }
   }
 
   FREE(value.items);
@@ -84,9 +89,14 @@ void api_free_array(array value)
 
 void api_free_dictionary(dictionary value)
 {
-  for (size_t i = 0; i < value.size; i++) {
-    api_free_string(value.items[i].key);
-    api_free_object(value.items[i].value);
+  /* nested in a decoded tree, it goes with the root */
+  sbassert(value.capacity != OBJECT_CAPACITY_PACKED);
+
+  if (value.capacity != OBJECT_CAPACITY_PACKED_ROOT) {
+    for (size_t i = 0; i < value.size; i++) {
+      api_free_string(value.items[i].key);
+      api_free_object(value.items[i].value);
+    }
   }
 
   FREE(value.items);
@@ -125,3 +135,69 @@ object copy_object(object obj)
       abort();
   }
 }
+
+STATIC bool dictionary_key_eq(string a, string b)
+{
+  if (a.length != b.length)
+    return (false);
+
+  return (a.length == 0 || memcmp(a.str, b.str, a.length) == 0);
+}
+
+STATIC dictionary_index * dictionary_get_index(dictionary dict)
+{
+  if (dict.capacity != OBJECT_CAPACITY_PACKED &&
+      dict.capacity != OBJECT_CAPACITY_PACKED_ROOT)
+    return (NULL);
+
+  if (dict.size < DICTIONARY_INDEX_THRESHOLD)
+    return (NULL);
+
+  dictionary_index *index = (dictionary_index *)(dict.items + dict.size);
+
+  if (!index->built) {
+    index->mask = (uint32_t)(dictionary_index_slots(dict.size) - 1);
+
+    for (size_t i = 0; i < dict.size; i++) {
+      uint32_t slot = string_hash(dict.items[i].key) & index->mask;
+
+      while (index->slots[slot])
+        slot = (slot + 1) & index->mask;
+
+      index->slots[slot] = (uint32_t)(i + 1);
+    }
+
+    index->built = true;
+  }
+
+  return (index);
+}
+
+/*
+ * Looks up a dictionary value by key. Large dictionaries decoded from the
+ * wire are searched through their hashed key index, all others are scanned.
+ * Returns NULL if the key does not exist.
+ */
+object * api_dictionary_get(dictionary dict, string key)
+{
+  dictionary_index *index = dictionary_get_index(dict);
+
+  if (!index) {
+    for (size_t i = 0; i < dict.size; i++) {
+      if (dictionary_key_eq(dict.items[i].key, key))
+        return (&dict.items[i].value);
+    }
+
+    return (NULL);
+  }
+
+  for (uint32_t slot = string_hash(key) & index->mask; index->slots[slot];
+      slot = (slot + 1) & index->mask) {
+    key_value_pair *item = &dict.items[index->slots[slot] - 1];
+
+    if (dictionary_key_eq(item->key, key))
+      return (&item->value);
+  }
+
+  return (NULL);
+}
@@ -24,7 +24,7 @@
 int api_register(string name, string desc, string author, string license,
     array functions, char *pluginkey, struct api_error *api_error)
 {
-  object *func;
+  size_t rejected;
 
   sbassert(pluginkey);
   sbassert(api_error);
@@ -35,28 +35,23 @@ int api_register(string name, string desc, string author, string license,
     return (-1);
   }
 
-  if (db_plugin_add(pluginkey, name, desc, author, license) == -1) {
-    error_set(api_error, API_ERROR_TYPE_VALIDATION,
-        "Failed to register plugin in database.");
-    return (-1);
-  }
-
   for (size_t i = 0; i < functions.size; i++) {
-    func = &functions.items[i];
-
-    if (func->type != OBJECT_TYPE_ARRAY) {
+    if (functions.items[i].type != OBJECT_TYPE_ARRAY)
       error_set(api_error, API_ERROR_TYPE_VALIDATION,
           "Function params has not expected type.");
-      continue;
-    }
+  }
 
-    if (db_function_add(pluginkey, &func->data.array) == -1) {
-      error_set(api_error, API_ERROR_TYPE_VALIDATION,
-          "Failed to register function in database.");
-      continue;
-    }
+  if (db_plugin_register(pluginkey, name, desc, author, license, functions,
+      &rejected) == -1) {
+    error_set(api_error, API_ERROR_TYPE_VALIDATION,
+        "Failed to register plugin in database.");
+    return (-1);
   }
 
+  if (rejected && !api_error->isset)
+    error_set(api_error, API_ERROR_TYPE_VALIDATION,
+        "Failed to register function in database.");
+
   if (api_error->isset)
     return (-1);
 
@@ -19,17 +19,57 @@
 
 #include "api/sb-api.h"
 #include "api/helpers.h"
+#include "rpc/msgpack/schema.h"
 #include "sb-common.h"
 
-int api_result(char *targetpluginkey, uint64_t callid, array args,
-    struct api_error *api_error)
+struct result_call {
+  uint64_t callid;
+  api_call_cb cb;
+  void *data;
+};
+
+static void result_response_cb(object res, struct api_error *error,
+    void *data)
+{
+  struct result_call *call = data;
+  struct schema_error schema_error;
+
+  if (error->isset) {
+    /* forwarded as is */
+  } else if (res.type != OBJECT_TYPE_ARRAY) {
+    error_set_response(error, RESULT_RESPONSE_INVALID);
+  } else if (schema_validate(SCHEMA_RESULT_RESPONSE, res.data.array,
+      &schema_error) == -1) {
+    schema_error_set(error, &schema_error);
+  } else if (call->callid != res.data.array.items[0].data.uinteger) {
+    error_set_response(error, RESULT_RESPONSE_CALLID);
+  }
+
+  api_free_object(res);
+
+  call->cb(call->callid, error, call->data);
+  FREE(call);
+}
+
+int api_result(uint64_t con_id, size_t shard, uint64_t callid, array args,
+    uint32_t timeout, api_call_cb cb, void *data, struct api_error *api_error)
 {
   string result;
-  object res;
+  struct result_call *call;
 
-  sbassert(targetpluginkey);
   sbassert(api_error);
 
+  call = MALLOC(struct result_call);
+
+  if (!call) {
+    error_set(api_error, API_ERROR_TYPE_EXCEPTION, "out of memory");
+    return (-1);
+  }
+
+  call->callid = callid;
+  call->cb = cb;
+  call->data = data;
+
   array meta = ARRAY_DICT_INIT;
   ADD(meta, UINTEGER_OBJ(callid));
 
@@ -37,29 +77,47 @@ int api_result(char *targetpluginkey, uint64_t callid, array args,
   ADD(request, ARRAY_OBJ(meta));
   ADD(request, copy_object(ARRAY_OBJ(args)));
 
-  /* send request */
   result = (string) {.str = "result", .length = sizeof("result") - 1};
-  res = connection_send_request(targetpluginkey, result, request,
-      api_error);
-
-  if (api_error->isset)
-    return (-1);
 
-  if (res.data.array.size != 1) {
-    error_set(api_error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching result API response. Either response is broken "
-        "or it just has wrong params size.");
+  if (connection_send_request_to(con_id, shard, result, request, timeout,
+      result_response_cb, call, api_error) == -1) {
+    FREE(call);
     return (-1);
   }
 
-  if (!(res.data.array.items[0].type == OBJECT_TYPE_UINT &&
-    callid == res.data.array.items[0].data.uinteger)) {
-    error_set(api_error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching run API response. Invalid callid");
-    return (-1);
-  }
+  return (0);
+}
 
-  api_free_array(res.data.array);
 
-  return (0);
+static void result_error_response_cb(object res,
+    UNUSED(struct api_error *error), UNUSED(void *data))
+{
+  api_free_object(res);
+}
+
+
+int api_result_error(uint64_t con_id, size_t shard, uint64_t callid,
+    struct api_error *err, uint32_t timeout, struct api_error *api_error)
+{
+  string result;
+
+  sbassert(err && err->isset);
+  sbassert(api_error);
+
+  array error = ARRAY_DICT_INIT;
+  ADD(error, INTEGER_OBJ(err->type));
+  ADD(error, STRING_OBJ(cstring_copy_string(api_error_message(err))));
+
+  array meta = ARRAY_DICT_INIT;
+  ADD(meta, UINTEGER_OBJ(callid));
+  ADD(meta, ARRAY_OBJ(error));
+
+  array request = ARRAY_DICT_INIT;
+  ADD(request, ARRAY_OBJ(meta));
+  ADD(request, ARRAY_OBJ(((array) ARRAY_DICT_INIT)));
+
+  result = (string) {.str = "result", .length = sizeof("result") - 1};
+
+  return connection_send_request_to(con_id, shard, result, request, timeout,
+      result_error_response_cb, NULL, api_error);
 }
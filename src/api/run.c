@@ -16,63 +16,147 @@
 
 #include <stdlib.h>
 #include <stddef.h>
+#ifdef __linux__
+#include <bsd/string.h>
+#endif
 
 #include "rpc/db/sb-db.h"
 #include "api/sb-api.h"
 #include "api/helpers.h"
+#include "rpc/msgpack/schema.h"
 
 
-int api_run(char *targetpluginkey, string function_name, uint64_t callid,
-    array args, struct api_error *api_error)
-{
-  string run;
-  object result;
-  array meta = ARRAY_DICT_INIT;
-  array request = ARRAY_DICT_INIT;
+struct run_call {
+  uint64_t callid;
+  api_call_cb cb;
+  void *data;
+  /* kept while the database verifies the call */
+  char target[PLUGINKEY_STRING_SIZE];
+  string function_name;
+  array args;
+  uint32_t timeout;
+};
 
-  sbassert(api_error);
+static void run_response_cb(object result, struct api_error *error,
+    void *data)
+{
+  struct run_call *call = data;
+  struct schema_error schema_error;
 
-  if (db_plugin_verify(targetpluginkey) == -1) {
-    error_set(api_error, API_ERROR_TYPE_VALIDATION, "API key is invalid.");
-    return (-1);
+  if (error->isset) {
+    /* forwarded as is */
+  } else if (result.type != OBJECT_TYPE_ARRAY) {
+    error_set_response(error, RUN_RESPONSE_INVALID);
+  } else if (schema_validate(SCHEMA_RUN_RESPONSE, result.data.array,
+      &schema_error) == -1) {
+    schema_error_set(error, &schema_error);
+  } else if (call->callid != result.data.array.items[0].data.uinteger) {
+    error_set_response(error, RUN_RESPONSE_CALLID);
   }
 
-  if (db_function_verify(targetpluginkey, function_name, &args) == -1) {
+  api_free_object(result);
+
+  call->cb(call->callid, error, call->data);
+  FREE(call);
+}
+
+static void run_verify_error_set(db_verify_result result,
+    struct api_error *api_error)
+{
+  if (result == DB_VERIFY_PLUGIN)
+    error_set(api_error, API_ERROR_TYPE_VALIDATION, "API key is invalid.");
+  else if (result == DB_VERIFY_FUNCTION)
     error_set(api_error, API_ERROR_TYPE_VALIDATION,
         "run() verification failed.");
-    return (-1);
-  }
+  else
+    error_set(api_error, API_ERROR_TYPE_EXCEPTION, "database unavailable");
+}
+
+/* forward a verified call to the target plugin */
+static int run_send(char *targetpluginkey, string function_name, array args,
+    uint32_t timeout, struct run_call *call, struct api_error *api_error)
+{
+  string run;
+  array meta = ARRAY_DICT_INIT;
+  array request = ARRAY_DICT_INIT;
 
   ADD(meta, OBJECT_OBJ((object) OBJECT_INIT));
-  ADD(meta, UINTEGER_OBJ(callid));
+  ADD(meta, UINTEGER_OBJ(call->callid));
 
-    ADD(request, ARRAY_OBJ(meta));
+  ADD(request, ARRAY_OBJ(meta));
   ADD(request, STRING_OBJ(cstring_copy_string(function_name.str)));
   ADD(request, copy_object(ARRAY_OBJ(args)));
 
-  /* send request */
   run = (string) {.str = "run", .length = sizeof("run") - 1};
-  result = connection_send_request(targetpluginkey, run, request,
-      api_error);
 
-  if (api_error->isset)
-    return (-1);
+  return connection_send_request(targetpluginkey, run, request, timeout,
+      run_response_cb, call, api_error);
+}
 
-  if (result.data.array.size != 1) {
-    error_set(api_error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching run API response. Either response is broken "
-        "or it just has wrong params size.");
+/* runs on the loop once the database answered */
+static void run_verified_cb(db_verify_result result, void *data)
+{
+  struct run_call *call = data;
+  struct api_error error = ERROR_INIT;
+  string function_name = call->function_name;
+  array args = call->args;
+
+  if (result != DB_VERIFY_VALID)
+    run_verify_error_set(result, &error);
+
+  if (error.isset || run_send(call->target, function_name, args,
+      call->timeout, call, &error) == -1) {
+    call->cb(call->callid, &error, call->data);
+    FREE(call);
+  }
+
+  api_free_string(function_name);
+  api_free_array(args);
+}
+
+int api_run(char *targetpluginkey, string function_name, uint64_t callid,
+    array args, uint32_t timeout, api_call_cb cb, void *data,
+    struct api_error *api_error)
+{
+  struct run_call *call;
+  db_verify_result result;
+
+  sbassert(api_error);
+
+  call = CALLOC(1, struct run_call);
+
+  if (!call) {
+    error_set(api_error, API_ERROR_TYPE_EXCEPTION, "out of memory");
     return (-1);
   }
 
-  if (!(result.data.array.items[0].type == OBJECT_TYPE_UINT &&
-    callid == result.data.array.items[0].data.uinteger)) {
-    error_set(api_error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching run API response. Invalid callid");
+  call->callid = callid;
+  call->cb = cb;
+  call->data = data;
+  call->timeout = timeout;
+
+  result = db_run_verify(targetpluginkey, function_name, &args,
+      run_verified_cb, call);
+
+  if (result == DB_VERIFY_PENDING) {
+    /* the request is freed once the handler returned */
+    strlcpy(call->target, targetpluginkey, sizeof(call->target));
+    call->function_name = cstring_copy_string(function_name.str);
+    call->args = copy_object(ARRAY_OBJ(args)).data.array;
+    return (0);
+  }
+
+  if (result != DB_VERIFY_VALID) {
+    run_verify_error_set(result, api_error);
+    FREE(call);
     return (-1);
   }
 
-  api_free_array(result.data.array);
+  if (run_send(targetpluginkey, function_name, args, timeout, call,
+      api_error) == -1) {
+    FREE(call);
+    return (-1);
+  }
 
   return (0);
 }
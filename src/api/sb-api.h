@@ -22,6 +22,10 @@
 #include "sb-common.h"
 #include "rpc/sb-rpc.h"
 
+/* called once the plugin acknowledged a forwarded run or result call */
+typedef void (*api_call_cb)(uint64_t callid, struct api_error *error,
+    void *data);
+
 /* Functions */
 
 /**
@@ -38,16 +42,23 @@
      struct api_error *api_error);
 
 /**
- * Run a plugin function
+ * Run a plugin function. The call is forwarded without waiting for the
+ * plugin, `cb` is called once it acknowledged the call or failed. If the
+ * function is not cached, the database is asked without blocking the loop
+ * and a failed verification is reported through `cb` as well.
  * @param[in] targetpluginkey    pluginkey of the plugin to start
  * @param[in] function_name      function of the plugin
  * @param[in] args    function arguments of the plugin
- * @param[in] pk      msgpack packer instance
+ * @param[in] timeout milliseconds the plugin may take to acknowledge the
+ *                    call, 0 to wait forever
+ * @param[in] cb      completion callback, not called if -1 is returned
+ * @param[in] data    user data passed to cb
  * @param[in] api_error   api_error instance
  * @return 0 in case of success otherwise -1
  */
 int api_run(char *targetpluginkey, string function_name, uint64_t callid,
-    array args, struct api_error *api_error);
+    array args, uint32_t timeout, api_call_cb cb, void *data,
+    struct api_error *api_error);
 
 /**
  * Generates an API key using /dev/urandom. The length of the key
@@ -61,11 +72,43 @@ int api_subscribe(uint64_t id, string event, struct api_error *api_error);
 int api_unsubscribe(uint64_t id, string event, struct api_error *api_error);
 int api_get_key(string key);
 
-int api_result(char *targetpluginkey, uint64_t callid, array args,
+/**
+ * Deliver the result of a call to the connection that made it.
+ * @param[in] con_id  connection of the caller
+ * @param[in] shard   shard serving the connection
+ * @return 0 in case of success otherwise -1
+ */
+int api_result(uint64_t con_id, size_t shard, uint64_t callid, array args,
+    uint32_t timeout, api_call_cb cb, void *data, struct api_error *api_error);
+
+/**
+ * Tell the caller that its call failed, e.g. its deadline expired. It gets
+ * a result whose meta carries the error, [[callid, [type, message]], []].
+ * Its answer is not waited for.
+ * @param[in] con_id  connection of the caller
+ * @param[in] shard   shard serving the connection
+ * @param[in] err     why the call failed
+ * @return 0 in case of success otherwise -1
+ */
+int api_result_error(uint64_t con_id, size_t shard, uint64_t callid,
+    struct api_error *err, uint32_t timeout, struct api_error *api_error);
+
+/**
+ * Tell a plugin to abandon a call. Its answer is not waited for.
+ * @param[in] targetpluginkey  pluginkey of the plugin running the call
+ * @param[in] callid           the call to cancel
+ * @return 0 in case of success otherwise -1
+ */
+int api_cancel(char *targetpluginkey, uint64_t callid, uint32_t timeout,
     struct api_error *api_error);
 
+/*
+ * Of a tree decoded by msgpack_rpc_to_object() only the root may be freed,
+ * nested arrays and dictionaries fail an assertion.
+ */
 void api_free_string(string value);
 void api_free_object(object value);
 void api_free_array(array value);
 void api_free_dictionary(dictionary value);
 object copy_object(object obj);
+object * api_dictionary_get(dictionary dict, string key);
@@ -20,6 +20,7 @@
 #include "rpc/db/sb-db.h"
 #include "api/sb-api.h"
 #include "api/helpers.h"
+#include "rpc/connection/topic.h"
 
 
 int api_subscribe(uint64_t con_id, string event, struct api_error *api_error)
@@ -32,6 +33,12 @@ int api_subscribe(uint64_t con_id, string event, struct api_error *api_error)
   memcpy(e, event.str, length);
   e[length] = '\000';
 
+  /* sensor.*.temp matches a single level, sensor.# any number of them */
+  if (!topic_pattern_valid(e)) {
+    error_set_response(api_error, SUBSCRIBE_EVENT_PATTERN);
+    return (-1);
+  }
+
   connection_subscribe(con_id, e);
 
   return 0;
@@ -22,11 +22,67 @@
 #include "tweetnacl.h"
 #include "rpc/sb-rpc.h"
 #include "rpc/db/sb-db.h"
+#include "rpc/db/cache.h"
 #include "main.h"
+#include "rpc/connection/worker.h"
+#include "rpc/connection/shard.h"
 
 int8_t verbose_level;
 loop main_loop;
 
+static uv_timer_t snapshot_timer;
+
+static void snapshot_event(UNUSED(void **argv))
+{
+  db_snapshot();
+}
+
+/* the memory store is written by a worker, the loop keeps serving */
+static void snapshot_timer_cb(UNUSED(uv_timer_t *handle))
+{
+  worker_pool_submit(event_create(1, snapshot_event, 0));
+}
+
+/* RedisDatabaseListen keeps the authorized set, the others are added to it */
+static int database_connect(options *opts, struct timeval timeout)
+{
+  struct db_endpoint endpoints[DB_SHARDS_MAX];
+  char *ips[DB_SHARDS_MAX];
+  size_t count = 0;
+  configline *line;
+  boxaddr addr;
+  uint16_t port;
+  int result = -1;
+
+  ips[count] = box_strdup(fmt_addr(&opts->RedisDatabaseListenAddr));
+  endpoints[count].ip = ips[count];
+  endpoints[count++].port = opts->RedisDatabaseListenPort;
+
+  for (line = opts->RedisDatabaseShard; line; line = line->next) {
+    if (count == DB_SHARDS_MAX) {
+      LOG_WARNING("At most %d Redis servers are supported.", DB_SHARDS_MAX);
+      goto out;
+    }
+
+    if (box_addr_port_lookup(line->value, &addr, &port) < 0)
+      goto out;
+
+    /* fmt_addr() reuses its buffer */
+    ips[count] = box_strdup(fmt_addr(&addr));
+    endpoints[count].ip = ips[count];
+    endpoints[count++].port = port;
+  }
+
+  result = db_connect_shards(endpoints, count, timeout,
+      opts->RedisDatabaseAuth);
+
+out:
+  for (size_t i = 0; i < count; i++)
+    FREE(ips[i]);
+
+  return (result);
+}
+
 int main(int argc, char **argv)
 {
   options *globaloptions;
@@ -47,14 +103,39 @@ int main(int argc, char **argv)
 
   globaloptions = options_get();
 
-  /* connect to database */
-  if (db_connect(fmt_addr(&globaloptions->RedisDatabaseListenAddr),
-      globaloptions->RedisDatabaseListenPort, timeout,
-      globaloptions->RedisDatabaseAuth) < 0) {
-    LOG_ERROR("Failed to connect to database");
-    abort();
+  db_cache_enable(globaloptions->DatabaseCache);
+
+  if (strcmp(globaloptions->DatabaseBackend, "memory") == 0) {
+    if (db_memory_open(globaloptions->DatabaseSnapshot) < 0) {
+      LOG_ERROR("Failed to open the memory database");
+      abort();
+    }
+  } else {
+    /* connect to database */
+    if (database_connect(globaloptions, timeout) < 0) {
+      LOG_ERROR("Failed to connect to database");
+      abort();
+    }
+
+    if (db_function_migrate() == -1)
+      LOG_WARNING("Failed to migrate function signatures.");
   }
 
+  /* run calls are verified without blocking the loop */
+  if (db_async_connect(&main_loop.uv) == -1)
+    LOG_WARNING("Failed to connect the event loop to the database.");
+
+  /* handshakes are authorized without asking the database */
+  if (strcmp(globaloptions->DatabaseBackend, "redis") == 0 &&
+      db_authorized_subscribe(&main_loop.uv) == -1)
+    LOG_WARNING("Failed to subscribe to the authorized keys.");
+
+  /* plugins registered again through other cores are evicted */
+  if (strcmp(globaloptions->DatabaseBackend, "redis") == 0 &&
+      globaloptions->DatabaseCache &&
+      db_cache_subscribe(&main_loop.uv) == -1)
+    LOG_WARNING("Failed to subscribe to registry changes.");
+
   /* initialize signal handler */
   if (signal_init() == -1) {
     LOG_ERROR("Failed to initialize signal handler.");
@@ -67,15 +148,43 @@ int main(int argc, char **argv)
     abort();
   }
 
+  dispatch_set_call_timeout((uint32_t)globaloptions->CallTimeout);
+  connection_set_max_instances((size_t)globaloptions->PluginInstances);
+
+  if (worker_pool_init((size_t)globaloptions->WorkerThreads) == -1) {
+    LOG_ERROR("Failed to start worker threads.");
+    abort();
+  }
+
+  if (globaloptions->DatabaseSnapshot &&
+      globaloptions->DatabaseSnapshotInterval > 0) {
+    uint64_t interval = (uint64_t)globaloptions->DatabaseSnapshotInterval *
+        1000;
+
+    if (uv_timer_init(&main_loop.uv, &snapshot_timer) != 0 ||
+        uv_timer_start(&snapshot_timer, snapshot_timer_cb, interval,
+        interval) != 0) {
+      LOG_ERROR("Failed to start database snapshots.");
+      abort();
+    }
+  }
+
   if (server_init() == -1) {
     LOG_ERROR("Failed to initialise server.");
     abort();
   }
 
+  if (shard_init((size_t)globaloptions->Shards) == -1) {
+    LOG_ERROR("Failed to start shards.");
+    abort();
+  }
+
   /* initialize server */
   if (globaloptions->apitype == SERVER_TYPE_TCP) {
     server_start_tcp(&globaloptions->ApiTransportListenAddr,
         globaloptions->ApiTransportListenPort);
+    shard_listen_tcp(&globaloptions->ApiTransportListenAddr,
+        globaloptions->ApiTransportListenPort);
   } else if (globaloptions->apitype == SERVER_TYPE_PIPE) {
     server_start_pipe(globaloptions->ApiNamedPipeListen);
   }
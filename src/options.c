@@ -89,7 +89,16 @@ static configvar option_vars_[] = {
   V(ApiNamedPipeListen,         FILENAME, NULL),
   V(RedisDatabaseListen,        STRING, NULL),
   V(RedisDatabaseAuth,          STRING, NULL),
+  V(RedisDatabaseShard,         LINELIST, NULL),
   V(ContactInfo,                STRING,   NULL),
+  V(WorkerThreads,              UINT,     "0"),
+  V(Shards,                     UINT,     "1"),
+  V(CallTimeout,                UINT,     "0"),
+  V(PluginInstances,            UINT,     "1"),
+  V(DatabaseBackend,            STRING,   "redis"),
+  V(DatabaseSnapshot,           FILENAME, NULL),
+  V(DatabaseSnapshotInterval,   UINT,     "60"),
+  V(DatabaseCache,              BOOL,     "1"),
   { NULL, CONFIG_TYPE_OBSOLETE, 0, NULL }
 };
 
@@ -232,6 +241,9 @@ STATIC char *load_boxrc_from_disk(void)
 
 STATIC int options_validate(options *options)
 {
+  boxaddr addr;
+  uint16_t port;
+
   if (options->ApiTransportListen && options->ApiNamedPipeListen) {
     LOG_WARNING("You cannot set both ApiTransportListen and ApiNamedPipeListen.\
         ");
@@ -259,10 +271,25 @@ STATIC int options_validate(options *options)
     }
   }
 
+  for (configline *line = options->RedisDatabaseShard; line;
+      line = line->next) {
+    if (box_addr_port_lookup(line->value, &addr, &port) < 0) {
+      LOG_WARNING("RedisDatabaseShard %s failed to parse or resolve. Please "
+          "fix.", line->value);
+      return (-1);
+    }
+  }
+
   if (options->ApiNamedPipeListen) {
     options->apitype = SERVER_TYPE_PIPE;
   }
 
+  if (strcmp(options->DatabaseBackend, "redis") != 0 &&
+      strcmp(options->DatabaseBackend, "memory") != 0) {
+    LOG_WARNING("DatabaseBackend must be redis or memory.");
+    return (-1);
+  }
+
   if (options->ContactInfo) {
     // do we need additional checks here for this string
   }
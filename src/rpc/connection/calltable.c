@@ -0,0 +1,406 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>                   // for abort, NULL
+#include <string.h>                   // for strcmp
+#include <uv.h>                       // for uv_mutex_t, uv_once
+#include <bsd/string.h>               // for strlcpy
+#include "rpc/connection/calltable.h"
+#include "rpc/connection/loop.h"      // for loop_timer_start, loop_timer_stop
+#include "rpc/connection/shard.h"     // for shard_loop
+#include "sb-common.h"                // for CALLOC, FREE, STATIC
+
+#define CALLTABLE_NONE UINT32_MAX
+#define CALLTABLE_INDEX_MASK ((uint64_t) CALLTABLE_SIZE - 1)
+
+enum {
+  SLOT_FREE = 0,
+  SLOT_USED,
+  /* released by another shard, freed once its timer fired */
+  SLOT_RELEASED
+};
+
+/* the lists a call in flight is linked into */
+enum {
+  LIST_CALLER = 0,
+  LIST_TARGET,
+  LIST_COUNT
+};
+
+/*
+ * The calls made by a connection, or the calls to a pluginkey, so closing a
+ * connection releases its calls without a walk over the table. A target list
+ * is freed with its last call, a caller list when the connection is dropped.
+ */
+struct call_list {
+  char pluginkey[PLUGINKEY_STRING_SIZE];
+  uint32_t head;
+  size_t size;
+};
+
+/*
+ * The deadline of a call runs on the loop of the shard that added it, only
+ * that shard touches the timer.
+ */
+struct call_slot {
+  struct call_record record;
+  uint32_t generation;
+  uint32_t next_free;
+  int state;
+  loop *loop;
+  wheel_timer timer;
+  /* links of the lists while the call is in flight */
+  struct call_list *list[LIST_COUNT];
+  uint32_t prev[LIST_COUNT];
+  uint32_t next[LIST_COUNT];
+};
+
+/* shared by all shards */
+static struct call_slot *chunks[CALLTABLE_SIZE / CALLTABLE_CHUNK_SIZE];
+static size_t nchunks = 0;
+static uint32_t free_head = CALLTABLE_NONE;
+static uv_once_t calltable_once = UV_ONCE_INIT;
+static uv_mutex_t calltable_lock;
+static calltable_expired_cb expired_cb = NULL;
+static hashmap(uint64_t, ptr_t) *caller_lists = NULL;
+static hashmap(cstr_t, ptr_t) *target_lists = NULL;
+
+STATIC void calltable_lock_init(void);
+STATIC struct call_slot *slot_at(uint32_t index);
+STATIC struct call_slot *slot_get(uint64_t callid);
+STATIC struct call_list *caller_list_get(uint64_t con_id);
+STATIC struct call_list *target_list_get(const char *target);
+STATIC void slot_link(struct call_slot *slot, uint32_t index, int which,
+    struct call_list *list);
+STATIC void slot_unlink(struct call_slot *slot);
+STATIC void slot_free(struct call_slot *slot);
+STATIC void slot_release(struct call_slot *slot);
+STATIC void slot_expired(wheel_timer *timer);
+
+STATIC void calltable_lock_init(void)
+{
+  if (uv_mutex_init(&calltable_lock) != 0)
+    abort();
+}
+
+STATIC struct call_slot *slot_at(uint32_t index)
+{
+  return &chunks[index / CALLTABLE_CHUNK_SIZE][index % CALLTABLE_CHUNK_SIZE];
+}
+
+STATIC struct call_slot *slot_get(uint64_t callid)
+{
+  uint64_t index = callid & CALLTABLE_INDEX_MASK;
+  struct call_slot *slot;
+
+  if (index >= nchunks * CALLTABLE_CHUNK_SIZE)
+    return NULL;
+
+  slot = slot_at((uint32_t) index);
+
+  if (slot->state != SLOT_USED || slot->record.callid != callid)
+    return NULL;
+
+  return slot;
+}
+
+STATIC struct call_list *caller_list_get(uint64_t con_id)
+{
+  struct call_list *list = hashmap_get(uint64_t, ptr_t)(caller_lists, con_id);
+
+  if (list)
+    return list;
+
+  if (!(list = CALLOC(1, struct call_list)))
+    return NULL;
+
+  list->head = CALLTABLE_NONE;
+  hashmap_put(uint64_t, ptr_t)(caller_lists, con_id, list);
+
+  return list;
+}
+
+STATIC struct call_list *target_list_get(const char *target)
+{
+  struct call_list *list = hashmap_get(cstr_t, ptr_t)(target_lists, target);
+
+  if (list)
+    return list;
+
+  if (!(list = CALLOC(1, struct call_list)))
+    return NULL;
+
+  /* the map is keyed by the copy in the list */
+  strlcpy(list->pluginkey, target, sizeof(list->pluginkey));
+  list->head = CALLTABLE_NONE;
+  hashmap_put(cstr_t, ptr_t)(target_lists, list->pluginkey, list);
+
+  return list;
+}
+
+STATIC void slot_link(struct call_slot *slot, uint32_t index, int which,
+    struct call_list *list)
+{
+  slot->list[which] = list;
+  slot->prev[which] = CALLTABLE_NONE;
+  slot->next[which] = list->head;
+
+  if (list->head != CALLTABLE_NONE)
+    slot_at(list->head)->prev[which] = index;
+
+  list->head = index;
+  list->size++;
+}
+
+STATIC void slot_unlink(struct call_slot *slot)
+{
+  struct call_list *list, *target = slot->list[LIST_TARGET];
+
+  for (int which = 0; which < LIST_COUNT; which++) {
+    list = slot->list[which];
+
+    if (slot->prev[which] != CALLTABLE_NONE)
+      slot_at(slot->prev[which])->next[which] = slot->next[which];
+    else
+      list->head = slot->next[which];
+
+    if (slot->next[which] != CALLTABLE_NONE)
+      slot_at(slot->next[which])->prev[which] = slot->prev[which];
+
+    list->size--;
+    slot->list[which] = NULL;
+  }
+
+  if (target->size == 0) {
+    hashmap_del(cstr_t, ptr_t)(target_lists, target->pluginkey);
+    FREE(target);
+  }
+}
+
+STATIC void slot_free(struct call_slot *slot)
+{
+  uint32_t index = (uint32_t) (slot->record.callid & CALLTABLE_INDEX_MASK);
+
+  slot->state = SLOT_FREE;
+  slot->loop = NULL;
+  slot->next_free = free_head;
+  free_head = index;
+}
+
+STATIC void slot_release(struct call_slot *slot)
+{
+  /* the callid of the call must not match the slot any longer */
+  if (++slot->generation == 0)
+    slot->generation = 1;
+
+  slot_unlink(slot);
+
+  if (!slot->loop) {
+    slot_free(slot);
+  } else if (slot->loop == shard_loop()) {
+    loop_timer_stop(slot->loop, &slot->timer);
+    slot_free(slot);
+  } else {
+    slot->state = SLOT_RELEASED;
+  }
+}
+
+STATIC void slot_expired(wheel_timer *timer)
+{
+  struct call_slot *slot = timer->data;
+  struct call_record record;
+  bool expired;
+
+  uv_mutex_lock(&calltable_lock);
+  expired = slot->state == SLOT_USED;
+  if (expired) {
+    record = slot->record;
+    if (++slot->generation == 0)
+      slot->generation = 1;
+    slot_unlink(slot);
+  }
+  slot_free(slot);
+  uv_mutex_unlock(&calltable_lock);
+
+  if (expired && expired_cb)
+    expired_cb(&record);
+}
+
+void calltable_init(calltable_expired_cb cb)
+{
+  uv_once(&calltable_once, calltable_lock_init);
+  expired_cb = cb;
+}
+
+void calltable_teardown(void)
+{
+  struct call_slot *slot;
+  struct call_list *list;
+
+  for (size_t i = 0; i < nchunks; i++) {
+    for (size_t j = 0; j < CALLTABLE_CHUNK_SIZE; j++) {
+      slot = &chunks[i][j];
+      if (slot->state != SLOT_FREE && slot->loop)
+        loop_timer_stop(slot->loop, &slot->timer);
+    }
+    FREE(chunks[i]);
+  }
+
+  nchunks = 0;
+  free_head = CALLTABLE_NONE;
+
+  if (caller_lists) {
+    hashmap_foreach_value(caller_lists, list, {
+      FREE(list);
+    });
+    hashmap_free(uint64_t, ptr_t)(caller_lists);
+    caller_lists = NULL;
+  }
+
+  if (target_lists) {
+    hashmap_foreach_value(target_lists, list, {
+      FREE(list);
+    });
+    hashmap_free(cstr_t, ptr_t)(target_lists);
+    target_lists = NULL;
+  }
+}
+
+int calltable_add(struct call_record *record, uint32_t timeout)
+{
+  struct call_slot *slot, *chunk;
+  struct call_list *caller, *target;
+  uint32_t index;
+
+  uv_mutex_lock(&calltable_lock);
+
+  if (!caller_lists) {
+    caller_lists = hashmap_new(uint64_t, ptr_t)();
+    target_lists = hashmap_new(cstr_t, ptr_t)();
+  }
+
+  if (free_head == CALLTABLE_NONE) {
+    if (nchunks == CALLTABLE_SIZE / CALLTABLE_CHUNK_SIZE ||
+        !(chunk = CALLOC(CALLTABLE_CHUNK_SIZE, struct call_slot))) {
+      uv_mutex_unlock(&calltable_lock);
+      return (-1);
+    }
+
+    /* the free list hands out the new slots in order */
+    for (uint32_t i = CALLTABLE_CHUNK_SIZE; i-- > 0;) {
+      chunk[i].generation = 1;
+      chunk[i].next_free = free_head;
+      free_head = (uint32_t) (nchunks * CALLTABLE_CHUNK_SIZE + i);
+    }
+
+    chunks[nchunks++] = chunk;
+  }
+
+  if (!(caller = caller_list_get(record->caller_id)) ||
+      !(target = target_list_get(record->target))) {
+    uv_mutex_unlock(&calltable_lock);
+    return (-1);
+  }
+
+  index = free_head;
+  slot = slot_at(index);
+  free_head = slot->next_free;
+
+  record->callid = ((uint64_t) slot->generation << CALLTABLE_INDEX_BITS) |
+      index;
+  slot->record = *record;
+  slot->state = SLOT_USED;
+  slot_link(slot, index, LIST_CALLER, caller);
+  slot_link(slot, index, LIST_TARGET, target);
+
+  /* started before the call is visible to other shards */
+  if (timeout) {
+    slot->loop = shard_loop();
+    loop_timer_start(slot->loop, &slot->timer, timeout, slot_expired, slot);
+  }
+
+  uv_mutex_unlock(&calltable_lock);
+
+  return (0);
+}
+
+bool calltable_lookup(uint64_t callid, struct call_record *record)
+{
+  struct call_slot *slot;
+
+  uv_mutex_lock(&calltable_lock);
+  slot = slot_get(callid);
+  if (slot)
+    *record = slot->record;
+  uv_mutex_unlock(&calltable_lock);
+
+  return slot != NULL;
+}
+
+bool calltable_release(uint64_t callid, const char *caller,
+    struct call_record *record)
+{
+  struct call_slot *slot;
+
+  uv_mutex_lock(&calltable_lock);
+  slot = slot_get(callid);
+
+  if (!slot || (caller && strcmp(slot->record.caller, caller) != 0)) {
+    uv_mutex_unlock(&calltable_lock);
+    return false;
+  }
+
+  if (record)
+    *record = slot->record;
+
+  slot_release(slot);
+  uv_mutex_unlock(&calltable_lock);
+
+  return true;
+}
+
+size_t calltable_drop_connection(uint64_t con_id, const char *target)
+{
+  struct call_list *list;
+  size_t dropped = 0;
+
+  uv_mutex_lock(&calltable_lock);
+
+  if (!caller_lists) {
+    uv_mutex_unlock(&calltable_lock);
+    return 0;
+  }
+
+  if ((list = hashmap_del(uint64_t, ptr_t)(caller_lists, con_id))) {
+    while (list->head != CALLTABLE_NONE) {
+      slot_release(slot_at(list->head));
+      dropped++;
+    }
+    FREE(list);
+  }
+
+  /* the list is freed with its last call */
+  if (target && (list = hashmap_get(cstr_t, ptr_t)(target_lists, target))) {
+    for (size_t n = list->size; n > 0; n--) {
+      slot_release(slot_at(list->head));
+      dropped++;
+    }
+  }
+
+  uv_mutex_unlock(&calltable_lock);
+
+  return dropped;
+}
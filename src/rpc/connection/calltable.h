@@ -0,0 +1,86 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>        // for bool
+#include <stddef.h>         // for size_t
+#include <stdint.h>         // for uint64_t, uint32_t
+#include "rpc/sb-rpc.h"     // for PLUGINKEY_STRING_SIZE
+
+/*
+ * Run calls in flight. A callid is the index of its slot in the table plus
+ * the generation of the slot, so looking a call up is an array access and a
+ * callid of a released call never matches the next call in its slot.
+ */
+#ifndef CALLTABLE_INDEX_BITS
+#define CALLTABLE_INDEX_BITS 16
+#endif
+#if CALLTABLE_INDEX_BITS < 10 || CALLTABLE_INDEX_BITS > 24
+#error "CALLTABLE_INDEX_BITS must be between 10 and 24"
+#endif
+/* upper bound of calls in flight */
+#define CALLTABLE_SIZE (1 << CALLTABLE_INDEX_BITS)
+/* slots are allocated in chunks, so a slot never moves */
+#define CALLTABLE_CHUNK_SIZE 1024
+
+struct call_record {
+  uint64_t callid;
+  /* connection and shard the result is sent to */
+  uint64_t caller_id;
+  size_t caller_shard;
+  char caller[PLUGINKEY_STRING_SIZE];
+  char target[PLUGINKEY_STRING_SIZE];
+};
+
+/* called on the loop the call was added on, the call is already released */
+typedef void (*calltable_expired_cb)(struct call_record *record);
+
+void calltable_init(calltable_expired_cb cb);
+void calltable_teardown(void);
+
+/**
+ * Add a call. Its deadline runs on the loop of the calling shard.
+ *
+ * @param record  the call, its callid is set on success
+ * @param timeout milliseconds until the call expires, 0 for no deadline
+ * @return 0 on success, -1 if the table is full
+ */
+int calltable_add(struct call_record *record, uint32_t timeout);
+
+/**
+ * Copy a call to `record`.
+ *
+ * @return true if the call is in flight
+ */
+bool calltable_lookup(uint64_t callid, struct call_record *record);
+
+/**
+ * Release a call. If `caller` is given, only a call made by that plugin is
+ * released. The call is copied to `record` if given.
+ *
+ * @return true if the call was in flight
+ */
+bool calltable_release(uint64_t callid, const char *caller,
+    struct call_record *record);
+
+/**
+ * Release the calls made by a connection that is closed, and the calls to
+ * `target` if given.
+ *
+ * @return number of released calls
+ */
+size_t calltable_drop_connection(uint64_t con_id, const char *target);
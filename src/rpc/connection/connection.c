@@ -42,15 +42,20 @@
 #include <stddef.h>                // for NULL, size_t
 #include <stdint.h>                // for uint64_t, UINT64_MAX, uint32_t
 #include <stdlib.h>                // for abort, exit, realloc
-#include <string.h>                // for strlen
+#include <string.h>                // for strlen, memmove
 #include <uv.h>                    // for uv_handle_t, uv_close, uv_timer_t
 #include "api/helpers.h"           // for NIL
 #include "api/sb-api.h"            // for api_free_array, api_free_object
 #include "khash.h"                 // for __i, khint32_t
-#include "main.h"                  // for main_loop
+#include "rpc/connection/calltable.h"  // for calltable_drop_connection
 #include "rpc/connection/event.h"  // for multiqueue_free, multiqueue_new_child
-#include "rpc/connection/loop.h"   // for loop, LOOP_PROCESS_EVENTS_UNTIL
+#include "rpc/connection/instance.h"  // for instance_group_pick
+#include "rpc/connection/loop.h"   // for loop, loop_schedule
+#include "rpc/connection/shard.h"  // for shard_loop, shard_post
+#include "rpc/connection/topic.h"  // for topic_subscribe, topic_get
+#include "rpc/connection/worker.h" // for worker_pool_submit
 #include "rpc/msgpack/helpers.h"   // for msgpack_rpc_serialize_request, msg...
+#include "rpc/msgpack/schema.h"    // for schema_validate_msgpack
 #include "rpc/sb-rpc.h"            // for callinfo, crypto_context, object
 #include "tweetnacl.h"             // for randombytes
 
@@ -63,56 +68,151 @@ STATIC void connection_handle_request(struct connection *con,
 STATIC void connection_handle_response(struct connection *con,
     msgpack_object *obj);
 STATIC void connection_request_event(void **argv);
+STATIC void connection_request_finish(connection_request_event_info *eventinfo);
+STATIC void offload_event(void **argv);
+STATIC void offload_done_event(void **argv);
 STATIC void connection_close(struct connection *con);
 STATIC void call_set_error(struct connection *con, char *msg);
+STATIC void call_complete(struct connection *con, struct callinfo *cinfo,
+    object result, struct api_error *error);
+STATIC void fail_pending_calls(struct connection *con, char *msg);
+STATIC void response_error_set(struct api_error *err, object error);
 STATIC int is_valid_rpc_response(msgpack_object *obj, struct connection *con);
 STATIC void free_connection(struct connection *con);
 STATIC void incref(struct connection *con);
 STATIC void decref(struct connection *con);
 STATIC void unsubscribe(struct connection *con, char *event);
 STATIC void send_delayed_notifications(struct connection *con);
+STATIC void packer_begin(struct connection *con, msgpack_packer *pac);
+STATIC int packer_flush(struct connection *con);
+STATIC void sbuffer_reserve_headroom(msgpack_sbuffer *sbuf);
+STATIC int send_request_local(char *pluginkey, string method, array args,
+    uint32_t timeout, connection_response_cb cb, void *data,
+    struct api_error *err);
+STATIC int send_request_id(uint64_t con_id, string method, array args,
+    uint32_t timeout, connection_response_cb cb, void *data,
+    struct api_error *err);
+STATIC int send_request_con(struct connection *con, string method,
+    array args, uint32_t timeout, connection_response_cb cb, void *data,
+    struct api_error *err);
+STATIC int instance_join(struct connection *con);
+STATIC bool instance_leave(struct connection *con);
+STATIC void discard_response_cb(object result, struct api_error *error,
+    void *data);
+STATIC void remote_fanout_event(void **argv);
+STATIC int send_request_group(char *pluginkey, string method, array args,
+    uint32_t timeout, struct api_error *err);
+STATIC void call_expired(wheel_timer *timer);
+STATIC void remote_request_event(void **argv);
+STATIC void remote_response_cb(object result, struct api_error *error,
+    void *data);
+STATIC void remote_done_event(void **argv);
+STATIC void remote_broadcast_event(void **argv);
+STATIC void collect_subscribers(topic *t, void *data);
+STATIC void log_stats(struct connection *con);
+STATIC void dump_stats_event(void **argv);
+
+/* the connections a broadcast is delivered to */
+struct broadcast {
+  uint64_t seq;
+  kvec_t(struct connection *) subscribers;
+};
+
+/* a request forwarded to the shard serving the target plugin */
+struct remote_call {
+  char pluginkey[PLUGINKEY_STRING_SIZE];
+  /* addresses the connection directly if set */
+  uint64_t con_id;
+  string method;
+  array args;
+  uint32_t timeout;
+  connection_response_cb cb;
+  void *data;
+  size_t origin;
+  object result;
+  struct api_error error;
+};
 
+/* connection ids are unique across all shards */
 static uint64_t next_con_id = 1;
-static hashmap(uint64_t, ptr_t) *connections = NULL;
-static hashmap(cstr_t, uint64_t) *pluginkeys = NULL;
-static hashmap(cstr_t, ptr_t) *event_strings = NULL;
-static msgpack_sbuffer sbuf;
+static __thread hashmap(uint64_t, ptr_t) *connections = NULL;
+/* pluginkey -> instance_group */
+static __thread hashmap(cstr_t, ptr_t) *groups = NULL;
+static size_t max_instances = 1;
+static __thread topic_registry *topics = NULL;
+/* tells the connections a broadcast already reached */
+static __thread uint64_t broadcast_seq = 0;
+
+int connection_shard_init(void)
+{
+  connections = hashmap_new(uint64_t, ptr_t)();
+  groups = hashmap_new(cstr_t, ptr_t)();
+  topics = topic_registry_new();
+
+  if (!connections || !groups || !topics)
+    return (-1);
+
+  return (0);
+}
 
 int connection_init(void)
 {
-  connections = hashmap_new(uint64_t, ptr_t)();
-  pluginkeys = hashmap_new(cstr_t, uint64_t)();
-  event_strings = hashmap_new(cstr_t, ptr_t)();
+  if (connection_shard_init() == -1)
+    return (-1);
 
   if (dispatch_table_init() == -1)
     return (-1);
 
-  if (!connections || !pluginkeys || !event_strings)
+  if (msgpack_rpc_responses_init() == -1)
     return (-1);
 
-  msgpack_sbuffer_init(&sbuf);
+  if (schema_init() == -1)
+    return (-1);
 
   return (0);
 }
 
-int connection_teardown(void)
+void connection_shard_close(void)
 {
-  if (!connections)
-    return (-1);
-
   struct connection *con;
 
+  if (!connections)
+    return;
+
   hashmap_foreach_value(connections, con, {
     connection_close(con);
   });
+}
 
+int connection_shard_teardown(void)
+{
+  if (!connections)
+    return (-1);
+
+  connection_shard_close();
 
   hashmap_free(uint64_t, ptr_t)(connections);
-  hashmap_free(cstr_t, uint64_t)(pluginkeys);
-  hashmap_free(cstr_t, ptr_t)(event_strings);
+  connections = NULL;
+  instance_group *group;
+  hashmap_foreach_value(groups, group, {
+    instance_group_free(group);
+  });
+  hashmap_free(cstr_t, ptr_t)(groups);
+  groups = NULL;
+  topic_registry_free(topics);
+  topics = NULL;
+
+  return (0);
+}
+
+int connection_teardown(void)
+{
+  if (connection_shard_teardown() == -1)
+    return (-1);
 
   dispatch_teardown();
-  msgpack_sbuffer_destroy(&sbuf);
+  msgpack_rpc_responses_teardown();
+  schema_teardown();
 
   return (0);
 }
@@ -128,18 +228,24 @@ int connection_create(uv_stream_t *stream)
   if (con == NULL)
     return (-1);
 
-  con->id = next_con_id++;
+  con->id = __atomic_fetch_add(&next_con_id, 1, __ATOMIC_RELAXED);
   con->msgid = 1;
   con->refcount = 1;
   con->mpac = msgpack_unpacker_new(MSGPACK_UNPACKER_INIT_BUFFER_SIZE);
   con->closed = false;
-  con->events = multiqueue_new_child(main_loop.events);
+  con->loop = shard_loop();
+  con->events = multiqueue_new_child(con->loop->events);
   con->streams.read = inputstream_new(parse_cb, STREAM_BUFFER_SIZE, con);
   con->streams.write = outputstream_new(1024 * 1024);
   con->streams.uv = stream;
   con->cc.nonce = (uint64_t) randommod(281474976710656LL);
   con->subscribed_events = hashmap_new(cstr_t, ptr_t)();
   con->pending_requests = 0;
+  con->broadcast_seq = 0;
+  con->routed = 0;
+  con->latency = 0;
+  con->pending_calls = hashmap_new(uint64_t, ptr_t)();
+  msgpack_sbuffer_init(&con->sbuf);
 
   if (ISODD(con->cc.nonce)) {
     con->cc.nonce++;
@@ -152,7 +258,7 @@ int connection_create(uv_stream_t *stream)
   randombytes(con->cc.minutekey, sizeof con->cc.minutekey);
   randombytes(con->cc.lastminutekey, sizeof con->cc.lastminutekey);
   con->minutekey_timer.data = &con->cc;
-  r = uv_timer_init(&main_loop.uv, &con->minutekey_timer);
+  r = uv_timer_init(&con->loop->uv, &con->minutekey_timer);
   sbassert(r == 0);
   r = uv_timer_start(&con->minutekey_timer, timer_cb, 60000, 60000);
   sbassert(r == 0);
@@ -162,8 +268,9 @@ int connection_create(uv_stream_t *stream)
   con->packet.end = 0;
   con->packet.pos = 0;
 
-  kv_init(con->callvector);
   kv_init(con->delayed_notifications);
+  kv_init(con->serial);
+  con->offloaded = false;
 
   inputstream_set(con->streams.read, stream);
   inputstream_start(con->streams.read);
@@ -181,14 +288,12 @@ void connection_subscribe(uint64_t id, char *event)
   if (!(con = hashmap_get(uint64_t, ptr_t)(connections, id)) || con->closed)
     abort();
 
-  char *event_string = hashmap_get(cstr_t, ptr_t)(event_strings, event);
-
-  if (!event_string) {
-    event_string = box_strdup(event);
-    hashmap_put(cstr_t, ptr_t)(event_strings, event_string, event_string);
-  }
+  if (hashmap_has(cstr_t, ptr_t)(con->subscribed_events, event))
+    return;
 
-  hashmap_put(cstr_t, ptr_t)(con->subscribed_events, event_string, event_string);
+  /* the connection's map is keyed by the name owned by the topic */
+  topic *t = topic_subscribe(topics, event, con);
+  hashmap_put(cstr_t, ptr_t)(con->subscribed_events, t->name, t);
 }
 
 void connection_unsubscribe(uint64_t id, char *event)
@@ -201,31 +306,49 @@ void connection_unsubscribe(uint64_t id, char *event)
   unsubscribe(con, event);
 }
 
+/* a connection subscribed to several matching patterns gets the event once */
+STATIC void collect_subscribers(topic *t, void *data)
+{
+  struct broadcast *broadcast = data;
+  struct connection *con;
+
+  for (size_t i = 0; i < kv_size(t->subscribers); i++) {
+    con = kv_A(t->subscribers, i);
+
+    if (con->broadcast_seq == broadcast->seq)
+      continue;
+
+    con->broadcast_seq = broadcast->seq;
+    kv_push(broadcast->subscribers, con);
+  }
+}
+
 STATIC void broadcast_event(char *name, array args)
 {
-  kvec_t(struct connection *) subscribed  = KV_INITIAL_VALUE;
+  struct broadcast broadcast = {.seq = ++broadcast_seq,
+      .subscribers = KV_INITIAL_VALUE};
   struct connection *con;
   msgpack_packer packer;
+  msgpack_sbuffer sbuf;
 
-  hashmap_foreach_value(connections, con, {
-    if (hashmap_has(cstr_t, ptr_t)(con->subscribed_events, name)) {
-      kv_push(subscribed, con);
-    }
-  });
+  topic_match(topics, name, collect_subscribers, &broadcast);
 
-  if (!kv_size(subscribed)) {
+  if (!kv_size(broadcast.subscribers)) {
     api_free_array(args);
     goto end;
   }
 
   string method = {.length = strlen(name), .str = name};
 
+  /* the event is packed once, every subscriber seals its own copy */
+  msgpack_sbuffer_init(&sbuf);
+  sbuffer_reserve_headroom(&sbuf);
   msgpack_packer_init(&packer, &sbuf, msgpack_sbuffer_write);
   msgpack_rpc_serialize_request(0, method, args, &packer);
   api_free_array(args);
 
-  for (size_t i = 0; i < kv_size(subscribed); i++) {
-    con = kv_A(subscribed, i);
+  for (size_t i = 0; i < kv_size(broadcast.subscribers); i++) {
+    con = kv_A(broadcast.subscribers, i);
 
     if (con->pending_requests) {
       wbuffer *rv = MALLOC(wbuffer);
@@ -233,29 +356,27 @@ STATIC void broadcast_event(char *name, array args)
       rv->data = sb_memdup_nulterm(sbuf.data, sbuf.size);
       kv_push(con->delayed_notifications, rv);
     } else {
-      crypto_write(&con->cc, sbuf.data, sbuf.size, con->streams.write);
+      msgpack_sbuffer_clear(&con->sbuf);
+      msgpack_sbuffer_write(&con->sbuf, sbuf.data, sbuf.size);
+      packer_flush(con);
     }
   }
 
-  msgpack_sbuffer_clear(&sbuf);
+  msgpack_sbuffer_destroy(&sbuf);
 
 end:
-  kv_destroy(subscribed);
+  kv_destroy(broadcast.subscribers);
 }
 
 STATIC void unsubscribe(struct connection *con, char *event)
 {
-  char *event_string = hashmap_get(cstr_t, ptr_t)(event_strings, event);
-  hashmap_del(cstr_t, ptr_t)(con->subscribed_events, event_string);
+  topic *t = hashmap_get(cstr_t, ptr_t)(con->subscribed_events, event);
 
-  hashmap_foreach_value(connections, con, {
-    if (hashmap_has(cstr_t, ptr_t)(con->subscribed_events, event_string)) {
-      return;
-    }
-  });
+  if (!t)
+    return;
 
-  hashmap_del(cstr_t, ptr_t)(event_strings, event_string);
-  FREE(event_string);
+  hashmap_del(cstr_t, ptr_t)(con->subscribed_events, t->name);
+  topic_unsubscribe(topics, t, con);
 }
 
 STATIC void incref(struct connection *con)
@@ -278,23 +399,102 @@ void connection_hashmap_put(uint64_t id, struct connection *con)
 
 void pluginkeys_hashmap_put(char *pluginkey, uint64_t id)
 {
-  hashmap_put(cstr_t, uint64_t)(pluginkeys, pluginkey, id);
+  struct connection *con = hashmap_get(uint64_t, ptr_t)(connections, id);
+
+  sbassert(con && strcmp(con->cc.pluginkeystring, pluginkey) == 0);
+  sbassert(instance_join(con) == 0);
+}
+
+void connection_set_max_instances(size_t max)
+{
+  max_instances = max ? max : 1;
+}
+
+/*
+ * Register a connection as an instance of its plugin.
+ *
+ * @return 0 on success, -1 if the plugin has all instances connected
+ */
+STATIC int instance_join(struct connection *con)
+{
+  instance_group *group = hashmap_get(cstr_t, ptr_t)(groups,
+      con->cc.pluginkeystring);
+
+  if (group && kv_size(group->members) >= max_instances)
+    return (-1);
+
+  /* instances may be connected to other shards as well */
+  if (shard_count() > 1 && shard_plugin_add(con->cc.pluginkeystring,
+      max_instances) == -1)
+    return (-1);
+
+  if (!group) {
+    group = instance_group_new(con->cc.pluginkeystring);
+    sbassert(group);
+    hashmap_put(cstr_t, ptr_t)(groups, group->pluginkey, group);
+  }
+
+  instance_group_add(group, con);
+
+  return (0);
+}
+
+/* @return true if the last instance of the plugin left the shard */
+STATIC bool instance_leave(struct connection *con)
+{
+  instance_group *group = hashmap_get(cstr_t, ptr_t)(groups,
+      con->cc.pluginkeystring);
+
+  if (!group || !instance_group_del(group, con))
+    return false;
+
+  LOG_VERBOSE(VERBOSE_LEVEL_1, "instance %lu of %s: %lu of %lu requests, "
+      "latency %lu us\n", con->id, group->pluginkey, con->routed,
+      group->routed, con->latency);
+
+  if (shard_count() > 1)
+    shard_plugin_del(con->cc.pluginkeystring);
+
+  if (kv_size(group->members))
+    return false;
+
+  hashmap_del(cstr_t, ptr_t)(groups, group->pluginkey);
+  instance_group_free(group);
+
+  return true;
 }
 
 STATIC void free_connection(struct connection *con)
 {
+  size_t dropped, index;
+  bool gone = instance_leave(con) &&
+      !(shard_count() > 1 && shard_plugin_lookup(con->cc.pluginkeystring,
+      &index));
+
+  /* calls made by the plugin, or to it, will never see a result */
+  dropped = calltable_drop_connection(con->id,
+      gone ? con->cc.pluginkeystring : NULL);
+  if (dropped)
+    LOG_VERBOSE(VERBOSE_LEVEL_0, "connection %lu: dropped %zu calls\n",
+        con->id, dropped);
+
   hashmap_del(uint64_t, ptr_t)(connections, con->id);
-  hashmap_del(cstr_t, uint64_t)(pluginkeys, con->cc.pluginkeystring);
   msgpack_unpacker_free(con->mpac);
+  msgpack_sbuffer_destroy(&con->sbuf);
 
-  char *event_string;
-  hashmap_foreach_value(con->subscribed_events, event_string, {
-    unsubscribe(con, event_string);
+  /* the topic names the map is keyed by may be freed on the way */
+  topic *t;
+  hashmap_foreach_value(con->subscribed_events, t, {
+    topic_unsubscribe(topics, t, con);
   });
 
   hashmap_free(cstr_t, ptr_t)(con->subscribed_events);
-  kv_destroy(con->callvector);
+  if (con->pending_calls)
+    hashmap_free(uint64_t, ptr_t)(con->pending_calls);
   kv_destroy(con->delayed_notifications);
+  kv_destroy(con->serial);
+
+  log_stats(con);
   multiqueue_free(con->events);
 
   if (con->packet.data)
@@ -303,6 +503,47 @@ STATIC void free_connection(struct connection *con)
   FREE(con);
 }
 
+STATIC void log_stats(struct connection *con)
+{
+  const multiqueue_stats *stats = multiqueue_get_stats(con->events);
+
+  LOG_VERBOSE(VERBOSE_LEVEL_1, "connection %lu: %lu events, queue depth %zu, "
+      "max queue depth %zu, avg wait %lu us, max wait %lu us\n", con->id,
+      stats->processed, stats->depth, stats->max_depth, stats->processed ?
+      stats->wait_total / stats->processed / 1000 : 0, stats->wait_max / 1000);
+}
+
+STATIC void dump_stats_event(UNUSED(void **argv))
+{
+  struct connection *con;
+
+  hashmap_foreach_value(connections, con, {
+    log_stats(con);
+  });
+}
+
+bool connection_get_stats(uint64_t id, multiqueue_stats *stats)
+{
+  struct connection *con = hashmap_get(uint64_t, ptr_t)(connections, id);
+
+  if (!con)
+    return false;
+
+  *stats = *multiqueue_get_stats(con->events);
+
+  return true;
+}
+
+void connection_dump_stats(void)
+{
+  for (size_t i = 0; i < shard_count(); i++) {
+    if (i != shard_self())
+      shard_post(i, event_create(1, dump_stats_event, 0));
+  }
+
+  dump_stats_event(NULL);
+}
+
 STATIC void timer_cb(uv_timer_t *timer)
 {
   struct crypto_context *cc = (struct crypto_context*)timer->data;
@@ -322,7 +563,7 @@ STATIC void connection_close(struct connection *con)
   timer_handle = (uv_handle_t*) &con->minutekey_timer;
   if (timer_handle) {
     uv_close(timer_handle, NULL);
-    uv_run(&main_loop.uv, UV_RUN_ONCE);
+    uv_run(&con->loop->uv, UV_RUN_ONCE);
   }
 
   inputstream_free(con->streams.read);
@@ -332,6 +573,8 @@ STATIC void connection_close(struct connection *con)
   if (handle)
     uv_close(handle, close_cb);
 
+  fail_pending_calls(con, "connection closed before the response arrived");
+
   decref(con);
 }
 
@@ -371,12 +614,9 @@ STATIC void send_error(struct connection *con, uint64_t id, char *err)
   error_set(&e, API_ERROR_TYPE_VALIDATION, "%s", err);
 
   msgpack_packer pac;
-  msgpack_packer_init(&pac, &sbuf, msgpack_sbuffer_write);
+  packer_begin(con, &pac);
   msgpack_rpc_serialize_response(id, &e, NIL, &pac);
-
-  crypto_write(&con->cc, sbuf.data, sbuf.size, con->streams.write);
-
-  msgpack_sbuffer_clear(&sbuf);
+  packer_flush(con);
 }
 
 STATIC void parse_cb(inputstream *istream, void *data, bool eof)
@@ -415,17 +655,13 @@ STATIC void parse_cb(inputstream *istream, void *data, bool eof)
       con->cc.state = TUNNEL_INITIAL;
     }
 
-    if (hashmap_has(cstr_t, uint64_t)(pluginkeys,
-        con->cc.pluginkeystring)) {
+    if (instance_join(con) == -1) {
       LOG_WARNING("pluginkey already registered, closing connection");
       sbmemzero(con->cc.pluginkeystring,
           sizeof con->cc.pluginkeystring);
       connection_close(con);
       goto end;
     }
-
-    hashmap_put(cstr_t, uint64_t)(pluginkeys, con->cc.pluginkeystring,
-      con->id);
   }
 
   pending = inputstream_pending(istream);
@@ -518,19 +754,26 @@ STATIC void parse_cb(inputstream *istream, void *data, bool eof)
     if (is_response) {
       if (is_valid_rpc_response(&result.data, con)) {
         connection_handle_response(con, &result.data);
+      } else if (result.data.via.array.ptr[1].via.u64 < con->msgid) {
+        /* answer to a call that expired in the meantime */
+        LOG_VERBOSE(VERBOSE_LEVEL_0, "dropping late response %lu\n",
+            result.data.via.array.ptr[1].via.u64);
       } else {
         call_set_error(con, "Returned response that doesn't have a matching "
                             "request id. Ensure the client is properly "
                             "synchronized");
+        msgpack_unpacked_destroy(&result);
+        goto end;
       }
 
-      msgpack_unpacked_destroy(&result);
-      goto end;
+      continue;
     }
 
     connection_handle_request(con, &result.data);
   }
 
+  msgpack_unpacked_destroy(&result);
+
   if (ret == MSGPACK_UNPACK_NOMEM_ERROR) {
     decref(con);
     exit(2);
@@ -559,21 +802,32 @@ bool connection_send_event(uint64_t id, char *name, array args)
 
   if (con) {
     string method = cstring_to_string(name);
-    msgpack_packer_init(&packer, &sbuf, msgpack_sbuffer_write);
+    packer_begin(con, &packer);
     msgpack_rpc_serialize_request(0, method, args, &packer);
     api_free_array(args);
 
     if (con->pending_requests) {
       wbuffer *rv = MALLOC(wbuffer);
-      rv->size = sbuf.size;
-      rv->data = sb_memdup_nulterm(sbuf.data, sbuf.size);
+      rv->size = con->sbuf.size;
+      rv->data = sb_memdup_nulterm(con->sbuf.data, con->sbuf.size);
       kv_push(con->delayed_notifications, rv);
+      msgpack_sbuffer_clear(&con->sbuf);
     } else {
-      crypto_write(&con->cc, sbuf.data, sbuf.size, con->streams.write);
+      packer_flush(con);
     }
-
-    msgpack_sbuffer_clear(&sbuf);
   } else {
+    /* every shard delivers the event to its own subscribers */
+    for (size_t i = 0; i < shard_count(); i++) {
+      if (i == shard_self())
+        continue;
+
+      array *copy = MALLOC(array);
+      sbassert(copy);
+      *copy = copy_object(ARRAY_OBJ(args)).data.array;
+      shard_post(i, event_create(1, remote_broadcast_event, 2,
+          box_strdup(name), copy));
+    }
+
     broadcast_event(name, args);
   }
 
@@ -581,84 +835,280 @@ bool connection_send_event(uint64_t id, char *name, array args)
 }
 
 
-object connection_send_request(char *pluginkey, string method,
-    array args, struct api_error *err)
+int connection_send_request(char *pluginkey, string method, array args,
+    uint32_t timeout, connection_response_cb cb, void *data,
+    struct api_error *err)
 {
-  uint64_t id;
-  struct connection *con;
-  msgpack_packer packer;
+  struct remote_call *call;
+  size_t index;
+
+  if (shard_count() == 1 || hashmap_has(cstr_t, ptr_t)(groups,
+      pluginkey) || !shard_plugin_lookup(pluginkey, &index)
+      || index == shard_self())
+    return send_request_local(pluginkey, method, args, timeout, cb, data,
+        err);
+
+  call = CALLOC(1, struct remote_call);
+
+  if (!call) {
+    api_free_array(args);
+    error_set(err, API_ERROR_TYPE_EXCEPTION, "out of memory");
+    return (-1);
+  }
+
+  strlcpy(call->pluginkey, pluginkey, sizeof(call->pluginkey));
+  call->method = copy_object(STRING_OBJ(method)).data.string;
+  call->args = args;
+  call->timeout = timeout;
+  call->cb = cb;
+  call->data = data;
+  call->origin = shard_self();
+  call->result = NIL;
+
+  shard_post(index, event_create(1, remote_request_event, 1, call));
+
+  return (0);
+}
+
+/*
+ * Send a request to a connection, instead of the connection a pluginkey is
+ * registered by. The connection may have been closed in the meantime.
+ */
+int connection_send_request_to(uint64_t con_id, size_t shard, string method,
+    array args, uint32_t timeout, connection_response_cb cb, void *data,
+    struct api_error *err)
+{
+  struct remote_call *call;
+
+  if (shard_count() == 1 || shard == shard_self())
+    return send_request_id(con_id, method, args, timeout, cb, data, err);
 
-  id = hashmap_get(cstr_t, uint64_t)(pluginkeys, pluginkey);
+  call = CALLOC(1, struct remote_call);
 
-  if (id == 0) {
+  if (!call) {
+    api_free_array(args);
+    error_set(err, API_ERROR_TYPE_EXCEPTION, "out of memory");
+    return (-1);
+  }
+
+  call->con_id = con_id;
+  call->method = copy_object(STRING_OBJ(method)).data.string;
+  call->args = args;
+  call->timeout = timeout;
+  call->cb = cb;
+  call->data = data;
+  call->origin = shard_self();
+  call->result = NIL;
+
+  shard_post(shard, event_create(1, remote_request_event, 1, call));
+
+  return (0);
+}
+
+int connection_send_request_all(char *pluginkey, string method, array args,
+    uint32_t timeout, struct api_error *err)
+{
+  bool sent = false;
+
+  for (size_t i = 0; shard_count() > 1 && i < shard_count(); i++) {
+    if (i == shard_self() || !shard_plugin_serves(pluginkey, i))
+      continue;
+
+    array *copy = MALLOC(array);
+    sbassert(copy);
+    *copy = copy_object(ARRAY_OBJ(args)).data.array;
+    shard_post(i, event_create(1, remote_fanout_event, 4,
+        box_strdup(pluginkey), copy_object(STRING_OBJ(method)).data.string.str,
+        copy, (void *) (uintptr_t) timeout));
+    sent = true;
+  }
+
+  if (send_request_group(pluginkey, method, args, timeout, err) == 0)
+    sent = true;
+  else if (sent)
+    *err = (struct api_error) ERROR_INIT;
+
+  return sent ? 0 : -1;
+}
+
+STATIC void discard_response_cb(object result,
+    UNUSED(struct api_error *error), UNUSED(void *data))
+{
+  api_free_object(result);
+}
+
+/* runs on a shard serving instances of the plugin */
+STATIC void remote_fanout_event(void **argv)
+{
+  struct api_error error = ERROR_INIT;
+  char *pluginkey = argv[0];
+  string method = cstring_to_string(argv[1]);
+  array *args = argv[2];
+
+  send_request_group(pluginkey, method, *args,
+      (uint32_t) (uintptr_t) argv[3], &error);
+
+  FREE(args);
+  FREE(argv[1]);
+  FREE(pluginkey);
+}
+
+/* send a request to every instance of the plugin on this shard */
+STATIC int send_request_group(char *pluginkey, string method, array args,
+    uint32_t timeout, struct api_error *err)
+{
+  instance_group *group = hashmap_get(cstr_t, ptr_t)(groups, pluginkey);
+  size_t size = group ? kv_size(group->members) : 0;
+  int rv = 0;
+
+  if (!size) {
     api_free_array(args);
     error_set(err, API_ERROR_TYPE_VALIDATION, "plugin not registered");
-    return NIL;
+    return (-1);
   }
 
-  con = hashmap_get(uint64_t, ptr_t)(connections, id);
+  for (size_t i = 0; i < size; i++) {
+    array copy = i + 1 < size ? copy_object(ARRAY_OBJ(args)).data.array :
+        args;
+
+    if (send_request_con(kv_A(group->members, i), method, copy, timeout,
+        discard_response_cb, NULL, err) == -1)
+      rv = -1;
+  }
+
+  return rv;
+}
+
+/* runs on the shard serving the plugin */
+STATIC void remote_request_event(void **argv)
+{
+  struct remote_call *call = argv[0];
+  int rv;
+
+  if (call->con_id)
+    rv = send_request_id(call->con_id, call->method, call->args,
+        call->timeout, remote_response_cb, call, &call->error);
+  else
+    rv = send_request_local(call->pluginkey, call->method, call->args,
+        call->timeout, remote_response_cb, call, &call->error);
+
+  if (rv == -1)
+    shard_post(call->origin, event_create(1, remote_done_event, 1, call));
+}
+
+STATIC void remote_response_cb(object result, struct api_error *error,
+    void *data)
+{
+  struct remote_call *call = data;
+
+  /* the callback owns the result, it is handed on to the origin shard */
+  call->result = result;
+  call->error = *error;
+
+  shard_post(call->origin, event_create(1, remote_done_event, 1, call));
+}
+
+/* runs on the shard the request was sent from */
+STATIC void remote_done_event(void **argv)
+{
+  struct remote_call *call = argv[0];
+
+  call->cb(call->result, &call->error, call->data);
+
+  api_free_string(call->method);
+  FREE(call);
+}
+
+STATIC void remote_broadcast_event(void **argv)
+{
+  char *name = argv[0];
+  array *args = argv[1];
+
+  broadcast_event(name, *args);
+  FREE(args);
+  FREE(name);
+}
+
+STATIC int send_request_local(char *pluginkey, string method, array args,
+    uint32_t timeout, connection_response_cb cb, void *data,
+    struct api_error *err)
+{
+  instance_group *group = hashmap_get(cstr_t, ptr_t)(groups, pluginkey);
+  struct connection *con = group ? instance_group_pick(group) : NULL;
 
-  /*
-   * if no connection is available for the key, set the connection to the
-   * the initial connection from the sender.
-   */
   if (!con) {
     api_free_array(args);
     error_set(err, API_ERROR_TYPE_VALIDATION, "plugin not registered");
-    return NIL;
+    return (-1);
   }
 
-  incref(con);
+  return send_request_con(con, method, args, timeout, cb, data, err);
+}
 
+STATIC int send_request_id(uint64_t con_id, string method, array args,
+    uint32_t timeout, connection_response_cb cb, void *data,
+    struct api_error *err)
+{
+  struct connection *con = hashmap_get(uint64_t, ptr_t)(connections, con_id);
+
+  if (!con) {
+    api_free_array(args);
+    error_set(err, API_ERROR_TYPE_VALIDATION, "plugin not registered");
+    return (-1);
+  }
+
+  return send_request_con(con, method, args, timeout, cb, data, err);
+}
+
+STATIC int send_request_con(struct connection *con, string method,
+    array args, uint32_t timeout, connection_response_cb cb, void *data,
+    struct api_error *err)
+{
+  struct callinfo *cinfo;
+  msgpack_packer packer;
   uint64_t msgid = con->msgid++;
 
-  msgpack_packer_init(&packer, &sbuf, msgpack_sbuffer_write);
+  packer_begin(con, &packer);
   msgpack_rpc_serialize_request(msgid, method, args, &packer);
 
   api_free_array(args);
 
-  LOG_VERBOSE(VERBOSE_LEVEL_0, "sending request: method = %s,  callinfo id = %u\n",
-      method.str, con->msgid);
-  if (crypto_write(&con->cc, sbuf.data, sbuf.size, con->streams.write) != 0)
-    return NIL;
-
-  msgpack_sbuffer_clear(&sbuf);
+  LOG_VERBOSE(VERBOSE_LEVEL_0, "sending request: method = %s,  callinfo id = %lu\n",
+      method.str, msgid);
+  if (packer_flush(con) != 0) {
+    error_set(err, API_ERROR_TYPE_EXCEPTION, "sending request failed");
+    return (-1);
+  }
 
-  struct callinfo cinfo = (struct callinfo) { msgid, false, false, NIL };
+  cinfo = MALLOC(struct callinfo);
 
-  loop_process_events_until(&main_loop, con, &cinfo);
+  if (!cinfo) {
+    error_set(err, API_ERROR_TYPE_EXCEPTION, "out of memory");
+    return (-1);
+  }
 
-  if (cinfo.errored) {
-    if (cinfo.result.type == OBJECT_TYPE_STR) {
-      error_set(err, API_ERROR_TYPE_EXCEPTION, "%s",
-          cinfo.result.data.string.str);
-    } else if (cinfo.result.type == OBJECT_TYPE_ARRAY) {
-      array array = cinfo.result.data.array;
+  cinfo->msgid = msgid;
+  cinfo->cb = cb;
+  cinfo->data = data;
+  cinfo->con = con;
+  cinfo->timer.pending = false;
+  cinfo->sent = uv_hrtime();
 
-      if (array.size == 2 && array.items[0].type == OBJECT_TYPE_INT
-          && (array.items[0].data.integer == API_ERROR_TYPE_EXCEPTION
-              || array.items[0].data.integer == API_ERROR_TYPE_VALIDATION)
-          && array.items[1].type == OBJECT_TYPE_STR) {
-        err->type = (api_error_type) array.items[0].data.integer;
-        strlcpy(err->msg, array.items[1].data.string.str, sizeof(err->msg));
-        err->isset = true;
-      } else {
-        error_set(err, API_ERROR_TYPE_EXCEPTION, "%s", "unknown error");
-      }
-    } else {
-      error_set(err, API_ERROR_TYPE_EXCEPTION, "%s", "unknown error");
-    }
+  /* connections set up by hand have no table yet */
+  if (!con->pending_calls)
+    con->pending_calls = hashmap_new(uint64_t, ptr_t)();
 
-    api_free_object(cinfo.result);
-  }
+  hashmap_put(uint64_t, ptr_t)(con->pending_calls, msgid, cinfo);
+  con->pending_requests++;
 
-  if (!con->pending_requests) {
-    send_delayed_notifications(con);
-  }
+  /* connections set up by hand have no loop to time the call on */
+  if (timeout && con->loop)
+    loop_timer_start(con->loop, &cinfo->timer, timeout, call_expired, cinfo);
 
-  decref(con);
+  /* the connection is kept alive until every pending call completed */
+  incref(con);
 
-  return cinfo.errored ? NIL : cinfo.result;
+  return (0);
 }
 
 STATIC void send_delayed_notifications(struct connection *con)
@@ -673,6 +1123,34 @@ STATIC void send_delayed_notifications(struct connection *con)
   kv_size(con->delayed_notifications) = 0;
 }
 
+/*
+ * Reset the connection's output buffer and reserve the crypto headroom in
+ * front of the message, so it can be sealed in place by packer_flush().
+ */
+STATIC void packer_begin(struct connection *con, msgpack_packer *pac)
+{
+  msgpack_sbuffer_clear(&con->sbuf);
+  sbuffer_reserve_headroom(&con->sbuf);
+  msgpack_packer_init(pac, &con->sbuf, msgpack_sbuffer_write);
+}
+
+STATIC int packer_flush(struct connection *con)
+{
+  int rv = crypto_write(&con->cc, con->sbuf.data, con->sbuf.size,
+      con->streams.write);
+
+  msgpack_sbuffer_clear(&con->sbuf);
+
+  return rv;
+}
+
+STATIC void sbuffer_reserve_headroom(msgpack_sbuffer *sbuf)
+{
+  static const char headroom[CRYPTO_PACKET_HEADROOM];
+
+  msgpack_sbuffer_write(sbuf, headroom, sizeof(headroom));
+}
+
 int connection_send_response(uint64_t con_id, uint32_t msgid,
     object arg, struct api_error *api_error)
 {
@@ -690,32 +1168,60 @@ int connection_send_response(uint64_t con_id, uint32_t msgid,
     return (-1);
   }
 
-  msgpack_packer_init(&packer, &sbuf, msgpack_sbuffer_write);
+  packer_begin(con, &packer);
   msgpack_rpc_serialize_response(msgid, api_error, arg, &packer);
 
   if (api_error->isset) {
+    msgpack_sbuffer_clear(&con->sbuf);
     return (-1);
   }
 
-  if (crypto_write(&con->cc, sbuf.data, sbuf.size, con->streams.write) != 0) {
+  if (packer_flush(con) != 0) {
     return (-1);
   }
 
-  msgpack_sbuffer_clear(&sbuf);
   api_free_object(arg);
 
   return 0;
 }
 
 
+void connection_send_ack(uint64_t con_id, uint64_t msgid, uint64_t callid,
+    struct api_error *error)
+{
+  msgpack_packer packer;
+  struct connection *con;
+
+  if (msgid == UINT64_MAX)
+    return;
+
+  con = hashmap_get(uint64_t, ptr_t)(connections, con_id);
+
+  /* the caller might have gone away while its call was forwarded */
+  if (!con || con->closed)
+    return;
+
+  packer_begin(con, &packer);
+
+  if (error->isset)
+    msgpack_rpc_serialize_response(msgid, error, NIL, &packer);
+  else
+    msgpack_rpc_serialize_ack(msgid, callid, &packer);
+
+  packer_flush(con);
+}
+
+
 STATIC void connection_handle_request(struct connection *con,
     msgpack_object *obj)
 {
   array args = ARRAY_DICT_INIT;
   uint64_t msgid;
   dispatch_info dispatcher;
-  msgpack_object *method;
+  msgpack_object *method, *argsobj;
+  msgpack_packer packer;
   struct api_error api_error = ERROR_INIT;
+  struct schema_error schema_error;
 
   msgpack_rpc_validate(&msgid, obj, &api_error);
 
@@ -731,11 +1237,30 @@ STATIC void connection_handle_request(struct connection *con,
   } else {
     dispatcher.func = msgpack_rpc_handle_missing_method;
     dispatcher.async = true;
+    dispatcher.schema = SCHEMA_NONE;
+    dispatcher.deferred = false;
+    dispatcher.offload = false;
   }
 
-  if (!msgpack_rpc_to_array(msgpack_rpc_args(obj), &args)) {
+  argsobj = msgpack_rpc_args(obj);
+
+  /* reject malformed arguments before spending any time on decoding them */
+  if (argsobj && dispatcher.schema != SCHEMA_NONE &&
+      schema_validate_msgpack(dispatcher.schema, argsobj, &schema_error) == -1) {
+    if (msgid != UINT64_MAX) {
+      schema_error_set(&api_error, &schema_error);
+      packer_begin(con, &packer);
+      msgpack_rpc_serialize_response(msgid, &api_error, NIL, &packer);
+      packer_flush(con);
+    }
+    return;
+  }
+
+  if (!msgpack_rpc_to_array(argsobj, &args)) {
     dispatcher.func = msgpack_rpc_handle_invalid_arguments;
     dispatcher.async = true;
+    dispatcher.deferred = false;
+    dispatcher.offload = false;
   }
 
   connection_request_event_info *eventinfo = MALLOC(connection_request_event_info);
@@ -743,6 +1268,8 @@ STATIC void connection_handle_request(struct connection *con,
   eventinfo->dispatcher = dispatcher;
   eventinfo->args = args;
   eventinfo->msgid = msgid;
+  eventinfo->result = NIL;
+  eventinfo->error = (struct api_error) ERROR_INIT;
 
   incref(con);
 
@@ -754,32 +1281,87 @@ STATIC void connection_handle_request(struct connection *con,
 }
 
 
+/*
+ * Requests of a connection are executed strictly in order. While an
+ * offloaded request runs on a worker, later requests of the connection are
+ * kept in its serial queue.
+ */
 STATIC void connection_request_event(void **argv)
 {
   connection_request_event_info *eventinfo = argv[0];
-  object result;
-  msgpack_packer packer;
-  struct connection *con;
-  struct api_error error = ERROR_INIT;
+  struct connection *con = eventinfo->con;
+  dispatch_info handler = eventinfo->dispatcher;
+
+  if (con->offloaded) {
+    kv_push(con->serial, eventinfo);
+    return;
+  }
+
+  if (handler.offload) {
+    con->offloaded = true;
+    worker_pool_submit(event_create(1, offload_event, 1, eventinfo));
+    return;
+  }
+
+  eventinfo->result = handler.func(con->id, eventinfo->msgid,
+      con->cc.pluginkeystring, eventinfo->args, &eventinfo->error);
+
+  connection_request_finish(eventinfo);
+}
 
-  con = eventinfo->con;
-  array args = eventinfo->args;
+/* runs on a worker thread */
+STATIC void offload_event(void **argv)
+{
+  connection_request_event_info *eventinfo = argv[0];
+  struct connection *con = eventinfo->con;
+
+  eventinfo->result = eventinfo->dispatcher.func(con->id, eventinfo->msgid,
+      con->cc.pluginkeystring, eventinfo->args, &eventinfo->error);
+
+  loop_schedule(con->loop, event_create(1, offload_done_event, 1, eventinfo));
+}
+
+STATIC void offload_done_event(void **argv)
+{
+  connection_request_event_info *eventinfo = argv[0];
+  struct connection *con = eventinfo->con;
+
+  incref(con);
+
+  con->offloaded = false;
+  connection_request_finish(eventinfo);
+
+  /* run what queued up behind the request, until the next one is offloaded */
+  while (!con->offloaded && kv_size(con->serial)) {
+    eventinfo = kv_A(con->serial, 0);
+    memmove(con->serial.items, con->serial.items + 1,
+        (kv_size(con->serial) - 1) * sizeof(*con->serial.items));
+    kv_size(con->serial)--;
+    connection_request_event((void **)&eventinfo);
+  }
+
+  decref(con);
+}
+
+STATIC void connection_request_finish(connection_request_event_info *eventinfo)
+{
+  msgpack_packer packer;
+  struct connection *con = eventinfo->con;
   uint64_t msgid = eventinfo->msgid;
   dispatch_info handler = eventinfo->dispatcher;
 
-  result = handler.func(con->id, msgid, con->cc.pluginkeystring, args, &error);
-
-  if (eventinfo->msgid != UINT64_MAX) {
-    msgpack_packer_init(&packer, &sbuf, msgpack_sbuffer_write);
-    msgpack_rpc_serialize_response(msgid, &error, result, &packer);
-    crypto_write(&eventinfo->con->cc, sbuf.data, sbuf.size,
-        eventinfo->con->streams.write);
-    msgpack_sbuffer_clear(&sbuf);
-  } else {
-    api_free_object(result);
+  /* deferred handlers answer on their own once the forwarded call returned */
+  if (msgid != UINT64_MAX && !con->closed
+      && !(handler.deferred && !eventinfo->error.isset)) {
+    packer_begin(con, &packer);
+    msgpack_rpc_serialize_response(msgid, &eventinfo->error, eventinfo->result,
+        &packer);
+    packer_flush(con);
   }
 
-  api_free_array(args);
+  api_free_object(eventinfo->result);
+
+  api_free_array(eventinfo->args);
 
   decref(con);
   FREE(eventinfo);
@@ -789,8 +1371,8 @@ STATIC int is_valid_rpc_response(msgpack_object *obj, struct connection *con)
 {
   uint64_t msg_id = obj->via.array.ptr[1].via.u64;
 
-  return kv_size(con->callvector) && msg_id
-      == kv_A(con->callvector, kv_size(con->callvector) - 1)->msgid;
+  return con->pending_calls
+      && hashmap_has(uint64_t, ptr_t)(con->pending_calls, msg_id);
 }
 
 
@@ -798,31 +1380,122 @@ STATIC void connection_handle_response(struct connection *con,
     msgpack_object *obj)
 {
   struct callinfo *cinfo;
+  struct api_error error = ERROR_INIT;
+  object result = NIL;
+  uint64_t msgid = obj->via.array.ptr[1].via.u64;
 
-  cinfo = kv_A(con->callvector, kv_size(con->callvector) - 1);
+  cinfo = hashmap_get(uint64_t, ptr_t)(con->pending_calls, msgid);
+  hashmap_del(uint64_t, ptr_t)(con->pending_calls, msgid);
 
   LOG_VERBOSE(VERBOSE_LEVEL_0, "received response: callinfo id = %lu\n",
       cinfo->msgid);
 
-  cinfo->returned = true;
-  cinfo->errored = (obj->via.array.ptr[2].type != MSGPACK_OBJECT_NIL);
-
-  if (cinfo->errored) {
-    msgpack_rpc_to_object(&obj->via.array.ptr[2], &cinfo->result);
+  if (obj->via.array.ptr[2].type != MSGPACK_OBJECT_NIL) {
+    msgpack_rpc_to_object(&obj->via.array.ptr[2], &result);
+    response_error_set(&error, result);
+    api_free_object(result);
+    result = NIL;
   } else {
-    msgpack_rpc_to_object(&obj->via.array.ptr[3], &cinfo->result);
+    msgpack_rpc_to_object(&obj->via.array.ptr[3], &result);
+  }
+
+  call_complete(con, cinfo, result, &error);
+}
+
+/*
+ * Hand the result of a pending call to its callback and drop the reference
+ * the call held on the connection.
+ */
+STATIC void call_complete(struct connection *con, struct callinfo *cinfo,
+    object result, struct api_error *error)
+{
+  con->pending_requests--;
+  instance_record_latency(con, (uv_hrtime() - cinfo->sent) / 1000);
+
+  if (cinfo->timer.pending)
+    loop_timer_stop(con->loop, &cinfo->timer);
+
+  cinfo->cb(result, error, cinfo->data);
+  FREE(cinfo);
+
+  if (!con->pending_requests && !con->closed) {
+    send_delayed_notifications(con);
   }
+
+  decref(con);
 }
 
-STATIC void call_set_error(struct connection *con, UNUSED(char *msg))
+/*
+ * The response of an expired call is dropped when it arrives late, see
+ * parse_cb().
+ */
+STATIC void call_expired(wheel_timer *timer)
 {
+  struct callinfo *cinfo = timer->data;
+  struct connection *con = cinfo->con;
+  struct api_error error = ERROR_INIT;
+
+  LOG_VERBOSE(VERBOSE_LEVEL_0, "request %lu expired\n", cinfo->msgid);
+
+  hashmap_del(uint64_t, ptr_t)(con->pending_calls, cinfo->msgid);
+  error_set_response(&error, CALL_TIMEOUT);
+  call_complete(con, cinfo, NIL, &error);
+}
+
+STATIC void fail_pending_calls(struct connection *con, char *msg)
+{
+  kvec_t(struct callinfo *) calls = KV_INITIAL_VALUE;
   struct callinfo *cinfo;
+  struct api_error error = ERROR_INIT;
+
+  if (!con->pending_calls)
+    return;
 
-  for (size_t i = 0; i < kv_size(con->callvector); i++) {
-      cinfo = kv_A(con->callvector, i);
-      cinfo->errored = true;
-      cinfo->returned = true;
+  /* callbacks may send new requests, so empty the table before */
+  hashmap_foreach_value(con->pending_calls, cinfo, {
+    kv_push(calls, cinfo);
+  });
+  hashmap_clear(uint64_t, ptr_t)(con->pending_calls);
+
+  for (size_t i = 0; i < kv_size(calls); i++) {
+    error_set(&error, API_ERROR_TYPE_EXCEPTION, "%s", msg);
+    call_complete(con, kv_A(calls, i), NIL, &error);
   }
 
+  kv_destroy(calls);
+}
+
+/*
+ * Convert the error object of a response to an api_error. Plugins answer
+ * with [type, message], anything else is reported as unknown error.
+ */
+STATIC void response_error_set(struct api_error *err, object error)
+{
+  if (error.type == OBJECT_TYPE_STR) {
+    error_set(err, API_ERROR_TYPE_EXCEPTION, "%s", error.data.string.str);
+  } else if (error.type == OBJECT_TYPE_ARRAY) {
+    array array = error.data.array;
+
+    if (array.size == 2 && array.items[0].type == OBJECT_TYPE_INT
+        && (array.items[0].data.integer == API_ERROR_TYPE_EXCEPTION
+            || array.items[0].data.integer == API_ERROR_TYPE_VALIDATION)
+        && array.items[1].type == OBJECT_TYPE_STR) {
+      err->type = (api_error_type) array.items[0].data.integer;
+      strlcpy(err->msg, array.items[1].data.string.str, sizeof(err->msg));
+      err->response = API_ERROR_RESPONSE_NONE;
+      err->isset = true;
+    } else {
+      error_set(err, API_ERROR_TYPE_EXCEPTION, "%s", "unknown error");
+    }
+  } else {
+    error_set(err, API_ERROR_TYPE_EXCEPTION, "%s", "unknown error");
+  }
+}
+
+STATIC void call_set_error(struct connection *con, char *msg)
+{
+  LOG_WARNING("%s", msg);
+
+  /* closing fails every pending call of the connection */
   connection_close(con);
 }
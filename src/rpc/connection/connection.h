@@ -33,17 +33,23 @@ struct connection {
   size_t pending_requests;
   size_t refcount;
   msgpack_unpacker *mpac;
-  msgpack_sbuffer *sbuf;
+  msgpack_sbuffer sbuf;
   char *unpackbuf;
   bool closed;
+  /* loop of the shard the connection was accepted on */
+  struct loop *loop;
   multiqueue *events;
   struct {
     inputstream *read;
     outputstream *write;
     uv_stream_t *uv;
   } streams;
-  kvec_t(struct callinfo *) callvector;
+  /* msgid -> outgoing request waiting for its response */
+  hashmap(uint64_t, ptr_t) *pending_calls;
   kvec_t(wbuffer *) delayed_notifications;
+  /* requests waiting for the offloaded request in flight */
+  kvec_t(connection_request_event_info *) serial;
+  bool offloaded;
   struct crypto_context cc;
   struct {
     uint64_t start;
@@ -53,5 +59,25 @@ struct connection {
     unsigned char *data;
   } packet;
   uv_timer_t minutekey_timer;
+  /* event name or pattern -> topic */
   hashmap(cstr_t, ptr_t) *subscribed_events;
+  /* the last broadcast delivered to the connection */
+  uint64_t broadcast_seq;
+  /* requests routed to the connection as an instance of its plugin */
+  uint64_t routed;
+  /* moving average of its response latency in microseconds */
+  uint64_t latency;
 };
+
+/**
+ * Copy the event queue metrics of a live connection of the calling shard.
+ *
+ * @return true if the connection is served by the calling shard
+ */
+bool connection_get_stats(uint64_t id, multiqueue_stats *stats);
+
+/**
+ * Log the event queue metrics of every live connection, each shard logs the
+ * connections it serves.
+ */
+void connection_dump_stats(void);
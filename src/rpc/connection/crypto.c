@@ -1,8 +1,9 @@
 #include "rpc/connection/crypto.h"
 #include <stdint.h>        // for uint64_t
-#include <stdlib.h>        // for exit
+#include <stdlib.h>        // for exit, abort
 #include <string.h>        // for memcpy, NULL, size_t
 #include <unistd.h>        // for close
+#include <uv.h>            // for uv_mutex_t, uv_once
 #include "rpc/db/sb-db.h"  // for db_authorized_verify, db_authorized_whitel...
 #include "rpc/sb-rpc.h"    // for crypto_context, outputstream_write, output...
 #include "sb-common.h"     // for sbmemzero, sbassert, FREE, ISODD, STATIC
@@ -27,10 +28,15 @@ static uint64_t counterlow;
 static uint64_t counterhigh;
 static unsigned char flagkeyloaded;
 static unsigned char noncekey[32];
+/* the nonce counter is shared by all shards */
+static uv_once_t nonce_once = UV_ONCE_INIT;
+static uv_mutex_t nonce_lock;
 
 STATIC int crypto_block(unsigned char *out, const unsigned char *in,
     const unsigned char *k);
 STATIC int safenonce(unsigned char *y, int flaglongterm);
+STATIC int safenonce_locked(unsigned char *y, int flaglongterm);
+STATIC void nonce_lock_init(void);
 STATIC void nonce_update(struct crypto_context *cc);
 
 int crypto_init(void)
@@ -43,7 +49,26 @@ int crypto_init(void)
 }
 
 
+STATIC void nonce_lock_init(void)
+{
+  if (uv_mutex_init(&nonce_lock) != 0)
+    abort();
+}
+
 STATIC int safenonce(unsigned char *y, int flaglongterm)
+{
+  int rv;
+
+  uv_once(&nonce_once, nonce_lock_init);
+
+  uv_mutex_lock(&nonce_lock);
+  rv = safenonce_locked(y, flaglongterm);
+  uv_mutex_unlock(&nonce_lock);
+
+  return rv;
+}
+
+STATIC int safenonce_locked(unsigned char *y, int flaglongterm)
 {
   unsigned char data[16];
 
@@ -479,93 +504,63 @@ fail:
 }
 
 
-int crypto_write(struct crypto_context *cc, char *data,
+int crypto_write(struct crypto_context *cc, char *packet,
     size_t length, outputstream *out)
 {
-  unsigned long long packetlen;
-  unsigned char *packet;
-  unsigned char *block = NULL;
-  unsigned char *ciphertext = NULL;
+  unsigned char *p = (unsigned char *)packet;
   unsigned char lengthbox[40] = { 0 };
   unsigned char nonce[crypto_box_NONCEBYTES];
-  uint64_t blocklen;
+  unsigned char compressednonce[8];
 
   sbassert(cc);
-  sbassert(data);
+  sbassert(packet);
   sbassert(out);
+  sbassert(length >= CRYPTO_PACKET_HEADROOM);
 
   /*
-   * add 8 byte for identifier, 24 byte for boxed length and 8 byte for
-   * compressed nonce. nacl api also requires 32 byte zero-padding
-   * (crypto_box_ZEROBYTES)
+   * the caller reserved CRYPTO_PACKET_HEADROOM bytes in front of the
+   * plaintext: 8 byte identifier, 8 byte compressed nonce and 24 byte boxed
+   * length. The last 16 bytes of the header overlap with the 32 byte
+   * zero-padding nacl requires (crypto_box_ZEROBYTES), so the payload can
+   * be boxed in place and the final packet is exactly `length` bytes.
    */
-  packetlen = length + 56;
-  packet = MALLOC_ARRAY(packetlen, unsigned char);
-
-  if (packet == NULL)
-    return -1;
 
   /* update nonce */
   nonce_update(cc);
 
-  memcpy(packet, CRYPTO_ID_MESSAGE_SERVER, 8);
-
   /* set nonce expansion prefix and compressed nonce (little-endian) */
   memcpy(nonce, CRYPTO_PREFIX_SPLONEBOXSERVER, 16);
   uint64_pack(nonce + 16, cc->nonce);
+  memcpy(compressednonce, nonce + 16, 8);
 
-  /* pack compressed nonce */
-  memcpy(packet + 8, nonce + 16, 8);
-
-  uint64_pack(lengthbox + 32, packetlen);
+  uint64_pack(lengthbox + 32, length);
 
   if (crypto_box_afternm(lengthbox, lengthbox, 40, nonce,
       cc->clientshortservershort) != 0)
-    goto fail;
-
-  /* pack boxed length */
-  memcpy(packet + 16, lengthbox + 16, 24);
-
-  blocklen = length + 32;
-  block = CALLOC(blocklen, unsigned char);
-  ciphertext = MALLOC_ARRAY(blocklen, unsigned char);
-
-  if ((block == NULL) || (ciphertext == NULL))
     return -1;
 
-  memcpy(block + 32, data, length);
-
   /* update nonce */
   nonce_update(cc);
   uint64_pack(nonce + 16, cc->nonce);
 
-  if (crypto_box_afternm(ciphertext, block, blocklen, nonce,
-      cc->clientshortservershort) != 0)
-    goto fail;
+  sbmemzero(p + CRYPTO_PACKET_HEADROOM - crypto_box_ZEROBYTES,
+      crypto_box_ZEROBYTES);
 
-  memcpy(packet + 40, ciphertext + 16, blocklen - 16);
+  if (crypto_box_afternm(p + CRYPTO_PACKET_HEADROOM - crypto_box_ZEROBYTES,
+      p + CRYPTO_PACKET_HEADROOM - crypto_box_ZEROBYTES,
+      length - CRYPTO_PACKET_HEADROOM + crypto_box_ZEROBYTES, nonce,
+      cc->clientshortservershort) != 0)
+    return -1;
 
-  if (outputstream_write(out, (char *)packet, packetlen) < 0)
-    goto fail;
+  /* the header overwrites the leading zero bytes of the box */
+  memcpy(p, CRYPTO_ID_MESSAGE_SERVER, 8);
+  memcpy(p + 8, compressednonce, 8);
+  memcpy(p + 16, lengthbox + 16, 24);
 
-  sbmemzero(packet, sizeof packet);
-  sbmemzero(block, sizeof block);
-  sbmemzero(ciphertext, sizeof ciphertext);
-  FREE(ciphertext);
-  FREE(block);
-  FREE(packet);
+  if (outputstream_write(out, packet, length) < 0)
+    return -1;
 
   return 0;
-
-fail:
-  sbmemzero(packet, sizeof packet);
-  sbmemzero(block, sizeof block);
-  sbmemzero(ciphertext, sizeof ciphertext);
-  FREE(ciphertext);
-  FREE(block);
-  FREE(packet);
-
-  return -1;
 }
 
 
@@ -30,26 +30,95 @@
  *    limitations under the License.
  */
 
-#include <msgpack/sbuffer.h>  // for msgpack_sbuffer_init, msgpack_sbuffer
 #include <stdbool.h>          // for false, true
 #include <stdint.h>           // for uint64_t
 #include <stdio.h>            // for snprintf
 #include <stdlib.h>           // for NULL, size_t
+#include <string.h>           // for strcmp
+#ifdef __linux__
+#include <bsd/string.h>       // for strlcpy
+#endif
 #include "api/helpers.h"      // for ARRAY_OBJ, ADD, NIL, UINTEGER_OBJ
 #include "api/sb-api.h"       // for api_broadcast, api_register, api_result
+#include "rpc/connection/calltable.h"  // for calltable_add, call_record
+#include "rpc/connection/shard.h"  // for shard_self
+#include "rpc/msgpack/schema.h"  // for schema_validate, schema_error_set
 #include "rpc/sb-rpc.h"       // for object, array, object::(anonymous), dis...
 #include "sb-common.h"        // for ::API_ERROR_TYPE_VALIDATION, error_set
 
-static msgpack_sbuffer sbuf;
 static hashmap(string, dispatch_info) *dispatch_table = NULL;
-static hashmap(uint64_t, ptr_t) *callids = NULL;
+/* deadline of calls whose caller did not set one, 0 for none */
+static uint32_t call_timeout = 0;
+
+/* the request a forwarded run or result call is answered to */
+struct deferred_reply {
+  uint64_t con_id;
+  uint64_t msgid;
+};
+
+STATIC struct deferred_reply *deferred_reply_new(uint64_t con_id,
+    uint64_t msgid)
+{
+  struct deferred_reply *reply = MALLOC(struct deferred_reply);
+
+  if (reply) {
+    reply->con_id = con_id;
+    reply->msgid = msgid;
+  }
+
+  return reply;
+}
+
+STATIC void run_call_expired(struct call_record *record)
+{
+  struct api_error error = ERROR_INIT;
+  struct api_error timeout = ERROR_INIT;
+
+  LOG_VERBOSE(VERBOSE_LEVEL_0, "call %lu expired\n", record->callid);
+
+  /* the caller waits for a result, it gets the timeout instead */
+  error_set_response(&timeout, CALL_TIMEOUT);
+
+  if (api_result_error(record->caller_id, record->caller_shard,
+      record->callid, &timeout, call_timeout, &error) == -1)
+    LOG_VERBOSE(VERBOSE_LEVEL_0, "caller of call %lu not told: %s\n",
+        record->callid, api_error_message(&error));
+
+  error = (struct api_error) ERROR_INIT;
+
+  /* the target may be gone already, nothing to cancel then */
+  api_cancel(record->target, record->callid, call_timeout, &error);
+}
+
+STATIC void run_reply_cb(uint64_t callid, struct api_error *error, void *data)
+{
+  struct deferred_reply *reply = data;
+
+  /* no result will follow for a call the target did not accept */
+  if (error->isset)
+    calltable_release(callid, NULL, NULL);
+
+  connection_send_ack(reply->con_id, reply->msgid, callid, error);
+  FREE(reply);
+}
+
+STATIC void result_reply_cb(uint64_t callid, struct api_error *error,
+    void *data)
+{
+  struct deferred_reply *reply = data;
+
+  if (!error->isset)
+    calltable_release(callid, NULL, NULL);
+
+  connection_send_ack(reply->con_id, reply->msgid, callid, error);
+  FREE(reply);
+}
 
 object msgpack_rpc_handle_missing_method(UNUSED(uint64_t channel_id),
     UNUSED(uint64_t msgid), UNUSED(char *pluginkey), UNUSED(array args),
     struct api_error *error)
 {
-  snprintf(error->msg, sizeof(error->msg), "Invalid method name");
-  error->isset = true;
+  error_set_response(error, MISSING_METHOD);
   return NIL;
 }
 
@@ -57,8 +126,7 @@ object msgpack_rpc_handle_invalid_arguments(UNUSED(uint64_t channel_id),
     UNUSED(uint64_t msgid), UNUSED(char *pluginkey), UNUSED(array args),
     struct api_error *error)
 {
-  snprintf(error->msg, sizeof(error->msg), "Invalid method arguments");
-  error->isset = true;
+  error_set_response(error, INVALID_ARGUMENTS);
   return NIL;
 }
 
@@ -74,75 +142,31 @@ object handle_register(UNUSED(uint64_t con_id), UNUSED(uint64_t msgid),
 {
   array rv = ARRAY_DICT_INIT;
   object ret = ARRAY_OBJ(rv);
-  array meta = ARRAY_DICT_INIT;
-  array functions = ARRAY_DICT_INIT;
+  array meta, functions;
   string name, description, author, license;
+  struct schema_error schema_error;
 
   if (!error)
     goto end;
 
-  /* check params size */
-  if (args.size != 2) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching register API request. Invalid params size");
-    goto end;
-  }
-
-  if (args.items[0].type == OBJECT_TYPE_ARRAY)
-    meta = args.items[0].data.array;
-  else {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching register API request. meta params has wrong type");
-    goto end;
-  }
-
-  /*
-   * meta params:
-   * [name, description, author, license]
-   */
-
-  if (meta.size != 4) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching register API request. Invalid meta params size");
-    goto end;
-  }
-
-  /* extract meta information */
-  if ((meta.items[0].type != OBJECT_TYPE_STR) ||
-      (meta.items[1].type != OBJECT_TYPE_STR) ||
-      (meta.items[2].type != OBJECT_TYPE_STR) ||
-      (meta.items[3].type != OBJECT_TYPE_STR)) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching register API request. meta element has wrong type");
-    goto end;
-  }
-
-  if (!meta.items[0].data.string.str || !meta.items[1].data.string.str ||
-      !meta.items[2].data.string.str || !meta.items[3].data.string.str) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching register API request. Invalid meta params size");
+  /* args = [[name, description, author, license], functions] */
+  if (schema_validate(SCHEMA_REGISTER, args, &schema_error) == -1) {
+    schema_error_set(error, &schema_error);
     goto end;
   }
 
+  meta = args.items[0].data.array;
   name = meta.items[0].data.string;
   description = meta.items[1].data.string;
   author = meta.items[2].data.string;
   license = meta.items[3].data.string;
-
-  if (args.items[1].type == OBJECT_TYPE_ARRAY) {
-    functions = args.items[1].data.array;
-  } else {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching register API request. functions has wrong type");
-    goto end;
-  }
+  functions = args.items[1].data.array;
 
   if (api_register(name, description, author, license, functions, pluginkey,
       error) == -1) {
 
     if (!error->isset)
-      error_set(error, API_ERROR_TYPE_VALIDATION,
-         "Error running register API request.");
+      error_set_response(error, REGISTER_FAILED);
 
     goto end;
   }
@@ -152,168 +176,154 @@ end:
 }
 
 
-object handle_run(UNUSED(uint64_t con_id), UNUSED(uint64_t msgid),
-    char *pluginkey, array args, struct api_error *error)
+object handle_run(uint64_t con_id, uint64_t msgid, char *pluginkey,
+    array args, struct api_error *error)
 {
-  array rv = ARRAY_DICT_INIT;
-  array meta = ARRAY_DICT_INIT;
-  array runargs = ARRAY_DICT_INIT;
-  string function_name = STRING_INIT;
-  object ret = ARRAY_OBJ(rv);
+  array meta, runargs;
+  string function_name;
+  object ret = NIL;
   uint64_t callid;
+  uint32_t timeout = call_timeout;
   char *targetpluginkey;
+  struct schema_error schema_error;
+  struct deferred_reply *reply;
+  struct call_record record;
 
   if (!error)
     goto end;
 
-  /* check params size */
-  if (args.size != 3) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching run API request. Invalid params size");
-    goto end;
-  }
-
-  if (args.items[0].type == OBJECT_TYPE_ARRAY)
-    meta = args.items[0].data.array;
-  else {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching run API request. meta params has wrong type");
-    goto end;
-  }
-
-  /* meta = [targetpluginkey, nil]*/
-  if (meta.size != 2) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching run API request. Invalid meta params size");
-    goto end;
-  }
-
-  /* extract meta information */
-  if (meta.items[0].type != OBJECT_TYPE_STR) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching run API request. meta elements have wrong type");
-    goto end;
-  }
-
-  if (!meta.items[0].data.string.str ||
-    meta.items[0].data.string.length + 1 != PLUGINKEY_STRING_SIZE) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching run API request. Invalid meta params size");
+  /* args = [[targetpluginkey, deadline or nil], function_name, runargs] */
+  if (schema_validate(SCHEMA_RUN, args, &schema_error) == -1) {
+    schema_error_set(error, &schema_error);
     goto end;
   }
 
+  meta = args.items[0].data.array;
   targetpluginkey = meta.items[0].data.string.str;
   to_upper(targetpluginkey);
+  function_name = args.items[1].data.string;
+  runargs = args.items[2].data.array;
 
-  if (meta.items[1].type != OBJECT_TYPE_NIL) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching run API request. meta elements have wrong type");
-    goto end;
-  }
+  /* the caller's deadline in milliseconds takes precedence */
+  if (meta.items[1].type == OBJECT_TYPE_UINT)
+    timeout = meta.items[1].data.uinteger > UINT32_MAX ? UINT32_MAX :
+        (uint32_t) meta.items[1].data.uinteger;
 
-  if (args.items[1].type == OBJECT_TYPE_STR) {
-    function_name = args.items[1].data.string;
-  } else {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching run API request. function string has wrong type");
-    goto end;
-  }
+  /* the result is routed back to this very connection */
+  record.caller_id = con_id;
+  record.caller_shard = shard_self();
+  strlcpy(record.caller, pluginkey, sizeof(record.caller));
+  strlcpy(record.target, targetpluginkey, sizeof(record.target));
 
-  if (args.items[2].type == OBJECT_TYPE_ARRAY) {
-    runargs = args.items[2].data.array;
-  } else {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching run API request. function string has wrong type");
+  if (calltable_add(&record, timeout) == -1) {
+    error_set_response(error, RUN_TOO_MANY_CALLS);
     goto end;
   }
 
-  callid = (uint64_t) randommod(281474976710656LL);
+  callid = record.callid;
   LOG_VERBOSE(VERBOSE_LEVEL_1, "generated callid %lu\n", callid);
-  hashmap_put(uint64_t, ptr_t)(callids, callid, pluginkey);
 
-  if (api_run(targetpluginkey, function_name, callid, runargs, error) == -1) {
-    if (false == error->isset)
-      error_set(error, API_ERROR_TYPE_VALIDATION,
-         "Error executing run API request.");
+  if (!(reply = deferred_reply_new(con_id, msgid))) {
+    calltable_release(callid, NULL, NULL);
+    error_set_response(error, RUN_FAILED);
     goto end;
   }
 
-  ADD(rv, UINTEGER_OBJ(callid));
-  ret = ARRAY_OBJ(rv);
+  /* answered with the [callid] ack once the target plugin accepted the call */
+  if (api_run(targetpluginkey, function_name, callid, runargs, timeout,
+      run_reply_cb, reply, error) == -1) {
+    calltable_release(callid, NULL, NULL);
+    FREE(reply);
+    if (false == error->isset)
+      error_set_response(error, RUN_FAILED);
+    goto end;
+  }
 
 end:
   return ret;
 }
 
-object handle_result(UNUSED(uint64_t con_id), UNUSED(uint64_t msgid),
-    UNUSED(char *pluginkey), array args, struct api_error *error)
+object handle_result(uint64_t con_id, uint64_t msgid, char *pluginkey,
+    array args, struct api_error *error)
 {
-  array rv = ARRAY_DICT_INIT;
-  array meta = ARRAY_DICT_INIT;
-  array resultargs = ARRAY_DICT_INIT;
-  object ret = ARRAY_OBJ(rv);
+  array resultargs;
+  object ret = NIL;
   uint64_t callid;
-
-  char * targetpluginkey;
+  struct schema_error schema_error;
+  struct deferred_reply *reply;
+  struct call_record record;
 
   if (!error)
     goto end;
 
-  /* check params size */
-  if (args.size != 2) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching result API request. Invalid params size");
+  /* args = [[callid], resultargs] */
+  if (schema_validate(SCHEMA_RESULT, args, &schema_error) == -1) {
+    schema_error_set(error, &schema_error);
     goto end;
   }
 
-  if (args.items[0].type == OBJECT_TYPE_ARRAY)
-    meta = args.items[0].data.array;
-  else {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching result API request. meta params has wrong type");
-    goto end;
-  }
+  callid = args.items[0].data.array.items[0].data.uinteger;
+  resultargs = args.items[1].data.array;
 
-  /* meta = [callid]*/
-  if (meta.size != 1) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching result API request. Invalid meta params size");
+  /* only the plugin running the call may deliver its result */
+  if (!calltable_lookup(callid, &record) ||
+      strcmp(record.target, pluginkey) != 0) {
+    error_set_response(error, RESULT_UNKNOWN_CALLID);
     goto end;
   }
 
-  /* extract meta information */
-  if (meta.items[0].type == OBJECT_TYPE_UINT) {
-    callid = meta.items[0].data.uinteger;
-  } else {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching result API request. meta elements have wrong type");
+  if (!(reply = deferred_reply_new(con_id, msgid))) {
+    error_set_response(error, RESULT_FAILED);
     goto end;
   }
 
-  if (args.items[1].type == OBJECT_TYPE_ARRAY) {
-    resultargs = args.items[1].data.array;
-  } else {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching result API request. function string has wrong type");
+  /* the callid is released once the result was delivered */
+  if (api_result(record.caller_id, record.caller_shard, callid, resultargs,
+      call_timeout, result_reply_cb, reply, error) == -1) {
+    FREE(reply);
+    if (false == error->isset)
+      error_set_response(error, RESULT_FAILED);
     goto end;
   }
 
-  targetpluginkey = hashmap_get(uint64_t, ptr_t)(callids, callid);
+end:
+  return ret;
+}
+
+/*
+ * Dispatch a cancel message. The call is forgotten at once and the target
+ * plugin is told to abandon it.
+ */
+object handle_cancel(UNUSED(uint64_t con_id), UNUSED(uint64_t msgid),
+    char *pluginkey, array args, struct api_error *error)
+{
+  array rv = ARRAY_DICT_INIT;
+  object ret = NIL;
+  uint64_t callid;
+  struct schema_error schema_error;
+  struct api_error cancel_error = ERROR_INIT;
+  struct call_record record;
+
+  if (!error)
+    goto end;
 
-  if (!targetpluginkey) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-      "Failed to find target's key associated with given callid.");
+  /* args = [[callid]] */
+  if (schema_validate(SCHEMA_CANCEL, args, &schema_error) == -1) {
+    schema_error_set(error, &schema_error);
     goto end;
   }
 
-  if (api_result(targetpluginkey, callid, resultargs, error) == -1) {
-    if (false == error->isset)
-      error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error executing result API request.");
+  callid = args.items[0].data.array.items[0].data.uinteger;
+
+  /* plugins may only cancel their own calls */
+  if (!calltable_release(callid, pluginkey, &record)) {
+    error_set_response(error, CANCEL_UNKNOWN_CALLID);
     goto end;
   }
 
-  hashmap_del(uint64_t, ptr_t)(callids, callid);
+  if (api_cancel(record.target, callid, call_timeout, &cancel_error) == -1)
+    LOG_VERBOSE(VERBOSE_LEVEL_0, "cancel of call %lu not forwarded: %s\n",
+        callid, api_error_message(&cancel_error));
 
   ADD(rv, UINTEGER_OBJ(callid));
   ret = ARRAY_OBJ(rv);
@@ -322,42 +332,24 @@ end:
   return ret;
 }
 
-
 object handle_broadcast(UNUSED(uint64_t con_id), UNUSED(uint64_t msgid),
     UNUSED(char *pluginkey), array args, struct api_error *error)
 {
   array rv = ARRAY_DICT_INIT;
-  array eventargs = ARRAY_DICT_INIT;
   object ret = ARRAY_OBJ(rv);
-  string eventname = STRING_INIT;
+  struct schema_error schema_error;
 
   if (!error)
     goto end;
 
-  /* check params size */
-  if (args.size != 2) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching broadcast API request. Invalid params size");
+  /* args = [eventname, eventargs] */
+  if (schema_validate(SCHEMA_BROADCAST, args, &schema_error) == -1) {
+    schema_error_set(error, &schema_error);
     goto end;
   }
 
-  if (args.items[0].type == OBJECT_TYPE_STR)
-    eventname = args.items[0].data.string;
-  else {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching broadcast API request. event name has wrong type");
-    goto end;
-  }
-
-  if (args.items[1].type == OBJECT_TYPE_ARRAY)
-    eventargs = args.items[1].data.array;
-  else {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching broadcast API request. event args has wrong type");
-    goto end;
-  }
-
-  if (api_broadcast(eventname, eventargs, error) == -1) {
+  if (api_broadcast(args.items[0].data.string, args.items[1].data.array,
+      error) == -1) {
     if (false == error->isset)
       error_set(error, API_ERROR_TYPE_VALIDATION,
         "Error executing broadcast API request.");
@@ -374,30 +366,21 @@ object handle_subscribe(uint64_t con_id, UNUSED(uint64_t msgid),
 {
   array rv = ARRAY_DICT_INIT;
   object ret = ARRAY_OBJ(rv);
-  string eventname = STRING_INIT;
+  struct schema_error schema_error;
 
   if (!error)
     goto end;
 
-  /* check params size */
-  if (args.size != 1) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching broadcast API request. Invalid params size");
+  /* args = [eventname] */
+  if (schema_validate(SCHEMA_SUBSCRIBE, args, &schema_error) == -1) {
+    schema_error_set(error, &schema_error);
     goto end;
   }
 
-  if (args.items[0].type == OBJECT_TYPE_STR)
-    eventname = args.items[0].data.string;
-  else {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching broadcast API request. event name has wrong type");
-    goto end;
-  }
-
-  if (api_subscribe(con_id, eventname, error) == -1) {
+  if (api_subscribe(con_id, args.items[0].data.string, error) == -1) {
     if (false == error->isset)
       error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error executing broadcast API request.");
+        "Error executing subscribe API request.");
     goto end;
   }
 
@@ -410,30 +393,21 @@ object handle_unsubscribe(uint64_t con_id, UNUSED(uint64_t msgid),
 {
   array rv = ARRAY_DICT_INIT;
   object ret = ARRAY_OBJ(rv);
-  string eventname = STRING_INIT;
+  struct schema_error schema_error;
 
   if (!error)
     goto end;
 
-  /* check params size */
-  if (args.size != 1) {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching broadcast API request. Invalid params size");
-    goto end;
-  }
-
-  if (args.items[0].type == OBJECT_TYPE_STR)
-    eventname = args.items[0].data.string;
-  else {
-    error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error dispatching broadcast API request. event name has wrong type");
+  /* args = [eventname] */
+  if (schema_validate(SCHEMA_UNSUBSCRIBE, args, &schema_error) == -1) {
+    schema_error_set(error, &schema_error);
     goto end;
   }
 
-  if (api_unsubscribe(con_id, eventname, error) == -1) {
+  if (api_unsubscribe(con_id, args.items[0].data.string, error) == -1) {
     if (false == error->isset)
       error_set(error, API_ERROR_TYPE_VALIDATION,
-        "Error executing broadcast API request.");
+        "Error executing unsubscribe API request.");
     goto end;
   }
 
@@ -453,11 +427,15 @@ dispatch_info dispatch_table_get(string method)
   return (hashmap_get(string, dispatch_info)(dispatch_table, method));
 }
 
+void dispatch_set_call_timeout(uint32_t timeout)
+{
+  call_timeout = timeout;
+}
+
 int dispatch_teardown(void)
 {
   hashmap_free(string, dispatch_info)(dispatch_table);
-
-  hashmap_free(uint64_t, ptr_t)(callids);
+  calltable_teardown();
 
   return (0);
 }
@@ -479,33 +457,42 @@ dispatch_info msgpack_rpc_get_handler_for(const char *name, size_t name_len)
 int dispatch_table_init(void)
 {
   dispatch_info register_info = {.func = handle_register, .async = false,
+      .schema = SCHEMA_REGISTER, .offload = true,
       .name = (string) {.str = "register", .length = sizeof("register") - 1}};
   dispatch_info run_info = {.func = handle_run, .async = false,
+      .schema = SCHEMA_RUN, .deferred = true,
       .name = (string) {.str = "run", .length = sizeof("run") - 1}};
   dispatch_info result_info = {.func = handle_result, .async = false,
+      .schema = SCHEMA_RESULT, .deferred = true,
       .name = (string) {.str = "result", .length = sizeof("result") - 1,}};
   dispatch_info broadcast_info = {.func = handle_broadcast, .async = true,
+      .schema = SCHEMA_BROADCAST,
       .name = (string) {.str = "broadcast", .length = sizeof("broadcast") - 1,}};
   dispatch_info subscribe_info = {.func = handle_subscribe, .async = false,
+      .schema = SCHEMA_SUBSCRIBE,
       .name = (string) {.str = "subscribe", .length = sizeof("subscribe") - 1,}};
+  dispatch_info cancel_info = {.func = handle_cancel, .async = false,
+      .schema = SCHEMA_CANCEL,
+      .name = (string) {.str = "cancel", .length = sizeof("cancel") - 1,}};
   dispatch_info unsubscribe_info = {.func = handle_unsubscribe, .async = false,
+      .schema = SCHEMA_UNSUBSCRIBE,
       .name = (string) {.str = "unsubscribe", .length = sizeof("unsubscribe") - 1,}};
 
 
-  msgpack_sbuffer_init(&sbuf);
-
   dispatch_table = hashmap_new(string, dispatch_info)();
-  callids = hashmap_new(uint64_t, ptr_t)();
 
-  if (!dispatch_table || !callids)
+  if (!dispatch_table)
     return (-1);
 
+  calltable_init(run_call_expired);
+
   dispatch_table_put(register_info.name, register_info);
   dispatch_table_put(run_info.name, run_info);
   dispatch_table_put(result_info.name, result_info);
   dispatch_table_put(broadcast_info.name, broadcast_info);
   dispatch_table_put(subscribe_info.name, subscribe_info);
   dispatch_table_put(unsubscribe_info.name, unsubscribe_info);
+  dispatch_table_put(cancel_info.name, cancel_info);
 
   return (0);
 }
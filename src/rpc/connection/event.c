@@ -31,35 +31,71 @@
 
 #include "rpc/connection/event.h"
 #include <stdbool.h>    // for bool, false, true
-#include <stddef.h>     // for NULL
+#include <stddef.h>     // for NULL, size_t
+#include <uv.h>         // for uv_hrtime
+#include "kvec.h"       // for kvec_t, kv_push, kv_A, kv_size, kv_destroy
 #include "queue.h"      // for QUEUE_REMOVE, QUEUE, QUEUE_EMPTY, QUEUE_INSER...
-#include "sb-common.h"  // for sbassert, FREE, MALLOC
+#include "sb-common.h"  // for sbassert, FREE, MALLOC, MALLOC_ARRAY
+
+/* number of items allocated at once when a slab runs empty */
+#define MULTIQUEUE_SLAB_SIZE 64
+/* events a queue may run per round of multiqueue_process_events_fair() */
+#define MULTIQUEUE_DEFAULT_QUANTUM 4
 
 typedef struct multiqueue_item multiqueueitem;
 
-struct multiqueue_item {
-  union {
-    multiqueue *queue;
-    struct {
-      event event;
-      multiqueueitem *parent;
-    } item;
-  } data;
-  bool link;  // true: current item is just a link to a node in a child queue
+typedef struct {
   QUEUE node;
+  multiqueueitem *item;
+} multiqueuenode;
+
+/*
+ * An item carries the event by value and both of its queue nodes, so
+ * queuing an event into a child queue needs no allocation for the link in
+ * the parent queue. Items come from a slab owned by the root queue and are
+ * recycled through its freelist.
+ */
+struct multiqueue_item {
+  event event;
+  multiqueue *queue;     // the queue the event was put into
+  multiqueuenode node;   // node in queue
+  multiqueuenode link;   // node in queue->parent, or in queue->own
+  multiqueueitem *next;  // next free item of the slab
+  uint64_t enqueued;     // uv_hrtime() of the put
 };
 
+/*
+ * Besides the FIFO over all of its events, a parent keeps the ring of
+ * queues with pending events for multiqueue_process_events_fair(). The
+ * parent itself is a member of the ring for the events put into it
+ * directly, which are linked in its own list.
+ */
 struct multiqueue {
   multiqueue *parent;
   QUEUE headtail;
   put_callback put_cb;
   void *data;
+  /* item slab, only used by parent queues and shared with their children */
+  multiqueueitem *freelist;
+  kvec_t(multiqueueitem *) slabs;
+  QUEUE own;             // events put into a parent queue itself
+  QUEUE active;          // ring of queues with pending events
+  QUEUE active_node;     // node in the ring of the parent
+  bool is_active;
+  size_t quantum;
+  size_t deficit;
+  multiqueue_stats stats;
 };
 
 static multiqueue *multiqueue_new(multiqueue *parent, put_callback put_cb, void *data);
 static event multiqueue_remove(multiqueue *this);
 static void multiqueue_push(multiqueue *this, event e);
-static multiqueueitem *multiqueue_node_data(QUEUE *q);
+static multiqueueitem *multiqueue_item_get(multiqueue *this);
+static void multiqueue_item_put(multiqueueitem *item);
+static void multiqueue_item_unlink(multiqueueitem *item);
+static event multiqueue_take(multiqueueitem *item);
+static void multiqueue_activate(multiqueue *this);
+static void multiqueue_deactivate(multiqueue *this);
 
 static event NILEVENT = { .handler = NULL, .argv = {NULL} };
 
@@ -82,23 +118,39 @@ static multiqueue *multiqueue_new(multiqueue *parent, put_callback put_cb,
   rv->parent = parent;
   rv->put_cb = put_cb;
   rv->data = data;
+  rv->freelist = NULL;
+  kv_init(rv->slabs);
+  QUEUE_INIT(&rv->own);
+  QUEUE_INIT(&rv->active);
+  QUEUE_INIT(&rv->active_node);
+  rv->is_active = false;
+  rv->quantum = MULTIQUEUE_DEFAULT_QUANTUM;
+  rv->deficit = 0;
+  rv->stats = (multiqueue_stats) {0, 0, 0, 0, 0};
   return rv;
 }
 
+/*
+ * Children must be freed before their parent, since their items live in
+ * the slab of the parent.
+ */
 void multiqueue_free(multiqueue *this)
 {
   sbassert(this);
   while (!QUEUE_EMPTY(&this->headtail)) {
     QUEUE *q = QUEUE_HEAD(&this->headtail);
-    multiqueueitem *item = multiqueue_node_data(q);
-    if (this->parent) {
-      QUEUE_REMOVE(&item->data.item.parent->node);
-      FREE(item->data.item.parent);
-    }
-    QUEUE_REMOVE(q);
-    FREE(item);
+    multiqueueitem *item = QUEUE_DATA(q, multiqueuenode, node)->item;
+    multiqueue_item_unlink(item);
+    multiqueue_item_put(item);
+  }
+
+  multiqueue_deactivate(this);
+
+  for (size_t i = 0; i < kv_size(this->slabs); i++) {
+    FREE(kv_A(this->slabs, i));
   }
 
+  kv_destroy(this->slabs);
   FREE(this);
 }
 
@@ -127,6 +179,79 @@ void multiqueue_process_events(multiqueue *this)
   }
 }
 
+/*
+ * Deficit round robin over the queues of a parent: every queue with pending
+ * events runs up to its quantum of events per round, so a queue flooded with
+ * events can not starve the others. At most `budget` events run per call.
+ *
+ * @return number of events processed
+ */
+size_t multiqueue_process_events_fair(multiqueue *this, size_t budget)
+{
+  size_t done = 0;
+
+  sbassert(this);
+
+  if (this->parent) {
+    for (; done < budget && !multiqueue_empty(this); done++) {
+      event e = multiqueue_remove(this);
+      if (e.handler) {
+        e.handler(e.argv);
+      }
+    }
+
+    return done;
+  }
+
+  while (done < budget && !QUEUE_EMPTY(&this->active)) {
+    multiqueue *q = QUEUE_DATA(QUEUE_HEAD(&this->active), multiqueue,
+        active_node);
+    QUEUE *pending = q == this ? &this->own : &q->headtail;
+
+    /* emptied through multiqueue_get() since it was activated */
+    if (QUEUE_EMPTY(pending)) {
+      multiqueue_deactivate(q);
+      continue;
+    }
+
+    if (!q->deficit) {
+      q->deficit = q->quantum;
+    }
+
+    multiqueueitem *item = QUEUE_DATA(QUEUE_HEAD(pending), multiqueuenode,
+        node)->item;
+    event e = multiqueue_take(item);
+
+    /* done with q before the handler runs, it may free q */
+    if (QUEUE_EMPTY(pending)) {
+      multiqueue_deactivate(q);
+    } else if (!--q->deficit) {
+      QUEUE_REMOVE(&q->active_node);
+      QUEUE_INSERT_TAIL(&this->active, &q->active_node);
+    }
+
+    done++;
+
+    if (e.handler) {
+      e.handler(e.argv);
+    }
+  }
+
+  return done;
+}
+
+void multiqueue_set_quantum(multiqueue *this, size_t quantum)
+{
+  sbassert(this && quantum > 0);
+  this->quantum = quantum;
+}
+
+const multiqueue_stats *multiqueue_get_stats(multiqueue *this)
+{
+  sbassert(this);
+  return &this->stats;
+}
+
 bool multiqueue_empty(multiqueue *this)
 {
   sbassert(this);
@@ -136,6 +261,7 @@ bool multiqueue_empty(multiqueue *this)
 void multiqueue_replace_parent(multiqueue *this, multiqueue *new_parent)
 {
   sbassert(multiqueue_empty(this));
+  multiqueue_deactivate(this);
   this->parent = new_parent;
 }
 
@@ -143,50 +269,112 @@ static event multiqueue_remove(multiqueue *this)
 {
   sbassert(!multiqueue_empty(this));
   QUEUE *h = QUEUE_HEAD(&this->headtail);
-  QUEUE_REMOVE(h);
-  multiqueueitem *item = multiqueue_node_data(h);
-  event rv;
-
-  if (item->link) {
-    sbassert(!this->parent);
-    // remove the next node in the linked queue
-    multiqueue *linked = item->data.queue;
-    sbassert(!multiqueue_empty(linked));
-    multiqueueitem *child =
-      multiqueue_node_data(QUEUE_HEAD(&linked->headtail));
-    QUEUE_REMOVE(&child->node);
-    rv = child->data.item.event;
-    FREE(child);
-  } else {
-    if (this->parent) {
-      // remove the corresponding link node in the parent queue
-      QUEUE_REMOVE(&item->data.item.parent->node);
-      FREE(item->data.item.parent);
-    }
-    rv = item->data.item.event;
+
+  /* the head of a parent may be a link, the child's head is the same item */
+  return multiqueue_take(QUEUE_DATA(h, multiqueuenode, node)->item);
+}
+
+static event multiqueue_take(multiqueueitem *item)
+{
+  multiqueue_stats *stats = &item->queue->stats;
+  uint64_t wait = uv_hrtime() - item->enqueued;
+  event rv = item->event;
+
+  stats->processed++;
+  stats->wait_total += wait;
+  if (wait > stats->wait_max) {
+    stats->wait_max = wait;
   }
 
-  FREE(item);
+  multiqueue_item_unlink(item);
+  multiqueue_item_put(item);
+
   return rv;
 }
 
 static void multiqueue_push(multiqueue *this, event e)
 {
-  multiqueueitem *item = MALLOC(multiqueueitem);
-  item->link = false;
-  item->data.item.event = e;
-  QUEUE_INSERT_TAIL(&this->headtail, &item->node);
+  multiqueueitem *item = multiqueue_item_get(this);
+  item->event = e;
+  item->queue = this;
+  item->enqueued = uv_hrtime();
+  item->node.item = item;
+  item->link.item = item;
+  QUEUE_INSERT_TAIL(&this->headtail, &item->node.node);
 
   if (this->parent) {
     // push link node to the parent queue
-    item->data.item.parent = MALLOC(multiqueueitem);
-    item->data.item.parent->link = true;
-    item->data.item.parent->data.queue = this;
-    QUEUE_INSERT_TAIL(&this->parent->headtail, &item->data.item.parent->node);
+    QUEUE_INSERT_TAIL(&this->parent->headtail, &item->link.node);
+    this->parent->stats.depth++;
+  } else {
+    QUEUE_INSERT_TAIL(&this->own, &item->link.node);
+  }
+
+  if (++this->stats.depth > this->stats.max_depth) {
+    this->stats.max_depth = this->stats.depth;
+  }
+
+  multiqueue_activate(this);
+}
+
+static void multiqueue_activate(multiqueue *this)
+{
+  multiqueue *root = this->parent ? this->parent : this;
+
+  if (!this->is_active) {
+    this->is_active = true;
+    this->deficit = 0;
+    QUEUE_INSERT_TAIL(&root->active, &this->active_node);
   }
 }
 
-static multiqueueitem *multiqueue_node_data(QUEUE *q)
+static void multiqueue_deactivate(multiqueue *this)
 {
-  return QUEUE_DATA(q, multiqueueitem, node);
+  if (this->is_active) {
+    this->is_active = false;
+    this->deficit = 0;
+    QUEUE_REMOVE(&this->active_node);
+  }
+}
+
+static multiqueueitem *multiqueue_item_get(multiqueue *this)
+{
+  multiqueue *root = this->parent ? this->parent : this;
+  multiqueueitem *item;
+
+  if (!root->freelist) {
+    multiqueueitem *slab = MALLOC_ARRAY(MULTIQUEUE_SLAB_SIZE, multiqueueitem);
+    sbassert(slab);
+    kv_push(root->slabs, slab);
+
+    for (size_t i = 0; i < MULTIQUEUE_SLAB_SIZE; i++) {
+      slab[i].next = root->freelist;
+      root->freelist = &slab[i];
+    }
+  }
+
+  item = root->freelist;
+  root->freelist = item->next;
+
+  return item;
+}
+
+static void multiqueue_item_put(multiqueueitem *item)
+{
+  multiqueue *root = item->queue->parent ? item->queue->parent : item->queue;
+
+  item->next = root->freelist;
+  root->freelist = item;
+}
+
+static void multiqueue_item_unlink(multiqueueitem *item)
+{
+  QUEUE_REMOVE(&item->node.node);
+  QUEUE_REMOVE(&item->link.node);
+
+  item->queue->stats.depth--;
+
+  if (item->queue->parent) {
+    item->queue->parent->stats.depth--;
+  }
 }
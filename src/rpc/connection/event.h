@@ -33,18 +33,32 @@
 #pragma once
 
 #include <stdbool.h>     // for bool
+#include <stddef.h>      // for size_t
+#include <stdint.h>      // for uint64_t
 #include "rpc/connection/event-defs.h"
 
 
 typedef struct multiqueue multiqueue;
 typedef void (*put_callback)(multiqueue *multiq, void *data);
 
+/* queue metrics, times in nanoseconds */
+typedef struct {
+  size_t depth;          // events queued right now
+  size_t max_depth;
+  uint64_t processed;    // events taken from the queue
+  uint64_t wait_total;   // time the processed events spent queued
+  uint64_t wait_max;
+} multiqueue_stats;
+
 multiqueue *multiqueue_new_parent(put_callback put_cb, void *data);
 multiqueue *multiqueue_new_child(multiqueue *parent);
 void multiqueue_free(multiqueue *this);
 event multiqueue_get(multiqueue *this);
 void multiqueue_put_event(multiqueue *this, event e);
 void multiqueue_process_events(multiqueue *this);
+size_t multiqueue_process_events_fair(multiqueue *this, size_t budget);
+void multiqueue_set_quantum(multiqueue *this, size_t quantum);
+const multiqueue_stats *multiqueue_get_stats(multiqueue *this);
 bool multiqueue_empty(multiqueue *this);
 void multiqueue_replace_parent(multiqueue *this, multiqueue *new_parent);
 
@@ -0,0 +1,122 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>                     // for NULL
+#ifdef __linux__
+#include <bsd/string.h>                 // for strlcpy
+#endif
+#include "rpc/connection/instance.h"
+#include "sb-common.h"                  // for MALLOC, FREE
+
+STATIC uint64_t instance_load(struct connection *con);
+
+/* the expected wait for an answer of the instance */
+STATIC uint64_t instance_load(struct connection *con)
+{
+  uint64_t latency = con->latency ? con->latency : INSTANCE_DEFAULT_LATENCY;
+
+  return (con->pending_requests + 1) * latency;
+}
+
+instance_group *instance_group_new(const char *pluginkey)
+{
+  instance_group *group = MALLOC(instance_group);
+
+  if (!group)
+    return NULL;
+
+  strlcpy(group->pluginkey, pluginkey, sizeof(group->pluginkey));
+  kv_init(group->members);
+  group->routed = 0;
+  group->next = 0;
+
+  return group;
+}
+
+void instance_group_free(instance_group *group)
+{
+  kv_destroy(group->members);
+  FREE(group);
+}
+
+void instance_group_add(instance_group *group, struct connection *con)
+{
+  kv_push(group->members, con);
+}
+
+bool instance_group_del(instance_group *group, struct connection *con)
+{
+  size_t size = kv_size(group->members);
+
+  for (size_t i = 0; i < size; i++) {
+    if (kv_A(group->members, i) == con) {
+      kv_A(group->members, i) = kv_A(group->members, size - 1);
+      kv_size(group->members)--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool instance_group_has(instance_group *group, struct connection *con)
+{
+  for (size_t i = 0; i < kv_size(group->members); i++) {
+    if (kv_A(group->members, i) == con)
+      return true;
+  }
+
+  return false;
+}
+
+struct connection *instance_group_pick(instance_group *group)
+{
+  size_t size = kv_size(group->members);
+  struct connection *con, *best = NULL;
+  uint64_t load, best_load = UINT64_MAX;
+
+  if (!size)
+    return NULL;
+
+  for (size_t i = 0; i < size; i++) {
+    con = kv_A(group->members, (group->next + i) % size);
+    load = instance_load(con);
+
+    if (load < best_load) {
+      best = con;
+      best_load = load;
+    }
+  }
+
+  group->next = (group->next + 1) % size;
+  best->routed++;
+  group->routed++;
+
+  return best;
+}
+
+void instance_record_latency(struct connection *con, uint64_t latency)
+{
+  if (!con->latency) {
+    con->latency = latency ? latency : 1;
+    return;
+  }
+
+  if (latency > con->latency)
+    con->latency += (latency - con->latency) >> INSTANCE_EWMA_SHIFT;
+  else
+    con->latency -= (con->latency - latency) >> INSTANCE_EWMA_SHIFT;
+}
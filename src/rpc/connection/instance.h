@@ -0,0 +1,59 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>                    // for bool
+#include <stddef.h>                     // for size_t
+#include <stdint.h>                     // for uint64_t
+#include "kvec.h"                       // for kvec_t
+#include "rpc/connection/connection.h"  // for connection
+
+/* latency assumed for an instance that did not answer yet, microseconds */
+#define INSTANCE_DEFAULT_LATENCY 1000
+/* a new latency sample weighs 1 / 2^INSTANCE_EWMA_SHIFT */
+#define INSTANCE_EWMA_SHIFT 3
+
+/*
+ * Connections of a shard registered under the same pluginkey. A request to
+ * the pluginkey goes to the instance with the least expected wait, that is
+ * its requests in flight times its average latency.
+ */
+typedef struct {
+  char pluginkey[PLUGINKEY_STRING_SIZE];
+  kvec_t(struct connection *) members;
+  /* requests routed to the group */
+  uint64_t routed;
+  /* the instance checked first, so equal load is spread round robin */
+  size_t next;
+} instance_group;
+
+instance_group *instance_group_new(const char *pluginkey);
+void instance_group_free(instance_group *group);
+
+void instance_group_add(instance_group *group, struct connection *con);
+
+/** @return false if the connection is no member of the group */
+bool instance_group_del(instance_group *group, struct connection *con);
+
+/** @return true if the connection is a member of the group */
+bool instance_group_has(instance_group *group, struct connection *con);
+
+/** @return the least loaded instance, NULL if the group is empty */
+struct connection *instance_group_pick(instance_group *group);
+
+/** Add the latency of an answered request to the average of the instance. */
+void instance_record_latency(struct connection *con, uint64_t latency);
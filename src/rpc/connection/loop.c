@@ -37,6 +37,7 @@
 
 static void async_cb(uv_async_t *handle);
 static void timer_cb(uv_timer_t *handle);
+static void wheel_cb(uv_timer_t *handle);
 
 void loop_init(UNUSED(loop *loop), UNUSED(void *data))
 {
@@ -53,6 +54,8 @@ void loop_init(UNUSED(loop *loop), UNUSED(void *data))
   uv_signal_init(&loop->uv, &loop->children_watcher);
   uv_timer_init(&loop->uv, &loop->children_kill_timer);
   uv_timer_init(&loop->uv, &loop->poll_timer);
+  uv_timer_init(&loop->uv, &loop->wheel_timer);
+  timerwheel_init(&loop->wheel, uv_now(&loop->uv));
 }
 
 void loop_poll_events(loop *loop, int ms)
@@ -105,6 +108,7 @@ void loop_close(loop *loop, bool wait)
   uv_close((uv_handle_t *)&loop->children_watcher, NULL);
   uv_close((uv_handle_t *)&loop->children_kill_timer, NULL);
   uv_close((uv_handle_t *)&loop->poll_timer, NULL);
+  uv_close((uv_handle_t *)&loop->wheel_timer, NULL);
   uv_close((uv_handle_t *)&loop->async, NULL);
   do {
     uv_run(&loop->uv, wait ? UV_RUN_DEFAULT : UV_RUN_NOWAIT);
@@ -115,6 +119,32 @@ void loop_close(loop *loop, bool wait)
   kl_destroy(WatcherPtr, loop->children);
 }
 
+/*
+ * Start a deadline on the timer wheel of the loop. A single uv timer ticks
+ * the wheel, however many deadlines are pending.
+ */
+void loop_timer_start(loop *loop, wheel_timer *timer, uint64_t timeout,
+    wheel_timer_cb cb, void *data)
+{
+  if (!loop->wheel.count) {
+    /* the idle wheel catches up with the loop time */
+    timerwheel_advance(&loop->wheel, uv_now(&loop->uv));
+    uv_timer_start(&loop->wheel_timer, wheel_cb, TIMERWHEEL_TICK,
+        TIMERWHEEL_TICK);
+  }
+
+  timerwheel_add(&loop->wheel, timer, timeout, cb, data);
+}
+
+void loop_timer_stop(loop *loop, wheel_timer *timer)
+{
+  timerwheel_del(&loop->wheel, timer);
+
+  if (!loop->wheel.count) {
+    uv_timer_stop(&loop->wheel_timer);
+  }
+}
+
 static void async_cb(uv_async_t *handle)
 {
   loop *l = handle->loop->data;
@@ -130,17 +160,13 @@ static void timer_cb(UNUSED(uv_timer_t *handle))
 {
 }
 
-void loop_process_events_until(loop *loop, struct connection *con,
-    struct callinfo *cinfo)
+static void wheel_cb(uv_timer_t *handle)
 {
-  /* push callinfo to connection callinfo vector */
-  kv_push(con->callvector, cinfo);
-  con->pending_requests++;
+  loop *l = handle->loop->data;
 
-  /* wait until requestinfo returned, in time process events */
-  LOOP_PROCESS_EVENTS_UNTIL(loop, con->events, -1, cinfo->returned);
+  timerwheel_advance(&l->wheel, uv_now(handle->loop));
 
-  /* delete last from callinfo vector */
-  (void)kv_pop(con->callvector);
-  con->pending_requests--;
+  if (!l->wheel.count) {
+    uv_timer_stop(handle);
+  }
 }
@@ -41,6 +41,7 @@
 #include "rpc/connection/connection.h"  // for connection
 #include "rpc/connection/event.h"       // for multiqueue, multiqueue_empty
 #include "rpc/connection/event-defs.h"
+#include "rpc/connection/timerwheel.h"  // for timerwheel, wheel_timer
 #include "rpc/sb-rpc.h"                 // for callinfo, event
 
 
@@ -59,6 +60,9 @@ typedef struct loop {
   uv_async_t async;
   uv_mutex_t mutex;
   int recursive;
+  /* deadlines of the loop, ticked by wheel_timer while any is pending */
+  timerwheel wheel;
+  uv_timer_t wheel_timer;
 } loop;
 
 #define CREATE_EVENT(multiqueue, handler, argc, ...) \
@@ -91,10 +95,17 @@ typedef struct loop {
     } \
   } while (0)
 
+/* events run per loop turn before pending I/O is polled again */
+#define LOOP_EVENTS_PER_TURN 64
+
+// Run a fair share of the queued events, poll for I/O once the queue is empty
 #define LOOP_PROCESS_EVENTS(loop, multiqueue, timeout) \
   do { \
     if (multiqueue && !multiqueue_empty(multiqueue)) { \
-      multiqueue_process_events(multiqueue); \
+      multiqueue_process_events_fair(multiqueue, LOOP_EVENTS_PER_TURN); \
+      if (!multiqueue_empty(multiqueue)) { \
+        loop_poll_events(loop, 0); \
+      } \
     } else { \
       loop_poll_events(loop, timeout); \
     } \
@@ -105,5 +116,6 @@ void loop_poll_events(loop *loop, int ms);
 void loop_schedule(loop *loop, event e);
 void loop_on_put(multiqueue *queue, void *data);
 void loop_close(loop *loop, bool wait);
-void loop_process_events_until(loop *loop, struct connection *con,
-    struct callinfo *cinfo);
+void loop_timer_start(loop *loop, wheel_timer *timer, uint64_t timeout,
+    wheel_timer_cb cb, void *data);
+void loop_timer_stop(loop *loop, wheel_timer *timer);
@@ -0,0 +1,117 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rpc/connection/mailbox.h"
+#include <stddef.h>     // for NULL
+#include "sb-common.h"  // for MALLOC, FREE, sbassert
+
+STATIC void mailbox_push(mailbox *mb, mailbox_msg *msg);
+STATIC mailbox_msg *mailbox_pop(mailbox *mb);
+STATIC void mailbox_async_cb(uv_async_t *handle);
+
+int mailbox_init(mailbox *mb, uv_loop_t *uv)
+{
+  mb->stub.next = NULL;
+  mb->head = &mb->stub;
+  mb->tail = &mb->stub;
+  mb->async.data = mb;
+
+  if (uv_async_init(uv, &mb->async, mailbox_async_cb) != 0)
+    return (-1);
+
+  return (0);
+}
+
+void mailbox_close(mailbox *mb)
+{
+  mailbox_msg *msg;
+
+  while ((msg = mailbox_pop(mb)))
+    FREE(msg);
+
+  uv_close((uv_handle_t *)&mb->async, NULL);
+}
+
+void mailbox_post(mailbox *mb, event e)
+{
+  mailbox_msg *msg = MALLOC(mailbox_msg);
+
+  sbassert(msg);
+  msg->event = e;
+  mailbox_push(mb, msg);
+
+  /* wakes the consumer after the message is linked in */
+  uv_async_send(&mb->async);
+}
+
+STATIC void mailbox_push(mailbox *mb, mailbox_msg *msg)
+{
+  mailbox_msg *prev;
+
+  __atomic_store_n(&msg->next, NULL, __ATOMIC_RELAXED);
+  prev = __atomic_exchange_n(&mb->head, msg, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&prev->next, msg, __ATOMIC_RELEASE);
+}
+
+STATIC mailbox_msg *mailbox_pop(mailbox *mb)
+{
+  mailbox_msg *tail = mb->tail;
+  mailbox_msg *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+  if (tail == &mb->stub) {
+    if (!next)
+      return NULL;
+
+    mb->tail = next;
+    tail = next;
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  }
+
+  if (next) {
+    mb->tail = next;
+    return tail;
+  }
+
+  /*
+   * a producer swapped itself in but did not link the message yet, its
+   * uv_async_send() brings us back here once it did
+   */
+  if (tail != __atomic_load_n(&mb->head, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  mailbox_push(mb, &mb->stub);
+  next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+  if (next) {
+    mb->tail = next;
+    return tail;
+  }
+
+  return NULL;
+}
+
+STATIC void mailbox_async_cb(uv_async_t *handle)
+{
+  mailbox *mb = handle->data;
+  mailbox_msg *msg;
+  event e;
+
+  while ((msg = mailbox_pop(mb))) {
+    e = msg->event;
+    FREE(msg);
+    e.handler(e.argv);
+  }
+}
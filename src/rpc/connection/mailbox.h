@@ -0,0 +1,60 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <uv.h>                         // for uv_async_t, uv_loop_t
+#include "rpc/connection/event-defs.h"  // for event
+
+typedef struct mailbox_msg mailbox_msg;
+
+struct mailbox_msg {
+  mailbox_msg *next;
+  event event;
+};
+
+/*
+ * Lock-free queue of events many threads post to and the thread running
+ * the mailbox's loop consumes (intrusive MPSC queue after Dmitry Vyukov).
+ */
+typedef struct {
+  /* most recently posted message, swapped atomically by producers */
+  mailbox_msg *head;
+  /* next message to consume, only touched by the consumer */
+  mailbox_msg *tail;
+  mailbox_msg stub;
+  uv_async_t async;
+} mailbox;
+
+/**
+ * Initialize a mailbox whose events run on `uv`. Must be called from the
+ * thread running `uv`.
+ *
+ * @param mb The mailbox
+ * @param uv The consuming loop
+ * @return 0 on success, -1 otherwise
+ */
+int mailbox_init(mailbox *mb, uv_loop_t *uv);
+
+/**
+ * Drop all undelivered events and close the mailbox.
+ */
+void mailbox_close(mailbox *mb);
+
+/**
+ * Post an event from any thread, it runs on the loop of the mailbox.
+ */
+void mailbox_post(mailbox *mb, event e);
@@ -22,10 +22,11 @@
 #include <netinet/in.h>           // for sockaddr_in
 #include <stddef.h>               // for NULL, size_t
 #include <stdint.h>               // for uint16_t
-#include <sys/socket.h>           // for sockaddr
+#include <sys/socket.h>           // for sockaddr, setsockopt, SO_REUSEPORT
+#include <unistd.h>               // for close
 #include "khash.h"                // for __i, khint32_t
-#include "main.h"                 // for main_loop
 #include "rpc/connection/loop.h"  // for loop
+#include "rpc/connection/shard.h" // for shard_count, shard_loop
 #include "rpc/db/sb-db.h"         // for db_authorized_set_whitelist_all
 #include "rpc/sb-rpc.h"           // for hashmap_cstr_t_ptr_t, hashmap_cstr_...
 #include "sb-common.h"            // for fmt_addr, ::SERVER_TYPE_TCP, LOG_ERROR
@@ -49,7 +50,10 @@ struct server {
   } socket;
 };
 
-static hashmap(cstr_t, ptr_t) *servers = NULL;
+/* every shard keeps its own listeners */
+static __thread hashmap(cstr_t, ptr_t) *servers = NULL;
+
+STATIC int server_tcp_reuseport(struct server *server);
 
 int server_init(void)
 {
@@ -74,6 +78,9 @@ int server_start_tcp(boxaddr *addr, uint16_t port)
 
   server = MALLOC(struct server);
 
+  if (!servers)
+    servers = hashmap_new(cstr_t, ptr_t)();
+
   if (hashmap_has(cstr_t, ptr_t)(servers, fmt_addr(addr))) {
     LOG("Already listening on %s", fmt_addr(addr));
     return (-1);
@@ -87,7 +94,14 @@ int server_start_tcp(boxaddr *addr, uint16_t port)
   box_addr_to_sockaddr(addr, port, &server->socket.tcp.addr,
       sizeof(struct sockaddr_in));
 
-  uv_tcp_init(&main_loop.uv, &server->socket.tcp.handle);
+  uv_tcp_init(&shard_loop()->uv, &server->socket.tcp.handle);
+
+  /* all shards bind the same address, the kernel spreads the connections */
+  if (shard_count() > 1 && server_tcp_reuseport(server) == -1) {
+    LOG_WARNING("Failed to enable SO_REUSEPORT on %s", fmt_addr(addr));
+    return (-1);
+  }
+
   result = uv_tcp_bind(&server->socket.tcp.handle,
       (const struct sockaddr *)&server->socket.tcp.addr, 0);
 
@@ -123,6 +137,9 @@ int server_start_pipe(char *name)
 
   server = MALLOC(struct server);
 
+  if (!servers)
+    servers = hashmap_new(cstr_t, ptr_t)();
+
   if (hashmap_has(cstr_t, ptr_t)(servers, name)) {
     LOG("Already listening on %s", name);
     return (-1);
@@ -139,7 +156,7 @@ int server_start_pipe(char *name)
     return (-1);
   }
 
-  uv_pipe_init(&main_loop.uv, &server->socket.pipe.handle, 0);
+  uv_pipe_init(&shard_loop()->uv, &server->socket.pipe.handle, 0);
   result = uv_pipe_bind(&server->socket.pipe.handle, server->socket.pipe.addr);
 
   if (result) {
@@ -168,6 +185,10 @@ int server_close(void)
 {
   struct server *server;
 
+  /* a shard that never listened has no listeners */
+  if (!servers)
+    return (0);
+
   hashmap_foreach_value(servers, server, {
     if (server->type == SERVER_TYPE_TCP)
       uv_close((uv_handle_t *)&server->socket.tcp.handle, server_free_cb);
@@ -176,6 +197,7 @@ int server_close(void)
   });
 
   hashmap_free(cstr_t, ptr_t)(servers);
+  servers = NULL;
 
   return (0);
 }
@@ -221,9 +243,9 @@ STATIC void connection_cb(uv_stream_t *server_stream, int status)
     return;
 
   if (server->type == SERVER_TYPE_TCP)
-    uv_tcp_init(&main_loop.uv, (uv_tcp_t *)client);
+    uv_tcp_init(server_stream->loop, (uv_tcp_t *)client);
   else
-    uv_pipe_init(&main_loop.uv, (uv_pipe_t *)client, 0);
+    uv_pipe_init(server_stream->loop, (uv_pipe_t *)client, 0);
 
   result = uv_accept(server_stream, client);
 
@@ -262,6 +284,26 @@ STATIC void connection_cb(uv_stream_t *server_stream, int status)
 }
 
 
+STATIC int server_tcp_reuseport(struct server *server)
+{
+  int fd;
+  int on = 1;
+
+  fd = socket(server->socket.tcp.addr.sa_family, SOCK_STREAM, 0);
+
+  if (fd == -1)
+    return (-1);
+
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1 ||
+      uv_tcp_open(&server->socket.tcp.handle, fd) != 0) {
+    close(fd);
+    return (-1);
+  }
+
+  return (0);
+}
+
+
 STATIC void client_free_cb(uv_handle_t *handle)
 {
   FREE(handle);
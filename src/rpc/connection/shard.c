@@ -0,0 +1,316 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rpc/connection/shard.h"
+#ifdef __linux__
+#include <bsd/string.h>                 // for strlcpy
+#endif
+#include <stdlib.h>                     // for abort
+#include <uv.h>                         // for uv_thread_t, uv_rwlock_t
+#include "main.h"                       // for main_loop
+#include "rpc/connection/mailbox.h"     // for mailbox, mailbox_post
+#include "rpc/db/sb-db.h"               // for db_thread_connect
+#include "rpc/sb-rpc.h"                 // for connection_shard_init, PLUGIN...
+
+struct shard {
+  loop *loop;
+  /* loop of the shard thread, shard 0 uses the main loop */
+  loop own_loop;
+  mailbox mailbox;
+  uv_thread_t thread;
+  size_t index;
+  /* set by the shard's own thread, it leaves its loop */
+  bool stop;
+};
+
+struct shard_plugin {
+  char pluginkey[PLUGINKEY_STRING_SIZE];
+  /* connected instances per shard */
+  size_t *instances;
+  size_t total;
+};
+
+struct shard_listen {
+  boxaddr addr;
+  uint16_t port;
+};
+
+STATIC void shard_main(void *arg);
+STATIC void shard_listen_event(void **argv);
+STATIC void shard_stop_event(void **argv);
+STATIC void directory_init(void);
+
+static struct shard *shards = NULL;
+static size_t nshards = 1;
+static uv_sem_t shards_ready;
+
+static __thread size_t self = 0;
+static __thread loop *self_loop = NULL;
+
+/* pluginkey -> shard_plugin, shared by all shards */
+static uv_once_t directory_once = UV_ONCE_INIT;
+static uv_rwlock_t directory_lock;
+static hashmap(cstr_t, ptr_t) *directory = NULL;
+
+int shard_init(size_t count)
+{
+  sbassert(!shards);
+
+  if (count <= 1)
+    return (0);
+
+  shards = CALLOC(count, struct shard);
+
+  if (!shards)
+    return (-1);
+
+  shards[0].loop = &main_loop;
+  shards[0].index = 0;
+
+  if (mailbox_init(&shards[0].mailbox, &main_loop.uv) == -1)
+    return (-1);
+
+  if (uv_sem_init(&shards_ready, 0) != 0)
+    return (-1);
+
+  nshards = count;
+
+  for (size_t i = 1; i < count; i++) {
+    shards[i].index = i;
+    shards[i].loop = &shards[i].own_loop;
+
+    if (uv_thread_create(&shards[i].thread, shard_main, &shards[i]) != 0) {
+      LOG_ERROR("Failed to start shard %zu.", i);
+      return (-1);
+    }
+  }
+
+  /* mailboxes must be up before any shard posts to another one */
+  for (size_t i = 1; i < count; i++)
+    uv_sem_wait(&shards_ready);
+
+  LOG_VERBOSE(VERBOSE_LEVEL_0, "started %zu shards\n", count);
+
+  return (0);
+}
+
+void shard_listen_tcp(boxaddr *addr, uint16_t port)
+{
+  struct shard_listen *listen;
+
+  for (size_t i = 1; i < nshards; i++) {
+    listen = MALLOC(struct shard_listen);
+    sbassert(listen);
+    listen->addr = *addr;
+    listen->port = port;
+    shard_post(i, event_create(1, shard_listen_event, 1, listen));
+  }
+}
+
+void shard_stop(void)
+{
+  if (!shards)
+    return;
+
+  for (size_t i = 1; i < nshards; i++)
+    shard_post(i, event_create(1, shard_stop_event, 0));
+
+  for (size_t i = 1; i < nshards; i++)
+    uv_thread_join(&shards[i].thread);
+
+  mailbox_close(&shards[0].mailbox);
+  uv_sem_destroy(&shards_ready);
+  FREE(shards);
+  nshards = 1;
+
+  LOG_VERBOSE(VERBOSE_LEVEL_0, "stopped shards\n");
+}
+
+size_t shard_count(void)
+{
+  return nshards;
+}
+
+size_t shard_self(void)
+{
+  return self;
+}
+
+loop *shard_loop(void)
+{
+  return self_loop ? self_loop : &main_loop;
+}
+
+void shard_post(size_t index, event e)
+{
+  sbassert(index < nshards && shards);
+  mailbox_post(&shards[index].mailbox, e);
+}
+
+int shard_plugin_add(char *pluginkey, size_t max)
+{
+  struct shard_plugin *plugin;
+  int rv = -1;
+
+  uv_once(&directory_once, directory_init);
+  uv_rwlock_wrlock(&directory_lock);
+
+  plugin = hashmap_get(cstr_t, ptr_t)(directory, pluginkey);
+
+  if (!plugin) {
+    plugin = MALLOC(struct shard_plugin);
+    sbassert(plugin);
+    plugin->instances = CALLOC(nshards, size_t);
+    sbassert(plugin->instances);
+    plugin->total = 0;
+    strlcpy(plugin->pluginkey, pluginkey, sizeof(plugin->pluginkey));
+    hashmap_put(cstr_t, ptr_t)(directory, plugin->pluginkey, plugin);
+  }
+
+  if (plugin->total < max) {
+    plugin->instances[self]++;
+    plugin->total++;
+    rv = 0;
+  }
+
+  uv_rwlock_wrunlock(&directory_lock);
+
+  return rv;
+}
+
+void shard_plugin_del(char *pluginkey)
+{
+  struct shard_plugin *plugin;
+
+  uv_once(&directory_once, directory_init);
+  uv_rwlock_wrlock(&directory_lock);
+
+  plugin = hashmap_get(cstr_t, ptr_t)(directory, pluginkey);
+
+  /* only a shard serving the plugin may remove an instance */
+  if (plugin && plugin->instances[self]) {
+    plugin->instances[self]--;
+
+    if (!--plugin->total) {
+      hashmap_del(cstr_t, ptr_t)(directory, pluginkey);
+      FREE(plugin->instances);
+      FREE(plugin);
+    }
+  }
+
+  uv_rwlock_wrunlock(&directory_lock);
+}
+
+bool shard_plugin_lookup(char *pluginkey, size_t *index)
+{
+  struct shard_plugin *plugin;
+  bool found = false;
+
+  uv_once(&directory_once, directory_init);
+  uv_rwlock_rdlock(&directory_lock);
+
+  plugin = hashmap_get(cstr_t, ptr_t)(directory, pluginkey);
+
+  /* the shard serving most instances has the most capacity */
+  for (size_t i = 0; plugin && i < nshards; i++) {
+    if (plugin->instances[i] && (!found ||
+        plugin->instances[i] > plugin->instances[*index])) {
+      *index = i;
+      found = true;
+    }
+  }
+
+  uv_rwlock_rdunlock(&directory_lock);
+
+  return found;
+}
+
+bool shard_plugin_serves(char *pluginkey, size_t index)
+{
+  struct shard_plugin *plugin;
+  bool serves;
+
+  uv_once(&directory_once, directory_init);
+  uv_rwlock_rdlock(&directory_lock);
+
+  plugin = hashmap_get(cstr_t, ptr_t)(directory, pluginkey);
+  serves = plugin && plugin->instances[index] > 0;
+
+  uv_rwlock_rdunlock(&directory_lock);
+
+  return serves;
+}
+
+STATIC void directory_init(void)
+{
+  uv_rwlock_init(&directory_lock);
+  directory = hashmap_new(cstr_t, ptr_t)();
+}
+
+STATIC void shard_main(void *arg)
+{
+  struct shard *shard = arg;
+
+  self = shard->index;
+  self_loop = shard->loop;
+
+  loop_init(shard->loop, NULL);
+
+  /* db_context() connects again when a connection needs the database */
+  if (db_thread_connect() == -1)
+    LOG_WARNING("Shard %zu failed to connect to database, retrying on use",
+        self);
+
+  if (db_async_connect(&shard->loop->uv) == -1)
+    LOG_WARNING("Shard %zu failed to connect its loop to database", self);
+
+  if (connection_shard_init() == -1 ||
+      mailbox_init(&shard->mailbox, &shard->loop->uv) == -1) {
+    LOG_ERROR("Failed to initialise shard %zu.", self);
+    abort();
+  }
+
+  uv_sem_post(&shards_ready);
+
+  while (!shard->stop) {
+    LOOP_PROCESS_EVENTS_UNTIL(shard->loop, shard->loop->events, 2000,
+        shard->stop);
+  }
+
+  /* replies still pending on the database run before the tables go */
+  connection_shard_close();
+  mailbox_close(&shard->mailbox);
+  loop_close(shard->loop, true);
+  connection_shard_teardown();
+  db_close();
+}
+
+STATIC void shard_stop_event(UNUSED(void **argv))
+{
+  server_close();
+  db_async_close();
+  shards[self].stop = true;
+}
+
+STATIC void shard_listen_event(void **argv)
+{
+  struct shard_listen *listen = argv[0];
+
+  if (server_start_tcp(&listen->addr, listen->port) == -1)
+    LOG_WARNING("Shard %zu failed to listen.", self);
+
+  FREE(listen);
+}
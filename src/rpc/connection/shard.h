@@ -0,0 +1,86 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>                    // for bool
+#include <stddef.h>                     // for size_t
+#include <stdint.h>                     // for uint16_t
+#include "rpc/connection/event-defs.h"  // for event
+#include "rpc/connection/loop.h"        // for loop
+#include "sb-common.h"                  // for boxaddr
+
+/*
+ * A shard is an event loop thread owning its connections. Shard 0 is the
+ * main loop, further shards accept on their own SO_REUSEPORT listener and
+ * keep their own connection tables and database context. Shards talk to
+ * each other only through their mailboxes.
+ */
+
+/**
+ * Start `count - 1` shard threads next to the main loop. Must be called on
+ * the main thread after connection_init().
+ *
+ * @param count Number of shards including the main loop
+ * @return 0 on success, -1 otherwise
+ */
+int shard_init(size_t count);
+
+/**
+ * Let every shard besides the main loop accept connections on addr:port.
+ * The main loop listens through server_start_tcp() as before.
+ */
+void shard_listen_tcp(boxaddr *addr, uint16_t port);
+
+/**
+ * Stop the shard threads started by shard_init(). Every shard closes its
+ * listeners, connections and mailbox, leaves its loop and is joined. Must
+ * be called on the main thread.
+ */
+void shard_stop(void);
+
+/** @return number of shards, 1 unless shard_init() started more */
+size_t shard_count(void);
+
+/** @return index of the shard the calling thread runs */
+size_t shard_self(void);
+
+/** @return the event loop of the calling thread's shard */
+loop *shard_loop(void);
+
+/**
+ * Run an event on the loop of another shard.
+ */
+void shard_post(size_t index, event e);
+
+/**
+ * Record an instance of a plugin connected to the calling shard.
+ *
+ * @param max Number of instances allowed across all shards
+ * @return 0 on success, -1 if `max` instances are connected already
+ */
+int shard_plugin_add(char *pluginkey, size_t max);
+void shard_plugin_del(char *pluginkey);
+
+/**
+ * Look up the shard serving most instances of a plugin.
+ *
+ * @return true if the plugin is connected to any shard
+ */
+bool shard_plugin_lookup(char *pluginkey, size_t *index);
+
+/** @return true if the shard serves an instance of the plugin */
+bool shard_plugin_serves(char *pluginkey, size_t index);
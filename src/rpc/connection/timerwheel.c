@@ -0,0 +1,100 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rpc/connection/timerwheel.h"
+#include "sb-common.h"  // for sbassert
+
+void timerwheel_init(timerwheel *wheel, uint64_t now)
+{
+  for (size_t i = 0; i < TIMERWHEEL_SLOTS; i++) {
+    QUEUE_INIT(&wheel->slots[i]);
+  }
+
+  wheel->time = now;
+  wheel->current = 0;
+  wheel->count = 0;
+}
+
+void timerwheel_add(timerwheel *wheel, wheel_timer *timer, uint64_t timeout,
+    wheel_timer_cb cb, void *data)
+{
+  uint64_t ticks = (timeout + TIMERWHEEL_TICK - 1) / TIMERWHEEL_TICK;
+
+  sbassert(!timer->pending);
+
+  if (ticks == 0)
+    ticks = 1;
+
+  /* the slot is passed the first time after ((ticks - 1) % SLOTS) + 1 ticks */
+  timer->rounds = (ticks - 1) / TIMERWHEEL_SLOTS;
+  timer->cb = cb;
+  timer->data = data;
+  timer->pending = true;
+
+  QUEUE_INSERT_TAIL(
+      &wheel->slots[(wheel->current + ticks) % TIMERWHEEL_SLOTS], &timer->node);
+  wheel->count++;
+}
+
+void timerwheel_del(timerwheel *wheel, wheel_timer *timer)
+{
+  if (!timer->pending)
+    return;
+
+  QUEUE_REMOVE(&timer->node);
+  timer->pending = false;
+  wheel->count--;
+}
+
+void timerwheel_advance(timerwheel *wheel, uint64_t now)
+{
+  QUEUE expired;
+  QUEUE *q, *slot;
+  wheel_timer *timer;
+
+  QUEUE_INIT(&expired);
+
+  while (wheel->time + TIMERWHEEL_TICK <= now) {
+    /* nothing to expire, catch up at once */
+    if (!wheel->count) {
+      wheel->time = now - (now - wheel->time) % TIMERWHEEL_TICK;
+      break;
+    }
+
+    wheel->time += TIMERWHEEL_TICK;
+    wheel->current = (wheel->current + 1) % TIMERWHEEL_SLOTS;
+    slot = &wheel->slots[wheel->current];
+
+    for (q = QUEUE_HEAD(slot); q != slot;) {
+      timer = QUEUE_DATA(q, wheel_timer, node);
+      q = q->next;
+
+      if (timer->rounds) {
+        timer->rounds--;
+      } else {
+        QUEUE_REMOVE(&timer->node);
+        QUEUE_INSERT_TAIL(&expired, &timer->node);
+      }
+    }
+
+    /* a callback may stop any other timer or start new ones */
+    while (!QUEUE_EMPTY(&expired)) {
+      timer = QUEUE_DATA(QUEUE_HEAD(&expired), wheel_timer, node);
+      timerwheel_del(wheel, timer);
+      timer->cb(timer);
+    }
+  }
+}
@@ -0,0 +1,65 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>  // for bool
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for uint64_t
+#include "queue.h"    // for QUEUE
+
+/* resolution of the wheel in milliseconds */
+#define TIMERWHEEL_TICK 100
+#define TIMERWHEEL_SLOTS 256
+
+typedef struct wheel_timer wheel_timer;
+typedef void (*wheel_timer_cb)(wheel_timer *timer);
+
+/* a timer is embedded in the object it expires */
+struct wheel_timer {
+  QUEUE node;
+  uint64_t rounds;  // full turns of the wheel left
+  wheel_timer_cb cb;
+  void *data;
+  bool pending;
+};
+
+/*
+ * Hashed timing wheel: timers are put into the slot their expiry falls in,
+ * so adding and removing a timer is O(1) however many are pending. The
+ * wheel does not keep time itself, its owner advances it.
+ */
+typedef struct {
+  QUEUE slots[TIMERWHEEL_SLOTS];
+  uint64_t time;    // time of the last tick
+  size_t current;   // slot of the last tick
+  size_t count;     // pending timers
+} timerwheel;
+
+void timerwheel_init(timerwheel *wheel, uint64_t now);
+
+/**
+ * Start a timer. It expires within one tick after `timeout` milliseconds
+ * passed since the last tick of the wheel.
+ */
+void timerwheel_add(timerwheel *wheel, wheel_timer *timer, uint64_t timeout,
+    wheel_timer_cb cb, void *data);
+
+/** Stop a timer, nothing happens if it is not pending. */
+void timerwheel_del(timerwheel *wheel, wheel_timer *timer);
+
+/** Run the callbacks of all timers that expired until `now`. */
+void timerwheel_advance(timerwheel *wheel, uint64_t now);
@@ -0,0 +1,314 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>                // for NULL
+#include <string.h>                // for strcmp, strchr
+#include "rpc/connection/topic.h"
+#include "sb-common.h"             // for MALLOC, FREE, box_strdup
+
+typedef kvec_t(char *) topic_levels;
+
+/* a level of the patterns, the path from the root spells the pattern */
+struct topic_node {
+  char *level;
+  struct topic_node *parent;
+  /* level -> topic_node, created with the first child */
+  hashmap(cstr_t, ptr_t) *children;
+  size_t nchildren;
+  /* the pattern ending at this node */
+  topic *topic;
+};
+
+STATIC void topic_free(topic *t);
+STATIC bool is_pattern(const char *name);
+STATIC void split_levels(char *name, topic_levels *out);
+STATIC struct topic_node *node_new(struct topic_node *parent,
+    const char *level);
+STATIC struct topic_node *node_child(struct topic_node *node,
+    const char *level);
+STATIC void node_free(struct topic_node *node);
+STATIC void node_insert(struct topic_node *root, topic *t);
+STATIC void node_remove(struct topic_node *root, topic *t);
+STATIC void node_match(struct topic_node *node, topic_levels *name, size_t i,
+    topic_match_cb cb, void *data);
+
+STATIC void topic_free(topic *t)
+{
+  kv_destroy(t->subscribers);
+  FREE(t->name);
+  FREE(t);
+}
+
+STATIC bool is_pattern(const char *name)
+{
+  return strchr(name, TOPIC_WILDCARD_ONE[0]) ||
+      strchr(name, TOPIC_WILDCARD_REST[0]);
+}
+
+/* cut a copy of the name into its levels, in place */
+STATIC void split_levels(char *name, topic_levels *out)
+{
+  char *sep;
+
+  kv_push(*out, name);
+
+  while ((sep = strchr(name, TOPIC_SEPARATOR))) {
+    *sep = '\0';
+    name = sep + 1;
+    kv_push(*out, name);
+  }
+}
+
+STATIC struct topic_node *node_new(struct topic_node *parent,
+    const char *level)
+{
+  struct topic_node *node = CALLOC(1, struct topic_node);
+
+  sbassert(node);
+  node->parent = parent;
+
+  if (parent) {
+    node->level = box_strdup(level);
+
+    if (!parent->children)
+      parent->children = hashmap_new(cstr_t, ptr_t)();
+
+    hashmap_put(cstr_t, ptr_t)(parent->children, node->level, node);
+    parent->nchildren++;
+  }
+
+  return node;
+}
+
+STATIC struct topic_node *node_child(struct topic_node *node,
+    const char *level)
+{
+  if (!node->nchildren)
+    return NULL;
+
+  return hashmap_get(cstr_t, ptr_t)(node->children, level);
+}
+
+STATIC void node_free(struct topic_node *node)
+{
+  struct topic_node *child;
+
+  if (node->children) {
+    hashmap_foreach_value(node->children, child, {
+      node_free(child);
+    });
+    hashmap_free(cstr_t, ptr_t)(node->children);
+  }
+
+  FREE(node->level);
+  FREE(node);
+}
+
+STATIC void node_insert(struct topic_node *root, topic *t)
+{
+  topic_levels name = KV_INITIAL_VALUE;
+  char *copy = box_strdup(t->name);
+  struct topic_node *node = root, *child;
+
+  split_levels(copy, &name);
+
+  for (size_t i = 0; i < kv_size(name); i++) {
+    if (!(child = node_child(node, kv_A(name, i))))
+      child = node_new(node, kv_A(name, i));
+    node = child;
+  }
+
+  node->topic = t;
+  t->node = node;
+
+  kv_destroy(name);
+  FREE(copy);
+}
+
+/* drop the levels no other pattern runs through */
+STATIC void node_remove(struct topic_node *root, topic *t)
+{
+  struct topic_node *node = t->node, *parent;
+
+  node->topic = NULL;
+  t->node = NULL;
+
+  while (node != root && !node->topic && !node->nchildren) {
+    parent = node->parent;
+    hashmap_del(cstr_t, ptr_t)(parent->children, node->level);
+    parent->nchildren--;
+    node_free(node);
+    node = parent;
+  }
+}
+
+STATIC void node_match(struct topic_node *node, topic_levels *name, size_t i,
+    topic_match_cb cb, void *data)
+{
+  struct topic_node *child;
+  char *level;
+
+  /* a trailing # also matches no level at all */
+  if ((child = node_child(node, TOPIC_WILDCARD_REST)) && child->topic)
+    cb(child->topic, data);
+
+  if (i == kv_size(*name)) {
+    if (node->topic)
+      cb(node->topic, data);
+    return;
+  }
+
+  level = kv_A(*name, i);
+
+  /* the wildcard nodes are only visited once, even for a literal * or # */
+  if (strcmp(level, TOPIC_WILDCARD_REST) != 0 &&
+      (child = node_child(node, level)))
+    node_match(child, name, i + 1, cb, data);
+
+  if (strcmp(level, TOPIC_WILDCARD_ONE) != 0 &&
+      (child = node_child(node, TOPIC_WILDCARD_ONE)))
+    node_match(child, name, i + 1, cb, data);
+}
+
+topic_registry *topic_registry_new(void)
+{
+  topic_registry *registry = MALLOC(topic_registry);
+
+  if (!registry)
+    return NULL;
+
+  if (!(registry->topics = hashmap_new(cstr_t, ptr_t)())) {
+    FREE(registry);
+    return NULL;
+  }
+
+  registry->patterns = node_new(NULL, NULL);
+
+  return registry;
+}
+
+void topic_registry_free(topic_registry *registry)
+{
+  topic *t;
+
+  if (!registry)
+    return;
+
+  hashmap_foreach_value(registry->topics, t, {
+    topic_free(t);
+  });
+
+  hashmap_free(cstr_t, ptr_t)(registry->topics);
+  node_free(registry->patterns);
+  FREE(registry);
+}
+
+topic *topic_get(topic_registry *registry, const char *name)
+{
+  return hashmap_get(cstr_t, ptr_t)(registry->topics, name);
+}
+
+bool topic_pattern_valid(const char *pattern)
+{
+  const char *level = pattern, *end;
+  size_t length;
+
+  for (;;) {
+    end = strchr(level, TOPIC_SEPARATOR);
+    length = end ? (size_t) (end - level) : strlen(level);
+
+    /* a wildcard takes the whole level */
+    if (length != 1 && (memchr(level, TOPIC_WILDCARD_ONE[0], length) ||
+        memchr(level, TOPIC_WILDCARD_REST[0], length)))
+      return false;
+
+    if (!end)
+      return true;
+
+    if (length == 1 && level[0] == TOPIC_WILDCARD_REST[0])
+      return false;
+
+    level = end + 1;
+  }
+}
+
+topic *topic_subscribe(topic_registry *registry, const char *name,
+    void *subscriber)
+{
+  topic *t = hashmap_get(cstr_t, ptr_t)(registry->topics, name);
+
+  if (!t) {
+    t = MALLOC(struct topic);
+    sbassert(t);
+    t->name = box_strdup(name);
+    t->node = NULL;
+    kv_init(t->subscribers);
+    hashmap_put(cstr_t, ptr_t)(registry->topics, t->name, t);
+
+    if (is_pattern(name))
+      node_insert(registry->patterns, t);
+  }
+
+  kv_push(t->subscribers, subscriber);
+
+  return t;
+}
+
+void topic_unsubscribe(topic_registry *registry, topic *t,
+    void *subscriber)
+{
+  size_t size = kv_size(t->subscribers);
+
+  /* the order of the subscribers does not matter */
+  for (size_t i = 0; i < size; i++) {
+    if (kv_A(t->subscribers, i) == subscriber) {
+      kv_A(t->subscribers, i) = kv_A(t->subscribers, size - 1);
+      kv_size(t->subscribers)--;
+      break;
+    }
+  }
+
+  if (kv_size(t->subscribers))
+    return;
+
+  if (t->node)
+    node_remove(registry->patterns, t);
+
+  hashmap_del(cstr_t, ptr_t)(registry->topics, t->name);
+  topic_free(t);
+}
+
+void topic_match(topic_registry *registry, const char *name,
+    topic_match_cb cb, void *data)
+{
+  topic *t = topic_get(registry, name);
+  topic_levels levels = KV_INITIAL_VALUE;
+  char *copy;
+
+  /* a pattern subscribed by its very name is found in the trie */
+  if (t && !t->node)
+    cb(t, data);
+
+  if (!registry->patterns->nchildren)
+    return;
+
+  copy = box_strdup(name);
+  split_levels(copy, &levels);
+  node_match(registry->patterns, &levels, 0, cb, data);
+
+  kv_destroy(levels);
+  FREE(copy);
+}
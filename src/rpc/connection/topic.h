@@ -0,0 +1,83 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>      // for bool
+#include <stddef.h>       // for size_t
+#include "kvec.h"         // for kvec_t
+#include "rpc/sb-rpc.h"   // for hashmap(cstr_t, ptr_t)
+
+/* separates the levels of an event name, as in sensor.room1.temp */
+#define TOPIC_SEPARATOR '.'
+/* matches exactly one level */
+#define TOPIC_WILDCARD_ONE "*"
+/* matches any number of levels, only allowed as the last level */
+#define TOPIC_WILDCARD_REST "#"
+
+/*
+ * Event names and patterns and their subscribers. A broadcast looks its
+ * topic up once and walks the trie of patterns once, then visits only the
+ * subscribers, however many connections there are.
+ */
+typedef struct topic {
+  char *name;
+  kvec_t(void *) subscribers;
+  /* trie node of a pattern, NULL for plain event names */
+  struct topic_node *node;
+} topic;
+
+typedef struct {
+  hashmap(cstr_t, ptr_t) *topics;
+  /* root of the trie of patterns, one level per node */
+  struct topic_node *patterns;
+} topic_registry;
+
+typedef void (*topic_match_cb)(topic *t, void *data);
+
+topic_registry *topic_registry_new(void);
+void topic_registry_free(topic_registry *registry);
+
+/** @return the topic of an event name, NULL if nobody subscribed to it */
+topic *topic_get(topic_registry *registry, const char *name);
+
+/**
+ * @return true if the wildcards of a pattern take whole levels and `#` is
+ *         the last level only
+ */
+bool topic_pattern_valid(const char *pattern);
+
+/**
+ * Add a subscriber to a topic, the topic is created if needed. The
+ * subscriber must not be subscribed to the topic yet. The name must be a
+ * valid pattern.
+ *
+ * @return the topic, its name lives as long as it has subscribers
+ */
+topic *topic_subscribe(topic_registry *registry, const char *name,
+    void *subscriber);
+
+/** Remove a subscriber, the topic is freed along with its last one. */
+void topic_unsubscribe(topic_registry *registry, topic *t,
+    void *subscriber);
+
+/**
+ * Call `cb` for the topic of an event name and every pattern matching it.
+ * The cost grows with the levels of the name and the wildcards on its way
+ * through the trie, not with the number of patterns.
+ */
+void topic_match(topic_registry *registry, const char *name,
+    topic_match_cb cb, void *data);
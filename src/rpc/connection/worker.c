@@ -0,0 +1,143 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rpc/connection/worker.h"
+#include <stdbool.h>               // for bool, false, true
+#include <unistd.h>                // for sysconf, _SC_NPROCESSORS_ONLN
+#include <uv.h>                    // for uv_thread_t, uv_mutex_t, uv_cond_t
+#include "kvec.h"                  // for kvec_t, kv_push, kv_A, kv_size
+#include "rpc/connection/event.h"  // for multiqueue, multiqueue_get
+#include "rpc/db/sb-db.h"          // for db_thread_connect, db_close
+#include "sb-common.h"             // for LOG_ERROR, sbassert
+
+STATIC void worker_main(void *arg);
+
+static struct {
+  bool started;
+  bool stop;
+  uv_mutex_t mutex;
+  uv_cond_t cond;
+  /* submitted events, only accessed with mutex held */
+  multiqueue *jobs;
+  kvec_t(uv_thread_t) threads;
+} pool = {.started = false};
+
+int worker_pool_init(size_t threads)
+{
+  uv_thread_t thread;
+
+  sbassert(!pool.started);
+
+  if (threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (size_t)cpus : 1;
+  }
+
+  if (uv_mutex_init(&pool.mutex) != 0)
+    return (-1);
+
+  if (uv_cond_init(&pool.cond) != 0) {
+    uv_mutex_destroy(&pool.mutex);
+    return (-1);
+  }
+
+  pool.jobs = multiqueue_new_parent(NULL, NULL);
+  pool.stop = false;
+  kv_init(pool.threads);
+
+  for (size_t i = 0; i < threads; i++) {
+    if (uv_thread_create(&thread, worker_main, NULL) != 0) {
+      LOG_WARNING("Failed to start worker thread.");
+      break;
+    }
+
+    kv_push(pool.threads, thread);
+  }
+
+  pool.started = true;
+
+  if (!kv_size(pool.threads)) {
+    worker_pool_teardown();
+    return (-1);
+  }
+
+  LOG_VERBOSE(VERBOSE_LEVEL_0, "started %zu worker threads\n",
+      kv_size(pool.threads));
+
+  return (0);
+}
+
+void worker_pool_teardown(void)
+{
+  if (!pool.started)
+    return;
+
+  uv_mutex_lock(&pool.mutex);
+  pool.stop = true;
+  uv_cond_broadcast(&pool.cond);
+  uv_mutex_unlock(&pool.mutex);
+
+  for (size_t i = 0; i < kv_size(pool.threads); i++) {
+    uv_thread_join(&kv_A(pool.threads, i));
+  }
+
+  kv_destroy(pool.threads);
+  multiqueue_free(pool.jobs);
+  uv_cond_destroy(&pool.cond);
+  uv_mutex_destroy(&pool.mutex);
+  pool.started = false;
+}
+
+void worker_pool_submit(event e)
+{
+  if (!pool.started) {
+    e.handler(e.argv);
+    return;
+  }
+
+  uv_mutex_lock(&pool.mutex);
+  multiqueue_put_event(pool.jobs, e);
+  uv_cond_signal(&pool.cond);
+  uv_mutex_unlock(&pool.mutex);
+}
+
+STATIC void worker_main(UNUSED(void *arg))
+{
+  event e;
+
+  /* db_context() connects again when a job needs the database */
+  if (db_thread_connect() == -1)
+    LOG_WARNING("Worker failed to connect to database, retrying on use");
+
+  for (;;) {
+    uv_mutex_lock(&pool.mutex);
+
+    while (multiqueue_empty(pool.jobs) && !pool.stop)
+      uv_cond_wait(&pool.cond, &pool.mutex);
+
+    if (multiqueue_empty(pool.jobs)) {
+      uv_mutex_unlock(&pool.mutex);
+      break;
+    }
+
+    e = multiqueue_get(pool.jobs);
+    uv_mutex_unlock(&pool.mutex);
+
+    e.handler(e.argv);
+  }
+
+  db_close();
+}
@@ -0,0 +1,43 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>                     // for size_t
+#include "rpc/connection/event-defs.h"  // for event
+
+/**
+ * Start the worker threads offloaded events run on. Every worker connects
+ * to the database on its own.
+ *
+ * @param threads Number of workers, 0 for one per online CPU
+ * @return 0 on success, -1 otherwise
+ */
+int worker_pool_init(size_t threads);
+
+/**
+ * Stop the workers after they finished all submitted events.
+ */
+void worker_pool_teardown(void);
+
+/**
+ * Run an event on the next idle worker. Results are handed back to the
+ * main loop by the event itself through loop_schedule(). Without a started
+ * pool the event runs right away on the calling thread.
+ *
+ * @param e The event to run
+ */
+void worker_pool_submit(event e);
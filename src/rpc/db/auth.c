@@ -15,40 +15,445 @@
  */
 
 #include <hiredis/hiredis.h>
+#include <hiredis/async.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <uv.h>
+#ifdef __linux__
+#include <bsd/string.h>
+#endif
 
 #include "rpc/db/sb-db.h"
+#include "rpc/db/backend.h"
 #include "sb-common.h"
 
 #define DB_AUTH_WHITELIST_ALL_SYM "*"
+/* published by a core that changed the authorized set */
+#define DB_AUTH_CHANNEL "authorized"
+/* prefix of a message carrying the added member */
+#define DB_AUTH_ADDED "sadd:"
+/* sent by servers with keyspace notifications for other writers */
+#define DB_AUTH_KEYSPACE "__keyspace@*__:authorized"
+#define DB_AUTH_MEMBER_SIZE (CLIENTLONGTERMPK_ARRAY_SIZE * 2 + 1)
+#define DB_AUTH_RETRY_MIN 100
+#define DB_AUTH_RETRY_MAX 10000
 
-int db_authorized_add(unsigned char *pluginlongtermpk)
+/*
+ * A copy of the authorized set, so handshakes are authorized without asking
+ * the database. The set is kept on the first server, DB_SHARD_AUTHORIZED.
+ * It is loaded once subscribed to changes of the set. Members other cores
+ * publish are added to it, keyspace events and messages without a member
+ * load it again. Until then, and while the subscription is lost, the
+ * database is asked.
+ */
+static struct {
+  uv_rwlock_t lock;
+  /* member -> member, long-term keys in base16 */
+  hashmap(cstr_t, ptr_t) *members;
+  /* the copy is complete and kept up to date */
+  bool synced;
+} authorized = {.members = NULL, .synced = false};
+static uv_once_t authorized_once = UV_ONCE_INIT;
+
+/* state of the subscription, only touched on its loop */
+static struct {
+  uv_loop_t *loop;
+  redisAsyncContext *sub;
+  uv_timer_t retry;
+  uint64_t delay;
+  /* the set being loaded with SSCAN */
+  hashmap(cstr_t, ptr_t) *loading;
+  bool reload;
+  /* bumped per subscription, a load started before it is dropped */
+  unsigned generation;
+  unsigned loading_generation;
+} subscription = {.loop = NULL, .sub = NULL, .delay = 0, .loading = NULL,
+    .reload = false, .generation = 0, .loading_generation = 0};
+
+STATIC void authorized_init(void);
+STATIC void members_free(hashmap(cstr_t, ptr_t) *members);
+STATIC void member_encode(char *member, const char *value, size_t len);
+STATIC void members_put(hashmap(cstr_t, ptr_t) *members, const char *value,
+    size_t len);
+STATIC int authorized_cached(const char *value, size_t len);
+STATIC void authorized_changed(const char *value, size_t len);
+STATIC void authorized_published(const char *value, size_t len);
+STATIC void authorized_synced(hashmap(cstr_t, ptr_t) *members);
+STATIC void authorized_unsync(void);
+STATIC int scan_reply(redisReply *reply, char *cursor, size_t size);
+STATIC void reload_start(void);
+STATIC void reload_cb(redisAsyncContext *ac, void *r, void *privdata);
+STATIC void subscribe_cb(redisAsyncContext *ac, void *r, void *privdata);
+STATIC void subscribe_lost(const redisAsyncContext *ac);
+STATIC void subscribe_connect_cb(const redisAsyncContext *ac, int status);
+STATIC void subscribe_disconnect_cb(const redisAsyncContext *ac, int status);
+STATIC void subscribe_retry_cb(uv_timer_t *timer);
+STATIC int subscribe_open(void);
+STATIC bool authorized_member(const char *value, size_t len);
+
+STATIC void authorized_init(void)
+{
+  if (uv_rwlock_init(&authorized.lock) != 0)
+    abort();
+
+  authorized.members = hashmap_new(cstr_t, ptr_t)();
+
+  if (!authorized.members)
+    abort();
+}
+
+STATIC void members_free(hashmap(cstr_t, ptr_t) *members)
+{
+  char *member;
+
+  if (!members)
+    return;
+
+  hashmap_foreach_value(members, member, {
+    FREE(member);
+  });
+  hashmap_free(cstr_t, ptr_t)(members);
+}
+
+/* long-term keys are binary, other members such as the symbol are not */
+STATIC void member_encode(char *member, const char *value, size_t len)
+{
+  if (len == CLIENTLONGTERMPK_ARRAY_SIZE)
+    base16_encode(member, DB_AUTH_MEMBER_SIZE, value, len);
+  else
+    strlcpy(member, value, MIN(len + 1, DB_AUTH_MEMBER_SIZE));
+}
+
+STATIC void members_put(hashmap(cstr_t, ptr_t) *members, const char *value,
+    size_t len)
+{
+  char member[DB_AUTH_MEMBER_SIZE];
+  char *copy;
+
+  member_encode(member, value, len);
+
+  if (hashmap_has(cstr_t, ptr_t)(members, member) ||
+      !(copy = box_strdup(member)))
+    return;
+
+  hashmap_put(cstr_t, ptr_t)(members, copy, copy);
+}
+
+/* @return 1 if the member is in the synced copy, 0 if not, -1 unsynced */
+STATIC int authorized_cached(const char *value, size_t len)
+{
+  char member[DB_AUTH_MEMBER_SIZE];
+  int result = -1;
+
+  uv_once(&authorized_once, authorized_init);
+  member_encode(member, value, len);
+
+  uv_rwlock_rdlock(&authorized.lock);
+  if (authorized.synced)
+    result = hashmap_has(cstr_t, ptr_t)(authorized.members, member) ? 1 : 0;
+  uv_rwlock_rdunlock(&authorized.lock);
+
+  return result;
+}
+
+/* a member added by this core is visible before the change is published */
+STATIC void authorized_changed(const char *value, size_t len)
+{
+  uv_once(&authorized_once, authorized_init);
+
+  uv_rwlock_wrlock(&authorized.lock);
+  if (authorized.synced)
+    members_put(authorized.members, value, len);
+  uv_rwlock_wrunlock(&authorized.lock);
+}
+
+/* a set being loaded may have been scanned past the member already */
+STATIC void authorized_published(const char *value, size_t len)
+{
+  if (subscription.loading)
+    members_put(subscription.loading, value, len);
+
+  authorized_changed(value, len);
+}
+
+STATIC void authorized_synced(hashmap(cstr_t, ptr_t) *members)
+{
+  hashmap(cstr_t, ptr_t) *old;
+
+  uv_once(&authorized_once, authorized_init);
+
+  uv_rwlock_wrlock(&authorized.lock);
+  old = authorized.members;
+  authorized.members = members;
+  authorized.synced = true;
+  uv_rwlock_wrunlock(&authorized.lock);
+
+  members_free(old);
+}
+
+STATIC void authorized_unsync(void)
 {
+  uv_once(&authorized_once, authorized_init);
+
+  uv_rwlock_wrlock(&authorized.lock);
+  authorized.synced = false;
+  uv_rwlock_wrunlock(&authorized.lock);
+}
+
+/* @return 1 if the scan is complete, 0 if it goes on at cursor, -1 */
+STATIC int scan_reply(redisReply *reply, char *cursor, size_t size)
+{
+  redisReply *members;
+
+  if (!reply || (reply->type != REDIS_REPLY_ARRAY) ||
+      (reply->elements != 2) ||
+      (reply->element[0]->type != REDIS_REPLY_STRING) ||
+      (reply->element[1]->type != REDIS_REPLY_ARRAY))
+    return (-1);
+
+  members = reply->element[1];
+
+  for (size_t i = 0; i < members->elements; i++) {
+    if (members->element[i]->type == REDIS_REPLY_STRING)
+      members_put(subscription.loading, members->element[i]->str,
+          (size_t) members->element[i]->len);
+  }
+
+  strlcpy(cursor, reply->element[0]->str, size);
+
+  return strcmp(cursor, "0") == 0 ? 1 : 0;
+}
+
+/* loads the set into a new copy, the old one is used meanwhile */
+STATIC void reload_start(void)
+{
+  redisAsyncContext *ac;
   redisReply *reply;
+  char cursor[32] = "0";
+  int done = 0;
 
-  reply = redisCommand(rc, "SADD authorized %b ", pluginlongtermpk, CLIENTLONGTERMPK_ARRAY_SIZE);
+  /* a change while loading is picked up by loading again */
+  if (subscription.loading) {
+    subscription.reload = true;
+    return;
+  }
 
-  if (reply->type == REDIS_REPLY_ERROR) {
-    LOG_WARNING("Redis failed to add string value to plugin: %s", reply->str);
-    freeReplyObject(reply);
+  subscription.reload = false;
+  subscription.loading_generation = subscription.generation;
+  subscription.loading = hashmap_new(cstr_t, ptr_t)();
+
+  if (!subscription.loading)
+    return;
+
+  db_shard_use(DB_SHARD_AUTHORIZED);
+  ac = db_async_context();
+
+  if (ac && (redisAsyncCommand(ac, reload_cb, NULL,
+      "SSCAN authorized 0 COUNT 1000") == REDIS_OK))
+    return;
+
+  /* without an asynchronous context the loop waits once */
+  while (done == 0) {
+    reply = db_command("SSCAN authorized %s COUNT 1000", cursor);
+    done = scan_reply(reply, cursor, sizeof(cursor));
+    if (reply)
+      freeReplyObject(reply);
+  }
+
+  reload_cb(NULL, NULL, done == 1 ? subscription.loading : NULL);
+}
+
+/* an SSCAN reply, or the loaded set passed as privdata */
+STATIC void reload_cb(redisAsyncContext *ac, void *r, void *privdata)
+{
+  char cursor[32];
+  int done = privdata ? 1 : -1;
+
+  if (r)
+    done = scan_reply(r, cursor, sizeof(cursor));
+
+  if ((done == 0) && (redisAsyncCommand(ac, reload_cb, NULL,
+      "SSCAN authorized %s COUNT 1000", cursor) == REDIS_OK))
+    return;
+
+  if ((done == 1) && subscription.sub &&
+      (subscription.loading_generation == subscription.generation)) {
+    authorized_synced(subscription.loading);
+  } else {
+    LOG_WARNING("Failed to load the authorized keys.\n");
+    members_free(subscription.loading);
+  }
+
+  subscription.loading = NULL;
+
+  if (subscription.reload)
+    reload_start();
+}
+
+/* confirmations and messages of the subscription */
+STATIC void subscribe_cb(UNUSED(redisAsyncContext *ac), void *r,
+    UNUSED(void *privdata))
+{
+  redisReply *reply = r, *payload;
+  size_t prefix = strlen(DB_AUTH_ADDED);
+
+  if (!reply || (reply->type != REDIS_REPLY_ARRAY) || (reply->elements < 3) ||
+      (reply->element[0]->type != REDIS_REPLY_STRING))
+    return;
+
+  /* subscribed to both, changes from now on are seen */
+  if (strcmp(reply->element[0]->str, "psubscribe") == 0) {
+    subscription.delay = 0;
+    reload_start();
+  } else if (strcmp(reply->element[0]->str, "message") == 0) {
+    payload = reply->element[2];
+
+    if ((payload->type == REDIS_REPLY_STRING) &&
+        ((size_t) payload->len > prefix) &&
+        (strncmp(payload->str, DB_AUTH_ADDED, prefix) == 0))
+      authorized_published(payload->str + prefix,
+          (size_t) payload->len - prefix);
+    else
+      reload_start();
+  } else if (strcmp(reply->element[0]->str, "pmessage") == 0) {
+    /* keyspace events do not name the member */
+    reload_start();
+  }
+}
+
+STATIC void subscribe_connect_cb(const redisAsyncContext *ac, int status)
+{
+  if (status != REDIS_OK) {
+    LOG_WARNING("Redis subscription failed: %s\n", ac->errstr);
+    subscribe_lost(ac);
+  }
+}
+
+STATIC void subscribe_disconnect_cb(const redisAsyncContext *ac, int status)
+{
+  if (status != REDIS_OK)
+    LOG_WARNING("Redis subscription lost: %s\n", ac->errstr);
+
+  subscribe_lost(ac);
+}
+
+STATIC void subscribe_lost(const redisAsyncContext *ac)
+{
+  if (ac != subscription.sub)
+    return;
+
+  /* changes are missed, handshakes ask the database until subscribed */
+  subscription.sub = NULL;
+  authorized_unsync();
+
+  if (!subscription.loop)
+    return;
+
+  subscription.delay = subscription.delay ?
+      MIN(subscription.delay * 2, DB_AUTH_RETRY_MAX) : DB_AUTH_RETRY_MIN;
+  uv_timer_start(&subscription.retry, subscribe_retry_cb, subscription.delay,
+      0);
+}
+
+STATIC void subscribe_retry_cb(UNUSED(uv_timer_t *timer))
+{
+  if (subscription.loop && !subscription.sub && subscribe_open() == -1) {
+    subscription.delay = MIN(subscription.delay * 2, DB_AUTH_RETRY_MAX);
+    uv_timer_start(&subscription.retry, subscribe_retry_cb,
+        subscription.delay, 0);
+  }
+}
+
+STATIC int subscribe_open(void)
+{
+  db_shard_use(DB_SHARD_AUTHORIZED);
+
+  subscription.sub = db_async_open(subscription.loop, subscribe_connect_cb,
+      subscribe_disconnect_cb);
+
+  if (!subscription.sub)
+    return (-1);
+
+  subscription.generation++;
+
+  if ((redisAsyncCommand(subscription.sub, subscribe_cb, NULL, "SUBSCRIBE "
+      DB_AUTH_CHANNEL) != REDIS_OK) ||
+      (redisAsyncCommand(subscription.sub, subscribe_cb, NULL, "PSUBSCRIBE "
+      DB_AUTH_KEYSPACE) != REDIS_OK)) {
+    redisAsyncDisconnect(subscription.sub);
+    subscription.sub = NULL;
     return (-1);
   }
 
-  freeReplyObject(reply);
+  return (0);
+}
+
+int db_authorized_subscribe(uv_loop_t *loop)
+{
+  if (subscription.loop)
+    return (0);
+
+  if (uv_timer_init(loop, &subscription.retry) != 0)
+    return (-1);
+
+  subscription.loop = loop;
+  subscription.delay = 0;
+
+  if (subscribe_open() == -1) {
+    subscription.delay = DB_AUTH_RETRY_MIN;
+    uv_timer_start(&subscription.retry, subscribe_retry_cb,
+        subscription.delay, 0);
+    return (-1);
+  }
 
   return (0);
 }
 
-bool db_authorized_verify(unsigned char *pluginlongtermpk)
+void db_authorized_unsubscribe(void)
+{
+  redisAsyncContext *sub = subscription.sub;
+
+  if (!subscription.loop)
+    return;
+
+  subscription.loop = NULL;
+  subscription.sub = NULL;
+  uv_close((uv_handle_t *) &subscription.retry, NULL);
+  authorized_unsync();
+
+  if (sub)
+    redisAsyncDisconnect(sub);
+}
+
+bool db_authorized_synced(void)
+{
+  bool synced;
+
+  uv_once(&authorized_once, authorized_init);
+
+  uv_rwlock_rdlock(&authorized.lock);
+  synced = authorized.synced;
+  uv_rwlock_rdunlock(&authorized.lock);
+
+  return synced;
+}
+
+STATIC bool authorized_member(const char *value, size_t len)
 {
   redisReply *reply;
   bool valid = false;
+  int cached = authorized_cached(value, len);
+
+  if (cached != -1)
+    return cached == 1;
 
-  reply = redisCommand(rc, "SISMEMBER authorized %b", pluginlongtermpk,
-    CLIENTLONGTERMPK_ARRAY_SIZE);
+  db_shard_use(DB_SHARD_AUTHORIZED);
+  reply = db_command("SISMEMBER authorized %b", value, len);
+
+  if (!reply)
+    return false;
 
   if (reply->type != REDIS_REPLY_INTEGER)
     LOG_WARNING("Redis failed to query plugin key existence: %s", reply->str);
@@ -60,11 +465,17 @@ bool db_authorized_verify(unsigned char *pluginlongtermpk)
   return valid;
 }
 
-int db_authorized_set_whitelist_all(void)
+int redis_authorized_add(unsigned char *pluginlongtermpk)
 {
   redisReply *reply;
 
-  reply = redisCommand(rc, "SADD authorized %s ", DB_AUTH_WHITELIST_ALL_SYM);
+  db_shard_use(DB_SHARD_AUTHORIZED);
+
+  reply = db_command("SADD authorized %b ", pluginlongtermpk,
+      CLIENTLONGTERMPK_ARRAY_SIZE);
+
+  if (!reply)
+    return (-1);
 
   if (reply->type == REDIS_REPLY_ERROR) {
     LOG_WARNING("Redis failed to add string value to plugin: %s", reply->str);
@@ -74,26 +485,56 @@ int db_authorized_set_whitelist_all(void)
 
   freeReplyObject(reply);
 
+  authorized_changed((char *) pluginlongtermpk, CLIENTLONGTERMPK_ARRAY_SIZE);
+
+  /* other cores add the member to their copy */
+  reply = db_command("PUBLISH " DB_AUTH_CHANNEL " " DB_AUTH_ADDED "%b",
+      pluginlongtermpk, CLIENTLONGTERMPK_ARRAY_SIZE);
+  if (reply)
+    freeReplyObject(reply);
+
   return (0);
+}
 
+bool redis_authorized_verify(unsigned char *pluginlongtermpk)
+{
+  return authorized_member((char *) pluginlongtermpk,
+      CLIENTLONGTERMPK_ARRAY_SIZE);
 }
 
-bool db_authorized_whitelist_all_is_set(void)
+int redis_authorized_set_whitelist_all(void)
 {
   redisReply *reply;
-  bool valid = false;
 
-  reply = redisCommand(rc, "SISMEMBER authorized %s", DB_AUTH_WHITELIST_ALL_SYM);
+  db_shard_use(DB_SHARD_AUTHORIZED);
 
-  if (reply->type != REDIS_REPLY_INTEGER)
-    LOG_WARNING("Redis failed to query plugin key existence: %s", reply->str);
-  else
-    valid = reply->integer == 1;
+  reply = db_command("SADD authorized %s ", DB_AUTH_WHITELIST_ALL_SYM);
+
+  if (!reply)
+    return (-1);
+
+  if (reply->type == REDIS_REPLY_ERROR) {
+    LOG_WARNING("Redis failed to add string value to plugin: %s", reply->str);
+    freeReplyObject(reply);
+    return (-1);
+  }
 
   freeReplyObject(reply);
 
-  return valid;
-}
+  authorized_changed(DB_AUTH_WHITELIST_ALL_SYM,
+      strlen(DB_AUTH_WHITELIST_ALL_SYM));
+
+  reply = db_command("PUBLISH " DB_AUTH_CHANNEL " " DB_AUTH_ADDED "%s",
+      DB_AUTH_WHITELIST_ALL_SYM);
+  if (reply)
+    freeReplyObject(reply);
 
+  return (0);
 
+}
 
+bool redis_authorized_whitelist_all_is_set(void)
+{
+  return authorized_member(DB_AUTH_WHITELIST_ALL_SYM,
+      strlen(DB_AUTH_WHITELIST_ALL_SYM));
+}
@@ -0,0 +1,119 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rpc/db/sb-db.h"
+#include "rpc/db/backend.h"
+#include "sb-common.h"
+
+const struct db_backend db_backend_redis = {
+  .name = "redis",
+  .thread_connect = redis_thread_connect,
+  .close = redis_close,
+  .async_connect = redis_async_connect,
+  .plugin_add = redis_plugin_add,
+  .plugin_register = redis_plugin_register,
+  .plugin_verify = redis_plugin_verify,
+  .function_add = redis_function_add,
+  .function_verify = redis_function_verify,
+  .run_verify = redis_run_verify,
+  .authorized_add = redis_authorized_add,
+  .authorized_verify = redis_authorized_verify,
+  .authorized_set_whitelist_all = redis_authorized_set_whitelist_all,
+  .authorized_whitelist_all_is_set = redis_authorized_whitelist_all_is_set,
+  .snapshot = NULL
+};
+
+static const struct db_backend *backend = &db_backend_redis;
+
+void db_backend_set(const struct db_backend *b)
+{
+  LOG_VERBOSE(VERBOSE_LEVEL_0, "Using the %s database backend.\n", b->name);
+  backend = b;
+}
+
+int db_thread_connect(void)
+{
+  return backend->thread_connect();
+}
+
+void db_close(void)
+{
+  backend->close();
+}
+
+int db_async_connect(uv_loop_t *loop)
+{
+  return backend->async_connect(loop);
+}
+
+int db_snapshot(void)
+{
+  return backend->snapshot ? backend->snapshot() : 0;
+}
+
+int db_plugin_add(char *pluginkey, string name, string desc, string author,
+    string license)
+{
+  return backend->plugin_add(pluginkey, name, desc, author, license);
+}
+
+int db_plugin_register(char *pluginkey, string name, string desc,
+    string author, string license, array functions, size_t *rejected)
+{
+  return backend->plugin_register(pluginkey, name, desc, author, license,
+      functions, rejected);
+}
+
+int db_plugin_verify(char *pluginkey)
+{
+  return backend->plugin_verify(pluginkey);
+}
+
+int db_function_add(char *pluginkey, array *func)
+{
+  return backend->function_add(pluginkey, func);
+}
+
+int db_function_verify(char *pluginkey, string name, array *args)
+{
+  return backend->function_verify(pluginkey, name, args);
+}
+
+db_verify_result db_run_verify(char *pluginkey, string name, array *args,
+    db_verify_cb cb, void *data)
+{
+  return backend->run_verify(pluginkey, name, args, cb, data);
+}
+
+int db_authorized_add(unsigned char *pluginlongtermpk)
+{
+  return backend->authorized_add(pluginlongtermpk);
+}
+
+bool db_authorized_verify(unsigned char *pluginlongtermpk)
+{
+  return backend->authorized_verify(pluginlongtermpk);
+}
+
+int db_authorized_set_whitelist_all(void)
+{
+  return backend->authorized_set_whitelist_all();
+}
+
+bool db_authorized_whitelist_all_is_set(void)
+{
+  return backend->authorized_whitelist_all_is_set();
+}
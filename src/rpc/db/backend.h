@@ -0,0 +1,79 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>        // for bool
+#include "rpc/db/sb-db.h"   // for db_verify_result, db_verify_cb
+
+/* shortest plugin name accepted on registration */
+#define DB_PLUGIN_MIN_LEN_NAME 3
+
+/*
+ * The store the db_* functions of sb-db.h operate on. Each operation
+ * behaves the same on every backend, see sb-db.h.
+ */
+struct db_backend {
+  const char *name;
+  int (*thread_connect)(void);
+  void (*close)(void);
+  int (*async_connect)(uv_loop_t *loop);
+  int (*plugin_add)(char *pluginkey, string name, string desc, string author,
+      string license);
+  int (*plugin_register)(char *pluginkey, string name, string desc,
+      string author, string license, array functions, size_t *rejected);
+  int (*plugin_verify)(char *pluginkey);
+  int (*function_add)(char *pluginkey, array *func);
+  int (*function_verify)(char *pluginkey, string name, array *args);
+  db_verify_result (*run_verify)(char *pluginkey, string name, array *args,
+      db_verify_cb cb, void *data);
+  int (*authorized_add)(unsigned char *pluginlongtermpk);
+  bool (*authorized_verify)(unsigned char *pluginlongtermpk);
+  int (*authorized_set_whitelist_all)(void);
+  bool (*authorized_whitelist_all_is_set)(void);
+  /* saves the store if it is kept in memory, NULL otherwise */
+  int (*snapshot)(void);
+};
+
+extern const struct db_backend db_backend_redis;
+extern const struct db_backend db_backend_memory;
+
+/** Select the backend of all threads, done once at startup. */
+void db_backend_set(const struct db_backend *backend);
+
+/**
+ * Checks a function of a register call, [name, desc, [args]].
+ * @return 0 if the function is valid, otherwise -1
+ */
+int db_function_parse(array *func, string *name, string *desc, array **args);
+
+/* Redis backend */
+int redis_thread_connect(void);
+void redis_close(void);
+int redis_async_connect(uv_loop_t *loop);
+int redis_plugin_add(char *pluginkey, string name, string desc,
+    string author, string license);
+int redis_plugin_register(char *pluginkey, string name, string desc,
+    string author, string license, array functions, size_t *rejected);
+int redis_plugin_verify(char *pluginkey);
+int redis_function_add(char *pluginkey, array *func);
+int redis_function_verify(char *pluginkey, string name, array *args);
+db_verify_result redis_run_verify(char *pluginkey, string name, array *args,
+    db_verify_cb cb, void *data);
+int redis_authorized_add(unsigned char *pluginlongtermpk);
+bool redis_authorized_verify(unsigned char *pluginlongtermpk);
+int redis_authorized_set_whitelist_all(void);
+bool redis_authorized_whitelist_all_is_set(void);
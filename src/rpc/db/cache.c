@@ -0,0 +1,453 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <hiredis/hiredis.h>
+#include <hiredis/async.h>
+#include <stdlib.h>                   // for abort, NULL
+#include <stdint.h>                   // for INT64_MAX
+#include <string.h>                   // for strcmp
+#include <uv.h>                       // for uv_rwlock_t, uv_once
+#ifdef __linux__
+#include <bsd/string.h>               // for strlcpy
+#endif
+#include "rpc/db/cache.h"
+#include "rpc/db/sb-db.h"             // for db_async_open, db_command
+#include "sb-common.h"                // for MALLOC, FREE, STATIC
+
+/* published on the first server by a core that changed a plugin */
+#define DB_CACHE_CHANNEL "registry"
+#define DB_CACHE_RETRY_MIN 100
+#define DB_CACHE_RETRY_MAX 10000
+
+struct cached_function {
+  char *name;
+  size_t argc;
+  object_type types[];
+};
+
+struct cached_plugin {
+  char pluginkey[PLUGINKEY_STRING_SIZE];
+  /* name -> cached_function */
+  hashmap(cstr_t, ptr_t) *functions;
+};
+
+/* pluginkey -> cached_plugin */
+static hashmap(cstr_t, ptr_t) *plugins = NULL;
+static uv_once_t cache_once = UV_ONCE_INIT;
+static uv_rwlock_t cache_lock;
+/* set once at startup */
+static bool enabled = true;
+/* changes of other cores are missed, lookups miss until subscribed again */
+static bool held = false;
+
+/* state of the subscription, only touched on its loop */
+static struct {
+  uv_loop_t *loop;
+  redisAsyncContext *sub;
+  uv_timer_t retry;
+  uint64_t delay;
+} registry = {.loop = NULL, .sub = NULL, .delay = 0};
+
+STATIC void cache_lock_init(void);
+STATIC struct cached_plugin *plugin_get(const char *pluginkey);
+STATIC void plugin_free(struct cached_plugin *plugin);
+STATIC void plugin_clear(struct cached_plugin *plugin);
+STATIC void cache_hold(bool hold);
+STATIC void registry_cb(redisAsyncContext *ac, void *r, void *privdata);
+STATIC void registry_lost(const redisAsyncContext *ac);
+STATIC void registry_connect_cb(const redisAsyncContext *ac, int status);
+STATIC void registry_disconnect_cb(const redisAsyncContext *ac, int status);
+STATIC void registry_retry_cb(uv_timer_t *timer);
+STATIC int registry_open(void);
+
+STATIC void cache_lock_init(void)
+{
+  if (uv_rwlock_init(&cache_lock) != 0)
+    abort();
+
+  plugins = hashmap_new(cstr_t, ptr_t)();
+
+  if (!plugins)
+    abort();
+}
+
+/* the cache lock is held for writing */
+STATIC struct cached_plugin *plugin_get(const char *pluginkey)
+{
+  struct cached_plugin *plugin = hashmap_get(cstr_t, ptr_t)(plugins,
+      pluginkey);
+
+  if (plugin)
+    return plugin;
+
+  plugin = MALLOC(struct cached_plugin);
+  sbassert(plugin);
+  strlcpy(plugin->pluginkey, pluginkey, sizeof(plugin->pluginkey));
+  plugin->functions = hashmap_new(cstr_t, ptr_t)();
+  sbassert(plugin->functions);
+  hashmap_put(cstr_t, ptr_t)(plugins, plugin->pluginkey, plugin);
+
+  return plugin;
+}
+
+STATIC void plugin_clear(struct cached_plugin *plugin)
+{
+  struct cached_function *function;
+
+  hashmap_foreach_value(plugin->functions, function, {
+    FREE(function->name);
+    FREE(function);
+  });
+  hashmap_clear(cstr_t, ptr_t)(plugin->functions);
+}
+
+STATIC void plugin_free(struct cached_plugin *plugin)
+{
+  plugin_clear(plugin);
+  hashmap_free(cstr_t, ptr_t)(plugin->functions);
+  FREE(plugin);
+}
+
+void db_cache_init(void)
+{
+  uv_once(&cache_once, cache_lock_init);
+}
+
+void db_cache_enable(bool enable)
+{
+  enabled = enable;
+}
+
+void db_cache_clear(void)
+{
+  struct cached_plugin *plugin;
+
+  db_cache_init();
+
+  uv_rwlock_wrlock(&cache_lock);
+  hashmap_foreach_value(plugins, plugin, {
+    plugin_free(plugin);
+  });
+  hashmap_clear(cstr_t, ptr_t)(plugins);
+  uv_rwlock_wrunlock(&cache_lock);
+}
+
+/* empties the cache, a held one stays empty until released */
+STATIC void cache_hold(bool hold)
+{
+  db_cache_clear();
+
+  uv_rwlock_wrlock(&cache_lock);
+  held = hold;
+  uv_rwlock_wrunlock(&cache_lock);
+}
+
+void db_cache_plugin_reset(const char *pluginkey)
+{
+  if (!enabled)
+    return;
+
+  db_cache_init();
+
+  uv_rwlock_wrlock(&cache_lock);
+  if (!held)
+    plugin_clear(plugin_get(pluginkey));
+  uv_rwlock_wrunlock(&cache_lock);
+}
+
+void db_cache_plugin_put(const char *pluginkey)
+{
+  if (!enabled)
+    return;
+
+  db_cache_init();
+
+  uv_rwlock_wrlock(&cache_lock);
+  if (!held)
+    plugin_get(pluginkey);
+  uv_rwlock_wrunlock(&cache_lock);
+}
+
+void db_cache_plugin_evict(const char *pluginkey)
+{
+  struct cached_plugin *plugin;
+
+  db_cache_init();
+
+  uv_rwlock_wrlock(&cache_lock);
+  plugin = hashmap_get(cstr_t, ptr_t)(plugins, pluginkey);
+  if (plugin)
+    hashmap_del(cstr_t, ptr_t)(plugins, plugin->pluginkey);
+  uv_rwlock_wrunlock(&cache_lock);
+
+  if (plugin)
+    plugin_free(plugin);
+}
+
+bool db_cache_plugin_has(const char *pluginkey)
+{
+  bool cached;
+
+  if (!enabled)
+    return false;
+
+  db_cache_init();
+
+  uv_rwlock_rdlock(&cache_lock);
+  cached = !held && hashmap_has(cstr_t, ptr_t)(plugins, pluginkey);
+  uv_rwlock_rdunlock(&cache_lock);
+
+  return cached;
+}
+
+void db_cache_function_put(const char *pluginkey, string name,
+    const object_type *types, size_t argc)
+{
+  struct cached_plugin *plugin;
+  struct cached_function *function, *old;
+
+  if (!enabled)
+    return;
+
+  function = malloc(sizeof(*function) + argc * sizeof(object_type));
+  if (!function)
+    return;
+
+  function->name = box_strndup(name.str, name.length);
+  if (!function->name) {
+    FREE(function);
+    return;
+  }
+
+  function->argc = argc;
+  for (size_t i = 0; i < argc; i++)
+    function->types[i] = types[i];
+
+  db_cache_init();
+
+  uv_rwlock_wrlock(&cache_lock);
+  if (held) {
+    /* dropped below like a replaced signature */
+    old = function;
+  } else {
+    plugin = plugin_get(pluginkey);
+    old = hashmap_get(cstr_t, ptr_t)(plugin->functions, function->name);
+    if (old)
+      hashmap_del(cstr_t, ptr_t)(plugin->functions, old->name);
+    hashmap_put(cstr_t, ptr_t)(plugin->functions, function->name, function);
+  }
+  uv_rwlock_wrunlock(&cache_lock);
+
+  if (old) {
+    FREE(old->name);
+    FREE(old);
+  }
+}
+
+db_cache_result db_cache_function_verify(const char *pluginkey, string name,
+    array *args)
+{
+  struct cached_plugin *plugin;
+  struct cached_function *function = NULL;
+  db_cache_result result = DB_CACHE_MISS;
+
+  if (!enabled)
+    return DB_CACHE_MISS;
+
+  db_cache_init();
+
+  uv_rwlock_rdlock(&cache_lock);
+  plugin = held ? NULL : hashmap_get(cstr_t, ptr_t)(plugins, pluginkey);
+  if (plugin)
+    function = hashmap_get(cstr_t, ptr_t)(plugin->functions, name.str);
+  if (function)
+    result = db_signature_check(function->types, function->argc, args) ?
+        DB_CACHE_VALID : DB_CACHE_INVALID;
+  uv_rwlock_rdunlock(&cache_lock);
+
+  return result;
+}
+
+bool db_signature_check(const object_type *types, size_t argc, array *args)
+{
+  if (argc != args->size) {
+    LOG_WARNING("Invalid argument count!");
+    return false;
+  }
+
+  for (size_t i = 0; i < argc; i++) {
+    if (types[i] == OBJECT_TYPE_INT &&
+        args->items[i].type == OBJECT_TYPE_UINT) {
+      /* Any positive integer will be treated as an unsigned int
+       * (see unpack/pack.c) and might be a valid signed integer */
+      if (args->items[i].data.uinteger > INT64_MAX) {
+        LOG_WARNING("run() function argument has wrong type.");
+        return false;
+      }
+    } else if (types[i] != args->items[i].type) {
+      LOG_WARNING("run() function argument has wrong type.");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* confirmations of the subscription and pluginkeys of changed plugins */
+STATIC void registry_cb(UNUSED(redisAsyncContext *ac), void *r,
+    UNUSED(void *privdata))
+{
+  redisReply *reply = r;
+
+  if (!reply || (reply->type != REDIS_REPLY_ARRAY) || (reply->elements < 3) ||
+      (reply->element[0]->type != REDIS_REPLY_STRING))
+    return;
+
+  /* changes from now on are seen, the ones before are dropped */
+  if (strcmp(reply->element[0]->str, "subscribe") == 0) {
+    registry.delay = 0;
+    cache_hold(false);
+  } else if ((strcmp(reply->element[0]->str, "message") == 0) &&
+      (reply->element[2]->type == REDIS_REPLY_STRING)) {
+    db_cache_plugin_evict(reply->element[2]->str);
+  }
+}
+
+STATIC void registry_connect_cb(const redisAsyncContext *ac, int status)
+{
+  if (status != REDIS_OK) {
+    LOG_WARNING("Redis registry subscription failed: %s\n", ac->errstr);
+    registry_lost(ac);
+  }
+}
+
+STATIC void registry_disconnect_cb(const redisAsyncContext *ac, int status)
+{
+  if (status != REDIS_OK)
+    LOG_WARNING("Redis registry subscription lost: %s\n", ac->errstr);
+
+  registry_lost(ac);
+}
+
+STATIC void registry_lost(const redisAsyncContext *ac)
+{
+  if (ac != registry.sub)
+    return;
+
+  /* changes are missed, run calls ask the database until subscribed */
+  registry.sub = NULL;
+  cache_hold(true);
+
+  if (!registry.loop)
+    return;
+
+  registry.delay = registry.delay ?
+      MIN(registry.delay * 2, DB_CACHE_RETRY_MAX) : DB_CACHE_RETRY_MIN;
+  uv_timer_start(&registry.retry, registry_retry_cb, registry.delay, 0);
+}
+
+STATIC void registry_retry_cb(UNUSED(uv_timer_t *timer))
+{
+  if (registry.loop && !registry.sub && registry_open() == -1) {
+    registry.delay = MIN(registry.delay * 2, DB_CACHE_RETRY_MAX);
+    uv_timer_start(&registry.retry, registry_retry_cb, registry.delay, 0);
+  }
+}
+
+STATIC int registry_open(void)
+{
+  db_shard_use(DB_SHARD_AUTHORIZED);
+
+  registry.sub = db_async_open(registry.loop, registry_connect_cb,
+      registry_disconnect_cb);
+
+  if (!registry.sub)
+    return (-1);
+
+  if (redisAsyncCommand(registry.sub, registry_cb, NULL, "SUBSCRIBE "
+      DB_CACHE_CHANNEL) != REDIS_OK) {
+    redisAsyncDisconnect(registry.sub);
+    registry.sub = NULL;
+    return (-1);
+  }
+
+  return (0);
+}
+
+int db_cache_subscribe(uv_loop_t *loop)
+{
+  if (registry.loop)
+    return (0);
+
+  if (uv_timer_init(loop, &registry.retry) != 0)
+    return (-1);
+
+  registry.loop = loop;
+  registry.delay = 0;
+  db_cache_init();
+
+  /* entries cached so far may be stale already */
+  cache_hold(true);
+
+  if (registry_open() == -1) {
+    registry.delay = DB_CACHE_RETRY_MIN;
+    uv_timer_start(&registry.retry, registry_retry_cb, registry.delay, 0);
+    return (-1);
+  }
+
+  return (0);
+}
+
+void db_cache_unsubscribe(void)
+{
+  redisAsyncContext *sub = registry.sub;
+
+  if (!registry.loop)
+    return;
+
+  registry.loop = NULL;
+  registry.sub = NULL;
+  uv_close((uv_handle_t *) &registry.retry, NULL);
+  cache_hold(false);
+
+  if (sub)
+    redisAsyncDisconnect(sub);
+}
+
+bool db_cache_synced(void)
+{
+  bool synced;
+
+  db_cache_init();
+
+  uv_rwlock_rdlock(&cache_lock);
+  synced = !held;
+  uv_rwlock_rdunlock(&cache_lock);
+
+  return synced;
+}
+
+void db_cache_publish(const char *pluginkey)
+{
+  redisReply *reply;
+
+  /* every core subscribes on the first server, see db_cache_subscribe() */
+  db_shard_use(DB_SHARD_AUTHORIZED);
+
+  reply = db_command("PUBLISH " DB_CACHE_CHANNEL " %s", pluginkey);
+  if (reply)
+    freeReplyObject(reply);
+}
@@ -0,0 +1,97 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>        // for bool
+#include <stddef.h>         // for size_t
+#include <uv.h>             // for uv_loop_t
+#include "rpc/sb-rpc.h"     // for array, string, object_type
+
+/*
+ * Registered plugins and the signatures of their functions, kept in memory
+ * so a run call is verified without asking the database. The cache is filled
+ * when a plugin registers, and from the database on a miss. It is shared by
+ * all threads. Where cores share a database, a core that changes a plugin
+ * publishes its pluginkey and the other cores evict it.
+ */
+
+typedef enum {
+  DB_CACHE_MISS = 0,
+  DB_CACHE_VALID,
+  DB_CACHE_INVALID
+} db_cache_result;
+
+void db_cache_init(void);
+
+/**
+ * Turn the cache on or off, e.g. where several cores share a database whose
+ * registry changes often. A disabled cache misses on every lookup.
+ */
+void db_cache_enable(bool enable);
+
+/** Drop every plugin, e.g. when connecting to another database. */
+void db_cache_clear(void);
+
+/** Add a plugin, the functions of a plugin registering again are dropped. */
+void db_cache_plugin_reset(const char *pluginkey);
+
+/** Add a plugin known to the database unless it is cached already. */
+void db_cache_plugin_put(const char *pluginkey);
+
+/** Drop a plugin and its functions, the next lookup misses. */
+void db_cache_plugin_evict(const char *pluginkey);
+
+/** @return true if the plugin is cached */
+bool db_cache_plugin_has(const char *pluginkey);
+
+/**
+ * Add or replace the signature of a function.
+ *
+ * @param types  the types of the arguments in order
+ */
+void db_cache_function_put(const char *pluginkey, string name,
+    const object_type *types, size_t argc);
+
+/**
+ * Check a call against the cached signature of the function.
+ *
+ * @return DB_CACHE_MISS if the function is not cached
+ */
+db_cache_result db_cache_function_verify(const char *pluginkey, string name,
+    array *args);
+
+/** @return true if the arguments match the types of a signature */
+bool db_signature_check(const object_type *types, size_t argc, array *args);
+
+/**
+ * Evict plugins other cores publish as changed, see db_cache_publish().
+ * Until subscribed, and while the subscription is lost, the cache is empty
+ * and lookups miss. A lost subscription is renewed with backoff.
+ *
+ * @param loop  the event loop the subscription is read by
+ * @return 0 on success, -1 if the first attempt failed
+ */
+int db_cache_subscribe(uv_loop_t *loop);
+
+/** End the subscription, the cache is filled again as without one. */
+void db_cache_unsubscribe(void);
+
+/** @return false while a subscription misses changes of other cores */
+bool db_cache_synced(void);
+
+/** Tell the other cores that a plugin or its functions changed. */
+void db_cache_publish(const char *pluginkey);
@@ -15,49 +15,624 @@
  */
 
 #include <hiredis/hiredis.h>
+#include <hiredis/async.h>
+#include <hiredis/adapters/libuv.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <uv.h>
 
 #include "rpc/db/sb-db.h"
+#include "rpc/db/backend.h"
+#include "rpc/db/cache.h"
+#include "rpc/db/script.h"
 #include "sb-common.h"
 
-int db_connect(const char *ip, int port, const struct timeval tv,
-    const char * password)
+/* first and longest delay between reconnect attempts in milliseconds */
+#define DB_BACKOFF_MIN 100
+#define DB_BACKOFF_MAX 10000
+/* requests waiting for the database to come back, others fail right away */
+#define DB_WAIT_QUEUE_SIZE 64
+/* milliseconds a request waits for the database to come back */
+#define DB_WAIT_TIMEOUT 2000
+/* a context idle for that many milliseconds is pinged before it is used */
+#define DB_IDLE_CHECK 30000
+/* points of every server on the hash ring */
+#define DB_SHARD_POINTS 64
+
+__thread redisContext *rc = NULL;
+__thread redisAsyncContext *arc = NULL;
+
+/*
+ * The servers the registry is sharded over, set up by db_connect(). Every
+ * thread owns its contexts, so commands of different threads are in flight
+ * in parallel. Threads talking to the same server share the backoff of
+ * reconnect attempts.
+ */
+static struct {
+  char *ip;
+  int port;
+  /* delay of the next attempt, 0 while the server is reachable */
+  uint64_t delay;
+  /* time of the next attempt */
+  uint64_t next;
+} shards[DB_SHARDS_MAX];
+static size_t nshards = 0;
+
+/* connection parameters shared by all servers */
+static struct timeval db_tv = {0, 0};
+static char *db_password = NULL;
+
+/*
+ * Every server owns the arcs of the ring that end at one of its points. A
+ * server added to the list only takes over keys from the others, the keys
+ * of the remaining servers stay where they are.
+ */
+static struct ring_point {
+  uint64_t point;
+  size_t shard;
+} ring[DB_SHARDS_MAX * DB_SHARD_POINTS];
+static size_t nring = 0;
+
+/* guards the backoff of all servers */
+static struct {
+  uv_mutex_t lock;
+  uv_cond_t reconnected;
+  size_t waiting;
+} pool;
+static uv_once_t pool_once = UV_ONCE_INIT;
+
+/* contexts of the calling thread, rc and arc are the ones of `current` */
+static __thread struct {
+  redisContext *rc;
+  redisAsyncContext *arc;
+  uint64_t last_used;
+  uint64_t async_delay;
+  uint64_t async_next;
+} contexts[DB_SHARDS_MAX];
+static __thread size_t current = 0;
+/* event loops never wait for a reconnect */
+static __thread uv_loop_t *async_loop = NULL;
+
+STATIC uint64_t now_ms(void);
+STATIC uint64_t shard_hash(const char *key);
+STATIC int ring_point_cmp(const void *a, const void *b);
+STATIC void ring_build(void);
+STATIC void pool_init(void);
+STATIC uint64_t backoff(uint64_t delay);
+STATIC void pool_result(bool reachable);
+STATIC int db_context_connect(void);
+STATIC int db_reconnect(void);
+STATIC size_t db_async_shard(const redisAsyncContext *ac);
+STATIC int db_async_shard_connect(void);
+STATIC void db_async_auth_cb(redisAsyncContext *ac, void *r, void *privdata);
+STATIC void db_async_connect_cb(const redisAsyncContext *ac, int status);
+STATIC void db_async_disconnect_cb(const redisAsyncContext *ac, int status);
+
+STATIC uint64_t now_ms(void)
+{
+  return uv_hrtime() / 1000000;
+}
+
+/* FNV-1a, mixed so that similar keys land far apart on the ring */
+STATIC uint64_t shard_hash(const char *key)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  for (; *key; key++) {
+    hash ^= (unsigned char) *key;
+    hash *= 0x100000001b3ULL;
+  }
+
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+
+  return hash;
+}
+
+STATIC int ring_point_cmp(const void *a, const void *b)
+{
+  const struct ring_point *x = a, *y = b;
+
+  return x->point < y->point ? -1 : x->point > y->point;
+}
+
+/* points depend on the address of a server only, not on its position */
+STATIC void ring_build(void)
+{
+  char label[256];
+
+  nring = 0;
+
+  for (size_t i = 0; i < nshards; i++) {
+    for (int j = 0; j < DB_SHARD_POINTS; j++) {
+      snprintf(label, sizeof(label), "%s:%d-%d", shards[i].ip,
+          shards[i].port, j);
+      ring[nring].point = shard_hash(label);
+      ring[nring].shard = i;
+      nring++;
+    }
+  }
+
+  qsort(ring, nring, sizeof(struct ring_point), ring_point_cmp);
+}
+
+STATIC void pool_init(void)
+{
+  if (uv_mutex_init(&pool.lock) != 0 || uv_cond_init(&pool.reconnected) != 0)
+    abort();
+}
+
+STATIC uint64_t backoff(uint64_t delay)
+{
+  return delay ? MIN(delay * 2, DB_BACKOFF_MAX) : DB_BACKOFF_MIN;
+}
+
+STATIC void pool_result(bool reachable)
+{
+  uv_mutex_lock(&pool.lock);
+
+  if (reachable) {
+    shards[current].delay = 0;
+    shards[current].next = 0;
+    uv_cond_broadcast(&pool.reconnected);
+  } else {
+    shards[current].delay = backoff(shards[current].delay);
+    shards[current].next = now_ms() + shards[current].delay;
+  }
+
+  uv_mutex_unlock(&pool.lock);
+}
+
+/* connects the context of the current shard */
+STATIC int db_context_connect(void)
 {
   redisReply *reply;
-  LOG_VERBOSE(VERBOSE_LEVEL_0, "Connection to database at port %d.\n", port);
 
-  rc = redisConnectWithTimeout(ip, port, tv);
+  uv_once(&pool_once, pool_init);
+
+  rc = redisConnectWithTimeout(shards[current].ip, shards[current].port,
+      db_tv);
 
   if ((rc == NULL) || rc->err) {
     if (rc) {
       LOG_WARNING("Redis connection error: %s", rc->errstr);
       redisFree(rc);
+      rc = NULL;
     } else
       LOG_WARNING("Redis connection error: can't allocate redis context");
 
+    pool_result(false);
     return (-1);
   }
 
-  /* AUTH */
-  reply = redisCommand(rc, "AUTH %s", password);
+  /* AUTH, again on every reconnect */
+  reply = redisCommand(rc, "AUTH %s", db_password);
 
-  if (reply->type == REDIS_REPLY_ERROR) {
-    LOG_WARNING("Redis authentication error: %s", reply->str);
-    freeReplyObject(reply);
+  if (!reply || (reply->type == REDIS_REPLY_ERROR)) {
+    LOG_WARNING("Redis authentication error: %s",
+        reply ? reply->str : rc->errstr);
+    if (reply)
+      freeReplyObject(reply);
     redisFree(rc);
+    rc = NULL;
 
+    pool_result(false);
     return (-1);
   }
 
   freeReplyObject(reply);
+  contexts[current].rc = rc;
+  contexts[current].last_used = now_ms();
+  pool_result(true);
 
   return (0);
 }
 
+/*
+ * While the server is unreachable, one attempt is made per backoff period.
+ * Other requests wait for its outcome in a bounded queue, requests on event
+ * loops fail right away.
+ */
+STATIC int db_reconnect(void)
+{
+  uint64_t deadline, now;
+  bool attempt = false;
+
+  if (nshards == 0)
+    return (-1);
+
+  uv_once(&pool_once, pool_init);
+
+  deadline = now_ms() + DB_WAIT_TIMEOUT;
+
+  uv_mutex_lock(&pool.lock);
+
+  for (;;) {
+    now = now_ms();
+
+    if (now >= shards[current].next) {
+      attempt = true;
+      /* the next attempt is due after this one failed */
+      if (shards[current].delay)
+        shards[current].next = now + shards[current].delay;
+      break;
+    }
+
+    if (async_loop || (pool.waiting >= DB_WAIT_QUEUE_SIZE) ||
+        (now >= deadline))
+      break;
+
+    pool.waiting++;
+    uv_cond_timedwait(&pool.reconnected, &pool.lock,
+        (MIN(shards[current].next, deadline) - now) * 1000000);
+    pool.waiting--;
+  }
+
+  uv_mutex_unlock(&pool.lock);
+
+  if (!attempt)
+    return (-1);
+
+  return db_context_connect();
+}
+
+size_t db_shard_count(void)
+{
+  return nshards;
+}
 
-void db_close(void)
+size_t db_shard_of(const char *pluginkey)
 {
+  uint64_t hash = shard_hash(pluginkey);
+  size_t low = 0, high = nring;
+
+  if (nshards < 2)
+    return (0);
+
+  /* the first point at or after the hash, wrapping around */
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+
+    if (ring[mid].point < hash)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return ring[low == nring ? 0 : low].shard;
+}
+
+void db_shard_use(size_t shard)
+{
+  if (shard >= DB_SHARDS_MAX)
+    return;
+
+  current = shard;
+  rc = contexts[shard].rc;
+  arc = contexts[shard].arc;
+}
+
+size_t db_shard_current(void)
+{
+  return current;
+}
+
+void db_shard_select(const char *pluginkey)
+{
+  db_shard_use(db_shard_of(pluginkey));
+}
+
+redisContext *db_context(void)
+{
+  redisReply *reply;
+
+  /* the server may have closed an idle connection in the meantime */
+  if (rc && (now_ms() - contexts[current].last_used > DB_IDLE_CHECK)) {
+    reply = redisCommand(rc, "PING");
+
+    if (reply)
+      freeReplyObject(reply);
+    else
+      db_context_drop();
+  }
+
+  if (!rc && (db_reconnect() == -1))
+    return NULL;
+
+  contexts[current].last_used = now_ms();
+
+  return rc;
+}
+
+void db_context_drop(void)
+{
+  if (!rc)
+    return;
+
+  LOG_WARNING("Redis connection lost: %s", rc->errstr);
   redisFree(rc);
+  rc = NULL;
+  contexts[current].rc = NULL;
+}
+
+redisReply *db_command(const char *format, ...)
+{
+  redisReply *reply = NULL;
+  va_list ap;
+
+  /* a command failing on a lost connection is tried once more */
+  for (int attempt = 0; (attempt < 2) && !reply; attempt++) {
+    if (!db_context())
+      break;
+
+    va_start(ap, format);
+    reply = redisvCommand(rc, format, ap);
+    va_end(ap);
+
+    if (!reply)
+      db_context_drop();
+  }
+
+  return reply;
+}
+
+int db_connect_shards(const struct db_endpoint *endpoints, size_t count,
+    const struct timeval tv, const char *password)
+{
+  if ((count == 0) || (count > DB_SHARDS_MAX)) {
+    LOG_WARNING("Redis servers must be between 1 and %d.\n", DB_SHARDS_MAX);
+    return (-1);
+  }
+
+  /* contexts of the previous servers */
+  redis_close();
+
+  for (size_t i = 0; i < nshards; i++)
+    FREE(shards[i].ip);
+
+  for (size_t i = 0; i < count; i++) {
+    LOG_VERBOSE(VERBOSE_LEVEL_0, "Connection to database at port %d.\n",
+        endpoints[i].port);
+    shards[i].ip = box_strdup(endpoints[i].ip);
+    shards[i].port = endpoints[i].port;
+    shards[i].delay = 0;
+    shards[i].next = 0;
+  }
+
+  nshards = count;
+  ring_build();
+
+  FREE(db_password);
+  db_tv = tv;
+  db_password = password ? box_strdup(password) : NULL;
+
+  /* the cache holds the registry of the previous database */
+  db_cache_clear();
+  db_script_reset();
+  db_backend_set(&db_backend_redis);
+
+  if (redis_thread_connect() == -1)
+    return (-1);
+
+  /* run calls are verified with single commands where it fails */
+  for (size_t i = 0; i < nshards; i++) {
+    db_shard_use(i);
+    db_script_load();
+  }
+
+  db_shard_use(DB_SHARD_AUTHORIZED);
+
+  return (0);
+}
+
+
+int db_connect(const char *ip, int port, const struct timeval tv,
+    const char * password)
+{
+  struct db_endpoint endpoint = {ip, port};
+
+  return db_connect_shards(&endpoint, 1, tv, password);
+}
+
+
+int redis_thread_connect(void)
+{
+  int result = 0;
+
+  if (nshards == 0)
+    return (-1);
+
+  for (size_t i = 0; i < nshards; i++) {
+    db_shard_use(i);
+
+    if (db_context_connect() == -1)
+      result = -1;
+  }
+
+  db_shard_use(DB_SHARD_AUTHORIZED);
+
+  return (result);
+}
+
+
+void redis_close(void)
+{
+  for (size_t i = 0; i < DB_SHARDS_MAX; i++) {
+    if (contexts[i].rc)
+      redisFree(contexts[i].rc);
+
+    contexts[i].rc = NULL;
+  }
+
+  rc = NULL;
+}
+
+
+/* @return the shard of an asynchronous context of the thread, or nshards */
+STATIC size_t db_async_shard(const redisAsyncContext *ac)
+{
+  for (size_t i = 0; i < nshards; i++) {
+    if (contexts[i].arc == ac)
+      return i;
+  }
+
+  return nshards;
+}
+
+
+STATIC void db_async_connect_cb(const redisAsyncContext *ac, int status)
+{
+  size_t shard = db_async_shard(ac);
+
+  if (shard == nshards)
+    return;
+
+  if (status == REDIS_OK) {
+    contexts[shard].async_delay = 0;
+    return;
+  }
+
+  LOG_WARNING("Redis connection error: %s", ac->errstr);
+  contexts[shard].async_delay = backoff(contexts[shard].async_delay);
+  contexts[shard].async_next = now_ms() + contexts[shard].async_delay;
+}
+
+
+STATIC void db_async_auth_cb(redisAsyncContext *ac, void *r,
+    UNUSED(void *privdata))
+{
+  redisReply *reply = r;
+
+  if (reply && reply->type == REDIS_REPLY_ERROR) {
+    LOG_WARNING("Redis authentication error: %s", reply->str);
+    redisAsyncDisconnect(ac);
+  }
+}
+
+
+/* runs on the loop of the context, hiredis frees the context afterwards */
+STATIC void db_async_disconnect_cb(const redisAsyncContext *ac, int status)
+{
+  size_t shard = db_async_shard(ac);
+
+  if (status != REDIS_OK)
+    LOG_WARNING("Redis connection lost: %s", ac->errstr);
+
+  if (shard < nshards)
+    contexts[shard].arc = NULL;
+
+  if (ac == arc)
+    arc = NULL;
+}
+
+
+redisAsyncContext *db_async_open(uv_loop_t *loop,
+    redisConnectCallback *connect, redisDisconnectCallback *disconnect)
+{
+  redisAsyncContext *ac;
+
+  if (current >= nshards)
+    return NULL;
+
+  ac = redisAsyncConnect(shards[current].ip, shards[current].port);
+
+  if ((ac == NULL) || ac->err) {
+    if (ac) {
+      LOG_WARNING("Redis connection error: %s", ac->errstr);
+      redisAsyncFree(ac);
+    } else
+      LOG_WARNING("Redis connection error: can't allocate redis context");
+
+    return NULL;
+  }
+
+  if ((redisLibuvAttach(ac, loop) != REDIS_OK) ||
+      (connect && (redisAsyncSetConnectCallback(ac, connect) != REDIS_OK)) ||
+      (redisAsyncSetDisconnectCallback(ac, disconnect) != REDIS_OK)) {
+    redisAsyncFree(ac);
+    return NULL;
+  }
+
+  /* sent first, replies arrive in order */
+  if (db_password && (redisAsyncCommand(ac, db_async_auth_cb, NULL,
+      "AUTH %s", db_password) != REDIS_OK)) {
+    redisAsyncFree(ac);
+    return NULL;
+  }
+
+  return ac;
+}
+
+
+/* connects the asynchronous context of the current shard */
+STATIC int db_async_shard_connect(void)
+{
+  contexts[current].async_next = now_ms() + contexts[current].async_delay;
+
+  arc = db_async_open(async_loop, db_async_connect_cb, db_async_disconnect_cb);
+  contexts[current].arc = arc;
+
+  if (!arc) {
+    contexts[current].async_delay = backoff(contexts[current].async_delay);
+    contexts[current].async_next = now_ms() + contexts[current].async_delay;
+    return (-1);
+  }
+
+  return (0);
+}
+
+
+int redis_async_connect(uv_loop_t *loop)
+{
+  int result = 0;
+
+  if (nshards == 0)
+    return (-1);
+
+  async_loop = loop;
+
+  for (size_t i = 0; i < nshards; i++) {
+    db_shard_use(i);
+
+    if (db_async_shard_connect() == -1)
+      result = -1;
+  }
+
+  db_shard_use(DB_SHARD_AUTHORIZED);
+
+  return (result);
+}
+
+
+redisAsyncContext *db_async_context(void)
+{
+  /* connecting does not block, but is not retried before the backoff */
+  if (!arc && async_loop && (current < nshards) &&
+      (now_ms() >= contexts[current].async_next))
+    db_async_shard_connect();
+
+  return arc;
+}
+
+
+void db_async_close(void)
+{
+  redisAsyncContext *ac;
+
+  async_loop = NULL;
+
+  /* no further commands, the pending ones are still answered */
+  for (size_t i = 0; i < DB_SHARDS_MAX; i++) {
+    ac = contexts[i].arc;
+    contexts[i].arc = NULL;
+
+    if (ac)
+      redisAsyncDisconnect(ac);
+  }
+
+  arc = NULL;
 }
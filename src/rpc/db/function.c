@@ -15,308 +15,693 @@
  */
 
 #include <hiredis/hiredis.h>
+#include <hiredis/async.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#ifdef __linux__
+#include <bsd/string.h>
+#endif
 
 #include "rpc/db/sb-db.h"
+#include "rpc/db/backend.h"
+#include "rpc/db/cache.h"
+#include "rpc/db/pipeline.h"
+#include "rpc/db/script.h"
+#include "rpc/msgpack/helpers.h"
+#include "api/helpers.h"
+#include "api/sb-api.h"
 #include "sb-common.h"
 
 #define FUNC_MAX_LEN_NAME 255
 #define FUNC_MIN_LEN_NAME 1
+/* field of the meta hash holding one byte per argument type */
+#define DB_FUNCTION_SIGNATURE "args"
 
-static int db_function_add_name(char *pluginkey, string name)
+/* checks a function of a register call, [name, desc, [args]] */
+int db_function_parse(array *func, string *name, string *desc,
+    array **args)
 {
-  redisReply *reply;
+  object *name_elem, *desc_elem, *args_elem;
 
-  if (!rc)
+  if (!func || (func->size <= 2))
     return (-1);
 
-  reply = redisCommand(rc, "SADD %s:func:all %s", pluginkey, name.str);
+  name_elem = &func->items[0];
+  *name = name_elem->data.string;
 
-  if (reply->type != REDIS_REPLY_INTEGER) {
-    LOG_WARNING("Redis failed to add function name to func:all set: %s",
-        reply->str);
-    freeReplyObject(reply);
+  if ((name_elem->type != OBJECT_TYPE_STR) ||
+      (name->length < FUNC_MIN_LEN_NAME) ||
+      (name->length > FUNC_MAX_LEN_NAME)) {
+    LOG_WARNING("Illegal function name.");
     return (-1);
   }
 
-  freeReplyObject(reply);
+  desc_elem = &func->items[1];
+  *desc = desc_elem->data.string;
+
+  if ((desc_elem->type != OBJECT_TYPE_STR) || !desc->str) {
+    LOG_WARNING("Illegal function description.");
+    return (-1);
+  }
+
+  args_elem = &func->items[2];
+
+  if (args_elem->type != OBJECT_TYPE_ARRAY) {
+    LOG_WARNING("Illegal function arguments.");
+    return (-1);
+  }
+
+  *args = &args_elem->data.array;
+
   return (0);
 }
 
 
-static int db_function_add_meta(char *pluginkey, string name, string desc)
+int db_function_queue(char *pluginkey, array *func)
 {
-  redisReply *reply;
+  unsigned char *signature;
+  string name, desc;
+  array *args;
+  int result = 0;
 
-  if (!rc || !name.str || !desc.str)
+  if (db_function_parse(func, &name, &desc, &args) == -1)
     return (-1);
 
-  reply = redisCommand(rc, "HSET %s:func:%s:meta desc %s", pluginkey,
-          name.str, desc.str);
+  signature = MALLOC_ARRAY(args->size ? args->size : 1, unsigned char);
 
-  if (reply->type == REDIS_REPLY_ERROR) {
-    LOG_WARNING("Redis failed to store function meta information: %s",
-        reply->str);
-    freeReplyObject(reply);
+  if (!signature)
     return (-1);
+
+  for (size_t i = 0; i < args->size; i++)
+    signature[i] = (unsigned char) args->items[i].type;
+
+  /* the signature of an earlier registration is replaced */
+  if ((db_queue("SADD %s:func:all %s", pluginkey, name.str) == -1) ||
+      (db_queue("HMSET %s:func:%s:meta desc %s " DB_FUNCTION_SIGNATURE " %b",
+      pluginkey, name.str, desc.str, signature, args->size) == -1)) {
+    LOG_WARNING("Failed to add function arguments!");
+    result = -1;
   }
 
-  freeReplyObject(reply);
+  FREE(signature);
+
+  return (result);
+}
+
+
+int db_function_hash(array *func, unsigned char *hash)
+{
+  msgpack_sbuffer sbuf;
+  msgpack_packer pk;
+  string name, desc;
+  array *args;
+
+  if (db_function_parse(func, &name, &desc, &args) == -1)
+    return (-1);
+
+  msgpack_sbuffer_init(&sbuf);
+  msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+
+  /* what db_function_queue() stores, argument values do not matter */
+  msgpack_pack_array(&pk, 3);
+  msgpack_rpc_from_string(name, &pk);
+  msgpack_rpc_from_string(desc, &pk);
+  msgpack_pack_array(&pk, args->size);
+  for (size_t i = 0; i < args->size; i++)
+    msgpack_pack_uint64(&pk, args->items[i].type);
+
+  crypto_hash(hash, (unsigned char *) sbuf.data, sbuf.size);
+  msgpack_sbuffer_destroy(&sbuf);
+
   return (0);
 }
 
 
-static int db_function_add_args(char *pluginkey, string name,
-    object_type type)
+void db_function_cache(char *pluginkey, array *func)
 {
-  redisReply *reply;
+  object_type *types;
+  string name, desc;
+  array *args;
+
+  if (db_function_parse(func, &name, &desc, &args) == -1)
+    return;
+
+  types = MALLOC_ARRAY(args->size ? args->size : 1, object_type);
 
-  if (!rc)
+  if (!types)
+    return;
+
+  for (size_t i = 0; i < args->size; i++)
+    types[i] = args->items[i].type;
+
+  db_cache_function_put(pluginkey, name, types, args->size);
+  FREE(types);
+}
+
+
+int redis_function_add(char *pluginkey, array *func)
+{
+  string name, desc;
+  array *args;
+
+  db_shard_select(pluginkey);
+
+  if (!db_context() || (db_function_parse(func, &name, &desc, &args) == -1))
     return (-1);
 
-  reply = redisCommand(rc, "LPUSH %s:func:%s:args %lu", pluginkey,
-          name.str, type);
+  if ((db_multi() == -1) || (db_function_queue(pluginkey, func) == -1)) {
+    db_exec();
+    return (-1);
+  }
 
-  if (reply->type != REDIS_REPLY_INTEGER) {
-    LOG_WARNING("Redis failed to store function argument: %s", reply->str);
-    freeReplyObject(reply);
+  /* the stored registration no longer matches the plugin's payload */
+  if ((db_queue("HDEL %s " DB_PLUGIN_HASH, pluginkey) == -1) ||
+      (db_queue("HDEL %s:func:hashes %s", pluginkey, name.str) == -1)) {
+    db_exec();
     return (-1);
   }
 
-  freeReplyObject(reply);
+  if (db_exec() == -1)
+    return (-1);
+
+  db_function_cache(pluginkey, func);
+  db_cache_publish(pluginkey);
+
   return (0);
 }
 
 
-static int db_function_flush_args(char *pluginkey, string name)
+/* parses the argument types of a function from its signature blob, a nil
+ * reply means the function is not registered */
+static ssize_t db_function_parse_args(redisReply *reply, object_type **types)
 {
-  redisReply *reply;
-  int start = 1;
-  int end = 0;
+  size_t argc;
 
-  if (!rc)
+  if (reply->type == REDIS_REPLY_NIL)
     return (-1);
 
-  /* if start > end, the result will be an empty list (which causes
-   * key to be removed) */
-   printf("name: %s\n", name.str);
-   printf("pluginkey: %s\n", pluginkey);
+  if (reply->type != REDIS_REPLY_STRING) {
+    LOG_WARNING("Redis failed to get function arguments.");
+    return (-1);
+  }
 
-  reply = redisCommand(rc, "LTRIM %s:func:%s:args %i %i", pluginkey,
-          name.str, start, end);
+  argc = (size_t) reply->len;
+  *types = MALLOC_ARRAY(argc ? argc : 1, object_type);
 
-  if ((reply->type != REDIS_REPLY_STATUS) ||
-      (strncmp(reply->str, "OK", 3) != 0)) {
-    LOG_WARNING("Redis failed to store function argument: %s", reply->str);
-    freeReplyObject(reply);
+  if (!*types)
+    return (-1);
+
+  for (size_t i = 0; i < argc; i++) {
+    if ((unsigned char) reply->str[i] > OBJECT_TYPE_DICTIONARY) {
+      LOG_WARNING("Redis function argument has wrong type.");
+      FREE(*types);
+      return (-1);
+    }
 
+    (*types)[i] = (object_type) (unsigned char) reply->str[i];
+  }
+
+  return ((ssize_t) argc);
+}
+
+
+/* loads the argument types of a function in order */
+static ssize_t db_function_get_args(char *pluginkey, string name,
+    object_type **types)
+{
+  redisReply *reply;
+  ssize_t argc;
+
+  reply = db_command("HGET %s:func:%s:meta " DB_FUNCTION_SIGNATURE,
+      pluginkey, name.str);
+
+  if (!reply) {
+    LOG_WARNING("No redis connection available!");
     return (-1);
   }
 
+  argc = db_function_parse_args(reply, types);
   freeReplyObject(reply);
 
-  return (0);
+  return (argc);
 }
 
 
-int db_function_add(char *pluginkey, array *func)
+int redis_function_verify(char *pluginkey, string name,
+    array *args)
 {
-  object *name_elem, *desc_elem, *args, *arg;
-  string name, desc;
+  object_type *types;
+  ssize_t argc;
+  bool valid;
+  db_cache_result cached = db_cache_function_verify(pluginkey, name, args);
 
-  if (!func || !rc || (func->size <= 2))
+  if (cached != DB_CACHE_MISS)
+    return cached == DB_CACHE_VALID ? 0 : -1;
+
+  db_shard_select(pluginkey);
+
+  /* registered before the cache was filled, e.g. by an earlier run */
+  if ((argc = db_function_get_args(pluginkey, name, &types)) < 0)
     return (-1);
 
-  name_elem = &func->items[0];
+  db_cache_function_put(pluginkey, name, types, (size_t) argc);
+  valid = db_signature_check(types, (size_t) argc, args);
+  FREE(types);
 
-  if (!name_elem) {
-    LOG_WARNING("Illegal function name pointer.");
+  return valid ? 0 : -1;
+}
+
+
+/* parses the argument types of a signature stored as a list of decimal
+ * strings by earlier versions, the first argument is the last element */
+static ssize_t db_function_parse_list(redisReply *reply,
+    unsigned char **signature)
+{
+  char *endptr;
+  long val;
+  size_t argc;
+
+  if (reply->type != REDIS_REPLY_ARRAY)
     return (-1);
-  }
 
-  name = name_elem->data.string;
+  argc = reply->elements;
+  *signature = MALLOC_ARRAY(argc ? argc : 1, unsigned char);
 
-  if ((name_elem->type != OBJECT_TYPE_STR) ||
-      (name.length < FUNC_MIN_LEN_NAME) ||
-      (name.length > FUNC_MAX_LEN_NAME)) {
-    LOG_WARNING("Illegal function name.");
+  if (!*signature)
     return (-1);
+
+  for (size_t j = argc, k = 0; j != 0; j--, k++) {
+    if (reply->element[j-1]->type != REDIS_REPLY_STRING)
+      goto fail;
+
+    errno = 0;
+    val = strtol(reply->element[j-1]->str, &endptr, 10);
+
+    if ((errno != 0) || (endptr == reply->element[j-1]->str) ||
+        (val < 0) || (val > OBJECT_TYPE_DICTIONARY))
+      goto fail;
+
+    (*signature)[k] = (unsigned char) val;
   }
 
-  desc_elem = &func->items[1];
+  return ((ssize_t) argc);
+
+fail:
+  LOG_WARNING("Redis function argument has wrong type.");
+  FREE(*signature);
+  return (-1);
+}
 
-  if (!desc_elem) {
-    LOG_WARNING("Illegal function description pointer.");
+
+/* moves the argument list <pluginkey>:func:<name>:args into the meta hash */
+static int db_function_migrate_key(const char *key)
+{
+  unsigned char *signature;
+  redisReply *reply;
+  char *meta;
+  size_t len = strlen(key);
+  ssize_t argc;
+  int result = -1;
+
+  reply = db_command("LRANGE %s 0 -1", key);
+
+  if (!reply)
     return (-1);
-  }
 
-  desc = desc_elem->data.string;
+  argc = db_function_parse_list(reply, &signature);
+  freeReplyObject(reply);
 
-  if (desc_elem->type != OBJECT_TYPE_STR) {
-    LOG_WARNING("Illegal function description.");
+  if (argc < 0)
     return (-1);
+
+  meta = box_strdup(key);
+
+  if (meta) {
+    memcpy(meta + len - strlen("args"), "meta", strlen("meta"));
+
+    if ((db_multi() == 0) &&
+        (db_queue("HSET %s " DB_FUNCTION_SIGNATURE " %b", meta, signature,
+        (size_t) argc) == 0) &&
+        (db_queue("DEL %s", key) == 0))
+      result = db_exec();
+    else
+      db_exec();
   }
 
-  if (db_function_add_name(pluginkey, name) == -1)
-    return (-1);
+  FREE(meta);
+  FREE(signature);
+
+  return (result);
+}
 
-  if (db_function_add_meta(pluginkey, name, desc) == -1)
-    return (-1);
 
-  args = &func->items[2];
+/* converts the signatures kept on the current shard */
+static int db_function_migrate_shard(void)
+{
+  redisReply *reply, *keys;
+  char cursor[32] = "0";
+  int migrated = 0;
 
-  db_function_flush_args(pluginkey, name);
+  do {
+    reply = db_command("SCAN %s MATCH *:func:*:args COUNT 100", cursor);
 
-  for (size_t i = 0; i < args->data.array.size; i++) {
-    arg = &args->data.array.items[i];
+    if (!reply)
+      return (-1);
 
-    if (db_function_add_args(pluginkey, name, arg->type) == -1) {
-      LOG_WARNING("Failed to add function arguments!");
+    if ((reply->type != REDIS_REPLY_ARRAY) || (reply->elements != 2) ||
+        (reply->element[0]->type != REDIS_REPLY_STRING) ||
+        (reply->element[1]->type != REDIS_REPLY_ARRAY)) {
+      LOG_WARNING("Redis failed to scan function arguments.");
+      freeReplyObject(reply);
       return (-1);
     }
-  }
 
-  return (0);
+    strlcpy(cursor, reply->element[0]->str, sizeof(cursor));
+    keys = reply->element[1];
+
+    for (size_t i = 0; i < keys->elements; i++) {
+      if ((keys->element[i]->type == REDIS_REPLY_STRING) &&
+          (db_function_migrate_key(keys->element[i]->str) == 0))
+        migrated++;
+    }
+
+    freeReplyObject(reply);
+  } while (strcmp(cursor, "0") != 0);
+
+  return (migrated);
 }
 
 
-static bool db_function_exists(char *pluginkey, string name)
+int db_function_migrate(void)
 {
-  redisReply *reply;
-  bool result;
+  int migrated = 0, result;
 
-  if (!rc) {
-    LOG_WARNING("No redis connection available!");
-    return (false);
+  /* every shard keeps the functions of its plugins */
+  for (size_t i = 0; i < db_shard_count(); i++) {
+    db_shard_use(i);
+
+    if ((result = db_function_migrate_shard()) == -1)
+      return (-1);
+
+    migrated += result;
   }
 
-  reply = redisCommand(rc, "SISMEMBER %s:func:all %s", pluginkey,
-          name.str);
+  if (migrated > 0)
+    LOG_VERBOSE(VERBOSE_LEVEL_0, "Migrated %d function signatures.\n",
+        migrated);
 
-  if (reply->type != REDIS_REPLY_INTEGER) {
-    LOG_WARNING("Redis failed to check if function is registered.");
-    freeReplyObject(reply);
-    return (false);
+  return (migrated);
+}
+
+
+/* maps the reply of the verify script and caches what it found */
+static db_verify_result db_script_result(redisReply *reply, char *pluginkey,
+    string name)
+{
+  db_verify_result result;
+  object_type *types;
+  ssize_t argc;
+
+  if ((reply->type != REDIS_REPLY_ARRAY) || (reply->elements < 1) ||
+      (reply->element[0]->type != REDIS_REPLY_INTEGER) ||
+      (reply->element[0]->integer < DB_VERIFY_VALID) ||
+      (reply->element[0]->integer > DB_VERIFY_FUNCTION)) {
+    LOG_WARNING("Redis verify script failed: %s\n",
+        reply->type == REDIS_REPLY_ERROR ? reply->str : "");
+    return (DB_VERIFY_ERROR);
   }
 
-  result = reply->integer != 0;
-  freeReplyObject(reply);
+  result = (db_verify_result) reply->element[0]->integer;
+
+  if (result != DB_VERIFY_PLUGIN)
+    db_cache_plugin_put(pluginkey);
+
+  if ((reply->elements > 1) &&
+      ((argc = db_function_parse_args(reply->element[1], &types)) >= 0)) {
+    db_cache_function_put(pluginkey, name, types, (size_t) argc);
+    FREE(types);
+  }
 
   return (result);
 }
 
 
-static ssize_t db_function_get_argc(char *pluginkey, string name)
+static bool db_script_missing(redisReply *reply)
+{
+  return reply && (reply->type == REDIS_REPLY_ERROR) &&
+      (strncmp(reply->str, "NOSCRIPT", strlen("NOSCRIPT")) == 0);
+}
+
+
+/* verifies a run call in one round trip, -1 if scripting is unusable */
+static int db_script_verify(char *pluginkey, string name, array *args,
+    db_verify_result *result)
 {
+  unsigned char *call;
   redisReply *reply;
-  ssize_t result;
+  const char *sha;
 
-  if (!rc) {
-    LOG_WARNING("No redis connection available!");
+  if ((db_script_load() == -1) || !(sha = db_script_sha()))
     return (-1);
-  }
 
-  reply = redisCommand(rc, "LLEN %s:func:%s:args", pluginkey,
-            name.str);
+  call = MALLOC_ARRAY(args->size ? args->size : 1, unsigned char);
 
-  if (reply->type != REDIS_REPLY_INTEGER) {
-    LOG_WARNING("Redis failed to get arguments list length: %s", reply->str);
-    freeReplyObject(reply);
+  if (!call)
     return (-1);
+
+  db_script_call_types(args, call);
+
+  reply = db_command("EVALSHA %s 2 %s %s:func:%s:meta %b %d %d", sha,
+      pluginkey, pluginkey, name.str, call, args->size, OBJECT_TYPE_INT,
+      OBJECT_TYPE_UINT);
+
+  /* flushed by SCRIPT FLUSH or a restart, EVAL loads it again */
+  if (db_script_missing(reply)) {
+    freeReplyObject(reply);
+    reply = db_command("EVAL %s 2 %s %s:func:%s:meta %b %d %d",
+        db_script_verify_source, pluginkey, pluginkey, name.str, call,
+        args->size, OBJECT_TYPE_INT, OBJECT_TYPE_UINT);
+  }
+
+  FREE(call);
+
+  if (!reply) {
+    *result = DB_VERIFY_ERROR;
+    return (0);
   }
 
-  result = reply->integer;
+  *result = db_script_result(reply, pluginkey, name);
   freeReplyObject(reply);
 
-  return (result);
+  return (0);
 }
 
 
-static int db_function_typecheck(char *pluginkey, string name,
-    array *args)
+/* a run call verified through the asynchronous context */
+struct run_verify {
+  char pluginkey[PLUGINKEY_STRING_SIZE];
+  string name;
+  array args;
+  bool plugin_exists;
+  bool failed;
+  /* sent with EVAL after the server lost the script */
+  bool reloaded;
+  int queued;
+  int replies;
+  db_verify_cb cb;
+  void *data;
+};
+
+
+static void run_verify_free(struct run_verify *verify)
 {
-  redisReply *reply;
-  ssize_t argc = 0;
-  char *endptr;
-  long val;
+  api_free_string(verify->name);
+  api_free_array(verify->args);
+  FREE(verify);
+}
 
-  if (!rc) {
-    LOG_WARNING("No redis connection available!");
-    return (-1);
+
+static int db_run_script_send(redisAsyncContext *ac,
+    struct run_verify *verify, const char *sha);
+
+
+static void db_run_verify_finish(struct run_verify *verify,
+    redisReply *reply)
+{
+  db_verify_result result = DB_VERIFY_VALID;
+  object_type *types;
+  ssize_t argc = -1;
+
+  if (reply)
+    argc = db_function_parse_args(reply, &types);
+
+  if (verify->failed) {
+    result = DB_VERIFY_ERROR;
+  } else if (!verify->plugin_exists) {
+    result = DB_VERIFY_PLUGIN;
+  } else if (argc < 0) {
+    result = DB_VERIFY_FUNCTION;
   }
 
-  /* check whether enough arguments are passed */
-  if (((argc = db_function_get_argc(pluginkey, name)) < 0) ||
-      ((size_t)argc != (size_t)args->size)) {
-    LOG_WARNING("Invalid argument count!");
-    return (-1);
+  if (verify->plugin_exists && !verify->failed)
+    db_cache_plugin_put(verify->pluginkey);
+
+  if (argc >= 0) {
+    if (result == DB_VERIFY_VALID)
+      db_cache_function_put(verify->pluginkey, verify->name, types,
+          (size_t) argc);
+
+    if (result == DB_VERIFY_VALID &&
+        !db_signature_check(types, (size_t) argc, &verify->args))
+      result = DB_VERIFY_FUNCTION;
+
+    FREE(types);
   }
 
-  reply = redisCommand(rc, "LRANGE %s:func:%s:args 0 %d", pluginkey,
-            name.str, argc);
-
-  /* check every single argument */
-  if (reply->type == REDIS_REPLY_ARRAY)
-    for (size_t j = reply->elements, k = 0; j != 0; j--, k++) {
-
-      /* The argument types are of type int. However, they are stored
-       * in a redis list and redis list items are of type string. */
-      if (reply->element[j-1]->type != REDIS_REPLY_STRING) {
-        LOG_WARNING("Redis returned list element has wrong type.");
-        freeReplyObject(reply);
-        return (-1);
-      }
-
-      errno = 0;
-      val = strtol(reply->element[j-1]->str, &endptr, 10);
-
-      if (((errno == ERANGE) && ((val == LONG_MAX) || (val == LONG_MIN))) ||
-          ((errno != 0) && (val == 0))) {
-        LOG_WARNING("Redis function argument has wrong type.");
-        freeReplyObject(reply);
-        return (-1);
-      }
-
-      if (endptr == reply->element[j-1]->str) {
-        LOG_WARNING("Redis function argument has wrong type.");
-        freeReplyObject(reply);
-        return (-1);
-      }
-
-      if(val == OBJECT_TYPE_INT && args->items[k].type == OBJECT_TYPE_UINT){
-        /* Any positive integer will be treated as an unsigned int
-         * (see unpack/pack.c) and might be a valid signed integer */
-        if(args->items[k].data.uinteger > INT64_MAX){
-          LOG_WARNING("run() function argument has wrong type.");
-          freeReplyObject(reply);
-          return (-1);
-        }
-      } else if (val != args->items[k].type){
-        LOG_WARNING("run() function argument has wrong type.");
-        freeReplyObject(reply);
-        return (-1);
-      }
+  verify->cb(result, verify->data);
+  run_verify_free(verify);
+}
 
-    }
 
-  freeReplyObject(reply);
+static void db_run_script_cb(redisAsyncContext *ac, void *r, void *privdata)
+{
+  struct run_verify *verify = privdata;
+  redisReply *reply = r;
+  db_verify_result result = DB_VERIFY_ERROR;
+
+  /* the SHA stays valid, EVAL loads the script again under it */
+  if (db_script_missing(reply) && !verify->reloaded) {
+    verify->reloaded = true;
+
+    if (db_run_script_send(ac, verify, NULL) == 0)
+      return;
+  } else if (reply) {
+    result = db_script_result(reply, verify->pluginkey, verify->name);
+  }
 
-  return (0);
+  verify->cb(result, verify->data);
+  run_verify_free(verify);
 }
 
 
-int db_function_verify(char *pluginkey, string name,
-    array *args)
+/* sends EVALSHA, or EVAL with the source if `sha` is NULL */
+static int db_run_script_send(redisAsyncContext *ac,
+    struct run_verify *verify, const char *sha)
 {
-  if (!db_function_exists(pluginkey, name))
-    return (-1);
+  unsigned char *call;
+  int result;
+
+  call = MALLOC_ARRAY(verify->args.size ? verify->args.size : 1,
+      unsigned char);
 
-  if (db_function_typecheck(pluginkey, name, args) == -1)
+  if (!call)
     return (-1);
 
-  return (0);
+  db_script_call_types(&verify->args, call);
+
+  result = redisAsyncCommand(ac, db_run_script_cb, verify,
+      sha ? "EVALSHA %s 2 %s %s:func:%s:meta %b %d %d" :
+      "EVAL %s 2 %s %s:func:%s:meta %b %d %d",
+      sha ? sha : db_script_verify_source, verify->pluginkey,
+      verify->pluginkey, verify->name.str, call, verify->args.size,
+      OBJECT_TYPE_INT, OBJECT_TYPE_UINT);
+
+  FREE(call);
+
+  return result == REDIS_OK ? 0 : -1;
+}
+
+
+/* replies arrive in the order EXISTS, HGET */
+static void db_run_verify_cb(UNUSED(redisAsyncContext *ac), void *r,
+    void *privdata)
+{
+  struct run_verify *verify = privdata;
+  redisReply *reply = r;
+  int index = verify->replies++;
+
+  /* a NULL reply means the context is gone */
+  if (!reply || (reply->type == REDIS_REPLY_ERROR)) {
+    verify->failed = true;
+    reply = NULL;
+  } else if (index == 0) {
+    verify->plugin_exists = reply->type == REDIS_REPLY_INTEGER &&
+        reply->integer == 1;
+  }
+
+  if (verify->replies == verify->queued)
+    db_run_verify_finish(verify, index == 1 ? reply : NULL);
+}
+
+
+db_verify_result redis_run_verify(char *pluginkey, string name, array *args,
+    db_verify_cb cb, void *data)
+{
+  struct run_verify *verify;
+  redisAsyncContext *ac;
+  db_verify_result result;
+  const char *sha;
+  db_cache_result cached = db_cache_function_verify(pluginkey, name, args);
+
+  if (cached != DB_CACHE_MISS)
+    return cached == DB_CACHE_VALID ? DB_VERIFY_VALID : DB_VERIFY_FUNCTION;
+
+  db_shard_select(pluginkey);
+  ac = db_async_context();
+
+  if (!ac || !(verify = CALLOC(1, struct run_verify))) {
+    if (db_script_verify(pluginkey, name, args, &result) == 0)
+      return (result);
+
+    if (redis_plugin_verify(pluginkey) == -1)
+      return (DB_VERIFY_PLUGIN);
+
+    if (redis_function_verify(pluginkey, name, args) == -1)
+      return (DB_VERIFY_FUNCTION);
+
+    return (DB_VERIFY_VALID);
+  }
+
+  strlcpy(verify->pluginkey, pluginkey, sizeof(verify->pluginkey));
+  verify->name = cstring_copy_string(name.str);
+  verify->args = copy_object(ARRAY_OBJ(*args)).data.array;
+  verify->cb = cb;
+  verify->data = data;
+
+  /* the script is loaded by the context of the thread */
+  if ((sha = db_script_sha())) {
+    if (db_run_script_send(ac, verify, sha) == -1) {
+      run_verify_free(verify);
+      return (DB_VERIFY_ERROR);
+    }
+
+    return (DB_VERIFY_PENDING);
+  }
+
+  /* the connecting thread could not load it, later calls use it */
+  db_script_load_async(ac);
+
+  /* pipelined, they cost a single round trip */
+  if (redisAsyncCommand(ac, db_run_verify_cb, verify, "EXISTS %s",
+      pluginkey) != REDIS_OK) {
+    run_verify_free(verify);
+    return (DB_VERIFY_ERROR);
+  }
+
+  /* once a command is queued, its callback runs even if the context fails */
+  verify->queued = 1;
+
+  if (redisAsyncCommand(ac, db_run_verify_cb, verify,
+      "HGET %s:func:%s:meta " DB_FUNCTION_SIGNATURE, pluginkey,
+      verify->name.str) != REDIS_OK) {
+    verify->failed = true;
+    return (DB_VERIFY_PENDING);
+  }
+
+  verify->queued++;
+
+  return (DB_VERIFY_PENDING);
 }
@@ -0,0 +1,791 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>                   // for PATH_MAX
+#include <stdio.h>                    // for rename
+#include <stdlib.h>                   // for abort, NULL
+#include <string.h>
+#include <sys/stat.h>                 // for stat
+#include <unistd.h>                   // for unlink
+#include <msgpack.h>
+#include <uv.h>                       // for uv_rwlock_t, uv_once
+#ifdef __linux__
+#include <bsd/string.h>               // for strlcpy
+#endif
+#include "rpc/db/sb-db.h"
+#include "rpc/db/backend.h"
+#include "rpc/db/cache.h"             // for db_signature_check
+#include "sb-common.h"                // for MALLOC, FREE, STATIC
+
+/* format of the snapshot file, its first element */
+#define MEMORY_SNAPSHOT_VERSION 1
+/* the whitelist-all-symbol is a member of the authorized set */
+#define MEMORY_WHITELIST_ALL_SYM "*"
+#define MEMORY_AUTHORIZED_SIZE (CLIENTLONGTERMPK_ARRAY_SIZE * 2 + 1)
+
+struct memory_function {
+  char *name;
+  char *desc;
+  size_t argc;
+  object_type types[];
+};
+
+/*
+ * Like the Redis backend, functions are kept apart from the plugin entry: a
+ * plugin added again keeps its functions.
+ */
+struct memory_plugin {
+  char pluginkey[PLUGINKEY_STRING_SIZE];
+  /* false until the plugin entry itself was added */
+  bool added;
+  char *name;
+  char *desc;
+  char *author;
+  char *license;
+  /* name -> memory_function */
+  hashmap(cstr_t, ptr_t) *functions;
+};
+
+/* pluginkey -> memory_plugin */
+static hashmap(cstr_t, ptr_t) *plugins = NULL;
+/* member -> member, base16 encoded long-term keys */
+static hashmap(cstr_t, ptr_t) *authorized = NULL;
+static uv_once_t memory_once = UV_ONCE_INIT;
+static uv_rwlock_t memory_lock;
+/* serializes writers of the snapshot file */
+static uv_mutex_t snapshot_lock;
+static char *snapshot_path = NULL;
+/* bumped on every change, the snapshot is skipped if nothing changed */
+static uint64_t version = 0;
+static uint64_t saved_version = 0;
+
+STATIC void memory_lock_init(void);
+STATIC void memory_init(void);
+STATIC struct memory_plugin *store_plugin_get(const char *pluginkey);
+STATIC void store_plugin_free(struct memory_plugin *plugin);
+STATIC void function_free(struct memory_function *function);
+STATIC int plugin_set(struct memory_plugin *plugin, string name, string desc,
+    string author, string license);
+STATIC int function_put(struct memory_plugin *plugin, const char *name,
+    size_t name_len, const char *desc, size_t desc_len,
+    const object_type *types, size_t argc);
+STATIC int function_store(struct memory_plugin *plugin, array *func);
+STATIC struct memory_function *function_get(const char *pluginkey,
+    const char *name);
+STATIC int authorized_put(const char *member, size_t len);
+STATIC bool authorized_has(const char *member);
+STATIC void memory_clear(void);
+STATIC void snapshot_pack_str(msgpack_packer *pk, const char *str);
+STATIC void snapshot_pack_plugin(msgpack_packer *pk,
+    struct memory_plugin *plugin);
+STATIC void snapshot_pack(msgpack_packer *pk);
+STATIC int snapshot_unpack(msgpack_object *obj);
+STATIC int snapshot_load(const char *path);
+STATIC int memory_snapshot(void);
+STATIC int memory_thread_connect(void);
+STATIC void memory_close(void);
+STATIC int memory_async_connect(uv_loop_t *loop);
+STATIC int memory_plugin_add(char *pluginkey, string name, string desc,
+    string author, string license);
+STATIC int memory_plugin_register(char *pluginkey, string name, string desc,
+    string author, string license, array functions, size_t *rejected);
+STATIC int memory_plugin_verify(char *pluginkey);
+STATIC int memory_function_add(char *pluginkey, array *func);
+STATIC int memory_function_verify(char *pluginkey, string name, array *args);
+STATIC db_verify_result memory_run_verify(char *pluginkey, string name,
+    array *args, db_verify_cb cb, void *data);
+STATIC int memory_authorized_add(unsigned char *pluginlongtermpk);
+STATIC bool memory_authorized_verify(unsigned char *pluginlongtermpk);
+STATIC int memory_authorized_set_whitelist_all(void);
+STATIC bool memory_authorized_whitelist_all_is_set(void);
+
+STATIC void memory_lock_init(void)
+{
+  if (uv_rwlock_init(&memory_lock) != 0 || uv_mutex_init(&snapshot_lock) != 0)
+    abort();
+
+  plugins = hashmap_new(cstr_t, ptr_t)();
+  authorized = hashmap_new(cstr_t, ptr_t)();
+
+  if (!plugins || !authorized)
+    abort();
+}
+
+/* the memory lock is held for writing */
+STATIC struct memory_plugin *store_plugin_get(const char *pluginkey)
+{
+  struct memory_plugin *plugin = hashmap_get(cstr_t, ptr_t)(plugins,
+      pluginkey);
+
+  if (plugin)
+    return plugin;
+
+  plugin = CALLOC(1, struct memory_plugin);
+  if (!plugin)
+    return NULL;
+
+  strlcpy(plugin->pluginkey, pluginkey, sizeof(plugin->pluginkey));
+  plugin->functions = hashmap_new(cstr_t, ptr_t)();
+  if (!plugin->functions) {
+    FREE(plugin);
+    return NULL;
+  }
+
+  hashmap_put(cstr_t, ptr_t)(plugins, plugin->pluginkey, plugin);
+
+  return plugin;
+}
+
+STATIC void function_free(struct memory_function *function)
+{
+  FREE(function->name);
+  FREE(function->desc);
+  FREE(function);
+}
+
+STATIC void store_plugin_free(struct memory_plugin *plugin)
+{
+  struct memory_function *function;
+
+  hashmap_foreach_value(plugin->functions, function, {
+    function_free(function);
+  });
+  hashmap_free(cstr_t, ptr_t)(plugin->functions);
+  FREE(plugin->name);
+  FREE(plugin->desc);
+  FREE(plugin->author);
+  FREE(plugin->license);
+  FREE(plugin);
+}
+
+/* the memory lock is held for writing */
+STATIC int plugin_set(struct memory_plugin *plugin, string name, string desc,
+    string author, string license)
+{
+  char *n = box_strndup(name.str, name.length);
+  char *d = box_strndup(desc.str, desc.length);
+  char *a = box_strndup(author.str, author.length);
+  char *l = box_strndup(license.str, license.length);
+
+  if (!n || !d || !a || !l) {
+    FREE(n);
+    FREE(d);
+    FREE(a);
+    FREE(l);
+    return (-1);
+  }
+
+  FREE(plugin->name);
+  FREE(plugin->desc);
+  FREE(plugin->author);
+  FREE(plugin->license);
+
+  plugin->name = n;
+  plugin->desc = d;
+  plugin->author = a;
+  plugin->license = l;
+  plugin->added = true;
+  version++;
+
+  return (0);
+}
+
+/* the memory lock is held for writing, a function of the same name is
+ * replaced */
+STATIC int function_put(struct memory_plugin *plugin, const char *name,
+    size_t name_len, const char *desc, size_t desc_len,
+    const object_type *types, size_t argc)
+{
+  struct memory_function *function, *old;
+
+  function = malloc(sizeof(*function) + argc * sizeof(object_type));
+  if (!function)
+    return (-1);
+
+  function->name = box_strndup(name, name_len);
+  function->desc = box_strndup(desc, desc_len);
+  if (!function->name || !function->desc) {
+    function_free(function);
+    return (-1);
+  }
+
+  function->argc = argc;
+  for (size_t i = 0; i < argc; i++)
+    function->types[i] = types[i];
+
+  old = hashmap_get(cstr_t, ptr_t)(plugin->functions, function->name);
+  if (old) {
+    hashmap_del(cstr_t, ptr_t)(plugin->functions, old->name);
+    function_free(old);
+  }
+
+  hashmap_put(cstr_t, ptr_t)(plugin->functions, function->name, function);
+  version++;
+
+  return (0);
+}
+
+/* the memory lock is held for writing */
+STATIC int function_store(struct memory_plugin *plugin, array *func)
+{
+  object_type *types;
+  string name, desc;
+  array *args;
+  int result;
+
+  if (db_function_parse(func, &name, &desc, &args) == -1)
+    return (-1);
+
+  types = MALLOC_ARRAY(args->size ? args->size : 1, object_type);
+  if (!types)
+    return (-1);
+
+  for (size_t i = 0; i < args->size; i++)
+    types[i] = args->items[i].type;
+
+  result = function_put(plugin, name.str, name.length, desc.str, desc.length,
+      types, args->size);
+  FREE(types);
+
+  return (result);
+}
+
+/* the memory lock is held */
+STATIC struct memory_function *function_get(const char *pluginkey,
+    const char *name)
+{
+  struct memory_plugin *plugin = hashmap_get(cstr_t, ptr_t)(plugins,
+      pluginkey);
+
+  if (!plugin)
+    return NULL;
+
+  return hashmap_get(cstr_t, ptr_t)(plugin->functions, name);
+}
+
+/* the memory lock is held for writing */
+STATIC int authorized_put(const char *member, size_t len)
+{
+  char *m;
+
+  if (hashmap_has(cstr_t, ptr_t)(authorized, member))
+    return (0);
+
+  m = box_strndup(member, len);
+  if (!m)
+    return (-1);
+
+  hashmap_put(cstr_t, ptr_t)(authorized, m, m);
+  version++;
+
+  return (0);
+}
+
+STATIC bool authorized_has(const char *member)
+{
+  bool found;
+
+  memory_init();
+
+  uv_rwlock_rdlock(&memory_lock);
+  found = hashmap_has(cstr_t, ptr_t)(authorized, member);
+  uv_rwlock_rdunlock(&memory_lock);
+
+  return found;
+}
+
+/* the memory lock is held for writing */
+STATIC void memory_clear(void)
+{
+  struct memory_plugin *plugin;
+  char *member;
+
+  hashmap_foreach_value(plugins, plugin, {
+    store_plugin_free(plugin);
+  });
+  hashmap_clear(cstr_t, ptr_t)(plugins);
+
+  hashmap_foreach_value(authorized, member, {
+    FREE(member);
+  });
+  hashmap_clear(cstr_t, ptr_t)(authorized);
+}
+
+STATIC void snapshot_pack_str(msgpack_packer *pk, const char *str)
+{
+  if (!str) {
+    msgpack_pack_nil(pk);
+    return;
+  }
+
+  msgpack_pack_str(pk, strlen(str));
+  msgpack_pack_str_body(pk, str, strlen(str));
+}
+
+/* [pluginkey, added, name, desc, author, license, [[name, desc, [types]]]] */
+STATIC void snapshot_pack_plugin(msgpack_packer *pk,
+    struct memory_plugin *plugin)
+{
+  struct memory_function *function;
+
+  msgpack_pack_array(pk, 7);
+  snapshot_pack_str(pk, plugin->pluginkey);
+  if (plugin->added)
+    msgpack_pack_true(pk);
+  else
+    msgpack_pack_false(pk);
+  snapshot_pack_str(pk, plugin->name);
+  snapshot_pack_str(pk, plugin->desc);
+  snapshot_pack_str(pk, plugin->author);
+  snapshot_pack_str(pk, plugin->license);
+
+  msgpack_pack_array(pk, kh_size(plugin->functions->table));
+  hashmap_foreach_value(plugin->functions, function, {
+    msgpack_pack_array(pk, 3);
+    snapshot_pack_str(pk, function->name);
+    snapshot_pack_str(pk, function->desc);
+    msgpack_pack_array(pk, function->argc);
+    for (size_t i = 0; i < function->argc; i++)
+      msgpack_pack_uint64(pk, function->types[i]);
+  });
+}
+
+/* [version, [plugins], [authorized]], the memory lock is held */
+STATIC void snapshot_pack(msgpack_packer *pk)
+{
+  struct memory_plugin *plugin;
+  char *member;
+
+  msgpack_pack_array(pk, 3);
+  msgpack_pack_uint64(pk, MEMORY_SNAPSHOT_VERSION);
+
+  msgpack_pack_array(pk, kh_size(plugins->table));
+  hashmap_foreach_value(plugins, plugin, {
+    snapshot_pack_plugin(pk, plugin);
+  });
+
+  msgpack_pack_array(pk, kh_size(authorized->table));
+  hashmap_foreach_value(authorized, member, {
+    snapshot_pack_str(pk, member);
+  });
+}
+
+#define SNAPSHOT_IS(obj, t) ((obj).type == MSGPACK_OBJECT_##t)
+#define SNAPSHOT_STR(obj) \
+  ((string) {.str = (char *) (obj).via.str.ptr, .length = (obj).via.str.size})
+
+/* the memory lock is held for writing */
+STATIC int snapshot_unpack(msgpack_object *obj)
+{
+  msgpack_object *p, *f, *t;
+  struct memory_plugin *plugin;
+  object_type *types;
+  char pluginkey[PLUGINKEY_STRING_SIZE];
+  int result;
+
+  if (!SNAPSHOT_IS(*obj, ARRAY) || obj->via.array.size != 3 ||
+      !SNAPSHOT_IS(obj->via.array.ptr[0], POSITIVE_INTEGER) ||
+      obj->via.array.ptr[0].via.u64 != MEMORY_SNAPSHOT_VERSION ||
+      !SNAPSHOT_IS(obj->via.array.ptr[1], ARRAY) ||
+      !SNAPSHOT_IS(obj->via.array.ptr[2], ARRAY))
+    return (-1);
+
+  for (uint32_t i = 0; i < obj->via.array.ptr[1].via.array.size; i++) {
+    p = obj->via.array.ptr[1].via.array.ptr[i].via.array.ptr;
+
+    if (!SNAPSHOT_IS(obj->via.array.ptr[1].via.array.ptr[i], ARRAY) ||
+        obj->via.array.ptr[1].via.array.ptr[i].via.array.size != 7 ||
+        !SNAPSHOT_IS(p[0], STR) || p[0].via.str.size >= sizeof(pluginkey) ||
+        !SNAPSHOT_IS(p[1], BOOLEAN) || !SNAPSHOT_IS(p[6], ARRAY))
+      return (-1);
+
+    memcpy(pluginkey, p[0].via.str.ptr, p[0].via.str.size);
+    pluginkey[p[0].via.str.size] = '\0';
+
+    if (!(plugin = store_plugin_get(pluginkey)))
+      return (-1);
+
+    if (p[1].via.boolean) {
+      if (!SNAPSHOT_IS(p[2], STR) || !SNAPSHOT_IS(p[3], STR) ||
+          !SNAPSHOT_IS(p[4], STR) || !SNAPSHOT_IS(p[5], STR) ||
+          plugin_set(plugin, SNAPSHOT_STR(p[2]), SNAPSHOT_STR(p[3]),
+          SNAPSHOT_STR(p[4]), SNAPSHOT_STR(p[5])) == -1)
+        return (-1);
+    }
+
+    for (uint32_t j = 0; j < p[6].via.array.size; j++) {
+      f = p[6].via.array.ptr[j].via.array.ptr;
+
+      if (!SNAPSHOT_IS(p[6].via.array.ptr[j], ARRAY) ||
+          p[6].via.array.ptr[j].via.array.size != 3 ||
+          !SNAPSHOT_IS(f[0], STR) || !SNAPSHOT_IS(f[1], STR) ||
+          !SNAPSHOT_IS(f[2], ARRAY))
+        return (-1);
+
+      types = MALLOC_ARRAY(f[2].via.array.size ? f[2].via.array.size : 1,
+          object_type);
+      if (!types)
+        return (-1);
+
+      t = f[2].via.array.ptr;
+      for (uint32_t k = 0; k < f[2].via.array.size; k++) {
+        if (!SNAPSHOT_IS(t[k], POSITIVE_INTEGER)) {
+          FREE(types);
+          return (-1);
+        }
+        types[k] = (object_type) t[k].via.u64;
+      }
+
+      result = function_put(plugin, f[0].via.str.ptr, f[0].via.str.size,
+          f[1].via.str.ptr, f[1].via.str.size, types, f[2].via.array.size);
+      FREE(types);
+
+      if (result == -1)
+        return (-1);
+    }
+  }
+
+  for (uint32_t i = 0; i < obj->via.array.ptr[2].via.array.size; i++) {
+    t = &obj->via.array.ptr[2].via.array.ptr[i];
+
+    if (!SNAPSHOT_IS(*t, STR) ||
+        authorized_put(t->via.str.ptr, t->via.str.size) == -1)
+      return (-1);
+  }
+
+  return (0);
+}
+
+/* the memory lock is held for writing */
+STATIC int snapshot_load(const char *path)
+{
+  msgpack_unpacked unpacked;
+  struct stat st;
+  char *buf;
+  size_t off = 0;
+  int result = -1;
+
+  if (stat(path, &st) == -1)
+    return errno == ENOENT ? 0 : -1;
+
+  if (st.st_size == 0)
+    return (0);
+
+  buf = MALLOC_ARRAY((size_t) st.st_size, char);
+  if (!buf)
+    return (-1);
+
+  if (filesystem_load(path, buf, (size_t) st.st_size) == -1) {
+    FREE(buf);
+    return (-1);
+  }
+
+  msgpack_unpacked_init(&unpacked);
+
+  if (msgpack_unpack_next(&unpacked, buf, (size_t) st.st_size, &off) ==
+      MSGPACK_UNPACK_SUCCESS)
+    result = snapshot_unpack(&unpacked.data);
+
+  msgpack_unpacked_destroy(&unpacked);
+  FREE(buf);
+
+  return (result);
+}
+
+STATIC void memory_init(void)
+{
+  uv_once(&memory_once, memory_lock_init);
+}
+
+int db_memory_open(const char *snapshot)
+{
+  int result = 0;
+
+  memory_init();
+
+  uv_mutex_lock(&snapshot_lock);
+  uv_rwlock_wrlock(&memory_lock);
+  memory_clear();
+  FREE(snapshot_path);
+
+  if (snapshot) {
+    snapshot_path = box_strdup(snapshot);
+
+    if (!snapshot_path || snapshot_load(snapshot) == -1) {
+      LOG_WARNING("Failed to load the database snapshot %s.\n", snapshot);
+      memory_clear();
+      result = -1;
+    }
+  }
+
+  saved_version = version;
+  uv_rwlock_wrunlock(&memory_lock);
+  uv_mutex_unlock(&snapshot_lock);
+
+  if (result == 0)
+    db_backend_set(&db_backend_memory);
+
+  return (result);
+}
+
+STATIC int memory_snapshot(void)
+{
+  msgpack_sbuffer sbuf;
+  msgpack_packer pk;
+  char tmp[PATH_MAX];
+  uint64_t packed;
+  int result = 0;
+
+  memory_init();
+
+  uv_mutex_lock(&snapshot_lock);
+  uv_rwlock_rdlock(&memory_lock);
+
+  if (!snapshot_path || version == saved_version) {
+    uv_rwlock_rdunlock(&memory_lock);
+    uv_mutex_unlock(&snapshot_lock);
+    return (0);
+  }
+
+  msgpack_sbuffer_init(&sbuf);
+  msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+  snapshot_pack(&pk);
+  packed = version;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", snapshot_path) >=
+      (int) sizeof(tmp))
+    result = -1;
+
+  uv_rwlock_rdunlock(&memory_lock);
+
+  /* a crash while writing leaves the last snapshot intact */
+  if (result == 0 && ((unlink(tmp) == -1 && errno != ENOENT) ||
+      filesystem_save_sync(tmp, sbuf.data, sbuf.size) == -1 ||
+      rename(tmp, snapshot_path) == -1))
+    result = -1;
+
+  if (result == 0)
+    saved_version = packed;
+  else
+    LOG_WARNING("Failed to save the database snapshot %s.\n", snapshot_path);
+
+  msgpack_sbuffer_destroy(&sbuf);
+  uv_mutex_unlock(&snapshot_lock);
+
+  return (result);
+}
+
+STATIC int memory_thread_connect(void)
+{
+  memory_init();
+  return (0);
+}
+
+STATIC void memory_close(void)
+{
+  /* the store is shared by all threads and lives as long as the process */
+}
+
+/* run calls are verified right away, the loop needs no connection */
+STATIC int memory_async_connect(UNUSED(uv_loop_t *loop))
+{
+  return (0);
+}
+
+STATIC int memory_plugin_add(char *pluginkey, string name, string desc,
+    string author, string license)
+{
+  struct memory_plugin *plugin;
+  int result = -1;
+
+  if (name.length < DB_PLUGIN_MIN_LEN_NAME) {
+    LOG_WARNING("Name length should be greater than %d.\n",
+        DB_PLUGIN_MIN_LEN_NAME);
+    return (-1);
+  }
+
+  memory_init();
+
+  uv_rwlock_wrlock(&memory_lock);
+  if ((plugin = store_plugin_get(pluginkey)))
+    result = plugin_set(plugin, name, desc, author, license);
+  uv_rwlock_wrunlock(&memory_lock);
+
+  return (result);
+}
+
+STATIC int memory_plugin_register(char *pluginkey, string name, string desc,
+    string author, string license, array functions, size_t *rejected)
+{
+  struct memory_plugin *plugin;
+  object *func;
+  int result = -1;
+
+  *rejected = 0;
+
+  if (name.length < DB_PLUGIN_MIN_LEN_NAME) {
+    LOG_WARNING("Name length should be greater than %d.\n",
+        DB_PLUGIN_MIN_LEN_NAME);
+    return (-1);
+  }
+
+  memory_init();
+
+  /* other threads see the plugin with all of its functions or not at all */
+  uv_rwlock_wrlock(&memory_lock);
+
+  if ((plugin = store_plugin_get(pluginkey)) &&
+      plugin_set(plugin, name, desc, author, license) == 0) {
+    result = 0;
+
+    /* invalid functions are skipped, the others are registered anyway */
+    for (size_t i = 0; i < functions.size; i++) {
+      func = &functions.items[i];
+
+      if (func->type != OBJECT_TYPE_ARRAY ||
+          function_store(plugin, &func->data.array) == -1)
+        (*rejected)++;
+    }
+  }
+
+  uv_rwlock_wrunlock(&memory_lock);
+
+  return (result);
+}
+
+STATIC int memory_plugin_verify(char *pluginkey)
+{
+  struct memory_plugin *plugin;
+  bool added;
+
+  memory_init();
+
+  uv_rwlock_rdlock(&memory_lock);
+  plugin = hashmap_get(cstr_t, ptr_t)(plugins, pluginkey);
+  added = plugin && plugin->added;
+  uv_rwlock_rdunlock(&memory_lock);
+
+  return added ? 0 : -1;
+}
+
+STATIC int memory_function_add(char *pluginkey, array *func)
+{
+  struct memory_plugin *plugin;
+  int result = -1;
+
+  memory_init();
+
+  uv_rwlock_wrlock(&memory_lock);
+  if ((plugin = store_plugin_get(pluginkey)))
+    result = function_store(plugin, func);
+  uv_rwlock_wrunlock(&memory_lock);
+
+  return (result);
+}
+
+STATIC int memory_function_verify(char *pluginkey, string name, array *args)
+{
+  struct memory_function *function;
+  bool valid = false;
+
+  memory_init();
+
+  uv_rwlock_rdlock(&memory_lock);
+  function = function_get(pluginkey, name.str);
+  if (function)
+    valid = db_signature_check(function->types, function->argc, args);
+  uv_rwlock_rdunlock(&memory_lock);
+
+  return valid ? 0 : -1;
+}
+
+/* never pending, the store answers right away */
+STATIC db_verify_result memory_run_verify(char *pluginkey, string name,
+    array *args, UNUSED(db_verify_cb cb), UNUSED(void *data))
+{
+  if (memory_plugin_verify(pluginkey) == -1)
+    return DB_VERIFY_PLUGIN;
+
+  if (memory_function_verify(pluginkey, name, args) == -1)
+    return DB_VERIFY_FUNCTION;
+
+  return DB_VERIFY_VALID;
+}
+
+STATIC int memory_authorized_add(unsigned char *pluginlongtermpk)
+{
+  char member[MEMORY_AUTHORIZED_SIZE];
+  int result;
+
+  base16_encode(member, sizeof(member), (char *) pluginlongtermpk,
+      CLIENTLONGTERMPK_ARRAY_SIZE);
+
+  memory_init();
+
+  uv_rwlock_wrlock(&memory_lock);
+  result = authorized_put(member, strlen(member));
+  uv_rwlock_wrunlock(&memory_lock);
+
+  return (result);
+}
+
+STATIC bool memory_authorized_verify(unsigned char *pluginlongtermpk)
+{
+  char member[MEMORY_AUTHORIZED_SIZE];
+
+  base16_encode(member, sizeof(member), (char *) pluginlongtermpk,
+      CLIENTLONGTERMPK_ARRAY_SIZE);
+
+  return authorized_has(member);
+}
+
+STATIC int memory_authorized_set_whitelist_all(void)
+{
+  int result;
+
+  memory_init();
+
+  uv_rwlock_wrlock(&memory_lock);
+  result = authorized_put(MEMORY_WHITELIST_ALL_SYM,
+      strlen(MEMORY_WHITELIST_ALL_SYM));
+  uv_rwlock_wrunlock(&memory_lock);
+
+  return (result);
+}
+
+STATIC bool memory_authorized_whitelist_all_is_set(void)
+{
+  return authorized_has(MEMORY_WHITELIST_ALL_SYM);
+}
+
+const struct db_backend db_backend_memory = {
+  .name = "memory",
+  .thread_connect = memory_thread_connect,
+  .close = memory_close,
+  .async_connect = memory_async_connect,
+  .plugin_add = memory_plugin_add,
+  .plugin_register = memory_plugin_register,
+  .plugin_verify = memory_plugin_verify,
+  .function_add = memory_function_add,
+  .function_verify = memory_function_verify,
+  .run_verify = memory_run_verify,
+  .authorized_add = memory_authorized_add,
+  .authorized_verify = memory_authorized_verify,
+  .authorized_set_whitelist_all = memory_authorized_set_whitelist_all,
+  .authorized_whitelist_all_is_set = memory_authorized_whitelist_all_is_set,
+  .snapshot = memory_snapshot
+};
@@ -0,0 +1,115 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <hiredis/hiredis.h>
+#include <stdarg.h>
+
+#include "rpc/db/sb-db.h"
+#include "rpc/db/pipeline.h"
+#include "sb-common.h"
+
+/* commands appended since MULTI, including MULTI */
+static __thread size_t queued = 0;
+
+int db_multi(void)
+{
+  if (!db_context())
+    return (-1);
+
+  if (redisAppendCommand(rc, "MULTI") != REDIS_OK)
+    return (-1);
+
+  queued = 1;
+
+  return (0);
+}
+
+int db_queue(const char *format, ...)
+{
+  va_list ap;
+  int result;
+
+  if (!rc || queued == 0)
+    return (-1);
+
+  va_start(ap, format);
+  result = redisvAppendCommand(rc, format, ap);
+  va_end(ap);
+
+  if (result != REDIS_OK)
+    return (-1);
+
+  queued++;
+
+  return (0);
+}
+
+int db_exec(void)
+{
+  redisReply *reply;
+  size_t pending;
+  int result = 0;
+
+  if (!rc || queued == 0)
+    return (-1);
+
+  pending = queued;
+  queued = 0;
+
+  if (redisAppendCommand(rc, "EXEC") != REDIS_OK) {
+    db_context_drop();
+    return (-1);
+  }
+
+  /* MULTI and the commands answer OK and QUEUED, errors abort the EXEC */
+  for (size_t i = 0; i < pending; i++) {
+    if (redisGetReply(rc, (void **) &reply) != REDIS_OK) {
+      db_context_drop();
+      return (-1);
+    }
+
+    if (reply->type == REDIS_REPLY_ERROR) {
+      LOG_WARNING("Redis failed to queue command: %s", reply->str);
+      result = -1;
+    }
+
+    freeReplyObject(reply);
+  }
+
+  if (redisGetReply(rc, (void **) &reply) != REDIS_OK) {
+    db_context_drop();
+    return (-1);
+  }
+
+  if (reply->type != REDIS_REPLY_ARRAY) {
+    LOG_WARNING("Redis failed to execute transaction: %s",
+        reply->type == REDIS_REPLY_ERROR ? reply->str : "aborted");
+    freeReplyObject(reply);
+    return (-1);
+  }
+
+  for (size_t i = 0; i < reply->elements; i++) {
+    if (reply->element[i]->type == REDIS_REPLY_ERROR) {
+      LOG_WARNING("Redis command of transaction failed: %s",
+          reply->element[i]->str);
+      result = -1;
+    }
+  }
+
+  freeReplyObject(reply);
+
+  return (result);
+}
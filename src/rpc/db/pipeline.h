@@ -0,0 +1,65 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>         // for size_t
+#include "rpc/sb-rpc.h"     // for array, string
+
+/*
+ * Commands of a transaction are appended to the output buffer of the
+ * thread's context and sent with EXEC, so the whole transaction costs one
+ * round trip and is applied atomically.
+ */
+
+/** Start a transaction on the thread's context. */
+int db_multi(void);
+
+/** Queue a command of the transaction started by db_multi(). */
+int db_queue(const char *format, ...);
+
+/**
+ * Send the transaction and read the replies.
+ *
+ * @return 0 if every command succeeded, otherwise -1
+ */
+int db_exec(void);
+
+/**
+ * Validate a function and queue the commands storing it.
+ *
+ * @return 0 on success, -1 if the function is not valid
+ */
+int db_function_queue(char *pluginkey, array *func);
+
+/*
+ * Field of the plugin hash holding the content hash of its last
+ * registration, and the hashes of its functions by name in
+ * <pluginkey>:func:hashes.
+ */
+#define DB_PLUGIN_HASH "hash"
+#define DB_HASH_SIZE crypto_hash_BYTES
+
+/**
+ * Hash what db_function_queue() stores of a function.
+ *
+ * @param hash  DB_HASH_SIZE bytes
+ * @return 0 on success, -1 if the function is not valid
+ */
+int db_function_hash(array *func, unsigned char *hash);
+
+/** Add a function stored by a successful transaction to the cache. */
+void db_function_cache(char *pluginkey, array *func);
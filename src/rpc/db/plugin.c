@@ -21,28 +21,42 @@
 #include <time.h>
 
 #include "rpc/db/sb-db.h"
+#include "rpc/db/backend.h"
+#include "rpc/db/cache.h"
+#include "rpc/db/pipeline.h"
+#include "rpc/msgpack/helpers.h"
 #include "sb-common.h"
 
-#define MIN_LEN_NAME 3
+STATIC void db_plugin_hash(string name, string desc, string author,
+    string license, unsigned char *hashes, bool *valid, size_t count,
+    unsigned char *hash);
+STATIC bool db_hash_equal(redisReply *reply, unsigned char *hash);
+STATIC redisReply *db_function_hashes(char *pluginkey);
+STATIC bool db_function_unchanged(redisReply *stored, string name,
+    unsigned char *hash);
 
 
-int db_plugin_add(char *pluginkey, string name, string desc, string author,
+int redis_plugin_add(char *pluginkey, string name, string desc, string author,
     string license)
 {
   redisReply *reply;
 
   LOG_VERBOSE(VERBOSE_LEVEL_0, "adding plugin..");
 
-  if (!rc)
-    return (-1);
+  db_shard_select(pluginkey);
 
-  if (name.length < MIN_LEN_NAME) {
-    LOG_WARNING("Name length should be greater than %d.\n", MIN_LEN_NAME);
+  if (name.length < DB_PLUGIN_MIN_LEN_NAME) {
+    LOG_WARNING("Name length should be greater than %d.\n", DB_PLUGIN_MIN_LEN_NAME);
     return (-1);
   }
 
-  reply = redisCommand(rc, "HMSET %s name %s desc %s author %s license %s",
-          pluginkey, name.str, desc.str, author.str, license.str);
+  /* an empty hash never matches, the next registration writes everything */
+  reply = db_command("HMSET %s name %s desc %s author %s license %s "
+          DB_PLUGIN_HASH " %s", pluginkey, name.str, desc.str, author.str,
+          license.str, "");
+
+  if (!reply)
+    return (-1);
 
   if (reply->type == REDIS_REPLY_ERROR) {
     LOG_WARNING("Redis failed to add string value to plugin: %s\n", reply->str);
@@ -51,20 +65,220 @@ int db_plugin_add(char *pluginkey, string name, string desc, string author,
   }
 
   freeReplyObject(reply);
+
+  /* the functions are registered again */
+  db_cache_plugin_reset(pluginkey);
+  db_cache_publish(pluginkey);
+
   LOG_VERBOSE(VERBOSE_LEVEL_0, ANSI_COLOR_GREEN "done\n" ANSI_COLOR_RESET);
   return (0);
 }
 
 
-int db_plugin_verify(char *pluginkey)
+/* hashes the plugin entry and the hashes of its valid functions in order */
+STATIC void db_plugin_hash(string name, string desc, string author,
+    string license, unsigned char *hashes, bool *valid, size_t count,
+    unsigned char *hash)
+{
+  msgpack_sbuffer sbuf;
+  msgpack_packer pk;
+  size_t nvalid = 0;
+
+  for (size_t i = 0; i < count; i++)
+    nvalid += valid[i];
+
+  msgpack_sbuffer_init(&sbuf);
+  msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+
+  msgpack_pack_array(&pk, 5);
+  msgpack_rpc_from_string(name, &pk);
+  msgpack_rpc_from_string(desc, &pk);
+  msgpack_rpc_from_string(author, &pk);
+  msgpack_rpc_from_string(license, &pk);
+  msgpack_pack_array(&pk, nvalid);
+
+  for (size_t i = 0; i < count; i++) {
+    if (valid[i]) {
+      msgpack_pack_bin(&pk, DB_HASH_SIZE);
+      msgpack_pack_bin_body(&pk, hashes + i * DB_HASH_SIZE, DB_HASH_SIZE);
+    }
+  }
+
+  crypto_hash(hash, (unsigned char *) sbuf.data, sbuf.size);
+  msgpack_sbuffer_destroy(&sbuf);
+}
+
+
+/* @return true if the stored field equals `hash` */
+STATIC bool db_hash_equal(redisReply *reply, unsigned char *hash)
+{
+  return reply && (reply->type == REDIS_REPLY_STRING) &&
+      (reply->len == DB_HASH_SIZE) &&
+      (memcmp(reply->str, hash, DB_HASH_SIZE) == 0);
+}
+
+
+/* @return the hashes of the stored functions by name, NULL on failure */
+STATIC redisReply *db_function_hashes(char *pluginkey)
+{
+  redisReply *reply = db_command("HGETALL %s:func:hashes", pluginkey);
+
+  if (reply && ((reply->type != REDIS_REPLY_ARRAY) ||
+      (reply->elements % 2 != 0))) {
+    freeReplyObject(reply);
+    return NULL;
+  }
+
+  return reply;
+}
+
+
+/* @return true if the stored function hash equals `hash` */
+STATIC bool db_function_unchanged(redisReply *stored, string name,
+    unsigned char *hash)
+{
+  redisReply *key;
+
+  for (size_t i = 0; i + 1 < stored->elements; i += 2) {
+    key = stored->element[i];
+
+    if ((key->type == REDIS_REPLY_STRING) && ((size_t) key->len ==
+        name.length) && (memcmp(key->str, name.str, name.length) == 0))
+      return db_hash_equal(stored->element[i + 1], hash);
+  }
+
+  return false;
+}
+
+
+int redis_plugin_register(char *pluginkey, string name, string desc,
+    string author, string license, array functions, size_t *rejected)
+{
+  unsigned char *hashes;
+  unsigned char hash[DB_HASH_SIZE];
+  redisReply *reply, *stored = NULL;
+  object *func;
+  string fname;
+  bool *valid;
+  int result = -1;
+
+  *rejected = 0;
+
+  db_shard_select(pluginkey);
+
+  if (!db_context())
+    return (-1);
+
+  if (name.length < DB_PLUGIN_MIN_LEN_NAME) {
+    LOG_WARNING("Name length should be greater than %d.\n", DB_PLUGIN_MIN_LEN_NAME);
+    return (-1);
+  }
+
+  valid = CALLOC(functions.size ? functions.size : 1, bool);
+  hashes = CALLOC((functions.size ? functions.size : 1) * DB_HASH_SIZE,
+      unsigned char);
+
+  if (!valid || !hashes)
+    goto out;
+
+  /* invalid functions are skipped, the others are registered anyway */
+  for (size_t i = 0; i < functions.size; i++) {
+    func = &functions.items[i];
+
+    valid[i] = func->type == OBJECT_TYPE_ARRAY &&
+        db_function_hash(&func->data.array, hashes + i * DB_HASH_SIZE) == 0;
+
+    if (!valid[i])
+      (*rejected)++;
+  }
+
+  db_plugin_hash(name, desc, author, license, hashes, valid, functions.size,
+      hash);
+
+  /* a plugin reconnecting with the same payload writes nothing */
+  reply = db_command("HGET %s " DB_PLUGIN_HASH, pluginkey);
+
+  if (!reply)
+    goto out;
+
+  if (db_hash_equal(reply, hash)) {
+    freeReplyObject(reply);
+    result = 0;
+    goto cache;
+  }
+
+  freeReplyObject(reply);
+
+  /* otherwise only the functions that differ are written */
+  if (!(stored = db_function_hashes(pluginkey)))
+    goto out;
+
+  if (db_multi() == -1 ||
+      db_queue("HMSET %s name %s desc %s author %s license %s "
+      DB_PLUGIN_HASH " %b", pluginkey, name.str, desc.str, author.str,
+      license.str, hash, (size_t) DB_HASH_SIZE) == -1) {
+    db_exec();
+    goto out;
+  }
+
+  for (size_t i = 0; i < functions.size; i++) {
+    if (!valid[i])
+      continue;
+
+    func = &functions.items[i];
+    fname = func->data.array.items[0].data.string;
+
+    if (db_function_unchanged(stored, fname, hashes + i * DB_HASH_SIZE))
+      continue;
+
+    if ((db_function_queue(pluginkey, &func->data.array) == -1) ||
+        (db_queue("HSET %s:func:hashes %s %b", pluginkey, fname.str,
+        hashes + i * DB_HASH_SIZE, (size_t) DB_HASH_SIZE) == -1)) {
+      db_exec();
+      goto out;
+    }
+  }
+
+  if (db_exec() == -1) {
+    LOG_WARNING("Redis failed to register plugin.\n");
+    goto out;
+  }
+
+  /* other cores drop what they cached of the previous registration */
+  db_cache_publish(pluginkey);
+  result = 0;
+
+cache:
+  db_cache_plugin_reset(pluginkey);
+
+  for (size_t i = 0; i < functions.size; i++) {
+    if (valid[i])
+      db_function_cache(pluginkey, &functions.items[i].data.array);
+  }
+
+out:
+  if (stored)
+    freeReplyObject(stored);
+  FREE(valid);
+  FREE(hashes);
+
+  return (result);
+}
+
+
+int redis_plugin_verify(char *pluginkey)
 {
   redisReply *reply;
   bool valid = false;
 
-  if (!rc)
-    return (-1);
+  if (db_cache_plugin_has(pluginkey))
+    return (0);
 
-  reply = redisCommand(rc, "Exists %s", pluginkey);
+  db_shard_select(pluginkey);
+  reply = db_command("EXISTS %s", pluginkey);
+
+  if (!reply)
+    return (-1);
 
   if (reply->type != REDIS_REPLY_INTEGER)
     LOG_WARNING("Redis failed to query plugin key existence: %s", reply->str);
@@ -76,5 +290,7 @@ int db_plugin_verify(char *pluginkey)
   if (!valid)
     return (-1);
 
+  db_cache_plugin_put(pluginkey);
+
   return (0);
 }
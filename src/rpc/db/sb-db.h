@@ -16,9 +16,47 @@
 
 #pragma once
 
+#include <hiredis/async.h>
+#include <uv.h>
+
 #include "rpc/sb-rpc.h"
 
-redisContext *rc;
+/*
+ * hiredis contexts are not thread-safe, every thread uses its own. Context
+ * of the server selected by db_shard_use().
+ */
+extern __thread redisContext *rc;
+
+/*
+ * Context whose replies are read by the event loop of the thread, NULL on
+ * threads without one. Used where a blocking call would stall plugins.
+ */
+extern __thread redisAsyncContext *arc;
+
+typedef enum {
+  DB_VERIFY_VALID = 0,
+  /* the plugin key is not registered */
+  DB_VERIFY_PLUGIN,
+  /* the function is not registered or the arguments do not match */
+  DB_VERIFY_FUNCTION,
+  /* the database did not answer */
+  DB_VERIFY_ERROR,
+  /* the result is passed to the callback once the database answered */
+  DB_VERIFY_PENDING
+} db_verify_result;
+
+typedef void (*db_verify_cb)(db_verify_result result, void *data);
+
+/* upper bound of Redis servers the registry is sharded over */
+#define DB_SHARDS_MAX 16
+/* the server keeping the authorized set, the first one given */
+#define DB_SHARD_AUTHORIZED 0
+
+/* a Redis server of the registry */
+struct db_endpoint {
+  const char *ip;
+  int port;
+};
 
 /* DB functions */
 
@@ -33,11 +71,129 @@ redisContext *rc;
 extern int db_connect(const char *ip, int port, const struct timeval tv,
     const char *password);
 
+/**
+ * Connects to Redis servers the registry is sharded over. The keys of a
+ * plugin are kept on one server, picked by consistent hashing of the
+ * pluginkey. The authorized set is kept on the first server. A single
+ * server behaves like db_connect().
+ * @param[in]   endpoints  the servers, at most DB_SHARDS_MAX
+ * @param[in]   count      number of servers
+ * @param[in]   tv         timeout for redis connections
+ * @param[in]   password   password to authenticate against every server
+ * @return    0 on success otherwise -1
+ */
+extern int db_connect_shards(const struct db_endpoint *endpoints,
+    size_t count, const struct timeval tv, const char *password);
+
+/**
+ * Returns the number of servers db_connect() connected to.
+ */
+extern size_t db_shard_count(void);
+
+/**
+ * Returns the server the keys of a plugin are kept on.
+ */
+extern size_t db_shard_of(const char *pluginkey);
+
+/**
+ * Selects the server that rc, arc, db_context(), db_command() and
+ * db_async_open() of the calling thread talk to, until selected again.
+ */
+extern void db_shard_use(size_t shard);
+
+/**
+ * Returns the server selected by db_shard_use() in the calling thread.
+ */
+extern size_t db_shard_current(void);
+
+/**
+ * Selects the server the keys of a plugin are kept on, see db_shard_use().
+ */
+extern void db_shard_select(const char *pluginkey);
+
+/**
+ * Connects the calling thread to the database db_connect() connected to.
+ * @return    0 on success otherwise -1
+ */
+extern int db_thread_connect(void);
+
 /**
  * Disconnects from Redis db and frees Context object.
  */
 extern void db_close(void);
 
+/**
+ * Uses the embedded store instead of Redis. The store is kept in memory,
+ * shared by all threads, and loaded from the snapshot file if it exists.
+ * @param[in]   snapshot  file the store is saved to by db_snapshot(), NULL
+ *                        to keep the store in memory only
+ * @return    0 on success, -1 if the snapshot could not be loaded
+ */
+extern int db_memory_open(const char *snapshot);
+
+/**
+ * Saves the embedded store to its snapshot file if it changed since the
+ * last snapshot. The file is replaced atomically. Does nothing on Redis.
+ * @return    0 on success otherwise -1
+ */
+extern int db_snapshot(void);
+
+/**
+ * Returns the context of the calling thread. A lost connection is
+ * reconnected and authenticated again, backing off exponentially while the
+ * database is unreachable. Meanwhile requests wait for a bounded time in a
+ * bounded queue, requests on event loops do not wait.
+ * @return    the context, NULL if the database is unreachable
+ */
+extern redisContext *db_context(void);
+
+/**
+ * Frees the context of the calling thread after an I/O error, the next
+ * db_context() reconnects.
+ */
+extern void db_context_drop(void);
+
+/**
+ * Runs a command like redisCommand() on the context of the calling thread.
+ * A command failing on a lost connection is tried once more on a new one.
+ * @return    the reply, NULL if the database is unreachable
+ */
+extern redisReply *db_command(const char *format, ...);
+
+/**
+ * Connects the event loop of the calling thread to the database db_connect()
+ * connected to. Replies are read by the loop instead of blocking it. The
+ * embedded store needs no connection.
+ * @param[in]   loop  the event loop of the calling thread
+ * @return    0 on success otherwise -1
+ */
+extern int db_async_connect(uv_loop_t *loop);
+
+/**
+ * Disconnects the event loop of the calling thread from the database once
+ * pending commands are answered.
+ */
+extern void db_async_close(void);
+
+/**
+ * Opens another asynchronous context to the server selected by
+ * db_shard_use(), e.g. for subscriptions, and authenticates it. The caller
+ * owns it.
+ * @param[in]   loop        the event loop the replies are read by
+ * @param[in]   connect     called once connected, may be NULL
+ * @param[in]   disconnect  called on the loop once the context is gone
+ * @return    the context, NULL on failure
+ */
+extern redisAsyncContext *db_async_open(uv_loop_t *loop,
+    redisConnectCallback *connect, redisDisconnectCallback *disconnect);
+
+/**
+ * Returns the asynchronous context of the calling thread, reconnecting it
+ * without blocking once the backoff passed.
+ * @return    the context, NULL if there is none
+ */
+extern redisAsyncContext *db_async_context(void);
+
 /**
  * Stores a function in database associated with the corresponding module.
  * @param[in] pluginkey  key of the module that provides the corresponding
@@ -59,6 +215,31 @@ extern int db_function_add(char *pluginkey, array *func);
 extern int db_function_verify(char *pluginkey, string name,
   array *args);
 
+/**
+ * Converts function signatures stored as argument lists by earlier
+ * versions into the signature blob of the function's meta hash. Run once
+ * after connecting to a Redis database written by an earlier version.
+ * @return number of converted functions, -1 if the database is unreachable
+ */
+extern int db_function_migrate(void);
+
+/**
+ * Verifies a run call like db_plugin_verify() and db_function_verify()
+ * without blocking the event loop. Calls of cached functions and calls on
+ * threads without an asynchronous context are verified right away.
+ * Otherwise the plugin and the function are looked up through the
+ * asynchronous context and the result is passed to `cb` on the loop.
+ * @param[in] pluginkey  key of the module that provides the function
+ * @param[in] name    name of the function to call
+ * @param[in] args    function arguments, only used until the function
+ *                    returns
+ * @param[in] cb      called with the result if DB_VERIFY_PENDING is returned
+ * @param[in] data    passed to `cb`
+ * @return the result, or DB_VERIFY_PENDING
+ */
+extern db_verify_result db_run_verify(char *pluginkey, string name,
+    array *args, db_verify_cb cb, void *data);
+
 /**
  * Creates a plugin entry in the database and uses the plugin key as key.
  * @param[in] pluginkey string that contains the plugin key
@@ -71,6 +252,22 @@ extern int db_function_verify(char *pluginkey, string name,
 extern int db_plugin_add(char *pluginkey, string name, string desc, string author,
     string license);
 
+/**
+ * Registers a plugin and its functions in one transaction, so the
+ * registration is atomic and costs a single round trip.
+ * @param[in] pluginkey string that contains the plugin key
+ * @param[in] name    name of plugin
+ * @param[in] desc    description of the plugin
+ * @param[in] author  author of the plugin
+ * @param[in] license the plugin's license text
+ * @param[in] functions  functions of the plugin, as passed to
+ *                    db_function_add()
+ * @param[out] rejected  number of invalid functions that were skipped
+ * returns -1 in case of error otherwise 0
+ */
+extern int db_plugin_register(char *pluginkey, string name, string desc,
+    string author, string license, array functions, size_t *rejected);
+
 /**
  * Checks whether the passed plugin key is assigned to a plugin.
  * @param[in] pluginkey  key to check
@@ -93,6 +290,29 @@ int db_authorized_add(unsigned char *pluginlongtermpk);
  */
 bool db_authorized_verify(unsigned char *pluginlongtermpk);
 
+/**
+ * Keeps a copy of the authorized keys in memory, so handshakes do not ask
+ * the database. The copy is loaded with SSCAN once subscribed to changes,
+ * which other cores publish and servers with keyspace notifications send,
+ * and loaded again on every change. A lost subscription is renewed with
+ * backoff, meanwhile the database is asked.
+ * @param[in]   loop  the event loop the subscription is read by, it needs
+ *                    an asynchronous context, see db_async_connect()
+ * @return    0 on success, -1 if the first attempt failed
+ */
+int db_authorized_subscribe(uv_loop_t *loop);
+
+/**
+ * Ends the subscription, handshakes ask the database again.
+ */
+void db_authorized_unsubscribe(void);
+
+/**
+ * Checks whether the authorized keys are checked against the copy in memory.
+ * returns true if so
+ */
+bool db_authorized_synced(void);
+
 /**
  * Whitelists all plugins via the whitelist-all-symbol.
  * returns 0 on success otherwise -1
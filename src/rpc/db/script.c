@@ -0,0 +1,201 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <hiredis/hiredis.h>
+#include <hiredis/async.h>
+#include <stdbool.h>
+#include <stdint.h>                   // for INT64_MAX, uintptr_t
+#include <stdlib.h>                   // for abort
+#include <string.h>
+#include <uv.h>                       // for uv_mutex_t, uv_once
+#ifdef __linux__
+#include <bsd/string.h>               // for strlcpy
+#endif
+#include "rpc/db/sb-db.h"
+#include "rpc/db/script.h"
+#include "sb-common.h"                // for LOG_WARNING, STATIC
+
+/* an unsigned argument that fits a signed one, it matches both types */
+#define SCRIPT_ANY_INTEGER 0xff
+/* SHA1 in hex */
+#define SCRIPT_SHA_SIZE 41
+
+enum {
+  SCRIPT_UNKNOWN = 0,
+  SCRIPT_LOADED,
+  /* the server refused to load it, e.g. scripting is disabled */
+  SCRIPT_DISABLED
+};
+
+const char db_script_verify_source[] =
+  "if redis.call('EXISTS', KEYS[1]) == 0 then return {1} end\n"
+  "local sig = redis.call('HGET', KEYS[2], 'args')\n"
+  "if not sig then return {2} end\n"
+  "local call = ARGV[1]\n"
+  "local int, uint = tonumber(ARGV[2]), tonumber(ARGV[3])\n"
+  "if #sig ~= #call then return {2, sig} end\n"
+  "for i = 1, #sig do\n"
+  "  local s, c = string.byte(sig, i), string.byte(call, i)\n"
+  "  if s ~= c and not (c == 255 and (s == int or s == uint)) then\n"
+  "    return {2, sig}\n"
+  "  end\n"
+  "end\n"
+  "return {0, sig}\n";
+
+static uv_once_t script_once = UV_ONCE_INIT;
+static uv_mutex_t script_lock;
+/* every server loads the script on its own, the SHA1 is the same on all */
+static int state[DB_SHARDS_MAX];
+static char sha[SCRIPT_SHA_SIZE];
+/* a SCRIPT LOAD is in flight on an asynchronous context */
+static bool loading[DB_SHARDS_MAX];
+
+STATIC void script_lock_init(void);
+STATIC int script_loaded(size_t shard, redisReply *reply);
+STATIC void script_load_cb(redisAsyncContext *ac, void *r, void *privdata);
+
+STATIC void script_lock_init(void)
+{
+  if (uv_mutex_init(&script_lock) != 0)
+    abort();
+}
+
+int db_script_load(void)
+{
+  size_t shard = db_shard_current();
+  redisReply *reply;
+  int current;
+
+  uv_once(&script_once, script_lock_init);
+
+  uv_mutex_lock(&script_lock);
+  current = state[shard];
+  uv_mutex_unlock(&script_lock);
+
+  if (current != SCRIPT_UNKNOWN)
+    return current == SCRIPT_LOADED ? 0 : -1;
+
+  reply = db_command("SCRIPT LOAD %s", db_script_verify_source);
+
+  /* unreachable, try again next time */
+  if (!reply)
+    return (-1);
+
+  current = script_loaded(shard, reply);
+  freeReplyObject(reply);
+
+  return current == SCRIPT_LOADED ? 0 : -1;
+}
+
+/* records the reply of SCRIPT LOAD on a server, returns its new state */
+STATIC int script_loaded(size_t shard, redisReply *reply)
+{
+  int current;
+
+  uv_mutex_lock(&script_lock);
+
+  if (reply->type == REDIS_REPLY_STRING && reply->len < SCRIPT_SHA_SIZE) {
+    strlcpy(sha, reply->str, sizeof(sha));
+    state[shard] = SCRIPT_LOADED;
+  } else {
+    LOG_WARNING("Redis refused the verify script, verifying without it: "
+        "%s\n", reply->type == REDIS_REPLY_ERROR ? reply->str : "");
+    state[shard] = SCRIPT_DISABLED;
+  }
+
+  current = state[shard];
+  uv_mutex_unlock(&script_lock);
+
+  return (current);
+}
+
+STATIC void script_load_cb(UNUSED(redisAsyncContext *ac), void *r,
+    void *privdata)
+{
+  size_t shard = (size_t) (uintptr_t) privdata;
+  redisReply *reply = r;
+
+  /* a NULL reply means the context is gone, the next call tries again */
+  if (reply)
+    script_loaded(shard, reply);
+
+  uv_mutex_lock(&script_lock);
+  loading[shard] = false;
+  uv_mutex_unlock(&script_lock);
+}
+
+void db_script_load_async(redisAsyncContext *ac)
+{
+  size_t shard = db_shard_current();
+  bool send;
+
+  uv_once(&script_once, script_lock_init);
+
+  uv_mutex_lock(&script_lock);
+  send = (state[shard] == SCRIPT_UNKNOWN) && !loading[shard];
+  loading[shard] = send;
+  uv_mutex_unlock(&script_lock);
+
+  if (!send)
+    return;
+
+  if (redisAsyncCommand(ac, script_load_cb, (void *) (uintptr_t) shard,
+      "SCRIPT LOAD %s", db_script_verify_source) != REDIS_OK) {
+    uv_mutex_lock(&script_lock);
+    loading[shard] = false;
+    uv_mutex_unlock(&script_lock);
+  }
+}
+
+const char *db_script_sha(void)
+{
+  const char *result;
+
+  uv_once(&script_once, script_lock_init);
+
+  uv_mutex_lock(&script_lock);
+  result = state[db_shard_current()] == SCRIPT_LOADED ? sha : NULL;
+  uv_mutex_unlock(&script_lock);
+
+  return result;
+}
+
+void db_script_reset(void)
+{
+  uv_once(&script_once, script_lock_init);
+
+  uv_mutex_lock(&script_lock);
+
+  for (size_t i = 0; i < DB_SHARDS_MAX; i++)
+    state[i] = SCRIPT_UNKNOWN;
+
+  uv_mutex_unlock(&script_lock);
+}
+
+void db_script_call_types(array *args, unsigned char *blob)
+{
+  object *arg;
+
+  for (size_t i = 0; i < args->size; i++) {
+    arg = &args->items[i];
+
+    /* positive integers are unpacked as unsigned, see db_signature_check */
+    if (arg->type == OBJECT_TYPE_UINT && arg->data.uinteger <= INT64_MAX)
+      blob[i] = SCRIPT_ANY_INTEGER;
+    else
+      blob[i] = (unsigned char) arg->type;
+  }
+}
@@ -0,0 +1,70 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>        // for bool
+#include <stddef.h>         // for size_t
+#include <hiredis/async.h>  // for redisAsyncContext
+#include "rpc/sb-rpc.h"     // for array
+
+/*
+ * A Lua script verifying a run call on the server: plugin existence,
+ * function membership and argument types cost a single command. It is
+ * loaded with SCRIPT LOAD and run with EVALSHA. Its SHA1 depends on the
+ * source only, a server that lost it (NOSCRIPT) is sent the source with
+ * EVAL, which loads it again under the same SHA1. Where scripting is
+ * disabled, the commands are sent one by one instead.
+ *
+ * KEYS: pluginkey, <pluginkey>:func:<name>:meta
+ * ARGV: argument types of the call, OBJECT_TYPE_INT, OBJECT_TYPE_UINT
+ * Reply: [verdict, signature], the verdict is a db_verify_result and the
+ * signature is missing if the function is not registered.
+ */
+
+/* Lua source of the script, sent with EVAL if the server lost it */
+extern const char db_script_verify_source[];
+
+/**
+ * Load the script on the server selected by db_shard_use(), unless it is
+ * loaded there already.
+ *
+ * @return 0 if the script can be used, -1 otherwise
+ */
+int db_script_load(void);
+
+/**
+ * Load the script through the asynchronous context of the selected server,
+ * unless it is loaded there already or a load is in flight. Calls made
+ * before the reply arrives are verified without the script.
+ */
+void db_script_load_async(redisAsyncContext *ac);
+
+/**
+ * @return the SHA1 of the script, NULL if it is unusable on the selected
+ * server
+ */
+const char *db_script_sha(void);
+
+/** Forget the script when connecting to another server. */
+void db_script_reset(void);
+
+/**
+ * Encode the argument types of a call, one byte per argument.
+ *
+ * @param blob  array of at least args->size bytes
+ */
+void db_script_call_types(array *args, unsigned char *blob);
@@ -1,10 +1,12 @@
+#ifdef __linux__
+#include <bsd/string.h>
+#endif
+
 #include "rpc/sb-rpc.h"
 #include "api/helpers.h"
 #include "rpc/msgpack/helpers.h"
 #include "sb-common.h"
 
-STATIC bool msgpack_rpc_to_string(const msgpack_object *const obj,
-    string *const arg);
 STATIC bool msgpack_rpc_is_notification(msgpack_object *req);
 STATIC msgpack_object *msgpack_rpc_msg_id(msgpack_object *req);
 
@@ -15,14 +17,121 @@ typedef struct {
   size_t idx;
 } msgpack_to_api_object_stack_item;
 
+/* A decoded object tree lives in a single allocation: all array and
+ * dictionary items first, followed by the NUL-terminated string bytes. */
+typedef struct {
+  char *items;
+  char *strings;
+} msgpack_to_api_object_block;
+
+STATIC size_t msgpack_rpc_string_size(const msgpack_object *const obj)
+{
+  if (obj->via.bin.ptr == NULL || obj->via.bin.size == 0) {
+    return 0;
+  }
+
+  return obj->via.bin.size + 1;
+}
+
+STATIC void msgpack_rpc_packed_size(const msgpack_object *const obj,
+    size_t *items, size_t *strings)
+{
+  kvec_t(const msgpack_object *) stack = KV_INITIAL_VALUE;
+  kv_push(stack, obj);
+
+  while (kv_size(stack)) {
+    const msgpack_object *cur = kv_pop(stack);
+
+    switch (cur->type) {
+      case MSGPACK_OBJECT_STR:
+      case MSGPACK_OBJECT_BIN:
+        *strings += msgpack_rpc_string_size(cur);
+        break;
+      case MSGPACK_OBJECT_ARRAY:
+        *items += cur->via.array.size * sizeof(object);
+        for (uint32_t i = 0; i < cur->via.array.size; i++) {
+          kv_push(stack, &cur->via.array.ptr[i]);
+        }
+        break;
+      case MSGPACK_OBJECT_MAP:
+        *items += cur->via.map.size * sizeof(key_value_pair) +
+            dictionary_index_size(cur->via.map.size);
+        for (uint32_t i = 0; i < cur->via.map.size; i++) {
+          const msgpack_object *key = &cur->via.map.ptr[i].key;
+          if (key->type == MSGPACK_OBJECT_STR ||
+              key->type == MSGPACK_OBJECT_BIN) {
+            *strings += msgpack_rpc_string_size(key);
+          }
+          kv_push(stack, &cur->via.map.ptr[i].val);
+        }
+        break;
+      case MSGPACK_OBJECT_NIL:
+      case MSGPACK_OBJECT_BOOLEAN:
+      case MSGPACK_OBJECT_POSITIVE_INTEGER:
+      case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+      case MSGPACK_OBJECT_FLOAT:
+      case MSGPACK_OBJECT_EXT:
+        break;
+    }
+  }
+
+  kv_destroy(stack);
+}
+
+STATIC string msgpack_rpc_packed_string(msgpack_to_api_object_block *block,
+    const msgpack_object *const obj)
+{
+  string str = {.str = NULL, .length = obj->via.bin.size};
+
+  if (msgpack_rpc_string_size(obj) == 0) {
+    return str;
+  }
+
+  str.str = block->strings;
+  memcpy(str.str, obj->via.bin.ptr, obj->via.bin.size);
+  str.str[obj->via.bin.size] = '\0';
+  block->strings += obj->via.bin.size + 1;
+
+  return str;
+}
+
+STATIC void * msgpack_rpc_packed_items(msgpack_to_api_object_block *block,
+    size_t size)
+{
+  void *items = block->items;
+  block->items += size;
+
+  return items;
+}
+
+/*
+ * Decodes a msgpack object into an api object. The resulting tree is
+ * allocated as one block owned by the returned root: nested arrays and
+ * dictionaries carry capacity OBJECT_CAPACITY_PACKED and must neither be
+ * grown nor freed on their own, the root carries OBJECT_CAPACITY_PACKED_ROOT
+ * and is released by the usual api_free_* functions. Large dictionaries get
+ * room for a key index, which api_dictionary_get() builds on demand.
+ */
 bool msgpack_rpc_to_object(const msgpack_object *const obj, object *const arg)
 {
   bool ret = true;
+  size_t itemsize = 0, stringsize = 0;
+  msgpack_to_api_object_block block = {NULL, NULL};
+
+  msgpack_rpc_packed_size(obj, &itemsize, &stringsize);
+
+  if (itemsize + stringsize > 0) {
+    block.items = CALLOC(itemsize + stringsize, char);
+    block.strings = block.items + itemsize;
+  }
+
   kvec_t(msgpack_to_api_object_stack_item) stack = KV_INITIAL_VALUE;
   kv_push(stack, ((msgpack_to_api_object_stack_item) { obj, arg, false, 0 }));
 
   while (ret && kv_size(stack)) {
     msgpack_to_api_object_stack_item cur = kv_last(stack);
+    const size_t capacity = (cur.aobj == arg
+        ? OBJECT_CAPACITY_PACKED_ROOT : OBJECT_CAPACITY_PACKED);
 
     if (!cur.container) {
       *cur.aobj = NIL;
@@ -51,21 +160,9 @@ bool msgpack_rpc_to_object(const msgpack_object *const obj, object *const arg)
         *cur.aobj = FLOATING_OBJ(cur.mobj->via.f64);
         break;
       }
-      case MSGPACK_OBJECT_STR: {
-        *cur.aobj = STRING_OBJ(((string) {
-          .length = cur.mobj->via.str.size,
-          .str = (cur.mobj->via.str.ptr == NULL || cur.mobj->via.str.size == 0
-              ? NULL : box_strndup(cur.mobj->via.str.ptr,
-              cur.mobj->via.str.size)),
-        }));
-        break;
-      }
+      case MSGPACK_OBJECT_STR:
       case MSGPACK_OBJECT_BIN: {
-        *cur.aobj = STRING_OBJ(((string) {
-          .length = cur.mobj->via.bin.size,
-          .str = (cur.mobj->via.bin.ptr == NULL || cur.mobj->via.bin.size == 0
-              ? NULL : box_strndup(cur.mobj->via.bin.ptr, cur.mobj->via.bin.size)),
-        }));
+        *cur.aobj = STRING_OBJ(msgpack_rpc_packed_string(&block, cur.mobj));
         break;
       }
 
@@ -88,9 +185,9 @@ bool msgpack_rpc_to_object(const msgpack_object *const obj, object *const arg)
         } else {
           *cur.aobj = ARRAY_OBJ(((array) {
             .size = size,
-            .capacity = size,
-            .items = (size > 0
-                ? calloc(size, sizeof(*cur.aobj->data.array.items)) : NULL),
+            .capacity = capacity,
+            .items = (size > 0 ? msgpack_rpc_packed_items(&block,
+                size * sizeof(object)) : NULL),
           }));
           cur.container = true;
           kv_last(stack) = cur;
@@ -109,20 +206,10 @@ bool msgpack_rpc_to_object(const msgpack_object *const obj, object *const arg)
             kv_last(stack) = cur;
             const msgpack_object *const key = &cur.mobj->via.map.ptr[idx].key;
             switch (key->type) {
-              case MSGPACK_OBJECT_STR: {
-                cur.aobj->data.dictionary.items[idx].key = ((string) {
-                  .length = key->via.str.size,
-                  .str = (key->via.str.ptr == NULL || key->via.str.size == 0
-                      ? NULL : box_strndup(key->via.str.ptr, key->via.str.size)),
-                });
-                break;
-              }
+              case MSGPACK_OBJECT_STR:
               case MSGPACK_OBJECT_BIN: {
-                cur.aobj->data.dictionary.items[idx].key = ((string) {
-                  .length = key->via.bin.size,
-                  .str = (key->via.bin.ptr == NULL || key->via.bin.size == 0
-                      ? NULL : box_strndup(key->via.bin.ptr, key->via.bin.size)),
-                });
+                cur.aobj->data.dictionary.items[idx].key =
+                    msgpack_rpc_packed_string(&block, key);
                 break;
               }
               case MSGPACK_OBJECT_NIL:
@@ -148,9 +235,9 @@ bool msgpack_rpc_to_object(const msgpack_object *const obj, object *const arg)
         } else {
           *cur.aobj = DICTIONARY_OBJ(((dictionary) {
             .size = size,
-            .capacity = size,
-            .items = (size > 0
-                ? calloc(size, sizeof(*cur.aobj->data.dictionary.items))
+            .capacity = capacity,
+            .items = (size > 0 ? msgpack_rpc_packed_items(&block,
+                size * sizeof(key_value_pair) + dictionary_index_size(size))
                 : NULL),
           }));
           cur.container = true;
@@ -169,64 +256,44 @@ bool msgpack_rpc_to_object(const msgpack_object *const obj, object *const arg)
 
   kv_destroy(stack);
 
-  return ret;
-}
-
-STATIC bool msgpack_rpc_to_string(const msgpack_object *const obj,
-                                  string *const arg)
-{
-  if (obj->type == MSGPACK_OBJECT_BIN || obj->type == MSGPACK_OBJECT_STR) {
-    arg->str = obj->via.bin.ptr != NULL
-                    ? box_strndup(obj->via.bin.ptr, obj->via.bin.size)
-                    : NULL;
-    arg->length = obj->via.bin.size;
-    return true;
+  /* the root owns the block unless it is a container or string itself */
+  if (arg->type != OBJECT_TYPE_ARRAY && arg->type != OBJECT_TYPE_DICTIONARY &&
+      arg->type != OBJECT_TYPE_STR) {
+    FREE(block.items);
   }
-  return false;
+
+  return ret;
 }
 
 bool msgpack_rpc_to_array(const msgpack_object *const obj, array *const arg)
 {
+  object result;
+
   if (obj->type != MSGPACK_OBJECT_ARRAY) {
+    *arg = (array) ARRAY_DICT_INIT;
     return false;
   }
 
-  arg->size = obj->via.array.size;
-  arg->items = CALLOC(obj->via.array.size, object);
-
-  for (uint32_t i = 0; i < obj->via.array.size; i++) {
-    if (!msgpack_rpc_to_object(obj->via.array.ptr + i, &arg->items[i])) {
-      return false;
-    }
-  }
+  bool ret = msgpack_rpc_to_object(obj, &result);
+  *arg = result.data.array;
 
-  return true;
+  return ret;
 }
 
 bool msgpack_rpc_to_dictionary(const msgpack_object *const obj,
                                dictionary *const arg)
 {
+  object result;
+
   if (obj->type != MSGPACK_OBJECT_MAP) {
+    *arg = (dictionary) ARRAY_DICT_INIT;
     return false;
   }
 
-  arg->size = obj->via.array.size;
-  arg->items = CALLOC(obj->via.map.size, key_value_pair);
-
-
-  for (uint32_t i = 0; i < obj->via.map.size; i++) {
-    if (!msgpack_rpc_to_string(&obj->via.map.ptr[i].key,
-          &arg->items[i].key)) {
-      return false;
-    }
-
-    if (!msgpack_rpc_to_object(&obj->via.map.ptr[i].val,
-          &arg->items[i].value)) {
-      return false;
-    }
-  }
+  bool ret = msgpack_rpc_to_object(obj, &result);
+  *arg = result.data.dictionary;
 
-  return true;
+  return ret;
 }
 
 void msgpack_rpc_from_boolean(bool result, msgpack_packer *res)
@@ -386,11 +453,111 @@ void msgpack_rpc_serialize_request(uint64_t request_id,
   msgpack_rpc_from_array(args, pac);
 }
 
+/* fixarray(4), 1, uint64 msgid */
+#define RESPONSE_HEADER_SIZE 11
+
+typedef struct {
+  char *data;
+  size_t size;
+} response_template;
+
+/* encoded [type, message], nil tails of all API_ERROR_RESPONSES */
+static response_template error_responses[API_ERROR_RESPONSE_COUNT];
+
+static const struct {
+  api_error_type type;
+  const char *message;
+} error_response_defs[API_ERROR_RESPONSE_COUNT] = {
+#define API_ERROR_RESPONSE_DEF(name, errtype, msg) \
+  [API_ERROR_RESPONSE_##name] = {errtype, msg},
+  API_ERROR_RESPONSES(API_ERROR_RESPONSE_DEF)
+#undef API_ERROR_RESPONSE_DEF
+};
+
+STATIC void msgpack_rpc_response_header(char *header, uint64_t response_id)
+{
+  header[0] = (char) 0x94;
+  header[1] = (char) 0x01;
+  header[2] = (char) 0xcf;
+
+  for (int i = 0; i < 8; i++)
+    header[3 + i] = (char) (response_id >> (56 - 8 * i));
+}
+
+int msgpack_rpc_responses_init(void)
+{
+  msgpack_sbuffer sbuf;
+  msgpack_packer pac;
+
+  for (int i = API_ERROR_RESPONSE_NONE + 1; i < API_ERROR_RESPONSE_COUNT; i++) {
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pac, &sbuf, msgpack_sbuffer_write);
+
+    msgpack_pack_array(&pac, 2);
+    msgpack_rpc_from_integer(error_response_defs[i].type, &pac);
+    msgpack_rpc_from_string(cstring_to_string(
+        (char *) error_response_defs[i].message), &pac);
+    msgpack_pack_nil(&pac);
+
+    error_responses[i].size = sbuf.size;
+    error_responses[i].data = msgpack_sbuffer_release(&sbuf);
+
+    if (!error_responses[i].data)
+      return (-1);
+  }
+
+  return (0);
+}
+
+void msgpack_rpc_responses_teardown(void)
+{
+  for (int i = 0; i < API_ERROR_RESPONSE_COUNT; i++) {
+    FREE(error_responses[i].data);
+    error_responses[i].size = 0;
+  }
+}
+
+/*
+ * Writes the successful response [1, msgid, nil, [callid]] without building
+ * an intermediate object.
+ */
+void msgpack_rpc_serialize_ack(uint64_t response_id, uint64_t callid,
+    msgpack_packer *pac)
+{
+  char ack[RESPONSE_HEADER_SIZE + 11];
+
+  msgpack_rpc_response_header(ack, response_id);
+  ack[RESPONSE_HEADER_SIZE] = (char) 0xc0;
+  ack[RESPONSE_HEADER_SIZE + 1] = (char) 0x91;
+  ack[RESPONSE_HEADER_SIZE + 2] = (char) 0xcf;
+
+  for (int i = 0; i < 8; i++)
+    ack[RESPONSE_HEADER_SIZE + 3 + i] = (char) (callid >> (56 - 8 * i));
+
+  pac->callback(pac->data, ack, sizeof(ack));
+}
+
 void msgpack_rpc_serialize_response(uint64_t response_id,
                                     struct api_error *err,
                                     object arg,
                                     msgpack_packer *pac)
 {
+  if (err->isset && err->response > API_ERROR_RESPONSE_NONE &&
+      err->response < API_ERROR_RESPONSE_COUNT) {
+    response_template *tmpl = &error_responses[err->response];
+
+    if (tmpl->data) {
+      char header[RESPONSE_HEADER_SIZE];
+
+      msgpack_rpc_response_header(header, response_id);
+      pac->callback(pac->data, header, sizeof(header));
+      pac->callback(pac->data, tmpl->data, tmpl->size);
+      return;
+    }
+
+    /* templates are not initialized, pack the message instead */
+  }
+
   msgpack_pack_array(pac, 4);
   msgpack_pack_int(pac, 1);
   msgpack_pack_uint64(pac, response_id);
@@ -399,7 +566,8 @@ void msgpack_rpc_serialize_response(uint64_t response_id,
     // error represented by a [type, message] array
     msgpack_pack_array(pac, 2);
     msgpack_rpc_from_integer(err->type, pac);
-    msgpack_rpc_from_string(cstring_to_string(err->msg), pac);
+    msgpack_rpc_from_string(
+        cstring_to_string((char *) api_error_message(err)), pac);
     // Nil result
     msgpack_pack_nil(pac);
   } else {
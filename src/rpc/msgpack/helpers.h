@@ -2,11 +2,15 @@
 
 #include "rpc/sb-rpc.h"
 
+/*
+ * Decoded trees are a single block owned by the root and are read-only:
+ * free the root only, with api_free_object(), api_free_array() or
+ * api_free_dictionary(). Nested strings, arrays and dictionaries must be
+ * neither freed nor grown, copy_object() what is kept or changed. Freeing
+ * a nested array or dictionary fails an assertion.
+ */
 bool msgpack_rpc_to_object(const msgpack_object *const obj, object *const arg);
 
-//STATIC bool msgpack_rpc_to_string(const msgpack_object *const obj,
-//    string *const arg);
-
 bool msgpack_rpc_to_array(const msgpack_object *const obj, array *const arg);
 
 bool msgpack_rpc_to_dictionary(const msgpack_object *const obj,
@@ -33,6 +37,13 @@ void msgpack_rpc_serialize_request(uint64_t request_id, string method,
 void msgpack_rpc_serialize_response(uint64_t response_id, struct api_error *err,
     object arg, msgpack_packer *pac);
 
+void msgpack_rpc_serialize_ack(uint64_t response_id, uint64_t callid,
+    msgpack_packer *pac);
+
+int msgpack_rpc_responses_init(void);
+
+void msgpack_rpc_responses_teardown(void);
+
 //STATIC bool msgpack_rpc_is_notification(msgpack_object *req);
 
 msgpack_object *msgpack_rpc_method(msgpack_object *req);
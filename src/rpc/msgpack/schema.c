@@ -0,0 +1,438 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "api/helpers.h"
+#include "rpc/sb-rpc.h"
+#include "rpc/msgpack/schema.h"
+#include "sb-common.h"
+
+/*
+ * Schemas are declared as a pre-order list of nodes, every SCHEMA_OP_ARRAY is
+ * closed by a SCHEMA_OP_END. At startup they are compiled into schema_insn
+ * bytecode, which carries the element count of each array, and are then
+ * checked in a single pass over either decoded objects or raw msgpack.
+ */
+typedef struct {
+  schema_op op;
+  api_error_response type_error;
+  api_error_response value_error;
+} schema_node;
+
+#define NODE(o, t, v) \
+  {SCHEMA_OP_##o, API_ERROR_RESPONSE_##t, API_ERROR_RESPONSE_##v}
+#define ARRAY(t, v) NODE(ARRAY, t, v)
+#define END NODE(END, NONE, NONE)
+
+static const schema_node register_schema[] = {
+  ARRAY(INVALID_ARGUMENTS, REGISTER_PARAMS_SIZE),
+    /* [name, description, author, license] */
+    ARRAY(REGISTER_META_TYPE, REGISTER_META_SIZE),
+      NODE(NONEMPTY_STRING, REGISTER_META_ELEMENT_TYPE, REGISTER_META_SIZE),
+      NODE(NONEMPTY_STRING, REGISTER_META_ELEMENT_TYPE, REGISTER_META_SIZE),
+      NODE(NONEMPTY_STRING, REGISTER_META_ELEMENT_TYPE, REGISTER_META_SIZE),
+      NODE(NONEMPTY_STRING, REGISTER_META_ELEMENT_TYPE, REGISTER_META_SIZE),
+    END,
+    NODE(ANY_ARRAY, REGISTER_FUNCTIONS_TYPE, NONE),
+  END
+};
+
+static const schema_node run_schema[] = {
+  ARRAY(INVALID_ARGUMENTS, RUN_PARAMS_SIZE),
+    /* [targetpluginkey, deadline or nil] */
+    ARRAY(RUN_META_TYPE, RUN_META_SIZE),
+      NODE(PLUGINKEY, RUN_META_ELEMENTS_TYPE, RUN_META_SIZE),
+      NODE(OPTIONAL_UINT, RUN_META_ELEMENTS_TYPE, NONE),
+    END,
+    NODE(NONEMPTY_STRING, RUN_FUNCTION_TYPE, RUN_FUNCTION_EMPTY),
+    NODE(ANY_ARRAY, RUN_FUNCTION_TYPE, NONE),
+  END
+};
+
+static const schema_node result_schema[] = {
+  ARRAY(INVALID_ARGUMENTS, RESULT_PARAMS_SIZE),
+    /* [callid] */
+    ARRAY(RESULT_META_TYPE, RESULT_META_SIZE),
+      NODE(UINT, RESULT_META_ELEMENTS_TYPE, NONE),
+    END,
+    NODE(ANY_ARRAY, RESULT_ARGS_TYPE, NONE),
+  END
+};
+
+static const schema_node broadcast_schema[] = {
+  ARRAY(INVALID_ARGUMENTS, BROADCAST_PARAMS_SIZE),
+    NODE(STRING, BROADCAST_EVENT_TYPE, NONE),
+    NODE(ANY_ARRAY, BROADCAST_ARGS_TYPE, NONE),
+  END
+};
+
+static const schema_node subscribe_schema[] = {
+  ARRAY(INVALID_ARGUMENTS, SUBSCRIBE_PARAMS_SIZE),
+    NODE(STRING, SUBSCRIBE_EVENT_TYPE, NONE),
+  END
+};
+
+static const schema_node unsubscribe_schema[] = {
+  ARRAY(INVALID_ARGUMENTS, UNSUBSCRIBE_PARAMS_SIZE),
+    NODE(STRING, UNSUBSCRIBE_EVENT_TYPE, NONE),
+  END
+};
+
+static const schema_node cancel_schema[] = {
+  ARRAY(INVALID_ARGUMENTS, CANCEL_PARAMS_SIZE),
+    /* [callid] */
+    ARRAY(CANCEL_META_TYPE, CANCEL_META_SIZE),
+      NODE(UINT, CANCEL_META_ELEMENTS_TYPE, NONE),
+    END,
+  END
+};
+
+static const schema_node run_response_schema[] = {
+  ARRAY(RUN_RESPONSE_INVALID, RUN_RESPONSE_INVALID),
+    NODE(UINT, RUN_RESPONSE_CALLID, NONE),
+  END
+};
+
+static const schema_node result_response_schema[] = {
+  ARRAY(RESULT_RESPONSE_INVALID, RESULT_RESPONSE_INVALID),
+    NODE(UINT, RESULT_RESPONSE_CALLID, NONE),
+  END
+};
+
+#undef NODE
+#undef ARRAY
+#undef END
+
+static const schema_node *schema_defs[SCHEMA_COUNT] = {
+  [SCHEMA_REGISTER] = register_schema,
+  [SCHEMA_RUN] = run_schema,
+  [SCHEMA_RESULT] = result_schema,
+  [SCHEMA_BROADCAST] = broadcast_schema,
+  [SCHEMA_SUBSCRIBE] = subscribe_schema,
+  [SCHEMA_UNSUBSCRIBE] = unsubscribe_schema,
+  [SCHEMA_CANCEL] = cancel_schema,
+  [SCHEMA_RUN_RESPONSE] = run_response_schema,
+  [SCHEMA_RESULT_RESPONSE] = result_response_schema,
+};
+
+static schema_insn *schemas[SCHEMA_COUNT];
+
+typedef enum {
+  SCHEMA_VALUE_ARRAY,
+  SCHEMA_VALUE_STRING,
+  SCHEMA_VALUE_UINT,
+  SCHEMA_VALUE_NIL,
+  SCHEMA_VALUE_OTHER
+} schema_value_kind;
+
+typedef struct {
+  schema_value_kind kind;
+  /* array elements or string bytes */
+  size_t size;
+  bool empty;
+} schema_value;
+
+typedef struct {
+  void (*inspect)(const void *node, schema_value *value);
+  const void *(*child)(const void *node, size_t idx);
+} schema_accessor;
+
+STATIC schema_insn * schema_compile(const schema_node *nodes)
+{
+  size_t count = 0, depth = 0;
+  size_t parents[SCHEMA_MAX_DEPTH];
+  schema_insn *insns;
+
+  /* the schema ends with the END closing the outermost array */
+  do {
+    if (nodes[count].op == SCHEMA_OP_ARRAY)
+      depth++;
+    else if (nodes[count].op == SCHEMA_OP_END)
+      depth--;
+    count++;
+  } while (depth > 0);
+
+  insns = CALLOC(count, schema_insn);
+
+  if (!insns)
+    return (NULL);
+
+  for (size_t i = 0; i < count; i++) {
+    insns[i].op = (uint8_t)nodes[i].op;
+    insns[i].type_error = (uint8_t)nodes[i].type_error;
+    insns[i].value_error = (uint8_t)nodes[i].value_error;
+
+    if (nodes[i].op == SCHEMA_OP_END) {
+      depth--;
+      continue;
+    }
+
+    if (depth > 0)
+      insns[parents[depth - 1]].arg++;
+
+    if (nodes[i].op == SCHEMA_OP_ARRAY) {
+      sbassert(depth < SCHEMA_MAX_DEPTH);
+      parents[depth++] = i;
+    }
+  }
+
+  return (insns);
+}
+
+int schema_init(void)
+{
+  for (int i = SCHEMA_NONE + 1; i < SCHEMA_COUNT; i++) {
+    if (schemas[i])
+      continue;
+
+    if (!(schemas[i] = schema_compile(schema_defs[i])))
+      return (-1);
+  }
+
+  return (0);
+}
+
+void schema_teardown(void)
+{
+  for (int i = 0; i < SCHEMA_COUNT; i++)
+    FREE(schemas[i]);
+}
+
+STATIC int schema_run(const schema_insn *insn, const void *root,
+    const schema_accessor *accessor, struct schema_error *err)
+{
+  const void *parents[SCHEMA_MAX_DEPTH];
+  size_t idx[SCHEMA_MAX_DEPTH];
+  size_t depth = 0;
+  schema_value value;
+  api_error_response response;
+
+  for (;; insn++) {
+    if (insn->op == SCHEMA_OP_END) {
+      if (--depth == 0)
+        return (0);
+
+      idx[depth - 1]++;
+      continue;
+    }
+
+    const void *node = (depth == 0 ? root :
+        accessor->child(parents[depth - 1], idx[depth - 1]));
+    accessor->inspect(node, &value);
+
+    response = API_ERROR_RESPONSE_NONE;
+
+    switch (insn->op) {
+      case SCHEMA_OP_ARRAY:
+        if (value.kind != SCHEMA_VALUE_ARRAY)
+          response = insn->type_error;
+        else if (value.size != insn->arg)
+          response = insn->value_error;
+        break;
+      case SCHEMA_OP_ANY_ARRAY:
+        if (value.kind != SCHEMA_VALUE_ARRAY)
+          response = insn->type_error;
+        break;
+      case SCHEMA_OP_STRING:
+        if (value.kind != SCHEMA_VALUE_STRING)
+          response = insn->type_error;
+        break;
+      case SCHEMA_OP_NONEMPTY_STRING:
+        if (value.kind != SCHEMA_VALUE_STRING)
+          response = insn->type_error;
+        else if (value.empty)
+          response = insn->value_error;
+        break;
+      case SCHEMA_OP_PLUGINKEY:
+        if (value.kind != SCHEMA_VALUE_STRING)
+          response = insn->type_error;
+        else if (value.empty || value.size + 1 != PLUGINKEY_STRING_SIZE)
+          response = insn->value_error;
+        break;
+      case SCHEMA_OP_UINT:
+        if (value.kind != SCHEMA_VALUE_UINT)
+          response = insn->type_error;
+        break;
+      case SCHEMA_OP_OPTIONAL_UINT:
+        if (value.kind != SCHEMA_VALUE_UINT && value.kind != SCHEMA_VALUE_NIL)
+          response = insn->type_error;
+        break;
+      case SCHEMA_OP_NIL:
+        if (value.kind != SCHEMA_VALUE_NIL)
+          response = insn->type_error;
+        break;
+      default:
+        abort();
+    }
+
+    if (response != API_ERROR_RESPONSE_NONE) {
+      if (err) {
+        err->response = response;
+        err->depth = depth;
+        for (size_t i = 0; i < depth; i++)
+          err->path[i] = idx[i];
+      }
+      return (-1);
+    }
+
+    if (insn->op == SCHEMA_OP_ARRAY) {
+      parents[depth] = node;
+      idx[depth++] = 0;
+    } else if (depth == 0) {
+      return (0);
+    } else {
+      idx[depth - 1]++;
+    }
+  }
+}
+
+STATIC const schema_insn * schema_get(schema_id id)
+{
+  sbassert(id > SCHEMA_NONE && id < SCHEMA_COUNT);
+
+  /* validation may run before schema_init(), e.g. in handlers called
+   * without a connection layer */
+  if (!schemas[id])
+    schemas[id] = schema_compile(schema_defs[id]);
+
+  sbassert(schemas[id]);
+
+  return (schemas[id]);
+}
+
+STATIC void schema_inspect_object(const void *node, schema_value *value)
+{
+  const object *obj = node;
+
+  value->size = 0;
+  value->empty = false;
+
+  switch (obj->type) {
+    case OBJECT_TYPE_ARRAY:
+      value->kind = SCHEMA_VALUE_ARRAY;
+      value->size = obj->data.array.size;
+      break;
+    case OBJECT_TYPE_STR:
+      value->kind = SCHEMA_VALUE_STRING;
+      value->size = obj->data.string.length;
+      value->empty = (obj->data.string.str == NULL);
+      break;
+    case OBJECT_TYPE_UINT:
+      value->kind = SCHEMA_VALUE_UINT;
+      break;
+    case OBJECT_TYPE_NIL:
+      value->kind = SCHEMA_VALUE_NIL;
+      break;
+    case OBJECT_TYPE_BOOL:
+    case OBJECT_TYPE_INT:
+    case OBJECT_TYPE_FLOAT:
+    case OBJECT_TYPE_DICTIONARY:
+    default:
+      value->kind = SCHEMA_VALUE_OTHER;
+      break;
+  }
+}
+
+STATIC const void * schema_child_object(const void *node, size_t idx)
+{
+  return (&((const object *)node)->data.array.items[idx]);
+}
+
+STATIC void schema_inspect_msgpack(const void *node, schema_value *value)
+{
+  const msgpack_object *obj = node;
+
+  value->size = 0;
+  value->empty = false;
+
+  switch (obj->type) {
+    case MSGPACK_OBJECT_ARRAY:
+      value->kind = SCHEMA_VALUE_ARRAY;
+      value->size = obj->via.array.size;
+      break;
+    case MSGPACK_OBJECT_STR:
+    case MSGPACK_OBJECT_BIN:
+      value->kind = SCHEMA_VALUE_STRING;
+      value->size = obj->via.bin.size;
+      value->empty = (obj->via.bin.ptr == NULL || obj->via.bin.size == 0);
+      break;
+    case MSGPACK_OBJECT_POSITIVE_INTEGER:
+      value->kind = SCHEMA_VALUE_UINT;
+      break;
+    case MSGPACK_OBJECT_NIL:
+      value->kind = SCHEMA_VALUE_NIL;
+      break;
+    case MSGPACK_OBJECT_BOOLEAN:
+    case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+    case MSGPACK_OBJECT_FLOAT:
+    case MSGPACK_OBJECT_MAP:
+    case MSGPACK_OBJECT_EXT:
+    default:
+      value->kind = SCHEMA_VALUE_OTHER;
+      break;
+  }
+}
+
+STATIC const void * schema_child_msgpack(const void *node, size_t idx)
+{
+  return (&((const msgpack_object *)node)->via.array.ptr[idx]);
+}
+
+static const schema_accessor object_accessor = {
+  schema_inspect_object, schema_child_object
+};
+
+static const schema_accessor msgpack_accessor = {
+  schema_inspect_msgpack, schema_child_msgpack
+};
+
+/*
+ * Validates decoded arguments against a schema.
+ *
+ * @param id schema to check against
+ * @param args decoded arguments
+ * @param err structured error describing the first mismatch, may be NULL
+ * @return 0 if args match the schema, -1 otherwise
+ */
+int schema_validate(schema_id id, array args, struct schema_error *err)
+{
+  object root = ARRAY_OBJ(args);
+
+  return (schema_run(schema_get(id), &root, &object_accessor, err));
+}
+
+/*
+ * Validates raw msgpack against a schema, so that malformed requests can be
+ * rejected before they are decoded.
+ */
+int schema_validate_msgpack(schema_id id, const msgpack_object *args,
+    struct schema_error *err)
+{
+  return (schema_run(schema_get(id), args, &msgpack_accessor, err));
+}
+
+void schema_error_set(struct api_error *api_error,
+    const struct schema_error *err)
+{
+  api_error->msg[0] = '\0';
+  api_error->isset = true;
+  api_error->type = api_error_response_type(err->response);
+  api_error->response = err->response;
+}
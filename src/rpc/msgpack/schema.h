@@ -0,0 +1,46 @@
+#pragma once
+
+#include "rpc/sb-rpc.h"
+
+#define SCHEMA_MAX_DEPTH 4
+
+typedef enum {
+  SCHEMA_OP_END = 0,
+  /* array with exactly the elements up to the matching SCHEMA_OP_END */
+  SCHEMA_OP_ARRAY,
+  /* array of any size and content */
+  SCHEMA_OP_ANY_ARRAY,
+  SCHEMA_OP_STRING,
+  /* string with at least one byte */
+  SCHEMA_OP_NONEMPTY_STRING,
+  /* string of exactly PLUGINKEY_STRING_SIZE - 1 bytes */
+  SCHEMA_OP_PLUGINKEY,
+  SCHEMA_OP_UINT,
+  /* unsigned integer or nil */
+  SCHEMA_OP_OPTIONAL_UINT,
+  SCHEMA_OP_NIL
+} schema_op;
+
+/* one compiled instruction, arg holds the element count of arrays */
+typedef struct {
+  uint8_t op;
+  uint8_t type_error;
+  uint8_t value_error;
+  uint8_t unused;
+  uint32_t arg;
+} schema_insn;
+
+struct schema_error {
+  api_error_response response;
+  /* index path from the validated array to the offending element */
+  size_t depth;
+  size_t path[SCHEMA_MAX_DEPTH];
+};
+
+int schema_init(void);
+void schema_teardown(void);
+int schema_validate(schema_id id, array args, struct schema_error *err);
+int schema_validate_msgpack(schema_id id, const msgpack_object *args,
+    struct schema_error *err);
+void schema_error_set(struct api_error *api_error,
+    const struct schema_error *err);
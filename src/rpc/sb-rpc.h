@@ -38,6 +38,7 @@
 #include <hiredis/hiredis.h>
 
 #include "sb-common.h"
+#include "rpc/connection/timerwheel.h"
 #include "tweetnacl.h"
 
 /* Typedefs */
@@ -57,7 +58,9 @@ typedef struct connection_request_event_info connection_request_event_info;
 
 #define STREAM_BUFFER_SIZE 0xffff
 
-#define CALLINFO_INIT (struct callinfo) {0, false, false, NIL}
+/* 8 byte identifier + 8 byte compressed nonce + 24 byte boxed length, the
+ * remaining 16 bytes of nacl zero-padding are overwritten by the header */
+#define CRYPTO_PACKET_HEADROOM (24 + crypto_box_ZEROBYTES)
 
 
 /*
@@ -100,6 +103,12 @@ typedef enum {
 
 typedef struct key_value_pair key_value_pair;
 
+/* capacity markers of arrays and dictionaries decoded by
+ * msgpack_rpc_to_object(), their items are part of a single block owned by
+ * the root object */
+#define OBJECT_CAPACITY_PACKED_ROOT SIZE_MAX
+#define OBJECT_CAPACITY_PACKED (SIZE_MAX - 1)
+
 typedef struct {
   object *items;
   size_t size;
@@ -112,6 +121,36 @@ typedef struct {
   size_t capacity;
 } dictionary;
 
+/* packed dictionaries with at least DICTIONARY_INDEX_THRESHOLD entries carry
+ * an open-addressing index over their keys right behind the items. The index
+ * is built on the first lookup, slots hold the item index + 1 or 0 if empty */
+#define DICTIONARY_INDEX_THRESHOLD 32
+
+typedef struct {
+  bool built;
+  uint32_t mask;
+  uint32_t slots[];
+} dictionary_index;
+
+static inline size_t dictionary_index_slots(size_t size)
+{
+  size_t slots = DICTIONARY_INDEX_THRESHOLD;
+
+  while (slots < 2 * size)
+    slots <<= 1;
+
+  return (slots);
+}
+
+static inline size_t dictionary_index_size(size_t size)
+{
+  if (size < DICTIONARY_INDEX_THRESHOLD)
+    return (0);
+
+  return (sizeof(dictionary_index) +
+      dictionary_index_slots(size) * sizeof(uint32_t));
+}
+
 struct object {
   object_type type;
   union {
@@ -155,9 +194,31 @@ struct key_value_pair {
 typedef object (*apidispatchwrapper)(uint64_t con_id, uint64_t msgid,
     char *pluginkey, array args, struct api_error *error);
 
+/* argument and response shapes checked by rpc/msgpack/schema.c */
+typedef enum {
+  SCHEMA_NONE = 0,
+  SCHEMA_REGISTER,
+  SCHEMA_RUN,
+  SCHEMA_RESULT,
+  SCHEMA_BROADCAST,
+  SCHEMA_SUBSCRIBE,
+  SCHEMA_UNSUBSCRIBE,
+  SCHEMA_CANCEL,
+  SCHEMA_RUN_RESPONSE,
+  SCHEMA_RESULT_RESPONSE,
+  SCHEMA_COUNT
+} schema_id;
+
 typedef struct {
   apidispatchwrapper func;
   bool async;
+  /* validated on the raw message before the arguments are decoded */
+  schema_id schema;
+  /* unless func fails right away, it answers later on through
+   * connection_send_ack() once the forwarded call returned */
+  bool deferred;
+  /* func only talks to the database and may run on a worker thread */
+  bool offload;
   string name;
 } dispatch_info;
 
@@ -183,11 +244,21 @@ struct wbuffer {
   char *data;
 };
 
+/* called once the response to an outgoing request arrived or the request
+ * failed, result is owned by the callback and NIL on error */
+typedef void (*connection_response_cb)(object result, struct api_error *error,
+    void *data);
+
+/* an outgoing request waiting for its response, see connection.pending_calls */
 struct callinfo {
   uint64_t msgid;
-  bool returned;
-  bool errored;
-  object result;
+  connection_response_cb cb;
+  void *data;
+  /* uv_hrtime() when the request was sent */
+  uint64_t sent;
+  struct connection *con;
+  /* completes the call with an error once its deadline passed */
+  wheel_timer timer;
 };
 
 struct outputstream {
@@ -221,6 +292,8 @@ struct connection_request_event_info {
   dispatch_info dispatcher;
   array args;
   uint64_t msgid;
+  object result;
+  struct api_error error;
 };
 
 /* hashmap declarations */
@@ -249,6 +322,28 @@ MAP_DECLS(cstr_t, uint64_t)
  */
 int connection_init(void);
 
+/**
+ * Create the connection tables of the calling shard thread.
+ * connection_init() does this for the main loop.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int connection_shard_init(void);
+
+/**
+ * Close the connections of the calling shard thread. Its tables stay, so
+ * replies still pending on the loop find the connections closed.
+ */
+void connection_shard_close(void);
+
+/**
+ * Close the connections of the calling shard thread and free its tables.
+ * connection_teardown() does this for the main loop.
+ *
+ * @return 0 on success, -1 if the tables were not created
+ */
+int connection_shard_teardown(void);
+
 /**
  * Create a API connection from a libuv stream (tcp or pipe/socket client
  * connection)
@@ -258,14 +353,48 @@ int connection_init(void);
  */
 int connection_create(uv_stream_t *stream);
 
-object connection_send_request(char *pluginkey, string method,
-    array args, struct api_error *err);
+/**
+ * Send a request to the plugin identified by `pluginkey` without waiting for
+ * its response. Any number of requests may be in flight on a connection, the
+ * responses are matched by message id and may arrive in any order. If the
+ * plugin is connected to another shard, the request is forwarded there and
+ * `cb` runs on the calling shard once the response was posted back. Of
+ * several instances of the plugin, the least loaded one gets the request.
+ *
+ * @param pluginkey The pluginkey of the receiving plugin
+ * @param method The RPC method to call
+ * @param args The request arguments, consumed by this call
+ * @param timeout Milliseconds to wait for the response, 0 to wait forever
+ * @param cb Called with the result once the response arrived or the
+ *           connection closed before
+ * @param data User data passed to `cb`
+ * @param err Set if the request could not be sent, `cb` is not called then
+ * @return 0 on success, -1 otherwise
+ */
+int connection_send_request(char *pluginkey, string method, array args,
+    uint32_t timeout, connection_response_cb cb, void *data,
+    struct api_error *err);
+int connection_send_request_to(uint64_t con_id, size_t shard, string method,
+    array args, uint32_t timeout, connection_response_cb cb, void *data,
+    struct api_error *err);
+
+/**
+ * Send a request to every instance of a plugin, on all shards. Their
+ * responses are dropped.
+ *
+ * @return 0 if at least one instance got the request, -1 otherwise
+ */
+int connection_send_request_all(char *pluginkey, string method, array args,
+    uint32_t timeout, struct api_error *err);
+
+/** Number of connections allowed to share a pluginkey, 1 by default. */
+void connection_set_max_instances(size_t max);
 int connection_send_response(uint64_t con_id, uint32_t msgid,
     object arg, struct api_error *api_error);
+void connection_send_ack(uint64_t con_id, uint64_t msgid, uint64_t callid,
+    struct api_error *error);
 void connection_hashmap_put(uint64_t id, struct connection *con);
 void pluginkeys_hashmap_put(char *pluginkey, uint64_t id);
-void loop_wait_for_response(struct connection *con,
-    struct callinfo *cinfo);
 int connection_teardown(void);
 void connection_subscribe(uint64_t id, char *event);
 void connection_unsubscribe(uint64_t id, char *event);
@@ -407,6 +536,7 @@ inputstream * streamhandle_get_inputstream(uv_handle_t *handle);
 
 int dispatch_table_init(void);
 int dispatch_teardown(void);
+void dispatch_set_call_timeout(uint32_t timeout);
 dispatch_info dispatch_table_get(string method);
 dispatch_info msgpack_rpc_get_handler_for(const char *name, size_t name_len);
 void dispatch_table_put(string method, dispatch_info info);
@@ -414,6 +544,8 @@ object handle_run(uint64_t con_id, uint64_t msgid, char *pluginkey,
     array args, struct api_error *error);
 object handle_result(uint64_t con_id, uint64_t msgid, char *pluginkey,
     array args, struct api_error *error);
+object handle_cancel(uint64_t con_id, uint64_t msgid, char *pluginkey,
+    array args, struct api_error *error);
 object handle_register(uint64_t con_id, uint64_t msgid, char *pluginkey,
     array args, struct api_error *error);
 object handle_subscribe(uint64_t con_id, uint64_t msgid, char *pluginkey,
@@ -502,15 +634,17 @@ int crypto_read(struct crypto_context *cc, unsigned char *in, char *out,
     uint64_t length, uint64_t *plaintextlen);
 
 /**
- * Box data into a server message packet send it
+ * Box a message in place into a server message packet and send it. The
+ * first CRYPTO_PACKET_HEADROOM bytes of `packet` are reserved for the packet
+ * header and the nacl zero-padding, the plaintext follows directly after.
  *
  * @param cc The crypto_context connection crypto information (nonce etc.)
- * @param data Buffer containing data
- * @param length The 'data' buffer length
+ * @param packet Buffer containing the reserved headroom and the plaintext
+ * @param length The 'packet' buffer length including the headroom
  * @param out The outputstream ready to write data
  * returns -1 in case of error otherwise 0
  */
-int crypto_write(struct crypto_context *cc, char *data,
+int crypto_write(struct crypto_context *cc, char *packet,
     size_t length, outputstream *out);
 
 void crypto_update_minutekey(struct crypto_context *cc);
@@ -98,9 +98,107 @@ typedef enum {
   SERVER_TYPE_UNKNOWN
 } server_type;
 
+/*
+ * Static errors that are answered with a pre-encoded response. Only the msgid
+ * is patched in when sending, the message itself is never formatted.
+ */
+#define API_ERROR_RESPONSES(X)                                                \
+  X(MISSING_METHOD, API_ERROR_TYPE_EXCEPTION, "Invalid method name")          \
+  X(INVALID_ARGUMENTS, API_ERROR_TYPE_EXCEPTION, "Invalid method arguments")  \
+  X(REGISTER_PARAMS_SIZE, API_ERROR_TYPE_VALIDATION,                          \
+      "Error dispatching register API request. Invalid params size")          \
+  X(REGISTER_META_TYPE, API_ERROR_TYPE_VALIDATION,                            \
+      "Error dispatching register API request. meta params has wrong type")   \
+  X(REGISTER_META_SIZE, API_ERROR_TYPE_VALIDATION,                            \
+      "Error dispatching register API request. Invalid meta params size")     \
+  X(REGISTER_META_ELEMENT_TYPE, API_ERROR_TYPE_VALIDATION,                    \
+      "Error dispatching register API request. meta element has wrong type")  \
+  X(REGISTER_FUNCTIONS_TYPE, API_ERROR_TYPE_VALIDATION,                       \
+      "Error dispatching register API request. functions has wrong type")     \
+  X(REGISTER_FAILED, API_ERROR_TYPE_VALIDATION,                               \
+      "Error running register API request.")                                  \
+  X(RUN_PARAMS_SIZE, API_ERROR_TYPE_VALIDATION,                               \
+      "Error dispatching run API request. Invalid params size")               \
+  X(RUN_META_TYPE, API_ERROR_TYPE_VALIDATION,                                 \
+      "Error dispatching run API request. meta params has wrong type")        \
+  X(RUN_META_SIZE, API_ERROR_TYPE_VALIDATION,                                 \
+      "Error dispatching run API request. Invalid meta params size")          \
+  X(RUN_META_ELEMENTS_TYPE, API_ERROR_TYPE_VALIDATION,                        \
+      "Error dispatching run API request. meta elements have wrong type")     \
+  X(RUN_FUNCTION_TYPE, API_ERROR_TYPE_VALIDATION,                             \
+      "Error dispatching run API request. function string has wrong type")    \
+  X(RUN_FUNCTION_EMPTY, API_ERROR_TYPE_VALIDATION,                            \
+      "Error dispatching run API request. function name is empty")            \
+  X(RUN_FAILED, API_ERROR_TYPE_VALIDATION,                                    \
+      "Error executing run API request.")                                     \
+  X(RUN_TOO_MANY_CALLS, API_ERROR_TYPE_EXCEPTION,                             \
+      "Error executing run API request. Too many calls in flight.")           \
+  X(RESULT_PARAMS_SIZE, API_ERROR_TYPE_VALIDATION,                            \
+      "Error dispatching result API request. Invalid params size")            \
+  X(RESULT_META_TYPE, API_ERROR_TYPE_VALIDATION,                              \
+      "Error dispatching result API request. meta params has wrong type")     \
+  X(RESULT_META_SIZE, API_ERROR_TYPE_VALIDATION,                              \
+      "Error dispatching result API request. Invalid meta params size")       \
+  X(RESULT_META_ELEMENTS_TYPE, API_ERROR_TYPE_VALIDATION,                     \
+      "Error dispatching result API request. meta elements have wrong type")  \
+  X(RESULT_ARGS_TYPE, API_ERROR_TYPE_VALIDATION,                              \
+      "Error dispatching result API request. function string has wrong type") \
+  X(RESULT_UNKNOWN_CALLID, API_ERROR_TYPE_VALIDATION,                         \
+      "Failed to find target's key associated with given callid.")            \
+  X(RESULT_FAILED, API_ERROR_TYPE_VALIDATION,                                 \
+      "Error executing result API request.")                                  \
+  X(BROADCAST_PARAMS_SIZE, API_ERROR_TYPE_VALIDATION,                         \
+      "Error dispatching broadcast API request. Invalid params size")         \
+  X(BROADCAST_EVENT_TYPE, API_ERROR_TYPE_VALIDATION,                          \
+      "Error dispatching broadcast API request. event name has wrong type")   \
+  X(BROADCAST_ARGS_TYPE, API_ERROR_TYPE_VALIDATION,                           \
+      "Error dispatching broadcast API request. event args has wrong type")   \
+  X(SUBSCRIBE_PARAMS_SIZE, API_ERROR_TYPE_VALIDATION,                         \
+      "Error dispatching subscribe API request. Invalid params size")         \
+  X(SUBSCRIBE_EVENT_TYPE, API_ERROR_TYPE_VALIDATION,                          \
+      "Error dispatching subscribe API request. event name has wrong type")   \
+  X(SUBSCRIBE_EVENT_PATTERN, API_ERROR_TYPE_VALIDATION,                       \
+      "Error dispatching subscribe API request. Invalid event pattern")       \
+  X(UNSUBSCRIBE_PARAMS_SIZE, API_ERROR_TYPE_VALIDATION,                       \
+      "Error dispatching unsubscribe API request. Invalid params size")       \
+  X(UNSUBSCRIBE_EVENT_TYPE, API_ERROR_TYPE_VALIDATION,                        \
+      "Error dispatching unsubscribe API request. event name has wrong type") \
+  X(RUN_RESPONSE_INVALID, API_ERROR_TYPE_VALIDATION,                          \
+      "Error dispatching run API response. Either response is broken "        \
+      "or it just has wrong params size.")                                    \
+  X(RUN_RESPONSE_CALLID, API_ERROR_TYPE_VALIDATION,                           \
+      "Error dispatching run API response. Invalid callid")                   \
+  X(RESULT_RESPONSE_INVALID, API_ERROR_TYPE_VALIDATION,                       \
+      "Error dispatching result API response. Either response is broken "     \
+      "or it just has wrong params size.")                                    \
+  X(RESULT_RESPONSE_CALLID, API_ERROR_TYPE_VALIDATION,                        \
+      "Error dispatching result API response. Invalid callid")                \
+  X(CANCEL_PARAMS_SIZE, API_ERROR_TYPE_VALIDATION,                            \
+      "Error dispatching cancel API request. Invalid params size")            \
+  X(CANCEL_META_TYPE, API_ERROR_TYPE_VALIDATION,                              \
+      "Error dispatching cancel API request. meta params has wrong type")     \
+  X(CANCEL_META_SIZE, API_ERROR_TYPE_VALIDATION,                              \
+      "Error dispatching cancel API request. Invalid meta params size")       \
+  X(CANCEL_META_ELEMENTS_TYPE, API_ERROR_TYPE_VALIDATION,                     \
+      "Error dispatching cancel API request. meta elements have wrong type")  \
+  X(CANCEL_UNKNOWN_CALLID, API_ERROR_TYPE_VALIDATION,                         \
+      "Failed to find a call of the caller with the given callid.")           \
+  X(CALL_TIMEOUT, API_ERROR_TYPE_EXCEPTION,                                   \
+      "The plugin did not answer before the deadline.")
+
+typedef enum {
+  API_ERROR_RESPONSE_NONE = 0,
+#define API_ERROR_RESPONSE_ENUM(name, errtype, message) \
+  API_ERROR_RESPONSE_##name,
+  API_ERROR_RESPONSES(API_ERROR_RESPONSE_ENUM)
+#undef API_ERROR_RESPONSE_ENUM
+  API_ERROR_RESPONSE_COUNT
+} api_error_response;
+
 struct api_error {
   api_error_type type;
   char msg[API_ERROR_MESSAGE_LEN];
+  api_error_response response;
   bool isset;
 };
 
@@ -205,11 +303,29 @@ typedef struct {
   boxaddr RedisDatabaseListenAddr;
   uint16_t RedisDatabaseListenPort;
   char *RedisDatabaseAuth;
+  /** Further Redis servers the plugin registry is sharded over. */
+  configline *RedisDatabaseShard;
 
   char *ApiNamedPipeListen;
   server_type apitype;
 
   char *ContactInfo;
+  /** Threads offloaded requests run on, 0 for one per online CPU. */
+  int WorkerThreads;
+  /** Event loop threads accepting plugin connections, including the main one. */
+  int Shards;
+  /** Milliseconds forwarded calls may take unless the caller sets a deadline. */
+  int CallTimeout;
+  /** Connections a plugin may have open at once, requests go to the least loaded. */
+  int PluginInstances;
+  /** Store of the plugin registry, redis or the embedded memory store. */
+  char *DatabaseBackend;
+  /** File the memory store is saved to and loaded from at startup. */
+  char *DatabaseSnapshot;
+  /** Seconds between snapshots of the memory store. */
+  int DatabaseSnapshotInterval;
+  /** Whether plugins and signatures read from Redis are kept in memory. */
+  int DatabaseCache;
   /** Ports to listen on for SOCKS connections. */
   uint16_t RedisPort;
 } options;
@@ -316,6 +432,45 @@ static inline bool string_eq(string a, string b)
   return (strncmp(a.str, b.str, MIN(a.length, b.length)) == 0);
 }
 
+static inline api_error_type api_error_response_type(api_error_response response)
+{
+  switch (response) {
+#define API_ERROR_RESPONSE_TYPE(name, errtype, message) \
+    case API_ERROR_RESPONSE_##name: return (errtype);
+    API_ERROR_RESPONSES(API_ERROR_RESPONSE_TYPE)
+#undef API_ERROR_RESPONSE_TYPE
+    case API_ERROR_RESPONSE_NONE:
+    case API_ERROR_RESPONSE_COUNT:
+    default:
+      return (API_ERROR_TYPE_EXCEPTION);
+  }
+}
+
+static inline const char *api_error_response_message(
+    api_error_response response)
+{
+  switch (response) {
+#define API_ERROR_RESPONSE_MESSAGE(name, errtype, message) \
+    case API_ERROR_RESPONSE_##name: return (message);
+    API_ERROR_RESPONSES(API_ERROR_RESPONSE_MESSAGE)
+#undef API_ERROR_RESPONSE_MESSAGE
+    case API_ERROR_RESPONSE_NONE:
+    case API_ERROR_RESPONSE_COUNT:
+    default:
+      return ("");
+  }
+}
+
+/* the message of an error: its own text, or the table entry of the response
+ * it was set to */
+static inline const char *api_error_message(const struct api_error *err)
+{
+  if (err->msg[0] != '\0' || err->response == API_ERROR_RESPONSE_NONE)
+    return (err->msg);
+
+  return (api_error_response_message(err->response));
+}
+
 /* Defines */
 #define hashmap(T, U) hashmap_##T##_##U
 
@@ -361,6 +516,17 @@ static inline bool string_eq(string a, string b)
       abort();                                                      \
     (err)->isset = true;                                            \
     (err)->type = errtype;                                          \
+    (err)->response = API_ERROR_RESPONSE_NONE;                      \
+  } while (0)
+
+/* sets one of the API_ERROR_RESPONSES, sent as its pre-encoded response. Only
+ * the response is recorded, api_error_message() looks its message up. */
+#define error_set_response(err, name)                               \
+  do {                                                              \
+    (err)->msg[0] = '\0';                                           \
+    (err)->isset = true;                                            \
+    (err)->type = api_error_response_type(API_ERROR_RESPONSE_##name); \
+    (err)->response = API_ERROR_RESPONSE_##name;                    \
   } while (0)
 
 #define hashmap_foreach_value(map, value, block) \
@@ -16,10 +16,15 @@
 
 #include "sb-common.h"
 #include "main.h"
+#include "rpc/db/sb-db.h"
+#include "rpc/connection/connection.h"
+#include "rpc/connection/shard.h"
 
 static void signal_sigint_cb(uv_signal_t *uvhandle, int signum);
+static void signal_sigusr1_cb(uv_signal_t *uvhandle, int signum);
 
 uv_signal_t sigint;
+uv_signal_t sigusr1;
 
 int signal_init(void)
 {
@@ -32,10 +37,29 @@ int signal_init(void)
     return (-1);
   }
 
+  /* SIGUSR1 logs the metrics of the live connections */
+  if (uv_signal_init(&main_loop.uv, &sigusr1) != 0) {
+    return (-1);
+  }
+
+  if (uv_signal_start(&sigusr1, signal_sigusr1_cb, SIGUSR1) != 0) {
+    return (-1);
+  }
+
   return 0;
 }
 
 static void signal_sigint_cb(UNUSED(uv_signal_t *handle), UNUSED(int signum))
 {
+  /* shards close their connections before the registry is saved */
+  shard_stop();
+
+  /* the memory store keeps what changed since the last snapshot */
+  db_snapshot();
   exit(0);
 }
+
+static void signal_sigusr1_cb(UNUSED(uv_signal_t *handle), UNUSED(int signum))
+{
+  connection_dump_stats();
+}
@@ -0,0 +1,172 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Latency benchmarks of the hot paths, run with `sb-bench [case]`, all cases
+ * without one. The database benchmarks use the Redis server of the boxrc and
+ * flush it, like sb-test does. Latencies are printed as percentiles in
+ * microseconds.
+ */
+
+#include <hiredis/hiredis.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include "sb-common.h"
+#include "main.h"
+#include "api/helpers.h"
+#include "api/sb-api.h"
+#include "rpc/db/sb-db.h"
+#include "helper-all.h"
+#include "bench/bench.h"
+
+int8_t verbose_level;
+loop main_loop;
+
+static const struct {
+  const char *name;
+  /* runs against the Redis server of the boxrc */
+  bool database;
+  int (*run)(void);
+} cases[] = {
+  {"trie", false, bench_trie},
+  {"decode", false, bench_decode},
+  {"multiqueue", false, bench_multiqueue},
+  {"run", true, bench_run},
+  {"register", true, bench_register},
+  {"shard", false, bench_shard},
+};
+
+static int sample_cmp(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+void bench_report(const char *what, uint64_t *samples, size_t count)
+{
+  qsort(samples, count, sizeof(*samples), sample_cmp);
+
+  printf("%-32s p50 %8.2f us  p99 %8.2f us  max %8.2f us  (n=%zu)\n", what,
+      (double) samples[count / 2] / 1000,
+      (double) samples[count * 99 / 100] / 1000,
+      (double) samples[count - 1] / 1000, count);
+}
+
+int bench_connect(void)
+{
+  struct timeval timeout = { 1, 500000 };
+  options *globaloptions;
+  redisReply *reply;
+  int result;
+
+  if (options_init_from_boxrc() < 0)
+    return (-1);
+
+  globaloptions = options_get();
+  result = db_connect(fmt_addr(&globaloptions->RedisDatabaseListenAddr),
+      globaloptions->RedisDatabaseListenPort, timeout,
+      globaloptions->RedisDatabaseAuth);
+  options_free(globaloptions);
+
+  if (result == -1)
+    return (-1);
+
+  reply = db_command("FLUSHALL");
+  if (reply)
+    freeReplyObject(reply);
+
+  return (0);
+}
+
+array bench_functions(void)
+{
+  array functions = ARRAY_DICT_INIT;
+  char name[32];
+
+  for (size_t i = 0; i < BENCH_FUNCTIONS; i++) {
+    snprintf(name, sizeof(name), "function%zu", i);
+    ADD(functions, helper_function_new(name, "description", 2));
+  }
+
+  return functions;
+}
+
+int bench_register_plugin(char *pluginkey, array functions)
+{
+  string name = cstring_copy_string("bench plugin");
+  string desc = cstring_copy_string("benchmarks");
+  string author = cstring_copy_string("author");
+  string license = cstring_copy_string("license");
+  size_t rejected;
+  int result;
+
+  result = db_plugin_register(pluginkey, name, desc, author, license,
+      functions, &rejected);
+
+  free_string(name);
+  free_string(desc);
+  free_string(author);
+  free_string(license);
+
+  return (result);
+}
+
+int main(int argc, char **argv)
+{
+  const char *which = argc > 1 ? argv[1] : NULL;
+  size_t count = sizeof(cases) / sizeof(cases[0]);
+  bool selected = false, database = false;
+  int result = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (!which || strcmp(which, cases[i].name) == 0) {
+      selected = true;
+      database |= cases[i].database;
+    }
+  }
+
+  if (!selected) {
+    fprintf(stderr, "usage: %s [", argv[0]);
+    for (size_t i = 0; i < count; i++)
+      fprintf(stderr, "%s%s", i ? "|" : "", cases[i].name);
+    fprintf(stderr, "]\n");
+    return (EXIT_FAILURE);
+  }
+
+  if (database && bench_connect() == -1) {
+    LOG_WARNING("Failed to connect to database, skipping its benchmarks.\n");
+    database = false;
+    result = -1;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if ((which && strcmp(which, cases[i].name) != 0) ||
+        (cases[i].database && !database))
+      continue;
+
+    result |= cases[i].run();
+  }
+
+  if (database)
+    db_close();
+
+  return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
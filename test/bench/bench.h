@@ -0,0 +1,43 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rpc/sb-rpc.h"
+
+/* functions of the plugins the database benchmarks register */
+#define BENCH_FUNCTIONS 8
+
+/* prints p50, p99 and the maximum of samples in nanoseconds */
+void bench_report(const char *what, uint64_t *samples, size_t count);
+
+/* connects to the database of the boxrc and flushes it */
+int bench_connect(void);
+
+/* BENCH_FUNCTIONS functions of two integer arguments, named functionN */
+array bench_functions(void);
+int bench_register_plugin(char *pluginkey, array functions);
+
+/* the cases, 0 on success */
+int bench_trie(void);
+int bench_multiqueue(void);
+int bench_run(void);
+int bench_register(void);
+int bench_shard(void);
+int bench_decode(void);
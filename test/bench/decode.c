@@ -0,0 +1,182 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <msgpack.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <uv.h>
+
+#include "sb-common.h"
+#include "api/sb-api.h"
+#include "rpc/sb-rpc.h"
+#include "rpc/msgpack/helpers.h"
+#include "bench/bench.h"
+
+#define BENCH_DECODES 10000
+
+/*
+ * sb-bench is linked with --wrap for the allocators, every allocation of
+ * the tree goes through these while counting is on.
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t number, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_reallocarray(void *ptr, size_t number, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t number, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+void *__wrap_reallocarray(void *ptr, size_t number, size_t size);
+
+static bool counting = false;
+static size_t allocations = 0;
+
+void *__wrap_malloc(size_t size)
+{
+  if (counting)
+    allocations++;
+
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t number, size_t size)
+{
+  if (counting)
+    allocations++;
+
+  return __real_calloc(number, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  if (counting)
+    allocations++;
+
+  return __real_realloc(ptr, size);
+}
+
+void *__wrap_reallocarray(void *ptr, size_t number, size_t size)
+{
+  if (counting)
+    allocations++;
+
+  return __real_reallocarray(ptr, number, size);
+}
+
+static void pack_string(msgpack_packer *pk, const char *str)
+{
+  msgpack_pack_str(pk, strlen(str));
+  msgpack_pack_str_body(pk, str, strlen(str));
+}
+
+/* [[targetpluginkey, deadline], functionname, [arguments]] */
+static void pack_run(msgpack_packer *pk)
+{
+  msgpack_pack_array(pk, 3);
+  msgpack_pack_array(pk, 2);
+  pack_string(pk, "BENCHPLUGINKEY00");
+  msgpack_pack_uint64(pk, 5000);
+  pack_string(pk, "function0");
+  msgpack_pack_array(pk, 5);
+  msgpack_pack_int64(pk, -5);
+  msgpack_pack_int64(pk, 7);
+  pack_string(pk, "an argument string");
+  msgpack_pack_array(pk, 2);
+  pack_string(pk, "first");
+  pack_string(pk, "second");
+  msgpack_pack_map(pk, 1);
+  pack_string(pk, "key");
+  pack_string(pk, "value");
+}
+
+/* the allocations of decoding one container or string at a time */
+static size_t count_nodes(const msgpack_object *obj)
+{
+  size_t count = 1;
+
+  if (obj->type == MSGPACK_OBJECT_STR || obj->type == MSGPACK_OBJECT_BIN)
+    return (1);
+
+  if (obj->type == MSGPACK_OBJECT_ARRAY) {
+    for (uint32_t i = 0; i < obj->via.array.size; i++)
+      count += count_nodes(&obj->via.array.ptr[i]);
+    return (count);
+  }
+
+  if (obj->type == MSGPACK_OBJECT_MAP) {
+    for (uint32_t i = 0; i < obj->via.map.size; i++) {
+      count += count_nodes(&obj->via.map.ptr[i].key);
+      count += count_nodes(&obj->via.map.ptr[i].val);
+    }
+    return (count);
+  }
+
+  return (0);
+}
+
+/* decoding the arguments of a run request into a tree of objects */
+int bench_decode(void)
+{
+  uint64_t *samples = CALLOC(BENCH_DECODES, uint64_t);
+  msgpack_sbuffer sbuf;
+  msgpack_packer pk;
+  msgpack_unpacked unpacked;
+  array args;
+  uint64_t start;
+  size_t total = 0;
+  int result = -1;
+
+  if (!samples)
+    return (-1);
+
+  msgpack_sbuffer_init(&sbuf);
+  msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+  pack_run(&pk);
+
+  msgpack_unpacked_init(&unpacked);
+  if (msgpack_unpack_next(&unpacked, sbuf.data, sbuf.size, NULL) !=
+      MSGPACK_UNPACK_SUCCESS)
+    goto out;
+
+  for (size_t i = 0; i < BENCH_DECODES; i++) {
+    allocations = 0;
+    counting = true;
+    start = uv_hrtime();
+    if (!msgpack_rpc_to_array(&unpacked.data, &args)) {
+      counting = false;
+      goto out;
+    }
+    api_free_array(args);
+    samples[i] = uv_hrtime() - start;
+    counting = false;
+    total += allocations;
+  }
+
+  bench_report("run decode", samples, BENCH_DECODES);
+  printf("%-32s %8.2f per payload  (per node %zu, %zu bytes)\n",
+      "run decode allocations", (double) total / BENCH_DECODES,
+      count_nodes(&unpacked.data), sbuf.size);
+
+  result = 0;
+
+out:
+  msgpack_unpacked_destroy(&unpacked);
+  msgpack_sbuffer_destroy(&sbuf);
+  FREE(samples);
+
+  return (result);
+}
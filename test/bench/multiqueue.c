@@ -0,0 +1,182 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <uv.h>
+
+#include "queue.h"
+#include "sb-common.h"
+#include "rpc/connection/event.h"
+#include "bench/bench.h"
+
+#define BENCH_QUEUE_CHILDREN 16
+#define BENCH_QUEUE_EVENTS 64
+#define BENCH_QUEUE_BATCHES 10000
+
+/*
+ * The multiqueue before its items came from a slab: every event put into a
+ * child queue allocated its item and a link item in the parent, and taking
+ * it out freed both. Kept to compare put/get throughput against.
+ */
+typedef struct legacy_item legacy_item;
+typedef struct legacy_queue legacy_queue;
+
+struct legacy_item {
+  union {
+    legacy_queue *queue;
+    struct {
+      event event;
+      legacy_item *parent;
+    } item;
+  } data;
+  bool link;
+  QUEUE node;
+};
+
+struct legacy_queue {
+  legacy_queue *parent;
+  QUEUE headtail;
+};
+
+static legacy_queue *legacy_new(legacy_queue *parent)
+{
+  legacy_queue *rv = MALLOC(legacy_queue);
+
+  sbassert(rv);
+  QUEUE_INIT(&rv->headtail);
+  rv->parent = parent;
+
+  return rv;
+}
+
+static void legacy_put(legacy_queue *this, event e)
+{
+  legacy_item *item = MALLOC(legacy_item);
+
+  sbassert(item);
+  item->link = false;
+  item->data.item.event = e;
+  QUEUE_INSERT_TAIL(&this->headtail, &item->node);
+
+  if (this->parent) {
+    item->data.item.parent = MALLOC(legacy_item);
+    sbassert(item->data.item.parent);
+    item->data.item.parent->link = true;
+    item->data.item.parent->data.queue = this;
+    QUEUE_INSERT_TAIL(&this->parent->headtail, &item->data.item.parent->node);
+  }
+}
+
+/* only called on a parent with events queued */
+static event legacy_get(legacy_queue *this)
+{
+  QUEUE *h = QUEUE_HEAD(&this->headtail);
+  legacy_item *item = QUEUE_DATA(h, legacy_item, node), *child;
+  event rv;
+
+  QUEUE_REMOVE(h);
+  child = QUEUE_DATA(QUEUE_HEAD(&item->data.queue->headtail), legacy_item,
+      node);
+  QUEUE_REMOVE(&child->node);
+  rv = child->data.item.event;
+  FREE(child);
+  FREE(item);
+
+  return rv;
+}
+
+static void bench_queue_event(UNUSED(void **argv))
+{
+}
+
+/* events spread over the children of a parent, then all taken from it */
+static void bench_queue_slab(uint64_t *samples)
+{
+  multiqueue *parent = multiqueue_new_parent(NULL, NULL);
+  multiqueue *children[BENCH_QUEUE_CHILDREN];
+  event e = event_create(1, bench_queue_event, 0);
+  uint64_t start;
+
+  for (size_t i = 0; i < BENCH_QUEUE_CHILDREN; i++)
+    children[i] = multiqueue_new_child(parent);
+
+  for (size_t i = 0; i < BENCH_QUEUE_BATCHES; i++) {
+    start = uv_hrtime();
+    for (size_t j = 0; j < BENCH_QUEUE_EVENTS; j++)
+      multiqueue_put_event(children[j % BENCH_QUEUE_CHILDREN], e);
+    for (size_t j = 0; j < BENCH_QUEUE_EVENTS; j++)
+      multiqueue_get(parent);
+    samples[i] = uv_hrtime() - start;
+  }
+
+  for (size_t i = 0; i < BENCH_QUEUE_CHILDREN; i++)
+    multiqueue_free(children[i]);
+  multiqueue_free(parent);
+}
+
+static void bench_queue_legacy(uint64_t *samples)
+{
+  legacy_queue *parent = legacy_new(NULL);
+  legacy_queue *children[BENCH_QUEUE_CHILDREN];
+  event e = event_create(1, bench_queue_event, 0);
+  uint64_t start;
+
+  for (size_t i = 0; i < BENCH_QUEUE_CHILDREN; i++)
+    children[i] = legacy_new(parent);
+
+  for (size_t i = 0; i < BENCH_QUEUE_BATCHES; i++) {
+    start = uv_hrtime();
+    for (size_t j = 0; j < BENCH_QUEUE_EVENTS; j++)
+      legacy_put(children[j % BENCH_QUEUE_CHILDREN], e);
+    for (size_t j = 0; j < BENCH_QUEUE_EVENTS; j++)
+      legacy_get(parent);
+    samples[i] = uv_hrtime() - start;
+  }
+
+  for (size_t i = 0; i < BENCH_QUEUE_CHILDREN; i++)
+    FREE(children[i]);
+  FREE(parent);
+}
+
+static void bench_queue_report(const char *what, uint64_t *samples)
+{
+  uint64_t total = 0;
+
+  for (size_t i = 0; i < BENCH_QUEUE_BATCHES; i++)
+    total += samples[i];
+
+  printf("%-32s %8.2f M events/s\n", what, (double) BENCH_QUEUE_BATCHES *
+      BENCH_QUEUE_EVENTS * 1000 / (double) total);
+  bench_report(what, samples, BENCH_QUEUE_BATCHES);
+}
+
+int bench_multiqueue(void)
+{
+  uint64_t *samples = CALLOC(BENCH_QUEUE_BATCHES, uint64_t);
+
+  if (!samples)
+    return (-1);
+
+  bench_queue_legacy(samples);
+  bench_queue_report("queue put/get, malloc per item", samples);
+  bench_queue_slab(samples);
+  bench_queue_report("queue put/get, slab", samples);
+
+  FREE(samples);
+
+  return (0);
+}
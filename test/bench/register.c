@@ -0,0 +1,59 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <uv.h>
+
+#include "sb-common.h"
+#include "api/sb-api.h"
+#include "bench/bench.h"
+
+#define BENCH_REGISTRATIONS 1000
+
+/* new plugins, then the same plugins registering again unchanged */
+int bench_register(void)
+{
+  char pluginkey[PLUGINKEY_STRING_SIZE];
+  uint64_t *samples = CALLOC(BENCH_REGISTRATIONS, uint64_t);
+  array functions = bench_functions();
+  uint64_t start;
+  int result = -1;
+
+  if (!samples)
+    goto out;
+
+  for (int again = 0; again < 2; again++) {
+    for (size_t i = 0; i < BENCH_REGISTRATIONS; i++) {
+      snprintf(pluginkey, sizeof(pluginkey), "BENCHREGISTER%03zu", i);
+      start = uv_hrtime();
+      if (bench_register_plugin(pluginkey, functions) == -1)
+        goto out;
+      samples[i] = uv_hrtime() - start;
+    }
+
+    bench_report(again ? "register, unchanged" : "register, new", samples,
+        BENCH_REGISTRATIONS);
+  }
+
+  result = 0;
+
+out:
+  FREE(samples);
+  api_free_array(functions);
+
+  return (result);
+}
@@ -0,0 +1,72 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <uv.h>
+
+#include "sb-common.h"
+#include "api/helpers.h"
+#include "api/sb-api.h"
+#include "rpc/db/cache.h"
+#include "rpc/db/sb-db.h"
+#include "bench/bench.h"
+
+#define BENCH_RUNS 10000
+
+/* synchronous run verification, answered by the cache or by Redis */
+int bench_run(void)
+{
+  char pluginkey[PLUGINKEY_STRING_SIZE] = "BENCHPLUGINKEY00";
+  uint64_t *samples = CALLOC(BENCH_RUNS, uint64_t);
+  string name = cstring_copy_string("function0");
+  array functions = bench_functions();
+  array args = ARRAY_DICT_INIT;
+  uint64_t start;
+  int result = -1;
+
+  ADD(args, INTEGER_OBJ(-5));
+  ADD(args, INTEGER_OBJ(7));
+
+  if (!samples || bench_register_plugin(pluginkey, functions) == -1)
+    goto out;
+
+  for (int cached = 1; cached >= 0; cached--) {
+    db_cache_enable(cached);
+    db_cache_clear();
+
+    for (size_t i = 0; i < BENCH_RUNS; i++) {
+      start = uv_hrtime();
+      if (db_run_verify(pluginkey, name, &args, NULL, NULL) !=
+          DB_VERIFY_VALID)
+        goto out;
+      samples[i] = uv_hrtime() - start;
+    }
+
+    bench_report(cached ? "run verify, cache" : "run verify, no cache",
+        samples, BENCH_RUNS);
+  }
+
+  result = 0;
+
+out:
+  db_cache_enable(true);
+  FREE(samples);
+  free_string(name);
+  api_free_array(functions);
+  api_free_array(args);
+
+  return (result);
+}
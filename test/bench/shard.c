@@ -0,0 +1,484 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <msgpack.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "sb-common.h"
+#include "main.h"
+#include "tweetnacl.h"
+#include "rpc/sb-rpc.h"
+#include "rpc/connection/shard.h"
+#include "rpc/connection/worker.h"
+#include "rpc/db/sb-db.h"
+#include "bench/bench.h"
+
+#define BENCH_SHARD_PORT 11100
+#define BENCH_SHARD_CLIENTS 32
+#define BENCH_SHARD_REQUESTS 4000
+/* requests a client has in flight before it reads the responses */
+#define BENCH_SHARD_PIPELINE 16
+#define BENCH_SHARD_PACKET 256
+
+/*
+ * A plugin speaking the tunnel protocol over a blocking socket, see
+ * src/rpc/connection/crypto.c for the server side.
+ */
+struct bench_client {
+  uint16_t port;
+  uv_barrier_t *start;
+  int fd;
+  uint64_t nonce;
+  unsigned char serverlongtermpk[32];
+  unsigned char shortterm[32];
+  size_t answered;
+  int result;
+};
+
+static size_t shard_counts[] = {1, 2, 4, 8};
+
+static int client_send(int fd, const unsigned char *data, size_t length)
+{
+  ssize_t written;
+
+  while (length > 0) {
+    written = send(fd, data, length, 0);
+
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return (-1);
+
+    data += written;
+    length -= (size_t) written;
+  }
+
+  return (0);
+}
+
+static int client_recv(int fd, unsigned char *data, size_t length)
+{
+  ssize_t received;
+
+  while (length > 0) {
+    received = recv(fd, data, length, 0);
+
+    if (received < 0 && errno == EINTR)
+      continue;
+    if (received <= 0)
+      return (-1);
+
+    data += received;
+    length -= (size_t) received;
+  }
+
+  return (0);
+}
+
+static int client_connect(uint16_t port)
+{
+  struct sockaddr_in addr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    return (-1);
+
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+    close(fd);
+    return (-1);
+  }
+
+  return (fd);
+}
+
+/* hello, cookie and initiate, the server does not answer the initiate */
+static int client_handshake(struct bench_client *client)
+{
+  unsigned char clientlongtermpk[32], clientlongtermsk[32];
+  unsigned char clientshorttermpk[32], clientshorttermsk[32];
+  unsigned char servershorttermpk[32];
+  unsigned char nonce[crypto_box_NONCEBYTES];
+  unsigned char vouchnonce[crypto_box_NONCEBYTES];
+  unsigned char hellopacket[192] = {0};
+  unsigned char cookiepacket[168];
+  unsigned char initiatepacket[256] = {0};
+  unsigned char allzeroboxed[96] = {0};
+  unsigned char cookiebox[160] = {0};
+  unsigned char cookieopened[160];
+  unsigned char initiatebox[160] = {0};
+  unsigned char vouchbox[96] = {0};
+
+  if (crypto_box_keypair(clientlongtermpk, clientlongtermsk) != 0 ||
+      crypto_box_keypair(clientshorttermpk, clientshorttermsk) != 0)
+    return (-1);
+
+  client->nonce = (uint64_t) randommod(281474976710656LL) | 1;
+
+  memcpy(nonce, "splonebox-client", 16);
+  uint64_pack(nonce + 16, client->nonce);
+
+  memcpy(hellopacket, "oqQN2kaH", 8);
+  memcpy(hellopacket + 8, clientshorttermpk, 32);
+  memcpy(hellopacket + 104, nonce + 16, 8);
+
+  if (crypto_box(allzeroboxed, allzeroboxed, 96, nonce,
+      client->serverlongtermpk, clientshorttermsk) != 0)
+    return (-1);
+
+  memcpy(hellopacket + 112, allzeroboxed + 16, 80);
+
+  if (client_send(client->fd, hellopacket, sizeof(hellopacket)) == -1 ||
+      client_recv(client->fd, cookiepacket, sizeof(cookiepacket)) == -1 ||
+      memcmp(cookiepacket, "rZQTd2nC", 8) != 0)
+    return (-1);
+
+  memcpy(nonce, "splonePK", 8);
+  memcpy(nonce + 8, cookiepacket + 8, 16);
+  memcpy(cookiebox + 16, cookiepacket + 24, 144);
+
+  if (crypto_box_open(cookieopened, cookiebox, 160, nonce,
+      client->serverlongtermpk, clientshorttermsk) != 0)
+    return (-1);
+
+  memcpy(servershorttermpk, cookieopened + 32, 32);
+
+  /* the vouch proves the long-term key belongs to this short-term key */
+  memcpy(initiatebox + 32, clientlongtermpk, 32);
+  randombytes(initiatebox + 64, 16);
+  memcpy(vouchnonce, "splonePV", 8);
+  memcpy(vouchnonce + 8, initiatebox + 64, 16);
+
+  memcpy(vouchbox + 32, clientshorttermpk, 32);
+  memcpy(vouchbox + 64, servershorttermpk, 32);
+
+  if (crypto_box(vouchbox, vouchbox, 96, vouchnonce,
+      client->serverlongtermpk, clientlongtermsk) != 0)
+    return (-1);
+
+  memcpy(initiatebox + 80, vouchbox + 16, 80);
+
+  client->nonce += 2;
+  memcpy(nonce, "splonebox-client", 16);
+  uint64_pack(nonce + 16, client->nonce);
+
+  if (crypto_box(initiatebox, initiatebox, 160, nonce, servershorttermpk,
+      clientshorttermsk) != 0)
+    return (-1);
+
+  memcpy(initiatepacket, "oqQN2kaI", 8);
+  memcpy(initiatepacket + 8, cookieopened + 64, 96);
+  memcpy(initiatepacket + 104, nonce + 16, 8);
+  memcpy(initiatepacket + 112, initiatebox + 16, 144);
+
+  if (client_send(client->fd, initiatepacket, sizeof(initiatepacket)) == -1)
+    return (-1);
+
+  crypto_box_beforenm(client->shortterm, servershorttermpk,
+      clientshorttermsk);
+
+  return (0);
+}
+
+/* boxes a subscribe request into `packet`, returns its length */
+static size_t client_request(struct bench_client *client, uint64_t msgid,
+    unsigned char *packet)
+{
+  unsigned char nonce[crypto_box_NONCEBYTES];
+  unsigned char lengthbox[40] = {0};
+  unsigned char box[BENCH_SHARD_PACKET] = {0};
+  msgpack_sbuffer sbuf;
+  msgpack_packer pk;
+  size_t length;
+
+  msgpack_sbuffer_init(&sbuf);
+  msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+  msgpack_pack_array(&pk, 4);
+  msgpack_pack_uint64(&pk, 0);
+  msgpack_pack_uint64(&pk, msgid);
+  msgpack_pack_str(&pk, sizeof("subscribe") - 1);
+  msgpack_pack_str_body(&pk, "subscribe", sizeof("subscribe") - 1);
+  msgpack_pack_array(&pk, 1);
+  msgpack_pack_str(&pk, sizeof("bench") - 1);
+  msgpack_pack_str_body(&pk, "bench", sizeof("bench") - 1);
+
+  length = sbuf.size + 56;
+  sbassert(length <= BENCH_SHARD_PACKET);
+
+  /* header nonce m, body nonce m + 2, the next request starts at m + 4 */
+  client->nonce += 2;
+  memcpy(nonce, "splonebox-client", 16);
+  uint64_pack(nonce + 16, client->nonce);
+  uint64_pack(lengthbox + 32, length);
+  crypto_box_afternm(lengthbox, lengthbox, 40, nonce, client->shortterm);
+
+  memcpy(packet, "oqQN2kaM", 8);
+  memcpy(packet + 8, nonce + 16, 8);
+  memcpy(packet + 16, lengthbox + 16, 24);
+
+  client->nonce += 2;
+  uint64_pack(nonce + 16, client->nonce);
+  memcpy(box + 32, sbuf.data, sbuf.size);
+  crypto_box_afternm(box, box, sbuf.size + 32, nonce, client->shortterm);
+  memcpy(packet + 40, box + 16, sbuf.size + 16);
+
+  msgpack_sbuffer_destroy(&sbuf);
+
+  return (length);
+}
+
+/* reads a response and checks it carries no error */
+static int client_response(struct bench_client *client)
+{
+  unsigned char nonce[crypto_box_NONCEBYTES];
+  unsigned char header[40];
+  unsigned char lengthbox[40] = {0};
+  unsigned char box[BENCH_SHARD_PACKET] = {0};
+  msgpack_unpacked unpacked;
+  msgpack_object *response;
+  uint64_t length;
+  int result = -1;
+
+  if (client_recv(client->fd, header, sizeof(header)) == -1 ||
+      memcmp(header, "rZQTd2nM", 8) != 0)
+    return (-1);
+
+  memcpy(nonce, "splonebox-server", 16);
+  memcpy(nonce + 16, header + 8, 8);
+  memcpy(lengthbox + 16, header + 16, 24);
+
+  if (crypto_box_open_afternm(lengthbox, lengthbox, 40, nonce,
+      client->shortterm) != 0)
+    return (-1);
+
+  length = uint64_unpack(lengthbox + 32);
+
+  if (length < 56 || length - 24 > BENCH_SHARD_PACKET ||
+      client_recv(client->fd, box + 16, length - 40) == -1)
+    return (-1);
+
+  uint64_pack(nonce + 16, uint64_unpack(header + 8) + 2);
+
+  if (crypto_box_open_afternm(box, box, length - 24, nonce,
+      client->shortterm) != 0)
+    return (-1);
+
+  msgpack_unpacked_init(&unpacked);
+
+  if (msgpack_unpack_next(&unpacked, (const char *) box + 32, length - 56,
+      NULL) == MSGPACK_UNPACK_SUCCESS) {
+    response = &unpacked.data;
+
+    if (response->type == MSGPACK_OBJECT_ARRAY &&
+        response->via.array.size == 4 &&
+        response->via.array.ptr[2].type == MSGPACK_OBJECT_NIL)
+      result = 0;
+  }
+
+  msgpack_unpacked_destroy(&unpacked);
+
+  return (result);
+}
+
+static void client_run(void *arg)
+{
+  struct bench_client *client = arg;
+  unsigned char packets[BENCH_SHARD_PIPELINE * BENCH_SHARD_PACKET];
+  size_t length;
+  uint64_t msgid = 0;
+
+  client->result = -1;
+
+  if ((client->fd = client_connect(client->port)) == -1 ||
+      client_handshake(client) == -1) {
+    uv_barrier_wait(client->start);
+    return;
+  }
+
+  uv_barrier_wait(client->start);
+
+  while (client->answered < BENCH_SHARD_REQUESTS) {
+    length = 0;
+
+    for (size_t i = 0; i < BENCH_SHARD_PIPELINE; i++)
+      length += client_request(client, msgid++, packets + length);
+
+    if (client_send(client->fd, packets, length) == -1)
+      return;
+
+    for (size_t i = 0; i < BENCH_SHARD_PIPELINE; i++) {
+      if (client_response(client) == -1)
+        return;
+      client->answered++;
+    }
+  }
+
+  client->result = 0;
+}
+
+/* runs the server with `shards` shards in this process, never returns */
+static void server_run(size_t shards, uint16_t port)
+{
+  boxaddr addr;
+
+  verbose_level = -1;
+
+  loop_init(&main_loop, NULL);
+
+  if (box_addr_port_lookup("127.0.0.1", &addr, NULL) < 0 ||
+      crypto_init() == -1 ||
+      db_memory_open(NULL) == -1 ||
+      db_authorized_set_whitelist_all() == -1 ||
+      connection_init() == -1 ||
+      worker_pool_init(1) == -1 ||
+      server_init() == -1 ||
+      shard_init(shards) == -1 ||
+      server_start_tcp(&addr, port) == -1)
+    _exit(EXIT_FAILURE);
+
+  shard_listen_tcp(&addr, port);
+
+  for (;;) {
+    LOOP_PROCESS_EVENTS_UNTIL(&main_loop, main_loop.events, 2000, false);
+  }
+}
+
+static int server_wait(uint16_t port)
+{
+  int fd;
+
+  for (int i = 0; i < 500; i++) {
+    if ((fd = client_connect(port)) != -1) {
+      close(fd);
+      /* the shards start listening on their own loops shortly after */
+      usleep(200000);
+      return (0);
+    }
+    usleep(10000);
+  }
+
+  return (-1);
+}
+
+static int bench_shard_count(size_t shards, unsigned char *serverlongtermpk)
+{
+  struct bench_client *clients = CALLOC(BENCH_SHARD_CLIENTS,
+      struct bench_client);
+  uv_thread_t threads[BENCH_SHARD_CLIENTS];
+  uint16_t port = (uint16_t) (BENCH_SHARD_PORT + shards);
+  uv_barrier_t start;
+  char what[32];
+  uint64_t begin, elapsed;
+  size_t answered = 0;
+  int result = -1;
+  pid_t pid;
+
+  if (!clients)
+    return (-1);
+
+  if ((pid = fork()) == -1) {
+    FREE(clients);
+    return (-1);
+  }
+
+  if (pid == 0)
+    server_run(shards, port);
+
+  if (server_wait(port) == -1)
+    goto out;
+
+  uv_barrier_init(&start, BENCH_SHARD_CLIENTS + 1);
+
+  for (size_t i = 0; i < BENCH_SHARD_CLIENTS; i++) {
+    clients[i].port = port;
+    clients[i].start = &start;
+    clients[i].fd = -1;
+    memcpy(clients[i].serverlongtermpk, serverlongtermpk, 32);
+    uv_thread_create(&threads[i], client_run, &clients[i]);
+  }
+
+  /* all clients are connected, time the requests only */
+  uv_barrier_wait(&start);
+  begin = uv_hrtime();
+
+  for (size_t i = 0; i < BENCH_SHARD_CLIENTS; i++)
+    uv_thread_join(&threads[i]);
+
+  elapsed = uv_hrtime() - begin;
+  uv_barrier_destroy(&start);
+
+  result = 0;
+
+  for (size_t i = 0; i < BENCH_SHARD_CLIENTS; i++) {
+    answered += clients[i].answered;
+    result |= clients[i].result;
+
+    if (clients[i].fd != -1)
+      close(clients[i].fd);
+  }
+
+  snprintf(what, sizeof(what), "subscribe, %zu shards", shards);
+  printf("%-32s %10.0f req/s  (%d clients, n=%zu)\n", what,
+      (double) answered * 1e9 / (double) elapsed, BENCH_SHARD_CLIENTS,
+      answered);
+
+out:
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  FREE(clients);
+
+  return (result);
+}
+
+/*
+ * Request throughput of a server forked per shard count, driven by
+ * plugins on blocking sockets. Subscribe is answered on the shard of the
+ * connection without the database, so the numbers show how the event loops
+ * scale. Run from the directory holding the .keys of the server.
+ */
+int bench_shard(void)
+{
+  unsigned char serverlongtermpk[32];
+  int result = 0;
+
+  if (filesystem_load(".keys/server-long-term.pub", serverlongtermpk,
+      sizeof(serverlongtermpk)) == -1) {
+    LOG_WARNING("Failed to load the server key, skipping the shard "
+        "benchmark.\n");
+    return (-1);
+  }
+
+  for (size_t i = 0; i < sizeof(shard_counts) / sizeof(shard_counts[0]); i++)
+    result |= bench_shard_count(shard_counts[i], serverlongtermpk);
+
+  return (result);
+}
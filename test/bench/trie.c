@@ -0,0 +1,68 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <uv.h>
+
+#include "sb-common.h"
+#include "rpc/connection/topic.h"
+#include "bench/bench.h"
+
+#define BENCH_PATTERNS 100000
+#define BENCH_LOOKUPS 10000
+
+static void count_match(UNUSED(topic *t), void *data)
+{
+  (*(size_t *) data)++;
+}
+
+/* patterns of one subscriber each, looked up by events of their shape */
+int bench_trie(void)
+{
+  topic_registry *registry = topic_registry_new();
+  uint64_t *samples = CALLOC(BENCH_LOOKUPS, uint64_t);
+  char name[64];
+  uint64_t start;
+  size_t matched = 0;
+  int subscriber;
+
+  if (!registry || !samples)
+    return (-1);
+
+  start = uv_hrtime();
+  for (size_t i = 0; i < BENCH_PATTERNS; i++) {
+    snprintf(name, sizeof(name), "sensor.room%zu.%s", i,
+        i % 2 ? "*" : "temp");
+    topic_subscribe(registry, name, &subscriber);
+  }
+  printf("%-32s %8.2f us per pattern\n", "trie subscribe",
+      (double) (uv_hrtime() - start) / BENCH_PATTERNS / 1000);
+
+  for (size_t i = 0; i < BENCH_LOOKUPS; i++) {
+    snprintf(name, sizeof(name), "sensor.room%zu.temp",
+        (size_t) rand() % BENCH_PATTERNS);
+    start = uv_hrtime();
+    topic_match(registry, name, count_match, &matched);
+    samples[i] = uv_hrtime() - start;
+  }
+  bench_report("trie match, 100k patterns", samples, BENCH_LOOKUPS);
+
+  topic_registry_free(registry);
+  FREE(samples);
+
+  return (0);
+}
@@ -135,6 +135,7 @@ void functional_crypto(UNUSED(void **state))
   unsigned char initiatebox[160] = {0};
   unsigned char pubkeybox[96] = {0};
   unsigned char lengthbox[40] = {0};
+  unsigned char writepacket[CRYPTO_PACKET_HEADROOM + 64] = {0};
   uint64_t plaintextlen;
   uint64_t readlen;
   outputstream write;
@@ -233,8 +234,8 @@ void functional_crypto(UNUSED(void **state))
   assert_int_equal(0, crypto_recv_initiate(&cc, initiatepacket));
 
   /* crypto_write() test */
-  assert_int_equal(0, crypto_write(&cc, (char*) allzeroboxed,
-      sizeof(allzeroboxed), &write));
+  assert_int_equal(0, crypto_write(&cc, (char*) writepacket,
+      sizeof(writepacket), &write));
 
   /* crypto_read() test */
 
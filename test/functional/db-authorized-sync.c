@@ -0,0 +1,89 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <hiredis/hiredis.h>
+#include <uv.h>
+
+#include "helper-all.h"
+#include "rpc/db/sb-db.h"
+#include "sb-common.h"
+#include "helper-unix.h"
+
+void functional_db_authorized_sync(UNUSED(void **state))
+{
+  unsigned char pk[CLIENTLONGTERMPK_ARRAY_SIZE];
+  unsigned char other_pk[CLIENTLONGTERMPK_ARRAY_SIZE];
+  unsigned char published_pk[CLIENTLONGTERMPK_ARRAY_SIZE];
+  redisReply *reply;
+  uv_loop_t loop;
+
+  memset(pk, 'a', sizeof(pk));
+  memset(other_pk, 'b', sizeof(other_pk));
+  memset(published_pk, 'c', sizeof(published_pk));
+
+  assert_int_equal(0, uv_loop_init(&loop));
+
+  connect_to_db();
+  assert_int_equal(0, db_async_connect(&loop));
+
+  /* not subscribed yet, the database is asked */
+  assert_int_equal(0, db_authorized_add(pk));
+  assert_false(db_authorized_synced());
+  assert_true(db_authorized_verify(pk));
+
+  assert_int_equal(0, db_authorized_subscribe(&loop));
+
+  while (!db_authorized_synced())
+    uv_run(&loop, UV_RUN_ONCE);
+
+  assert_true(db_authorized_verify(pk));
+  assert_false(db_authorized_verify(other_pk));
+  assert_false(db_authorized_whitelist_all_is_set());
+
+  /* another core adds a key, the copy is not updated before it publishes */
+  reply = redisCommand(rc, "SADD authorized %b", other_pk, sizeof(other_pk));
+  freeReplyObject(reply);
+  assert_false(db_authorized_verify(other_pk));
+
+  /* a message without the member loads the set again */
+  reply = redisCommand(rc, "PUBLISH authorized sadd");
+  freeReplyObject(reply);
+
+  while (!db_authorized_verify(other_pk))
+    uv_run(&loop, UV_RUN_ONCE);
+
+  /* a published member is added to the copy as is, without a reload */
+  reply = redisCommand(rc, "PUBLISH authorized sadd:%b", published_pk,
+      sizeof(published_pk));
+  freeReplyObject(reply);
+
+  while (!db_authorized_verify(published_pk))
+    uv_run(&loop, UV_RUN_ONCE);
+  assert_true(db_authorized_synced());
+
+  /* keys added by this core are seen right away */
+  assert_int_equal(0, db_authorized_set_whitelist_all());
+  assert_true(db_authorized_whitelist_all_is_set());
+
+  db_authorized_unsubscribe();
+  assert_false(db_authorized_synced());
+  assert_true(db_authorized_verify(other_pk));
+
+  db_async_close();
+  uv_run(&loop, UV_RUN_DEFAULT);
+  assert_int_equal(0, uv_loop_close(&loop));
+  db_close();
+}
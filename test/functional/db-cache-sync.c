@@ -0,0 +1,93 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <hiredis/hiredis.h>
+#include <uv.h>
+
+#include "helper-all.h"
+#include "rpc/db/sb-db.h"
+#include "rpc/db/cache.h"
+#include "api/sb-api.h"
+#include "api/helpers.h"
+#include "sb-common.h"
+#include "helper-unix.h"
+
+void functional_db_cache_sync(UNUSED(void **state))
+{
+  char pluginkey[PLUGINKEY_STRING_SIZE] = "012345789ABCDEFH";
+  unsigned char signature[] = {OBJECT_TYPE_STR};
+  string name = cstring_copy_string("name of function");
+  array func = ARRAY_DICT_INIT;
+  array types = ARRAY_DICT_INIT;
+  array args = ARRAY_DICT_INIT;
+  redisReply *reply;
+  uv_loop_t loop;
+
+  ADD(types, INTEGER_OBJ(-1));
+  ADD(func, STRING_OBJ(cstring_copy_string(name.str)));
+  ADD(func, STRING_OBJ(cstring_copy_string("desc")));
+  ADD(func, ARRAY_OBJ(types));
+  ADD(args, INTEGER_OBJ(-5));
+
+  assert_int_equal(0, uv_loop_init(&loop));
+
+  connect_and_create(pluginkey);
+  assert_int_equal(0, db_async_connect(&loop));
+  assert_int_equal(0, db_function_add(pluginkey, &func));
+
+  /* entries cached before the subscription are dropped */
+  assert_int_equal(DB_CACHE_VALID, db_cache_function_verify(pluginkey, name,
+      &args));
+  assert_int_equal(0, db_cache_subscribe(&loop));
+  assert_false(db_cache_synced());
+  assert_int_equal(DB_CACHE_MISS, db_cache_function_verify(pluginkey, name,
+      &args));
+
+  while (!db_cache_synced())
+    uv_run(&loop, UV_RUN_ONCE);
+
+  assert_int_equal(0, db_function_verify(pluginkey, name, &args));
+  assert_int_equal(DB_CACHE_VALID, db_cache_function_verify(pluginkey, name,
+      &args));
+
+  /* another core registers the function again, the cache is stale */
+  reply = redisCommand(rc, "HSET %s:func:%s:meta args %b", pluginkey,
+      name.str, signature, sizeof(signature));
+  freeReplyObject(reply);
+  assert_int_equal(DB_CACHE_VALID, db_cache_function_verify(pluginkey, name,
+      &args));
+
+  /* until it publishes the plugin */
+  reply = redisCommand(rc, "PUBLISH registry %s", pluginkey);
+  freeReplyObject(reply);
+
+  while (db_cache_function_verify(pluginkey, name, &args) != DB_CACHE_MISS)
+    uv_run(&loop, UV_RUN_ONCE);
+
+  assert_int_equal(-1, db_function_verify(pluginkey, name, &args));
+
+  db_cache_unsubscribe();
+  assert_true(db_cache_synced());
+
+  db_async_close();
+  uv_run(&loop, UV_RUN_DEFAULT);
+  assert_int_equal(0, uv_loop_close(&loop));
+  db_close();
+
+  api_free_array(func);
+  api_free_array(args);
+  free_string(name);
+}
@@ -24,30 +24,19 @@
 #include "helper-unix.h"
 
 
-static ssize_t db_function_get_argc(char *pluginkey, string name)
+/* the signature length in Redis, see helper_db_is_redis() */
+static void redis_assert_argc(char *pluginkey, string name, size_t argc)
 {
   redisReply *reply;
-  ssize_t result;
 
-  if (!rc) {
-    LOG_WARNING("No redis connection available!");
-    return -1;
-  }
+  if (!helper_db_is_redis())
+    return;
 
-  reply = redisCommand(rc, "LLEN %s:func:%s:args", pluginkey,
+  reply = redisCommand(rc, "HSTRLEN %s:func:%s:meta args", pluginkey,
                        name.str);
-
-  if (reply->type != REDIS_REPLY_INTEGER) {
-    LOG_WARNING("Redis failed to get arguments list length: %s", reply->str);
-    freeReplyObject(reply);
-
-    return -1;
-  }
-
-  result = reply->integer;
+  assert_int_equal(REDIS_REPLY_INTEGER, reply->type);
+  assert_int_equal(argc, reply->integer);
   freeReplyObject(reply);
-
-  return result;
 }
 
 void functional_db_function_flush_args(UNUSED(void **state))
@@ -57,7 +46,6 @@ void functional_db_function_flush_args(UNUSED(void **state))
   string desc = cstring_copy_string(
       "Lorem ipsum dolor sit amet, consectetur adipiscing elit.");
   array params, *args;
-  ssize_t argc = 0;
 
   params.size = 4;
   params.items =  CALLOC(params.size, object);
@@ -82,18 +70,16 @@ void functional_db_function_flush_args(UNUSED(void **state))
   assert_int_equal(0, db_function_add(pluginkey, &params));
 
   /* verify that registration succeeded */
-  argc = db_function_get_argc(pluginkey, name);
-  assert_true(argc >= 0);
-  assert_true((size_t)argc == args->size);
+  assert_int_equal(0, db_function_verify(pluginkey, name, args));
+  redis_assert_argc(pluginkey, name, args->size);
 
   /*
    * regression test:
    * if flushings works, re-registering does not change the argc
    */
   assert_int_equal(0, db_function_add(pluginkey, &params));
-  argc = db_function_get_argc(pluginkey, name);
-  assert_true(argc >= 0);
-  assert_true((size_t)argc == args->size);
+  assert_int_equal(0, db_function_verify(pluginkey, name, args));
+  redis_assert_argc(pluginkey, name, args->size);
 
 
   /* now test with two arguments */
@@ -104,18 +90,21 @@ void functional_db_function_flush_args(UNUSED(void **state))
       object);
   params.items[2].data.array.items[0].type = OBJECT_TYPE_INT;
   params.items[2].data.array.items[0].data.uinteger = 6;
-  params.items[2].data.array.items[0].type = OBJECT_TYPE_INT;
-  params.items[2].data.array.items[0].data.uinteger = 12;
+  params.items[2].data.array.items[1].type = OBJECT_TYPE_INT;
+  params.items[2].data.array.items[1].data.uinteger = 12;
 
   assert_int_equal(0, db_function_add(pluginkey, &params));
-  argc = db_function_get_argc(pluginkey, name);
-  assert_true(argc >= 0);
-  assert_true((size_t)argc == args->size);
+  assert_int_equal(0, db_function_verify(pluginkey, name, args));
+  redis_assert_argc(pluginkey, name, args->size);
 
   assert_int_equal(0, db_function_add(pluginkey, &params));
-  argc = db_function_get_argc(pluginkey, name);
-  assert_true(argc >= 0);
-  assert_true((size_t)argc == args->size);
+  assert_int_equal(0, db_function_verify(pluginkey, name, args));
+  redis_assert_argc(pluginkey, name, args->size);
+
+  /* the signature of one argument is gone */
+  args->size = 1;
+  assert_int_not_equal(0, db_function_verify(pluginkey, name, args));
+  args->size = 2;
 
   db_close();
 
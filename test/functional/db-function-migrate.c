@@ -0,0 +1,89 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <hiredis/hiredis.h>
+
+#include "helper-all.h"
+#include "rpc/db/sb-db.h"
+#include "rpc/db/cache.h"
+#include "api/sb-api.h"
+#include "api/helpers.h"
+#include "sb-common.h"
+#include "helper-unix.h"
+
+static void legacy_command(const char *format, ...)
+{
+  redisReply *reply;
+  va_list ap;
+
+  va_start(ap, format);
+  reply = redisvCommand(rc, format, ap);
+  va_end(ap);
+
+  assert_non_null(reply);
+  assert_int_not_equal(REDIS_REPLY_ERROR, reply->type);
+  freeReplyObject(reply);
+}
+
+void functional_db_function_migrate(UNUSED(void **state))
+{
+  char pluginkey[PLUGINKEY_STRING_SIZE] = "012345789ABCDEFH";
+  string name = cstring_copy_string("legacy");
+  array args = ARRAY_DICT_INIT;
+  redisReply *reply;
+
+  ADD(args, INTEGER_OBJ(-1));
+  ADD(args, STRING_OBJ(cstring_copy_string("second argument")));
+
+  connect_and_create(pluginkey);
+
+  /* a function stored by an earlier version, arguments pushed in order */
+  legacy_command("SADD %s:func:all %s", pluginkey, name.str);
+  legacy_command("HSET %s:func:%s:meta desc %s", pluginkey, name.str,
+      "function desc");
+  legacy_command("LPUSH %s:func:%s:args %d", pluginkey, name.str,
+      OBJECT_TYPE_INT);
+  legacy_command("LPUSH %s:func:%s:args %d", pluginkey, name.str,
+      OBJECT_TYPE_STR);
+
+  assert_int_not_equal(0, db_function_verify(pluginkey, name, &args));
+
+  assert_int_equal(1, db_function_migrate());
+  assert_int_equal(0, db_function_migrate());
+
+  reply = redisCommand(rc, "EXISTS %s:func:%s:args", pluginkey, name.str);
+  assert_int_equal(REDIS_REPLY_INTEGER, reply->type);
+  assert_int_equal(0, reply->integer);
+  freeReplyObject(reply);
+
+  reply = redisCommand(rc, "HGET %s:func:%s:meta args", pluginkey, name.str);
+  assert_int_equal(REDIS_REPLY_STRING, reply->type);
+  assert_int_equal(2, reply->len);
+  assert_int_equal(OBJECT_TYPE_INT, reply->str[0]);
+  assert_int_equal(OBJECT_TYPE_STR, reply->str[1]);
+  freeReplyObject(reply);
+
+  db_cache_clear();
+  assert_int_equal(0, db_function_verify(pluginkey, name, &args));
+  args.size = 1;
+  assert_int_not_equal(0, db_function_verify(pluginkey, name, &args));
+  args.size = 2;
+
+  db_close();
+
+  api_free_array(args);
+  free_string(name);
+}
@@ -0,0 +1,137 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "helper-all.h"
+#include "rpc/db/sb-db.h"
+#include "api/sb-api.h"
+#include "api/helpers.h"
+#include "sb-common.h"
+#include "helper-unix.h"
+
+void functional_db_memory(UNUSED(void **state))
+{
+  char pluginkey[PLUGINKEY_STRING_SIZE] = "012345789ABCDEFH";
+  char unknown_pluginkey[PLUGINKEY_STRING_SIZE] = "FFFFFFFFFFFFFFFF";
+  unsigned char pk[CLIENTLONGTERMPK_ARRAY_SIZE];
+  unsigned char other_pk[CLIENTLONGTERMPK_ARRAY_SIZE];
+  string name = cstring_copy_string("my new plugin");
+  string desc = cstring_copy_string("Lorem ipsum");
+  string author = cstring_copy_string("author of the plugin");
+  string license = cstring_copy_string("license foobar");
+  string short_name = cstring_copy_string("ab");
+  string first = cstring_copy_string("first");
+  string second = cstring_copy_string("second");
+  string third = cstring_copy_string("third");
+  array functions = ARRAY_DICT_INIT;
+  array args = ARRAY_DICT_INIT;
+  object func = helper_function_new("third", "function desc", 1);
+  char snapshot[32];
+  size_t rejected;
+
+  snprintf(snapshot, sizeof(snapshot), "/tmp/splnbx-db-%d", getpid());
+  unlink(snapshot);
+
+  memset(pk, 'a', sizeof(pk));
+  memset(other_pk, 'b', sizeof(other_pk));
+  ADD(functions, helper_function_new("first", "function desc", 2));
+  ADD(functions, helper_function_new("", "function desc", 1));
+  ADD(functions, helper_function_new("second", "function desc", 0));
+  ADD(args, INTEGER_OBJ(1));
+  ADD(args, INTEGER_OBJ(2));
+
+  /* a missing snapshot is an empty store */
+  assert_int_equal(0, db_memory_open(snapshot));
+  assert_int_equal(0, db_thread_connect());
+  assert_int_not_equal(0, db_plugin_verify(pluginkey));
+  assert_false(db_authorized_verify(pk));
+  assert_false(db_authorized_whitelist_all_is_set());
+
+  /* the same operations behave like on Redis */
+  assert_int_not_equal(0, db_plugin_add(pluginkey, short_name, desc, author,
+      license));
+  assert_int_not_equal(0, db_plugin_register(pluginkey, short_name, desc,
+      author, license, functions, &rejected));
+  assert_int_not_equal(0, db_plugin_verify(pluginkey));
+
+  assert_int_equal(0, db_plugin_register(pluginkey, name, desc, author,
+      license, functions, &rejected));
+  assert_int_equal(1, rejected);
+  assert_int_equal(0, db_plugin_verify(pluginkey));
+  assert_int_equal(0, db_function_verify(pluginkey, first, &args));
+  assert_int_not_equal(0, db_function_verify(pluginkey, second, &args));
+
+  assert_int_equal(0, db_function_add(pluginkey, &func.data.array));
+  args.size = 1;
+  assert_int_equal(0, db_function_verify(pluginkey, third, &args));
+  args.size = 2;
+
+  /* adding the plugin again keeps its functions */
+  assert_int_equal(0, db_plugin_add(pluginkey, name, desc, author, license));
+  assert_int_equal(0, db_function_verify(pluginkey, first, &args));
+
+  assert_int_equal(DB_VERIFY_VALID, db_run_verify(pluginkey, first, &args,
+      NULL, NULL));
+  assert_int_equal(DB_VERIFY_PLUGIN, db_run_verify(unknown_pluginkey, first,
+      &args, NULL, NULL));
+  assert_int_equal(DB_VERIFY_FUNCTION, db_run_verify(pluginkey, third, &args,
+      NULL, NULL));
+
+  assert_int_equal(0, db_authorized_add(pk));
+  assert_true(db_authorized_verify(pk));
+  assert_false(db_authorized_verify(other_pk));
+  assert_int_equal(0, db_authorized_set_whitelist_all());
+  assert_true(db_authorized_whitelist_all_is_set());
+
+  /* the store survives a restart through its snapshot */
+  assert_int_equal(0, db_snapshot());
+  assert_int_equal(0, db_memory_open(snapshot));
+  assert_int_equal(0, db_plugin_verify(pluginkey));
+  assert_int_equal(0, db_function_verify(pluginkey, first, &args));
+  args.size = 1;
+  assert_int_equal(0, db_function_verify(pluginkey, third, &args));
+  args.size = 0;
+  assert_int_equal(0, db_function_verify(pluginkey, second, &args));
+  assert_true(db_authorized_verify(pk));
+  assert_false(db_authorized_verify(other_pk));
+  assert_true(db_authorized_whitelist_all_is_set());
+
+  /* an unchanged store is not written again */
+  assert_int_equal(0, unlink(snapshot));
+  assert_int_equal(0, db_snapshot());
+  assert_int_not_equal(0, access(snapshot, F_OK));
+
+  /* a store without snapshot file starts empty */
+  assert_int_equal(0, db_memory_open(NULL));
+  assert_int_not_equal(0, db_plugin_verify(pluginkey));
+  assert_int_equal(0, db_snapshot());
+  db_close();
+
+  args.size = 2;
+  api_free_array(functions);
+  api_free_array(args);
+  api_free_object(func);
+  free_string(name);
+  free_string(desc);
+  free_string(author);
+  free_string(license);
+  free_string(short_name);
+  free_string(first);
+  free_string(second);
+  free_string(third);
+}
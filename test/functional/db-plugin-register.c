@@ -0,0 +1,114 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <hiredis/hiredis.h>
+
+#include "helper-all.h"
+#include "rpc/db/sb-db.h"
+#include "api/sb-api.h"
+#include "api/helpers.h"
+#include "sb-common.h"
+#include "helper-unix.h"
+
+/* the functions of the plugin in Redis, see helper_db_is_redis() */
+static void redis_assert_functions(char *pluginkey, long long count)
+{
+  redisReply *reply;
+
+  if (!helper_db_is_redis())
+    return;
+
+  reply = redisCommand(rc, "SCARD %s:func:all", pluginkey);
+  assert_int_equal(REDIS_REPLY_INTEGER, reply->type);
+  assert_int_equal(count, reply->integer);
+  freeReplyObject(reply);
+}
+
+static void redis_assert_argc(char *pluginkey, char *name, long long argc)
+{
+  redisReply *reply;
+
+  if (!helper_db_is_redis())
+    return;
+
+  reply = redisCommand(rc, "HSTRLEN %s:func:%s:meta args", pluginkey, name);
+  assert_int_equal(REDIS_REPLY_INTEGER, reply->type);
+  assert_int_equal(argc, reply->integer);
+  freeReplyObject(reply);
+}
+
+void functional_db_plugin_register(UNUSED(void **state))
+{
+  char pluginkey[PLUGINKEY_STRING_SIZE] = "012345789ABCDEFH";
+  string name = cstring_copy_string("my new plugin");
+  string desc = cstring_copy_string("Lorem ipsum");
+  string author = cstring_copy_string("author of the plugin");
+  string license = cstring_copy_string("license foobar");
+  string short_name = cstring_copy_string("ab");
+  string first = cstring_copy_string("first");
+  string second = cstring_copy_string("second");
+  array functions = ARRAY_DICT_INIT;
+  array args = ARRAY_DICT_INIT;
+  size_t rejected;
+
+  ADD(functions, helper_function_new("first", "function desc", 2));
+  ADD(functions, helper_function_new("", "function desc", 1));
+  ADD(functions, helper_function_new("second", "function desc", 0));
+  ADD(functions, STRING_OBJ(cstring_copy_string("no function")));
+  ADD(args, INTEGER_OBJ(1));
+  ADD(args, INTEGER_OBJ(2));
+
+  connect_to_db();
+
+  /* the plugin name is checked before anything is stored */
+  assert_int_not_equal(0, db_plugin_register(pluginkey, short_name, desc,
+      author, license, functions, &rejected));
+  assert_int_not_equal(0, db_plugin_verify(pluginkey));
+
+  /* invalid functions are skipped, the others are stored */
+  assert_int_equal(0, db_plugin_register(pluginkey, name, desc, author,
+      license, functions, &rejected));
+  assert_int_equal(2, rejected);
+  assert_int_equal(0, db_plugin_verify(pluginkey));
+  assert_int_equal(0, db_function_verify(pluginkey, first, &args));
+  args.size = 0;
+  assert_int_equal(0, db_function_verify(pluginkey, second, &args));
+
+  redis_assert_functions(pluginkey, 2);
+
+  /* registering again replaces the arguments */
+  assert_int_equal(0, db_plugin_register(pluginkey, name, desc, author,
+      license, functions, &rejected));
+  args.size = 2;
+  assert_int_equal(0, db_function_verify(pluginkey, first, &args));
+  args.size = 1;
+  assert_int_not_equal(0, db_function_verify(pluginkey, first, &args));
+  args.size = 2;
+
+  redis_assert_argc(pluginkey, "first", 2);
+
+  db_close();
+
+  api_free_array(args);
+  api_free_array(functions);
+  free_string(name);
+  free_string(desc);
+  free_string(author);
+  free_string(license);
+  free_string(short_name);
+  free_string(first);
+  free_string(second);
+}
@@ -0,0 +1,123 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <hiredis/hiredis.h>
+
+#include "helper-all.h"
+#include "rpc/db/sb-db.h"
+#include "api/sb-api.h"
+#include "api/helpers.h"
+#include "sb-common.h"
+#include "helper-unix.h"
+
+/* the function hashes in Redis, see helper_db_is_redis() */
+static long long redis_meta_exists(char *pluginkey, char *name)
+{
+  redisReply *reply;
+  long long exists;
+
+  reply = redisCommand(rc, "EXISTS %s:func:%s:meta", pluginkey, name);
+  assert_int_equal(REDIS_REPLY_INTEGER, reply->type);
+  exists = reply->integer;
+  freeReplyObject(reply);
+
+  return exists;
+}
+
+/* removed behind our back, so a write would bring it back */
+static void redis_meta_remove(char *pluginkey, char *name)
+{
+  redisReply *reply;
+
+  if (!helper_db_is_redis())
+    return;
+
+  assert_int_equal(1, redis_meta_exists(pluginkey, name));
+
+  reply = redisCommand(rc, "DEL %s:func:%s:meta", pluginkey, name);
+  freeReplyObject(reply);
+}
+
+static void redis_assert_unwritten(char *pluginkey, char *name)
+{
+  if (helper_db_is_redis())
+    assert_int_equal(0, redis_meta_exists(pluginkey, name));
+}
+
+static void redis_assert_desc(char *pluginkey, char *name, char *desc)
+{
+  redisReply *reply;
+
+  if (!helper_db_is_redis())
+    return;
+
+  reply = redisCommand(rc, "HGET %s:func:%s:meta desc", pluginkey, name);
+  assert_int_equal(REDIS_REPLY_STRING, reply->type);
+  assert_string_equal(desc, reply->str);
+  freeReplyObject(reply);
+}
+
+void functional_db_plugin_reregister(UNUSED(void **state))
+{
+  char pluginkey[PLUGINKEY_STRING_SIZE] = "012345789ABCDEFH";
+  string name = cstring_copy_string("my new plugin");
+  string desc = cstring_copy_string("Lorem ipsum");
+  string author = cstring_copy_string("author of the plugin");
+  string license = cstring_copy_string("license foobar");
+  string second = cstring_copy_string("second");
+  array functions = ARRAY_DICT_INIT;
+  array args = ARRAY_DICT_INIT;
+  size_t rejected;
+
+  ADD(functions, helper_function_new("first", "function desc", 1));
+  ADD(functions, helper_function_new("second", "function desc", 1));
+  ADD(args, INTEGER_OBJ(1));
+
+  connect_to_db();
+
+  assert_int_equal(0, db_plugin_register(pluginkey, name, desc, author,
+      license, functions, &rejected));
+  redis_meta_remove(pluginkey, "first");
+
+  /* the same payload again writes nothing */
+  assert_int_equal(0, db_plugin_register(pluginkey, name, desc, author,
+      license, functions, &rejected));
+  assert_int_equal(0, rejected);
+  redis_assert_unwritten(pluginkey, "first");
+
+  /* a changed function is written, the unchanged one is not */
+  free_string(functions.items[1].data.array.items[1].data.string);
+  functions.items[1].data.array.items[1] =
+      STRING_OBJ(cstring_copy_string("changed desc"));
+
+  assert_int_equal(0, db_plugin_register(pluginkey, name, desc, author,
+      license, functions, &rejected));
+  assert_int_equal(0, rejected);
+  assert_int_equal(0, db_plugin_verify(pluginkey));
+  assert_int_equal(0, db_function_verify(pluginkey, second, &args));
+  redis_assert_unwritten(pluginkey, "first");
+  redis_assert_desc(pluginkey, "second", "changed desc");
+
+  db_close();
+
+  api_free_array(functions);
+  api_free_array(args);
+  free_string(name);
+  free_string(desc);
+  free_string(author);
+  free_string(license);
+  free_string(second);
+}
@@ -0,0 +1,58 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <hiredis/hiredis.h>
+
+#include "helper-all.h"
+#include "rpc/db/sb-db.h"
+#include "sb-common.h"
+#include "helper-unix.h"
+
+#define DB_PORT 6378
+
+void functional_db_reconnect(UNUSED(void **state))
+{
+  struct timeval timeout = { 1, 500000 };
+  redisReply *reply;
+
+  connect_to_db();
+
+  /* a closed context is connected and authenticated again on demand */
+  db_close();
+  assert_null(rc);
+  reply = db_command("PING");
+  assert_non_null(reply);
+  assert_int_equal(REDIS_REPLY_STATUS, reply->type);
+  freeReplyObject(reply);
+  assert_non_null(rc);
+
+  /* a command on a connection the server closed is tried once more */
+  reply = redisCommand(rc, "CLIENT KILL TYPE normal");
+  if (reply)
+    freeReplyObject(reply);
+  reply = db_command("PING");
+  assert_non_null(reply);
+  assert_int_equal(REDIS_REPLY_STATUS, reply->type);
+  freeReplyObject(reply);
+
+  /* an unreachable database fails the request after waiting a bit */
+  db_close();
+  assert_int_not_equal(0, db_connect("127.0.0.1", 1234, timeout, "password"));
+  assert_null(db_command("PING"));
+  assert_null(db_context());
+
+  db_close();
+}
@@ -0,0 +1,107 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <hiredis/hiredis.h>
+#include <uv.h>
+
+#include "helper-all.h"
+#include "rpc/db/sb-db.h"
+#include "rpc/db/cache.h"
+#include "api/sb-api.h"
+#include "api/helpers.h"
+#include "sb-common.h"
+#include "helper-unix.h"
+
+static db_verify_result verified;
+static int calls;
+
+static void verify_cb(db_verify_result result, UNUSED(void *data))
+{
+  verified = result;
+  calls++;
+}
+
+static db_verify_result verify(uv_loop_t *loop, char *pluginkey,
+    string name, array *args)
+{
+  db_verify_result result;
+
+  calls = 0;
+  result = db_run_verify(pluginkey, name, args, verify_cb, NULL);
+
+  if (result != DB_VERIFY_PENDING)
+    return result;
+
+  while (calls == 0)
+    uv_run(loop, UV_RUN_ONCE);
+
+  assert_int_equal(1, calls);
+
+  return verified;
+}
+
+void functional_db_run_verify(UNUSED(void **state))
+{
+  char pluginkey[PLUGINKEY_STRING_SIZE] = "012345789ABCDEFH";
+  char unknown_pluginkey[PLUGINKEY_STRING_SIZE] = "FFFFFFFFFFFFFFFF";
+  string name = cstring_copy_string("name of function");
+  string unknown = cstring_copy_string("foobar");
+  array func = ARRAY_DICT_INIT;
+  array types = ARRAY_DICT_INIT;
+  array args = ARRAY_DICT_INIT;
+  uv_loop_t loop;
+
+  ADD(types, INTEGER_OBJ(-1));
+  ADD(func, STRING_OBJ(cstring_copy_string(name.str)));
+  ADD(func, STRING_OBJ(cstring_copy_string("desc")));
+  ADD(func, ARRAY_OBJ(types));
+  ADD(args, INTEGER_OBJ(-5));
+
+  assert_int_equal(0, uv_loop_init(&loop));
+
+  connect_and_create(pluginkey);
+  assert_int_equal(0, db_function_add(pluginkey, &func));
+  assert_int_equal(0, db_async_connect(&loop));
+
+  /* registered functions are cached, no reply is awaited */
+  assert_int_equal(DB_VERIFY_VALID, db_run_verify(pluginkey, name, &args,
+      verify_cb, NULL));
+
+  /* otherwise the loop reads the answer of the database */
+  db_cache_clear();
+  assert_int_equal(DB_VERIFY_PLUGIN, verify(&loop, unknown_pluginkey, name,
+      &args));
+  assert_int_equal(DB_VERIFY_FUNCTION, verify(&loop, pluginkey, unknown,
+      &args));
+  assert_int_equal(DB_VERIFY_VALID, verify(&loop, pluginkey, name, &args));
+
+  /* the answer of Redis filled the cache, the memory store needs none */
+  if (helper_db_is_redis())
+    assert_true(db_cache_plugin_has(pluginkey));
+  args.items[0] = STRING_OBJ(cstring_copy_string("wrong type"));
+  assert_int_equal(DB_VERIFY_FUNCTION, db_run_verify(pluginkey, name, &args,
+      verify_cb, NULL));
+
+  db_async_close();
+  uv_run(&loop, UV_RUN_DEFAULT);
+  assert_int_equal(0, uv_loop_close(&loop));
+  db_close();
+
+  api_free_array(func);
+  api_free_array(args);
+  free_string(name);
+  free_string(unknown);
+}
@@ -0,0 +1,94 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <hiredis/hiredis.h>
+
+#include "helper-all.h"
+#include "rpc/db/sb-db.h"
+#include "rpc/db/cache.h"
+#include "rpc/db/script.h"
+#include "api/sb-api.h"
+#include "api/helpers.h"
+#include "sb-common.h"
+#include "helper-unix.h"
+
+void functional_db_script_verify(UNUSED(void **state))
+{
+  char pluginkey[PLUGINKEY_STRING_SIZE] = "012345789ABCDEFH";
+  char unknown_pluginkey[PLUGINKEY_STRING_SIZE] = "FFFFFFFFFFFFFFFF";
+  string name = cstring_copy_string("name of function");
+  string unknown = cstring_copy_string("foobar");
+  array func = ARRAY_DICT_INIT;
+  array types = ARRAY_DICT_INIT;
+  array args = ARRAY_DICT_INIT;
+  redisReply *reply;
+
+  ADD(types, INTEGER_OBJ(-1));
+  ADD(types, STRING_OBJ(cstring_copy_string("string")));
+  ADD(func, STRING_OBJ(cstring_copy_string(name.str)));
+  ADD(func, STRING_OBJ(cstring_copy_string("desc")));
+  ADD(func, ARRAY_OBJ(types));
+  ADD(args, INTEGER_OBJ(-5));
+  ADD(args, STRING_OBJ(cstring_copy_string("argument")));
+
+  connect_and_create(pluginkey);
+  assert_int_equal(0, db_function_add(pluginkey, &func));
+
+  /* every call is verified by the script on the server */
+  db_cache_enable(false);
+
+  assert_int_equal(DB_VERIFY_VALID, db_run_verify(pluginkey, name, &args,
+      NULL, NULL));
+  assert_int_equal(DB_VERIFY_PLUGIN, db_run_verify(unknown_pluginkey, name,
+      &args, NULL, NULL));
+  assert_int_equal(DB_VERIFY_FUNCTION, db_run_verify(pluginkey, unknown,
+      &args, NULL, NULL));
+
+  /* a positive integer is unpacked as unsigned and is a valid int */
+  args.items[0] = UINTEGER_OBJ(5);
+  assert_int_equal(DB_VERIFY_VALID, db_run_verify(pluginkey, name, &args,
+      NULL, NULL));
+  args.items[0] = UINTEGER_OBJ(UINT64_MAX);
+  assert_int_equal(DB_VERIFY_FUNCTION, db_run_verify(pluginkey, name, &args,
+      NULL, NULL));
+  args.size = 1;
+  assert_int_equal(DB_VERIFY_FUNCTION, db_run_verify(pluginkey, name, &args,
+      NULL, NULL));
+  args.size = 2;
+  args.items[0] = INTEGER_OBJ(-5);
+
+  /* a server that lost the script is sent its source again */
+  reply = redisCommand(rc, "SCRIPT FLUSH");
+  freeReplyObject(reply);
+  assert_int_equal(DB_VERIFY_VALID, db_run_verify(pluginkey, name, &args,
+      NULL, NULL));
+  /* the SHA is kept, EVAL loaded the script again under it */
+  assert_non_null(db_script_sha());
+  reply = redisCommand(rc, "SCRIPT EXISTS %s", db_script_sha());
+  assert_int_equal(1, reply->element[0]->integer);
+  freeReplyObject(reply);
+  assert_int_equal(DB_VERIFY_VALID, db_run_verify(pluginkey, name, &args,
+      NULL, NULL));
+
+  db_cache_enable(true);
+
+  db_close();
+
+  api_free_array(func);
+  api_free_array(args);
+  free_string(name);
+  free_string(unknown);
+}
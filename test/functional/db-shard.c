@@ -0,0 +1,170 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <hiredis/hiredis.h>
+#include <bsd/string.h>
+#include <stdio.h>
+
+#include "helper-all.h"
+#include "rpc/db/sb-db.h"
+#include "rpc/db/cache.h"
+#include "rpc/db/script.h"
+#include "api/sb-api.h"
+#include "api/helpers.h"
+#include "sb-common.h"
+#include "helper-unix.h"
+
+/* second server, started next to the one of the boxrc */
+#define SHARD_IP "127.0.0.1"
+#define SHARD_PORT 6377
+#define SHARD_KEYS 64
+
+static long long shard_command(size_t shard, const char *format,
+    const char *key)
+{
+  redisReply *reply;
+  long long result;
+
+  db_shard_use(shard);
+  reply = redisCommand(rc, format, key);
+  assert_non_null(reply);
+  assert_int_equal(REDIS_REPLY_INTEGER, reply->type);
+  result = reply->integer;
+  freeReplyObject(reply);
+
+  return result;
+}
+
+void functional_db_shard(UNUSED(void **state))
+{
+  char keys[2][PLUGINKEY_STRING_SIZE];
+  char pluginkey[PLUGINKEY_STRING_SIZE];
+  size_t placed[SHARD_KEYS];
+  unsigned char pk[CLIENTLONGTERMPK_ARRAY_SIZE];
+  struct db_endpoint endpoints[2];
+  struct timeval timeout = { 1, 500000 };
+  string name = cstring_copy_string("my new plugin");
+  string desc = cstring_copy_string("Lorem ipsum");
+  string author = cstring_copy_string("author of the plugin");
+  string license = cstring_copy_string("license foobar");
+  string first = cstring_copy_string("first");
+  array functions = ARRAY_DICT_INIT;
+  array args = ARRAY_DICT_INIT;
+  options *globaloptions;
+  redisReply *reply;
+  char *ip, *auth;
+  size_t rejected, found = 0;
+
+  ADD(functions, helper_function_new("first", "function desc", 1));
+  ADD(args, INTEGER_OBJ(1));
+  memset(pk, 'a', sizeof(pk));
+
+  assert_true(options_init_from_boxrc() >= 0);
+  globaloptions = options_get();
+  auth = box_strdup(globaloptions->RedisDatabaseAuth);
+
+  ip = box_strdup(fmt_addr(&globaloptions->RedisDatabaseListenAddr));
+  endpoints[0].ip = ip;
+  endpoints[0].port = globaloptions->RedisDatabaseListenPort;
+  endpoints[1].ip = SHARD_IP;
+  endpoints[1].port = SHARD_PORT;
+
+  assert_int_equal(0, db_connect_shards(endpoints, 2, timeout, auth));
+  assert_int_equal(2, db_shard_count());
+
+  for (size_t i = 0; i < 2; i++) {
+    db_shard_use(i);
+    freeReplyObject(redisCommand(rc, "FLUSHALL"));
+  }
+
+  /* the verify script is loaded on every server */
+  for (size_t i = 0; i < 2; i++) {
+    db_shard_use(i);
+    assert_non_null(db_script_sha());
+    reply = redisCommand(rc, "SCRIPT EXISTS %s", db_script_sha());
+    assert_non_null(reply);
+    assert_int_equal(1, reply->element[0]->integer);
+    freeReplyObject(reply);
+  }
+
+  /* one plugin per server */
+  memset(keys, 0, sizeof(keys));
+
+  for (size_t i = 0; found < 2; i++) {
+    assert_true(i < 1000);
+    snprintf(pluginkey, sizeof(pluginkey), "PLUGINKEY%07zu", i);
+
+    if (keys[db_shard_of(pluginkey)][0] == '\0') {
+      strlcpy(keys[db_shard_of(pluginkey)], pluginkey, PLUGINKEY_STRING_SIZE);
+      found++;
+    }
+  }
+
+  /* all keys of a plugin are kept on its server only */
+  for (size_t i = 0; i < 2; i++) {
+    assert_int_equal(0, db_plugin_register(keys[i], name, desc, author,
+        license, functions, &rejected));
+
+    assert_int_equal(i == 0, shard_command(0, "EXISTS %s", keys[i]));
+    assert_int_equal(i == 1, shard_command(1, "EXISTS %s", keys[i]));
+  }
+
+  db_cache_clear();
+
+  for (size_t i = 0; i < 2; i++) {
+    assert_int_equal(0, db_plugin_verify(keys[i]));
+    assert_int_equal(0, db_function_verify(keys[i], first, &args));
+  }
+
+  /* the authorized set is kept on the first server */
+  assert_int_equal(0, db_authorized_add(pk));
+  assert_true(db_authorized_verify(pk));
+  assert_int_equal(1, shard_command(0, "EXISTS %s", "authorized"));
+  assert_int_equal(0, shard_command(1, "EXISTS %s", "authorized"));
+
+  /* a plugin stays on its server whatever the order of the servers */
+  for (size_t i = 0; i < SHARD_KEYS; i++) {
+    snprintf(pluginkey, sizeof(pluginkey), "PLUGINKEY%07zu", i);
+    placed[i] = db_shard_of(pluginkey);
+  }
+
+  db_close();
+
+  endpoints[1].ip = ip;
+  endpoints[1].port = endpoints[0].port;
+  endpoints[0].ip = SHARD_IP;
+  endpoints[0].port = SHARD_PORT;
+
+  assert_int_equal(0, db_connect_shards(endpoints, 2, timeout, auth));
+
+  for (size_t i = 0; i < SHARD_KEYS; i++) {
+    snprintf(pluginkey, sizeof(pluginkey), "PLUGINKEY%07zu", i);
+    assert_int_equal(1 - placed[i], db_shard_of(pluginkey));
+  }
+
+  db_close();
+
+  FREE(ip);
+  FREE(auth);
+  options_free(globaloptions);
+  api_free_array(functions);
+  api_free_array(args);
+  free_string(name);
+  free_string(desc);
+  free_string(author);
+  free_string(license);
+  free_string(first);
+}
@@ -197,6 +197,19 @@ void functional_dispatch_handle_result(UNUSED(void **state))
 
   handle_run(con->id, 1234, con->cc.pluginkeystring, runrequest, &error);
   api_free_array(runrequest);
+  helper_reply_callid(con, con->msgid - 1, plugin->callid);
+
+  /* only the plugin running the call may deliver its result */
+  char otherkey[] = "0000000000000000";
+  request = api_result_valid(plugin);
+  handle_result(con->id, 1234, otherkey, request, &error);
+  assert_true(error.isset);
+  assert_int_equal(API_ERROR_RESPONSE_RESULT_UNKNOWN_CALLID, error.response);
+  /* the message of a pre-encoded error is still logged */
+  assert_string_equal("Failed to find target's key associated with given "
+      "callid.", api_error_message(&error));
+  error = (struct api_error) ERROR_INIT;
+  api_free_array(request);
 
   expect_check(__wrap_crypto_write, &deserialized, validate_result_request, NULL);
 
@@ -204,6 +217,17 @@ void functional_dispatch_handle_result(UNUSED(void **state))
   handle_result(con->id, 1234, con->cc.pluginkeystring, request, &error);
   assert_false(error.isset);
   api_free_array(request);
+  helper_reply_callid(con, con->msgid - 1, plugin->callid);
+  assert_int_equal(0, con->pending_requests);
+
+  /* the callid is released with the delivered result */
+  request = api_result_valid(plugin);
+  handle_result(con->id, 1234, con->cc.pluginkeystring, request, &error);
+  assert_true(error.isset);
+  assert_int_equal(API_ERROR_RESPONSE_RESULT_UNKNOWN_CALLID, error.response);
+  error = (struct api_error) ERROR_INIT;
+  api_free_array(request);
+
   /*
    * The following asserts verify, that the handle_result method cancels
    * as soon as illegitim result calls are processed. A API_ERROR must be
@@ -20,6 +20,7 @@
 #include "sb-common.h"
 #include "rpc/sb-rpc.h"
 #include "rpc/connection/connection.h"
+#include "rpc/connection/calltable.h"
 #include "api/helpers.h"
 #include "api/sb-api.h"
 #ifdef __linux__
@@ -30,6 +31,9 @@
 #include "helper-all.h"
 #include "helper-validate.h"
 
+/* static in dispatch.c, exported by the BOX_UNIT_TESTS build */
+void run_call_expired(struct call_record *record);
+
 static array api_run_valid(struct plugin *plugin)
 {
   array meta = ARRAY_DICT_INIT;
@@ -97,6 +101,17 @@ static array api_run_wrong_meta_size(struct plugin *plugin)
   return request;
 }
 
+static array api_cancel_valid(uint64_t callid)
+{
+  array meta = ARRAY_DICT_INIT;
+  ADD(meta, UINTEGER_OBJ(callid));
+
+  array request = ARRAY_DICT_INIT;
+  ADD(request, ARRAY_OBJ(meta));
+
+  return request;
+}
+
 static array api_run_wrong_pluginkey_type(struct plugin *plugin)
 {
   array meta = ARRAY_DICT_INIT;
@@ -174,6 +189,63 @@ void functional_dispatch_handle_run(UNUSED(void **state))
   handle_run(con->id, 123, con->cc.pluginkeystring, request, &error);
   assert_false(error.isset);
   api_free_array(request);
+  assert_int_equal(1, con->pending_requests);
+  helper_reply_callid(con, con->msgid - 1, plugin->callid);
+  assert_int_equal(0, con->pending_requests);
+
+  /* the caller of an expired call gets the timeout, the target a cancel */
+  struct call_record record;
+  assert_true(calltable_release(plugin->callid, NULL, &record));
+  expect_check(__wrap_crypto_write, &deserialized, validate_result_timeout,
+      plugin);
+  expect_check(__wrap_crypto_write, &deserialized, validate_cancel_request,
+      plugin);
+  run_call_expired(&record);
+  assert_int_equal(2, con->pending_requests);
+  helper_reply_callid(con, con->msgid - 1, plugin->callid);
+  helper_reply_callid(con, con->msgid - 2, plugin->callid);
+  assert_int_equal(0, con->pending_requests);
+
+  /* several calls may be in flight, their responses arrive in any order */
+  expect_check(__wrap_crypto_write, &deserialized, validate_run_request, plugin);
+  request = api_run_valid(plugin);
+  handle_run(con->id, 124, con->cc.pluginkeystring, request, &error);
+  assert_false(error.isset);
+  api_free_array(request);
+  uint64_t first_msgid = con->msgid - 1;
+  uint64_t first_callid = plugin->callid;
+
+  expect_check(__wrap_crypto_write, &deserialized, validate_run_request, plugin);
+  request = api_run_valid(plugin);
+  handle_run(con->id, 125, con->cc.pluginkeystring, request, &error);
+  assert_false(error.isset);
+  api_free_array(request);
+  assert_int_equal(2, con->pending_requests);
+
+  helper_reply_callid(con, con->msgid - 1, plugin->callid);
+  assert_int_equal(1, con->pending_requests);
+  helper_reply_callid(con, first_msgid, first_callid);
+  assert_int_equal(0, con->pending_requests);
+
+  /* a cancelled call is forgotten and the target is told to abandon it */
+  expect_check(__wrap_crypto_write, &deserialized, validate_cancel_request,
+      plugin);
+  request = api_cancel_valid(plugin->callid);
+  object cancelled = handle_cancel(con->id, 126, con->cc.pluginkeystring,
+      request, &error);
+  assert_false(error.isset);
+  assert_int_equal(plugin->callid, cancelled.data.array.items[0].data.uinteger);
+  api_free_object(cancelled);
+  assert_int_equal(1, con->pending_requests);
+  helper_reply_callid(con, con->msgid - 1, plugin->callid);
+  assert_int_equal(0, con->pending_requests);
+
+  /* it can not be cancelled twice */
+  handle_cancel(con->id, 127, con->cc.pluginkeystring, request, &error);
+  assert_true(error.isset);
+  assert_int_equal(API_ERROR_RESPONSE_CANCEL_UNKNOWN_CALLID, error.response);
+  error.isset = false;
+  api_free_array(request);
 
   /*
    * The following asserts verify, that the handle_run method cancels
@@ -46,6 +46,14 @@ static array api_subscribe_wrong_args_size(void)
   return request;
 }
 
+static array api_subscribe_invalid_pattern(void)
+{
+  array request = ARRAY_DICT_INIT;
+  ADD(request, STRING_OBJ(cstring_copy_string("sensor.#.temp")));
+
+  return request;
+}
+
 static array api_subscribe_wrong_args_type(void)
 {
   array request = ARRAY_DICT_INIT;
@@ -60,12 +68,14 @@ void functional_dispatch_handle_subscribe(UNUSED(void **state))
   struct connection *con1;
   struct connection *con2;
   struct api_error error = ERROR_INIT;
+  multiqueue_stats stats;
   array request;
 
   con1 = CALLOC(1, struct connection);
   con1->id = (uint64_t) randommod(281474976710656LL);
   con1->msgid = 4321;
   con1->subscribed_events = hashmap_new(cstr_t, ptr_t)();
+  con1->events = multiqueue_new_parent(NULL, NULL);
 
   con2 = CALLOC(1, struct connection);
   con2->id = (uint64_t) randommod(281474976710656LL);
@@ -89,7 +99,11 @@ void functional_dispatch_handle_subscribe(UNUSED(void **state))
   pluginkeys_hashmap_put(con1->cc.pluginkeystring, con1->id);
   pluginkeys_hashmap_put(con2->cc.pluginkeystring, con2->id);
 
-
+  /* the queue metrics of a live connection can be read at any time */
+  assert_true(connection_get_stats(con1->id, &stats));
+  assert_int_equal(0, stats.depth);
+  assert_int_equal(0, stats.processed);
+  assert_false(connection_get_stats(con1->id + 1, &stats));
 
   //expect_check(__wrap_crypto_write, &deserialized, validate_run_request, plugin);
 
@@ -125,6 +139,13 @@ void functional_dispatch_handle_subscribe(UNUSED(void **state))
   error.isset = false;
   api_free_array(request);
 
+  request = api_subscribe_invalid_pattern();
+  handle_subscribe(con1->id, 123, con1->cc.pluginkeystring, request, &error);
+  assert_true(error.isset);
+  assert_int_equal(API_ERROR_RESPONSE_SUBSCRIBE_EVENT_PATTERN, error.response);
+  error.isset = false;
+  api_free_array(request);
+
   request = api_subscribe_wrong_args_size();
   handle_unsubscribe(con1->id, 123, con1->cc.pluginkeystring, request, &error);
   assert_true(error.isset);
@@ -142,6 +163,7 @@ void functional_dispatch_handle_subscribe(UNUSED(void **state))
 
   hashmap_free(cstr_t, ptr_t)(con1->subscribed_events);
   hashmap_free(cstr_t, ptr_t)(con2->subscribed_events);
+  multiqueue_free(con1->events);
 
   helper_free_plugin(plugin);
   connection_teardown();
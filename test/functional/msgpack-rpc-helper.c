@@ -16,6 +16,7 @@
 
 #include "helper-unix.h"
 #include "sb-common.h"
+#include "api/sb-api.h"
 #include "api/helpers.h"
 #include "rpc/msgpack/helpers.h"
 
@@ -120,6 +121,19 @@ void functional_msgpack_rpc_helper(UNUSED(void **state))
   object deserialized_object;
   assert_true(msgpack_rpc_to_object(&deserialized, &deserialized_object));
 
+  // decoded trees are packed into a single block owned by the root
+  assert_int_equal(3, deserialized_array.size);
+  assert_true(deserialized_array.capacity == OBJECT_CAPACITY_PACKED_ROOT);
+  assert_true(deserialized_array.items[1].data.array.capacity ==
+      OBJECT_CAPACITY_PACKED);
+  assert_string_equal("test",
+      deserialized_array.items[1].data.array.items[0].data.string.str);
+  dictionary dict = deserialized_array.items[2].data.dictionary;
+  assert_true(dict.capacity == OBJECT_CAPACITY_PACKED);
+  assert_string_equal("ghi", dict.items[2].key.str);
+  assert_string_equal("321",
+      dict.items[2].value.data.dictionary.items[1].value.data.string.str);
+
   // test response serialize without error set
   msgpack_rpc_serialize_response(1234, &err, deserialized_object, &pk);
   msgpack_sbuffer_clear(&sbuf);
@@ -129,6 +143,32 @@ void functional_msgpack_rpc_helper(UNUSED(void **state))
   msgpack_rpc_serialize_response(1234, &err, deserialized_object, &pk);
   msgpack_sbuffer_clear(&sbuf);
 
+  // pre-encoded error responses and acks
+  assert_int_equal(0, msgpack_rpc_responses_init());
+  error_set_response(&err, RUN_PARAMS_SIZE);
+  msgpack_rpc_serialize_response(1234, &err, NIL, &pk);
+  msgpack_object deserialized_err;
+  msgpack_unpack(sbuf.data, sbuf.size, NULL, &mempool, &deserialized_err);
+  assert_int_equal(4, deserialized_err.via.array.size);
+  assert_int_equal(1234, deserialized_err.via.array.ptr[1].via.u64);
+  msgpack_object *errobj = &deserialized_err.via.array.ptr[2];
+  assert_int_equal(API_ERROR_TYPE_VALIDATION, errobj->via.array.ptr[0].via.u64);
+  assert_true(strncmp("Error dispatching run API request. Invalid params size",
+      errobj->via.array.ptr[1].via.str.ptr,
+      errobj->via.array.ptr[1].via.str.size) == 0);
+  assert_true(deserialized_err.via.array.ptr[3].type == MSGPACK_OBJECT_NIL);
+  msgpack_sbuffer_clear(&sbuf);
+
+  msgpack_rpc_serialize_ack(1234, 281474976710655ULL, &pk);
+  msgpack_object deserialized_ack;
+  msgpack_unpack(sbuf.data, sbuf.size, NULL, &mempool, &deserialized_ack);
+  assert_int_equal(1234, deserialized_ack.via.array.ptr[1].via.u64);
+  assert_true(deserialized_ack.via.array.ptr[2].type == MSGPACK_OBJECT_NIL);
+  assert_int_equal(281474976710655ULL,
+      deserialized_ack.via.array.ptr[3].via.array.ptr[0].via.u64);
+  msgpack_sbuffer_clear(&sbuf);
+  msgpack_rpc_responses_teardown();
+
   // notification helper tests
   err.isset = false;
   object notification_object = helper_valid_notification_object();
@@ -164,6 +204,34 @@ void functional_msgpack_rpc_helper(UNUSED(void **state))
 
   msgpack_sbuffer_clear(&sbuf);
 
+  // dictionary lookups, linear for small and indexed for large dictionaries
+  assert_non_null(api_dictionary_get(dict, STATIC_CSTR_AS_STRING("ghi")));
+  assert_null(api_dictionary_get(dict, STATIC_CSTR_AS_STRING("gh")));
+
+  dictionary large = ARRAY_DICT_INIT;
+  char key[16];
+  for (int i = 0; i < 100; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    PUT(large, key, INTEGER_OBJ(i));
+  }
+  msgpack_rpc_from_dictionary(large, &pk);
+  msgpack_object deserialized_large;
+  msgpack_unpack(sbuf.data, sbuf.size, NULL, &mempool, &deserialized_large);
+  dictionary deserialized_dict;
+  assert_true(msgpack_rpc_to_dictionary(&deserialized_large, &deserialized_dict));
+  for (int i = 0; i < 100; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    object *value = api_dictionary_get(deserialized_dict,
+        (string) {.str = key, .length = strlen(key)});
+    assert_non_null(value);
+    assert_int_equal(i, value->data.integer);
+  }
+  assert_null(api_dictionary_get(deserialized_dict,
+      STATIC_CSTR_AS_STRING("key100")));
+  msgpack_sbuffer_clear(&sbuf);
+  api_free_dictionary(large);
+  api_free_dictionary(deserialized_dict);
+
   api_free_object(serialize_object);
   api_free_array(deserialized_array);
   api_free_object(deserialized_object);
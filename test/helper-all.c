@@ -21,17 +21,48 @@
 #include "rpc/db/sb-db.h"
 #include "api/helpers.h"
 #include "api/sb-api.h"
+#include "rpc/connection/connection.h"
 
 #include "helper-unix.h"
 #include "helper-all.h"
 #include "helper-validate.h"
 
+/* static in connection.c, exported by the BOX_UNIT_TESTS build */
+void connection_handle_response(struct connection *con, msgpack_object *obj);
+
+/* the backend connect_to_db() opens, see helper_db_memory() */
+static bool db_memory = false;
+
+int helper_db_redis(UNUSED(void **state))
+{
+  db_memory = false;
+  return (0);
+}
+
+int helper_db_memory(UNUSED(void **state))
+{
+  db_memory = true;
+  return (0);
+}
+
+bool helper_db_is_redis(void)
+{
+  return !db_memory;
+}
+
 void connect_to_db(void)
 {
   redisReply *reply;
   options *globaloptions;
   struct timeval timeout = { 1, 500000 };
 
+  /* an empty store, like the flushed Redis database */
+  if (db_memory) {
+    assert_int_equal(0, db_memory_open(NULL));
+    assert_int_equal(0, db_thread_connect());
+    return;
+  }
+
   if (options_init_from_boxrc() < 0) {
       LOG_ERROR("Reading config failed--see warnings above. "
               "For usage, try -h.");
@@ -109,3 +140,45 @@ void helper_free_plugin(struct plugin *p)
   FREE(p->function);
   FREE(p);
 }
+
+/* a function of a register request with `argc` integer arguments */
+object helper_function_new(char *name, char *desc, size_t argc)
+{
+  array func = ARRAY_DICT_INIT;
+  array args = ARRAY_DICT_INIT;
+
+  for (size_t i = 0; i < argc; i++)
+    ADD(args, INTEGER_OBJ(-1));
+
+  ADD(func, STRING_OBJ(cstring_copy_string(name)));
+  ADD(func, STRING_OBJ(cstring_copy_string(desc)));
+  ADD(func, ARRAY_OBJ(args));
+
+  return ARRAY_OBJ(func);
+}
+
+/* answer the request `msgid` sent to `con` with a [callid] response */
+void helper_reply_callid(struct connection *con, uint64_t msgid,
+    uint64_t callid)
+{
+  msgpack_sbuffer sbuf;
+  msgpack_packer pk;
+  msgpack_zone mempool;
+  msgpack_object deserialized;
+
+  msgpack_sbuffer_init(&sbuf);
+  msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+  msgpack_pack_array(&pk, 4);
+  msgpack_pack_uint64(&pk, 1);
+  msgpack_pack_uint64(&pk, msgid);
+  msgpack_pack_nil(&pk);
+  msgpack_pack_array(&pk, 1);
+  msgpack_pack_uint64(&pk, callid);
+
+  msgpack_zone_init(&mempool, 256);
+  msgpack_unpack(sbuf.data, sbuf.size, NULL, &mempool, &deserialized);
+  connection_handle_response(con, &deserialized);
+
+  msgpack_zone_destroy(&mempool);
+  msgpack_sbuffer_destroy(&sbuf);
+}
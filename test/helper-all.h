@@ -18,6 +18,7 @@
 
 #include "sb-common.h"
 #include "rpc/db/sb-db.h"
+#include "rpc/connection/connection.h"
 
 struct function {
   string name;
@@ -35,6 +36,14 @@ struct plugin {
   uint64_t callid;
 };
 
+/*
+ * cmocka setups selecting the backend connect_to_db() opens, Redis unless
+ * a test runs with helper_db_memory(). helper_db_redis() is the teardown.
+ */
+int helper_db_redis(void **state);
+int helper_db_memory(void **state);
+/* checks inspecting the Redis keys directly only run on Redis */
+bool helper_db_is_redis(void);
 void connect_to_db(void);
 void connect_and_create(char *apikey);
 int validate_run_request(const unsigned long data1, const unsigned long data2);
@@ -43,4 +52,7 @@ int validate_crypto_write(unsigned char *buffer, uint64_t length);
 void register_test_function(void);
 struct plugin *helper_get_example_plugin(void);
 void helper_free_plugin(struct plugin *p);
+object helper_function_new(char *name, char *desc, size_t argc);
 void helper_register_plugin(struct plugin *p);
+void helper_reply_callid(struct connection *con, uint64_t msgid,
+    uint64_t callid);
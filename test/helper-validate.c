@@ -64,13 +64,9 @@ int validate_run_request(const unsigned long data1,
   assert_true(meta.data.array.items[1].type == OBJECT_TYPE_UINT);
 
   /* since the callid must be forwarded to the client1, the original
-   * sender of the rpc call, we need to push the callid on the cmocka test
-   * stack. this allows verifying of it later on */
-  uint64_t callid = meta.data.array.items[1].data.uinteger;
-  will_return(__wrap_loop_process_events_until, OBJECT_TYPE_UINT);
-  will_return(__wrap_loop_process_events_until, callid);
-
-  p->callid = callid;
+   * sender of the rpc call, we need to remember it. the test answers the
+   * request with it later on */
+  p->callid = meta.data.array.items[1].data.uinteger;
 
   /* the function to call on client2 side */
   func = request.data.array.items[1];
@@ -94,6 +90,82 @@ int validate_run_request(const unsigned long data1,
 }
 
 
+int validate_cancel_request(const unsigned long data1,
+  const unsigned long data2)
+{
+  struct msgpack_object *deserialized = (struct msgpack_object *) data1;
+  struct plugin *p = (struct plugin *) data2;
+  array message;
+  object meta, request;
+
+  msgpack_rpc_to_array(deserialized, &message);
+
+  assert_true(message.items[0].type == OBJECT_TYPE_UINT);
+  assert_int_equal(0, message.items[0].data.uinteger);
+
+  assert_true(message.items[2].type == OBJECT_TYPE_STR);
+  assert_string_equal(message.items[2].data.string.str, "cancel");
+
+  /* [[callid]] */
+  request = message.items[3];
+  assert_true(request.type == OBJECT_TYPE_ARRAY);
+  assert_int_equal(1, request.data.array.size);
+
+  meta = request.data.array.items[0];
+  assert_true(meta.type == OBJECT_TYPE_ARRAY);
+  assert_int_equal(1, meta.data.array.size);
+  assert_true(meta.data.array.items[0].type == OBJECT_TYPE_UINT);
+  assert_int_equal(p->callid, meta.data.array.items[0].data.uinteger);
+
+  api_free_array(message);
+
+  return (1);
+}
+
+
+/* a result that tells the caller its call timed out */
+int validate_result_timeout(const unsigned long data1,
+  const unsigned long data2)
+{
+  struct msgpack_object *deserialized = (struct msgpack_object *) data1;
+  struct plugin *p = (struct plugin *) data2;
+  array message;
+  object meta, request, error;
+
+  msgpack_rpc_to_array(deserialized, &message);
+
+  assert_true(message.items[0].type == OBJECT_TYPE_UINT);
+  assert_int_equal(0, message.items[0].data.uinteger);
+
+  assert_true(message.items[2].type == OBJECT_TYPE_STR);
+  assert_string_equal(message.items[2].data.string.str, "result");
+
+  /* [[callid, [type, message]], []] */
+  request = message.items[3];
+  assert_true(request.type == OBJECT_TYPE_ARRAY);
+  assert_int_equal(2, request.data.array.size);
+  assert_true(request.data.array.items[1].type == OBJECT_TYPE_ARRAY);
+  assert_int_equal(0, request.data.array.items[1].data.array.size);
+
+  meta = request.data.array.items[0];
+  assert_true(meta.type == OBJECT_TYPE_ARRAY);
+  assert_int_equal(2, meta.data.array.size);
+  assert_int_equal(p->callid, meta.data.array.items[0].data.uinteger);
+
+  error = meta.data.array.items[1];
+  assert_true(error.type == OBJECT_TYPE_ARRAY);
+  assert_int_equal(2, error.data.array.size);
+  assert_int_equal(API_ERROR_TYPE_EXCEPTION,
+      error.data.array.items[0].data.uinteger);
+  assert_string_equal("The plugin did not answer before the deadline.",
+      error.data.array.items[1].data.string.str);
+
+  api_free_array(message);
+
+  return (1);
+}
+
+
 int validate_result_request(const unsigned long data1,
   UNUSED(const unsigned long data2))
 {
@@ -130,14 +202,6 @@ int validate_result_request(const unsigned long data1,
   /* client2 id should be nil */
   assert_true(meta.data.array.items[0].type == OBJECT_TYPE_UINT);
 
-  /* since the callid must be forwarded to the client1, the original
-   * sender of the rpc call, we need to push the callid on the cmocka test
-   * stack. this allows verifying of it later on */
-  uint64_t callid = meta.data.array.items[0].data.uinteger;
-
-  will_return(__wrap_loop_process_events_until, OBJECT_TYPE_UINT);
-  will_return(__wrap_loop_process_events_until, callid);
-
   api_free_array(message);
 
   return (1);
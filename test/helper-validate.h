@@ -20,4 +20,6 @@ int validate_register_response(const unsigned long data1, const unsigned long da
 int validate_run_request(const unsigned long data1, const unsigned long data2);
 int validate_run_response(const unsigned long data1, const unsigned long data2);
 int validate_result_request(const unsigned long data1, const unsigned long data2);
+int validate_result_timeout(const unsigned long data1, const unsigned long data2);
+int validate_cancel_request(const unsigned long data1, const unsigned long data2);
 int validate_result_response(const unsigned long data1, const unsigned long data2);
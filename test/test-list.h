@@ -17,18 +17,42 @@
 #pragma once
 
 #include "helper-unix.h"
+#include "helper-all.h"
+
+/* the behaviour of the db_* functions is the same on every backend */
+#define DB_BACKEND_TESTS(f) \
+  {#f " (redis)", f, helper_db_redis, NULL, NULL}, \
+  {#f " (memory)", f, helper_db_memory, helper_db_redis, NULL}
 
 void unit_server_start(void **state);
 void unit_server_stop(void **state);
+void unit_shard_stop(void **state);
 void unit_dispatch_table_get(void **state);
+void unit_schema_validate(void **state);
+void unit_multiqueue(void **state);
+void unit_timerwheel(void **state);
+void unit_calltable(void **state);
+void unit_topic(void **state);
+void unit_instance(void **state);
+void unit_db_cache(void **state);
 
 void functional_client_connect(void **state);
 void functional_db_connect(void **state);
+void functional_db_reconnect(void **state);
+void functional_db_memory(void **state);
+void functional_db_function_migrate(void **state);
+void functional_db_script_verify(void **state);
+void functional_db_authorized_sync(void **state);
+void functional_db_cache_sync(void **state);
 void functional_db_plugin_add(void **state);
+void functional_db_plugin_register(void **state);
+void functional_db_plugin_reregister(void **state);
+void functional_db_shard(void **state);
 void functional_db_pluginkey_verify(void **state);
 void functional_db_function_add(void **state);
 void functional_db_function_verify(void **state);
 void functional_db_function_flush_args(void **state);
+void functional_db_run_verify(void **state);
 void functional_filesystem_load(void **state);
 void functional_filesystem_save_sync(void **state);
 void functional_dispatch_handle_register(void **state);
@@ -43,14 +67,32 @@ void functional_db_whitelist(void **state);
 
 const struct CMUnitTest tests[] = {
   cmocka_unit_test(unit_dispatch_table_get),
+  cmocka_unit_test(unit_schema_validate),
+  cmocka_unit_test(unit_multiqueue),
+  cmocka_unit_test(unit_timerwheel),
+  cmocka_unit_test(unit_calltable),
+  cmocka_unit_test(unit_topic),
+  cmocka_unit_test(unit_instance),
+  cmocka_unit_test(unit_db_cache),
   cmocka_unit_test(unit_server_start),
   cmocka_unit_test(unit_server_stop),
+  cmocka_unit_test(unit_shard_stop),
   cmocka_unit_test(functional_db_connect),
-  cmocka_unit_test(functional_db_plugin_add),
-  cmocka_unit_test(functional_db_pluginkey_verify),
-  cmocka_unit_test(functional_db_function_add),
-  cmocka_unit_test(functional_db_function_verify),
-  cmocka_unit_test(functional_db_function_flush_args),
+  cmocka_unit_test(functional_db_reconnect),
+  cmocka_unit_test(functional_db_memory),
+  cmocka_unit_test(functional_db_function_migrate),
+  cmocka_unit_test(functional_db_script_verify),
+  cmocka_unit_test(functional_db_authorized_sync),
+  cmocka_unit_test(functional_db_cache_sync),
+  DB_BACKEND_TESTS(functional_db_plugin_add),
+  DB_BACKEND_TESTS(functional_db_plugin_register),
+  DB_BACKEND_TESTS(functional_db_plugin_reregister),
+  cmocka_unit_test(functional_db_shard),
+  DB_BACKEND_TESTS(functional_db_pluginkey_verify),
+  DB_BACKEND_TESTS(functional_db_function_add),
+  DB_BACKEND_TESTS(functional_db_function_verify),
+  DB_BACKEND_TESTS(functional_db_function_flush_args),
+  DB_BACKEND_TESTS(functional_db_run_verify),
   cmocka_unit_test(functional_filesystem_load),
   cmocka_unit_test(functional_filesystem_save_sync),
   cmocka_unit_test(functional_dispatch_handle_register),
@@ -61,5 +103,5 @@ const struct CMUnitTest tests[] = {
   cmocka_unit_test(functional_msgpack_rpc_helper),
   cmocka_unit_test(functional_crypto),
   cmocka_unit_test(functional_confparse),
-  cmocka_unit_test(functional_db_whitelist),
+  DB_BACKEND_TESTS(functional_db_whitelist),
 };
@@ -0,0 +1,92 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "sb-common.h"
+#include "rpc/connection/calltable.h"
+#include "helper-unix.h"
+
+static struct call_record record_new(uint64_t caller_id, const char *caller,
+    const char *target)
+{
+  struct call_record record;
+
+  memset(&record, 0, sizeof(record));
+  record.caller_id = caller_id;
+  strcpy(record.caller, caller);
+  strcpy(record.target, target);
+
+  return record;
+}
+
+void unit_calltable(UNUSED(void **state))
+{
+  struct call_record a = record_new(1, "CALLER", "TARGET");
+  struct call_record b = record_new(2, "OTHER", "TARGET");
+  struct call_record found;
+  uint64_t stale;
+
+  calltable_init(NULL);
+
+  assert_int_equal(0, calltable_add(&a, 0));
+  assert_int_equal(0, calltable_add(&b, 0));
+  assert_true(a.callid != b.callid);
+
+  assert_true(calltable_lookup(a.callid, &found));
+  assert_int_equal(1, found.caller_id);
+  assert_string_equal("TARGET", found.target);
+
+  /* only the caller may release a call by its pluginkey */
+  assert_false(calltable_release(a.callid, "OTHER", NULL));
+  assert_true(calltable_release(a.callid, "CALLER", &found));
+  assert_int_equal(a.callid, found.callid);
+  assert_false(calltable_lookup(a.callid, &found));
+  assert_false(calltable_release(a.callid, NULL, NULL));
+
+  /* the slot is reused, the old callid does not match the new call */
+  stale = a.callid;
+  assert_int_equal(0, calltable_add(&a, 0));
+  assert_true(a.callid != stale);
+  assert_false(calltable_lookup(stale, &found));
+  assert_false(calltable_lookup(stale + CALLTABLE_SIZE * 1000, &found));
+
+  /* closing the caller drops its calls, closing the target drops all */
+  assert_int_equal(1, calltable_drop_connection(1, NULL));
+  assert_false(calltable_lookup(a.callid, &found));
+  assert_true(calltable_lookup(b.callid, &found));
+  assert_int_equal(0, calltable_add(&a, 0));
+  assert_int_equal(2, calltable_drop_connection(3, "TARGET"));
+  assert_false(calltable_lookup(b.callid, &found));
+  assert_int_equal(0, calltable_drop_connection(2, "TARGET"));
+
+  /* released calls leave the lists of their caller and target */
+  assert_int_equal(0, calltable_add(&a, 0));
+  assert_int_equal(0, calltable_add(&b, 0));
+  assert_true(calltable_release(a.callid, NULL, NULL));
+  assert_int_equal(0, calltable_drop_connection(1, NULL));
+  assert_int_equal(1, calltable_drop_connection(3, "TARGET"));
+
+  /* the table is bounded */
+  for (size_t i = 0; i < CALLTABLE_SIZE; i++) {
+    assert_int_equal(0, calltable_add(&a, 0));
+  }
+  assert_int_equal(-1, calltable_add(&b, 0));
+  assert_true(calltable_release(a.callid, NULL, NULL));
+  assert_int_equal(0, calltable_add(&b, 0));
+
+  calltable_teardown();
+}
@@ -0,0 +1,76 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sb-common.h"
+#include "api/helpers.h"
+#include "rpc/db/cache.h"
+#include "helper-unix.h"
+
+void unit_db_cache(UNUSED(void **state))
+{
+  string name = cstring_to_string("function");
+  string other = cstring_to_string("other");
+  object_type types[] = {OBJECT_TYPE_STR, OBJECT_TYPE_INT};
+  object items[2];
+  array args = {.items = items, .size = 2, .capacity = 2};
+
+  items[0] = STRING_OBJ(cstring_to_string("value"));
+  items[1] = INTEGER_OBJ(-1);
+
+  db_cache_clear();
+  assert_false(db_cache_plugin_has("PLUGIN"));
+  assert_int_equal(DB_CACHE_MISS,
+      db_cache_function_verify("PLUGIN", name, &args));
+
+  db_cache_plugin_reset("PLUGIN");
+  db_cache_function_put("PLUGIN", name, types, 2);
+  assert_true(db_cache_plugin_has("PLUGIN"));
+  assert_int_equal(DB_CACHE_VALID,
+      db_cache_function_verify("PLUGIN", name, &args));
+  assert_int_equal(DB_CACHE_MISS,
+      db_cache_function_verify("PLUGIN", other, &args));
+
+  /* positive integers are unpacked as unsigned */
+  items[1] = UINTEGER_OBJ(1);
+  assert_int_equal(DB_CACHE_VALID,
+      db_cache_function_verify("PLUGIN", name, &args));
+  items[1] = UINTEGER_OBJ(UINT64_MAX);
+  assert_int_equal(DB_CACHE_INVALID,
+      db_cache_function_verify("PLUGIN", name, &args));
+
+  args.size = 1;
+  assert_int_equal(DB_CACHE_INVALID,
+      db_cache_function_verify("PLUGIN", name, &args));
+  args.size = 2;
+
+  /* a new signature replaces the old one */
+  db_cache_function_put("PLUGIN", name, types, 1);
+  assert_int_equal(DB_CACHE_INVALID,
+      db_cache_function_verify("PLUGIN", name, &args));
+
+  /* registering again drops the functions, but keeps the plugin */
+  db_cache_plugin_reset("PLUGIN");
+  assert_true(db_cache_plugin_has("PLUGIN"));
+  assert_int_equal(DB_CACHE_MISS,
+      db_cache_function_verify("PLUGIN", name, &args));
+
+  db_cache_plugin_put("OTHER");
+  assert_true(db_cache_plugin_has("OTHER"));
+
+  db_cache_clear();
+  assert_false(db_cache_plugin_has("PLUGIN"));
+  assert_false(db_cache_plugin_has("OTHER"));
+}
@@ -0,0 +1,72 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "sb-common.h"
+#include "rpc/connection/instance.h"
+#include "helper-unix.h"
+
+void unit_instance(UNUSED(void **state))
+{
+  instance_group *group = instance_group_new("PLUGIN");
+  struct connection a, b, c;
+
+  memset(&a, 0, sizeof(a));
+  memset(&b, 0, sizeof(b));
+  memset(&c, 0, sizeof(c));
+
+  assert_non_null(group);
+  assert_string_equal("PLUGIN", group->pluginkey);
+  assert_null(instance_group_pick(group));
+
+  instance_group_add(group, &a);
+  instance_group_add(group, &b);
+  assert_true(instance_group_has(group, &a));
+  assert_false(instance_group_has(group, &c));
+
+  /* idle instances without latency samples are picked in turns */
+  assert_true(&a == instance_group_pick(group));
+  assert_true(&b == instance_group_pick(group));
+  assert_true(&a == instance_group_pick(group));
+  assert_int_equal(2, a.routed);
+  assert_int_equal(1, b.routed);
+  assert_int_equal(3, group->routed);
+
+  /* the first sample is taken as is, later ones move the average by 1/8 */
+  instance_record_latency(&a, 800);
+  assert_int_equal(800, a.latency);
+  instance_record_latency(&a, 1600);
+  assert_int_equal(900, a.latency);
+  instance_record_latency(&a, 100);
+  assert_int_equal(800, a.latency);
+  instance_record_latency(&b, 100);
+
+  /* requests in flight weigh with the latency of the instance */
+  a.pending_requests = 0;
+  b.pending_requests = 3;
+  assert_true(&b == instance_group_pick(group));
+  b.pending_requests = 8;
+  assert_true(&a == instance_group_pick(group));
+  assert_true(&a == instance_group_pick(group));
+
+  assert_true(instance_group_del(group, &a));
+  assert_false(instance_group_del(group, &a));
+  assert_false(instance_group_has(group, &a));
+  assert_true(&b == instance_group_pick(group));
+
+  instance_group_free(group);
+}
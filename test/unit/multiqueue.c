@@ -0,0 +1,114 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+#include "sb-common.h"
+#include "rpc/connection/event.h"
+#include "helper-unix.h"
+
+static uintptr_t processed[16];
+static size_t nprocessed;
+
+static void handler(UNUSED(void **argv))
+{
+}
+
+static void record(void **argv)
+{
+  processed[nprocessed++] = (uintptr_t)argv[0];
+}
+
+static uintptr_t get_value(multiqueue *queue)
+{
+  event e = multiqueue_get(queue);
+
+  assert_true(e.handler == handler);
+
+  return (uintptr_t)e.argv[0];
+}
+
+void unit_multiqueue(UNUSED(void **state))
+{
+  multiqueue *parent = multiqueue_new_parent(NULL, NULL);
+  multiqueue *child1 = multiqueue_new_child(parent);
+  multiqueue *child2 = multiqueue_new_child(parent);
+
+  assert_null(multiqueue_get(parent).handler);
+
+  multiqueue_put(child1, handler, 1, (void *)1);
+  multiqueue_put(child2, handler, 1, (void *)2);
+  multiqueue_put(parent, handler, 1, (void *)3);
+  multiqueue_put(child1, handler, 1, (void *)4);
+
+  /* the parent returns the events of all queues in order */
+  assert_int_equal(1, get_value(parent));
+
+  /* taking an event from a child drops its link in the parent */
+  assert_int_equal(4, get_value(child1));
+  assert_true(multiqueue_empty(child1));
+  assert_int_equal(2, get_value(parent));
+  assert_true(multiqueue_empty(child2));
+  assert_int_equal(3, get_value(parent));
+  assert_true(multiqueue_empty(parent));
+
+  /* more events than fit in a single slab */
+  for (uintptr_t i = 0; i < 200; i++) {
+    multiqueue_put(i % 2 ? child1 : child2, handler, 1, (void *)i);
+  }
+
+  for (uintptr_t i = 0; i < 100; i++) {
+    assert_int_equal(i, get_value(parent));
+  }
+
+  /* a flooded queue gets its quantum per round, then the others run */
+  for (uintptr_t i = 0; i < 100; i++) {
+    assert_int_equal(100 + i, get_value(parent));
+  }
+
+  multiqueue_set_quantum(child1, 2);
+  for (uintptr_t i = 0; i < 6; i++) {
+    multiqueue_put(child1, record, 1, (void *)(10 + i));
+  }
+  multiqueue_put(child2, record, 1, (void *)20);
+  multiqueue_put(parent, record, 1, (void *)30);
+
+  assert_int_equal(5, multiqueue_process_events_fair(parent, 5));
+  assert_int_equal(10, processed[0]);
+  assert_int_equal(11, processed[1]);
+  assert_int_equal(20, processed[2]);
+  assert_int_equal(30, processed[3]);
+  assert_int_equal(12, processed[4]);
+  assert_int_equal(3, multiqueue_get_stats(child1)->depth);
+  assert_int_equal(3, multiqueue_get_stats(parent)->depth);
+
+  assert_int_equal(3, multiqueue_process_events_fair(parent, 10));
+  assert_int_equal(15, processed[7]);
+  assert_true(multiqueue_empty(parent));
+  assert_int_equal(0, multiqueue_get_stats(child1)->depth);
+  assert_int_equal(100, multiqueue_get_stats(child1)->max_depth);
+  assert_true(multiqueue_get_stats(child1)->wait_max <=
+      multiqueue_get_stats(child1)->wait_total);
+
+  /* queued events are released along with their queues */
+  multiqueue_put(child1, handler, 1, (void *)6);
+  multiqueue_put(child2, handler, 1, (void *)7);
+  multiqueue_free(child1);
+  multiqueue_free(child2);
+  assert_true(multiqueue_empty(parent));
+  multiqueue_put(parent, handler, 1, (void *)5);
+  multiqueue_free(parent);
+}
@@ -0,0 +1,116 @@
+/**
+ *    Copyright (C) 2015 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <msgpack.h>
+
+#include "sb-common.h"
+#include "rpc/sb-rpc.h"
+#include "rpc/msgpack/helpers.h"
+#include "rpc/msgpack/schema.h"
+#include "api/helpers.h"
+#include "api/sb-api.h"
+#include "helper-unix.h"
+
+
+static array run_args(char *pluginkey, object deadline)
+{
+  array meta = ARRAY_DICT_INIT;
+  ADD(meta, STRING_OBJ(cstring_copy_string(pluginkey)));
+  ADD(meta, deadline);
+
+  array args = ARRAY_DICT_INIT;
+  ADD(args, ARRAY_OBJ(meta));
+  ADD(args, STRING_OBJ(cstring_copy_string("func")));
+  ADD(args, ARRAY_OBJ(((array) ARRAY_DICT_INIT)));
+
+  return args;
+}
+
+void unit_schema_validate(UNUSED(void **state))
+{
+  struct schema_error err;
+  struct api_error api_error = ERROR_INIT;
+  array args;
+
+  assert_int_equal(0, schema_init());
+
+  /* valid run arguments */
+  args = run_args("0123456789ABCDEF", NIL);
+  assert_int_equal(0, schema_validate(SCHEMA_RUN, args, &err));
+
+  /* the same arguments checked on raw msgpack */
+  msgpack_sbuffer sbuf;
+  msgpack_packer pk;
+  msgpack_zone mempool;
+  msgpack_object deserialized;
+
+  msgpack_sbuffer_init(&sbuf);
+  msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+  msgpack_zone_init(&mempool, 1024);
+  msgpack_rpc_from_array(args, &pk);
+  msgpack_unpack(sbuf.data, sbuf.size, NULL, &mempool, &deserialized);
+  assert_int_equal(0, schema_validate_msgpack(SCHEMA_RUN, &deserialized, &err));
+  assert_int_equal(-1, schema_validate_msgpack(SCHEMA_RESULT, &deserialized,
+      &err));
+  assert_int_equal(API_ERROR_RESPONSE_RESULT_PARAMS_SIZE, err.response);
+  api_free_array(args);
+
+  /* pluginkey of wrong length, reported with its path */
+  args = run_args("0123", NIL);
+  assert_int_equal(-1, schema_validate(SCHEMA_RUN, args, &err));
+  assert_int_equal(API_ERROR_RESPONSE_RUN_META_SIZE, err.response);
+  assert_int_equal(2, err.depth);
+  assert_int_equal(0, err.path[0]);
+  assert_int_equal(0, err.path[1]);
+  api_free_array(args);
+
+  /* the deadline is optional */
+  args = run_args("0123456789ABCDEF", UINTEGER_OBJ(1000));
+  assert_int_equal(0, schema_validate(SCHEMA_RUN, args, &err));
+  api_free_array(args);
+
+  /* second meta element is neither a deadline nor nil */
+  args = run_args("0123456789ABCDEF", STRING_OBJ(cstring_copy_string("1")));
+  assert_int_equal(-1, schema_validate(SCHEMA_RUN, args, &err));
+  assert_int_equal(API_ERROR_RESPONSE_RUN_META_ELEMENTS_TYPE, err.response);
+  assert_int_equal(1, err.path[1]);
+
+  schema_error_set(&api_error, &err);
+  assert_true(api_error.isset);
+  assert_true(api_error.type == API_ERROR_TYPE_VALIDATION);
+  api_free_array(args);
+
+  /* an empty function name is rejected, it has no str to look up */
+  args = run_args("0123456789ABCDEF", NIL);
+  api_free_string(args.items[1].data.string);
+  args.items[1] = STRING_OBJ(((string) {.str = NULL, .length = 0}));
+  assert_int_equal(-1, schema_validate(SCHEMA_RUN, args, &err));
+  assert_int_equal(API_ERROR_RESPONSE_RUN_FUNCTION_EMPTY, err.response);
+  assert_int_equal(1, err.depth);
+  assert_int_equal(1, err.path[0]);
+
+  msgpack_sbuffer_clear(&sbuf);
+  msgpack_rpc_from_array(args, &pk);
+  msgpack_unpack(sbuf.data, sbuf.size, NULL, &mempool, &deserialized);
+  assert_int_equal(-1, schema_validate_msgpack(SCHEMA_RUN, &deserialized,
+      &err));
+  assert_int_equal(API_ERROR_RESPONSE_RUN_FUNCTION_EMPTY, err.response);
+  api_free_array(args);
+
+  msgpack_zone_destroy(&mempool);
+  msgpack_sbuffer_destroy(&sbuf);
+  schema_teardown();
+}
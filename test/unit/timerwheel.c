@@ -0,0 +1,84 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sb-common.h"
+#include "rpc/connection/timerwheel.h"
+#include "helper-unix.h"
+
+static timerwheel wheel;
+static size_t fired;
+
+static void expired(wheel_timer *timer)
+{
+  fired++;
+  timer->data = NULL;
+}
+
+/* stops the timer passed as data, even if it expired in the same tick */
+static void expired_stop(wheel_timer *timer)
+{
+  fired++;
+  timerwheel_del(&wheel, timer->data);
+}
+
+void unit_timerwheel(UNUSED(void **state))
+{
+  wheel_timer short_timer = {.pending = false};
+  wheel_timer long_timer = {.pending = false};
+  wheel_timer stopped = {.pending = false};
+  uint64_t now = 1000;
+  uint64_t turn = TIMERWHEEL_TICK * TIMERWHEEL_SLOTS;
+
+  timerwheel_init(&wheel, now);
+
+  timerwheel_add(&wheel, &short_timer, 250, expired, &short_timer);
+  /* longer than a full turn of the wheel, lands in an earlier slot */
+  timerwheel_add(&wheel, &long_timer, turn + 50, expired, &long_timer);
+  timerwheel_add(&wheel, &stopped, 250, expired, &stopped);
+  assert_int_equal(3, wheel.count);
+
+  timerwheel_del(&wheel, &stopped);
+  timerwheel_del(&wheel, &stopped);
+  assert_int_equal(2, wheel.count);
+
+  timerwheel_advance(&wheel, now + 299);
+  assert_int_equal(0, fired);
+  timerwheel_advance(&wheel, now + 300);
+  assert_int_equal(1, fired);
+  assert_false(short_timer.pending);
+  assert_null(short_timer.data);
+
+  /* the long timer survives its first pass over the slot */
+  timerwheel_advance(&wheel, now + turn);
+  assert_int_equal(1, fired);
+  assert_true(long_timer.pending);
+  timerwheel_advance(&wheel, now + turn + 100);
+  assert_int_equal(2, fired);
+  assert_int_equal(0, wheel.count);
+
+  /* an idle wheel catches up without walking the slots */
+  now += 100 * turn;
+  timerwheel_advance(&wheel, now + 42);
+  assert_int_equal(now, wheel.time);
+
+  /* callbacks may stop other timers expiring in the same tick */
+  fired = 0;
+  timerwheel_add(&wheel, &short_timer, 100, expired_stop, &long_timer);
+  timerwheel_add(&wheel, &long_timer, 100, expired, &long_timer);
+  timerwheel_advance(&wheel, now + 100);
+  assert_int_equal(1, fired);
+  assert_int_equal(0, wheel.count);
+}
@@ -0,0 +1,125 @@
+/**
+ *    Copyright (C) 2016 splone UG
+ *
+ *    This program is free software: you can redistribute it and/or  modify
+ *    it under the terms of the GNU Affero General Public License, version 3,
+ *    as published by the Free Software Foundation.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU Affero General Public License for more details.
+ *
+ *    You should have received a copy of the GNU Affero General Public License
+ *    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include "sb-common.h"
+#include "rpc/connection/topic.h"
+#include "helper-unix.h"
+
+#define MANY_PATTERNS 100000
+
+static size_t matched;
+
+static void count_match(topic *t, void *data)
+{
+  matched += kv_size(t->subscribers);
+  if (data)
+    assert_string_equal(data, t->name);
+}
+
+static size_t match(topic_registry *registry, const char *name)
+{
+  matched = 0;
+  topic_match(registry, name, count_match, NULL);
+  return matched;
+}
+
+void unit_topic(UNUSED(void **state))
+{
+  topic_registry *registry = topic_registry_new();
+  int a, b, c;
+  topic *t;
+
+  assert_non_null(registry);
+  assert_null(topic_get(registry, "event"));
+
+  t = topic_subscribe(registry, "event", &a);
+  assert_true(t == topic_subscribe(registry, "event", &b));
+  assert_true(t == topic_subscribe(registry, "event", &c));
+  assert_true(t == topic_get(registry, "event"));
+  assert_string_equal("event", t->name);
+  assert_int_equal(3, kv_size(t->subscribers));
+
+  /* the last subscriber takes the place of a removed one */
+  topic_unsubscribe(registry, t, &a);
+  assert_int_equal(2, kv_size(t->subscribers));
+  assert_true(&c == kv_A(t->subscribers, 0));
+  assert_true(&b == kv_A(t->subscribers, 1));
+
+  assert_null(topic_get(registry, "other"));
+  topic_subscribe(registry, "other", &a);
+
+  /* the topic is gone along with its last subscriber */
+  topic_unsubscribe(registry, t, &b);
+  topic_unsubscribe(registry, t, &c);
+  assert_null(topic_get(registry, "event"));
+  assert_non_null(topic_get(registry, "other"));
+
+  /* exact names and patterns alike */
+  topic_unsubscribe(registry, topic_get(registry, "other"), &a);
+  assert_true(topic_pattern_valid("sensor.room1.temp"));
+  assert_true(topic_pattern_valid("sensor.*.temp"));
+  assert_true(topic_pattern_valid("#"));
+  assert_false(topic_pattern_valid("sensor.#.temp"));
+  assert_false(topic_pattern_valid("sensor.room*"));
+  assert_false(topic_pattern_valid("sensor.##"));
+
+  topic_subscribe(registry, "sensor.room1.temp", &a);
+  topic_subscribe(registry, "sensor.*.temp", &b);
+  topic_subscribe(registry, "sensor.#", &c);
+  topic_subscribe(registry, "*.room2.*", &a);
+
+  assert_int_equal(3, match(registry, "sensor.room1.temp"));
+  assert_int_equal(3, match(registry, "sensor.room2.temp"));
+  assert_int_equal(2, match(registry, "sensor.room2.light"));
+  assert_int_equal(1, match(registry, "sensor"));
+  assert_int_equal(0, match(registry, "actor.room1.temp"));
+  assert_int_equal(1, match(registry, "actor.room2.temp"));
+
+  /* a pattern leaves the trie with its last subscriber */
+  topic_unsubscribe(registry, topic_get(registry, "sensor.#"), &c);
+  assert_int_equal(0, match(registry, "sensor"));
+  matched = 0;
+  topic_match(registry, "sensor.room3.temp", count_match, "sensor.*.temp");
+  assert_int_equal(1, matched);
+
+  topic_registry_free(registry);
+
+  /* matching does not depend on the number of patterns */
+  registry = topic_registry_new();
+  for (size_t i = 0; i < MANY_PATTERNS; i++) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "sensor.room%zu.*", i);
+    topic_subscribe(registry, pattern, &a);
+  }
+  topic_subscribe(registry, "sensor.*.temp", &b);
+
+  assert_int_equal(2, match(registry, "sensor.room4711.temp"));
+  assert_int_equal(1, match(registry, "sensor.hall.temp"));
+  assert_int_equal(0, match(registry, "sensor.hall.light"));
+
+  for (size_t i = 0; i < MANY_PATTERNS; i += 2) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "sensor.room%zu.*", i);
+    topic_unsubscribe(registry, topic_get(registry, pattern), &a);
+  }
+
+  assert_int_equal(1, match(registry, "sensor.room4710.temp"));
+  assert_int_equal(2, match(registry, "sensor.room4711.temp"));
+
+  topic_registry_free(registry);
+}
@@ -3,7 +3,6 @@
 #include <msgpack/object.h>
 #include "rpc/sb-rpc.h"
 #include "rpc/msgpack/helpers.h"
-#include "rpc/connection/loop.h"
 #include "api/helpers.h"
 #include "helper-unix.h"
 #include "helper-all.h"
@@ -24,7 +23,8 @@ int __wrap_crypto_write(struct crypto_context *cc, char *buffer,
   msgpack_zone mempool;
   msgpack_zone_init(&mempool, 2048);
 
-  msgpack_unpack(buffer, len, NULL, &mempool, &deserialized);
+  msgpack_unpack(buffer + CRYPTO_PACKET_HEADROOM, len - CRYPTO_PACKET_HEADROOM,
+      NULL, &mempool, &deserialized);
   check_expected(&deserialized);
   msgpack_zone_destroy(&mempool);
 
@@ -54,20 +54,3 @@ int __wrap_outputstream_write(UNUSED(outputstream *ostream), char *buffer, size_
 
   return (0);
 }
-
-void __wrap_loop_process_events_until(UNUSED(loop *loop),
-    UNUSED(struct connection *con), struct callinfo *cinfo)
-{
-  assert_non_null(cinfo);
-
-  /* The callid and the message_params type are determined by the unit test. */
-
-  cinfo->result = ARRAY_OBJ(((array) {
-    .size = 1,
-    .capacity = 1,
-    .items = calloc(1, sizeof(object)),
-  }));
-
-  cinfo->result.data.array.items[0].type = (object_type)mock();
-  cinfo->result.data.array.items[0].data.uinteger = (uint64_t)mock();
-}